@@ -0,0 +1,360 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#include "dbm_compress.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbm_hyperparams.h"
+
+// Parameters of the LZ77 codec, which uses the sequence format of LZ4.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+/*******************************************************************************
+ * \brief Returns the smaller of two given integer (missing from the C standard)
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline int imin(int x, int y) { return (x < y ? x : y); }
+
+// Compression mode of pack transfers, off by default.
+static dbm_compress_mode_t compress_mode = DBM_COMPRESS_NONE;
+
+/*******************************************************************************
+ * \brief Internal routine for selecting the compression mode of pack transfers.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_compress_set_mode(const dbm_compress_mode_t mode) {
+  assert(mode == DBM_COMPRESS_NONE || mode == DBM_COMPRESS_LOSSLESS ||
+         mode == DBM_COMPRESS_LOSSY);
+  compress_mode = mode;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for querying the compression mode of pack transfers.
+ * \author Ole Schuett
+ ******************************************************************************/
+dbm_compress_mode_t dbm_compress_get_mode(void) { return compress_mode; }
+
+/*******************************************************************************
+ * \brief Internal routine for computing how many mantissa bits are needed.
+ *        Dropping all but nbits mantissa bits changes each element by less
+ *        than 2^-nbits of its magnitude, hence the block by less than
+ *        2^-nbits of its norm.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress_mantissa_bits(const double norm, const double max_error) {
+  if (max_error <= 0.0) {
+    return 52; // No truncation.
+  }
+  const double ratio = sqrt(norm) / max_error;
+  if (ratio <= 1.0) {
+    return 0;
+  }
+  return imin(52, (int)ceil(log2(ratio)));
+}
+
+/*******************************************************************************
+ * \brief Internal routine for truncating the mantissas to given number of bits.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_compress_truncate(const int n, double data[n], const int nbits) {
+  assert(0 <= nbits && nbits <= 52);
+  if (nbits == 52) {
+    return;
+  }
+  const uint64_t mask = ~((UINT64_C(1) << (52 - nbits)) - 1);
+  for (int i = 0; i < n; i++) {
+    uint64_t bits;
+    memcpy(&bits, &data[i], sizeof(double));
+    bits &= mask;
+    memcpy(&data[i], &bits, sizeof(double));
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for grouping the i-th bytes of all given doubles.
+ *        Exponents and leading mantissa bytes tend to repeat, which the
+ *        subsequent LZ77 stage can only exploit when they are adjacent.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void shuffle(const int n, const double *data, unsigned char *output) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (int i = 0; i < n; i++) {
+    for (int b = 0; b < (int)sizeof(double); b++) {
+      output[b * n + i] = bytes[i * sizeof(double) + b];
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for reverting the shuffle routine.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void unshuffle(const int n, const unsigned char *input, double *data) {
+  unsigned char *bytes = (unsigned char *)data;
+  for (int i = 0; i < n; i++) {
+    for (int b = 0; b < (int)sizeof(double); b++) {
+      bytes[i * sizeof(double) + b] = input[b * n + i];
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for writing the remainder of a sequence's length.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int lz_write_length(int length, unsigned char *output, int pos) {
+  while (length >= 255) {
+    output[pos++] = 255;
+    length -= 255;
+  }
+  output[pos++] = (unsigned char)length;
+  return pos;
+}
+
+/*******************************************************************************
+ * \brief Private routine for writing a sequence of literals and a match.
+ *        A match_len of zero denotes the final sequence, which has no match.
+ *        Returns the new output position or -1 if the capacity is exceeded.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int lz_write_sequence(const int nliterals, const unsigned char *literals,
+                             const int offset, const int match_len,
+                             const int capacity, unsigned char *output,
+                             int pos) {
+  const int max_nbytes =
+      nliterals + nliterals / 255 + match_len / 255 + 5; // token+offset+...
+  if (pos + max_nbytes > capacity) {
+    return -1;
+  }
+  const int literals_code = imin(nliterals, 15);
+  const int match_code =
+      (match_len > 0) ? imin(match_len - LZ_MIN_MATCH, 15) : 0;
+  output[pos++] = (unsigned char)(literals_code << 4 | match_code);
+  if (literals_code == 15) {
+    pos = lz_write_length(nliterals - 15, output, pos);
+  }
+  memcpy(&output[pos], literals, nliterals);
+  pos += nliterals;
+  if (match_len > 0) {
+    output[pos++] = (unsigned char)(offset & 255);
+    output[pos++] = (unsigned char)(offset >> 8);
+    if (match_code == 15) {
+      pos = lz_write_length(match_len - LZ_MIN_MATCH - 15, output, pos);
+    }
+  }
+  return pos;
+}
+
+/*******************************************************************************
+ * \brief Private routine for compressing bytes with a greedy LZ77 scheme.
+ *        Returns the number of bytes written or -1 if capacity is exceeded.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int lz_compress(const int n, const unsigned char *input,
+                       const int capacity, unsigned char *output) {
+  int table[1 << LZ_HASH_BITS];
+  memset(table, -1, sizeof(table));
+
+  int pos = 0, anchor = 0, i = 0;
+  while (i + LZ_MIN_MATCH <= n) {
+    uint32_t seq;
+    memcpy(&seq, &input[i], sizeof(uint32_t));
+    const uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    const int ref = table[hash];
+    table[hash] = i;
+    if (ref >= 0 && i - ref <= LZ_MAX_OFFSET &&
+        memcmp(&input[ref], &input[i], LZ_MIN_MATCH) == 0) {
+      int match_len = LZ_MIN_MATCH;
+      while (i + match_len < n &&
+             input[ref + match_len] == input[i + match_len]) {
+        match_len++;
+      }
+      pos = lz_write_sequence(i - anchor, &input[anchor], i - ref, match_len,
+                              capacity, output, pos);
+      if (pos < 0) {
+        return -1;
+      }
+      i += match_len;
+      anchor = i;
+    } else {
+      i += 1 + ((i - anchor) >> 6); // Skip faster through incompressible data.
+    }
+  }
+  return lz_write_sequence(n - anchor, &input[anchor], 0, 0, capacity, output,
+                           pos);
+}
+
+/*******************************************************************************
+ * \brief Private routine for reading the remainder of a sequence's length.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int lz_read_length(const unsigned char *input, int *pos) {
+  int length = 0, byte;
+  do {
+    byte = input[(*pos)++];
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+/*******************************************************************************
+ * \brief Private routine for decompressing bytes created by lz_compress.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void lz_decompress(const int nbytes, const unsigned char *input,
+                          const int n, unsigned char *output) {
+  int pos = 0, i = 0;
+  while (pos < nbytes) {
+    const int token = input[pos++];
+    int nliterals = token >> 4;
+    if (nliterals == 15) {
+      nliterals += lz_read_length(input, &pos);
+    }
+    assert(i + nliterals <= n && pos + nliterals <= nbytes);
+    memcpy(&output[i], &input[pos], nliterals);
+    pos += nliterals;
+    i += nliterals;
+    if (pos >= nbytes) {
+      break; // Final sequence has no match.
+    }
+    const int offset = input[pos] | (input[pos + 1] << 8);
+    pos += 2;
+    int match_len = (token & 15) + LZ_MIN_MATCH;
+    if ((token & 15) == 15) {
+      match_len += lz_read_length(input, &pos);
+    }
+    assert(0 < offset && offset <= i && i + match_len <= n);
+    if (offset == 1) { // Runs of a repeated byte, e.g. truncated mantissas.
+      memset(&output[i], output[i - 1], match_len);
+    } else if (offset >= match_len) {
+      memcpy(&output[i], &output[i - offset], match_len);
+    } else {
+      for (int j = 0; j < match_len; j++) { // Match overlaps with itself.
+        output[i + j] = output[i - offset + j];
+      }
+    }
+    i += match_len;
+  }
+  assert(i == n);
+}
+
+/*******************************************************************************
+ * \brief Internal routine for computing the max compressed size of n doubles.
+ *        The compressed data consists of a header with n and the sizes of all
+ *        chunks, followed by the chunks. Incompressible chunks are copied.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress_bound(const int n) {
+  const int nchunks = (n + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+  const int header_size = (1 + nchunks) * sizeof(int);
+  assert(n <= (INT_MAX - header_size) / (int)sizeof(double));
+  return header_size + n * sizeof(double);
+}
+
+/*******************************************************************************
+ * \brief Internal routine for losslessly compressing n doubles.
+ *        The chunks are compressed independently by multiple threads.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress(const int n, const double data[n], unsigned char *output) {
+  const int nchunks = (n + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+  const int header_size = (1 + nchunks) * sizeof(int);
+  unsigned char *body = &output[header_size];
+  int *chunk_nbytes = malloc(nchunks * sizeof(int));
+
+#pragma omp parallel if (nchunks > 1)
+  {
+    unsigned char *shuffled = malloc(COMPRESS_CHUNK_SIZE * sizeof(double));
+#pragma omp for schedule(dynamic)
+    for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+      const int offset = ichunk * COMPRESS_CHUNK_SIZE;
+      const int size = imin(COMPRESS_CHUNK_SIZE, n - offset);
+      const int size_bytes = size * sizeof(double);
+      // Compress each chunk into its slot, which is compacted afterwards.
+      unsigned char *slot = &body[(size_t)offset * sizeof(double)];
+      shuffle(size, &data[offset], shuffled);
+      const int nbytes = lz_compress(size_bytes, shuffled, size_bytes, slot);
+      if (nbytes < 0) {
+        memcpy(slot, &data[offset], size_bytes);
+        chunk_nbytes[ichunk] = -size_bytes; // Negative marks a copied chunk.
+      } else {
+        chunk_nbytes[ichunk] = nbytes;
+      }
+    }
+    free(shuffled);
+  } // end of omp parallel region
+
+  // Compact the chunks. They only move towards the front.
+  int pos = 0;
+  for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+    const int offset = ichunk * COMPRESS_CHUNK_SIZE;
+    const int nbytes = abs(chunk_nbytes[ichunk]);
+    memmove(&body[pos], &body[(size_t)offset * sizeof(double)], nbytes);
+    pos += nbytes;
+  }
+
+  memcpy(&output[0], &n, sizeof(int));
+  memcpy(&output[sizeof(int)], chunk_nbytes, nchunks * sizeof(int));
+  free(chunk_nbytes);
+  return header_size + pos;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for decompressing data created by dbm_compress.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_decompress(const int nbytes, const unsigned char *input,
+                   const int max_n, double data[max_n]) {
+  int n;
+  memcpy(&n, &input[0], sizeof(int));
+  assert(0 <= n && n <= max_n);
+  const int nchunks = (n + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+  const int header_size = (1 + nchunks) * sizeof(int);
+  int *chunk_nbytes = malloc(nchunks * sizeof(int));
+  int *chunk_start = malloc(nchunks * sizeof(int));
+  memcpy(chunk_nbytes, &input[sizeof(int)], nchunks * sizeof(int));
+  int pos = header_size;
+  for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+    chunk_start[ichunk] = pos;
+    pos += abs(chunk_nbytes[ichunk]);
+  }
+  assert(pos == nbytes);
+
+#pragma omp parallel if (nchunks > 1)
+  {
+    unsigned char *shuffled = malloc(COMPRESS_CHUNK_SIZE * sizeof(double));
+#pragma omp for schedule(dynamic)
+    for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+      const int offset = ichunk * COMPRESS_CHUNK_SIZE;
+      const int size = imin(COMPRESS_CHUNK_SIZE, n - offset);
+      const int size_bytes = size * sizeof(double);
+      const unsigned char *chunk = &input[chunk_start[ichunk]];
+      if (chunk_nbytes[ichunk] < 0) {
+        assert(-chunk_nbytes[ichunk] == size_bytes);
+        memcpy(&data[offset], chunk, size_bytes);
+      } else {
+        lz_decompress(chunk_nbytes[ichunk], chunk, size_bytes, shuffled);
+        unshuffle(size, shuffled, &data[offset]);
+      }
+    }
+    free(shuffled);
+  } // end of omp parallel region
+
+  free(chunk_nbytes);
+  free(chunk_start);
+  return n;
+}
+
+// EOF
@@ -0,0 +1,76 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#ifndef DBM_COMPRESS_H
+#define DBM_COMPRESS_H
+
+/*******************************************************************************
+ * \brief Internal enum for the compression modes of pack transfers.
+ *        The values must match the DBM_PACK_COMPRESSION_* constants in
+ *        dbm_api.F.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef enum {
+  DBM_COMPRESS_NONE = 0,
+  DBM_COMPRESS_LOSSLESS = 1,
+  DBM_COMPRESS_LOSSY = 2,
+} dbm_compress_mode_t;
+
+/*******************************************************************************
+ * \brief Internal routine for selecting the compression mode of pack
+ *        transfers. It is set via dbm_library_set_pack_compression and
+ *        defaults to DBM_COMPRESS_NONE.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_compress_set_mode(const dbm_compress_mode_t mode);
+
+/*******************************************************************************
+ * \brief Internal routine for querying the compression mode of pack transfers.
+ * \author Ole Schuett
+ ******************************************************************************/
+dbm_compress_mode_t dbm_compress_get_mode(void);
+
+/*******************************************************************************
+ * \brief Internal routine for computing how many mantissa bits are needed to
+ *        represent a block with given squared norm within given max_error.
+ *        The error is measured as Frobenius norm. Zero max_error means exact.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress_mantissa_bits(const double norm, const double max_error);
+
+/*******************************************************************************
+ * \brief Internal routine for truncating the mantissas to the given number of
+ *        bits. This zeros the lower bytes, which can then be compressed well.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_compress_truncate(const int n, double data[n], const int nbits);
+
+/*******************************************************************************
+ * \brief Internal routine for computing the max compressed size of n doubles.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress_bound(const int n);
+
+/*******************************************************************************
+ * \brief Internal routine for losslessly compressing n doubles.
+ *        The output buffer must hold dbm_compress_bound(n) bytes.
+ *        Returns the number of bytes written.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_compress(const int n, const double data[n], unsigned char *output);
+
+/*******************************************************************************
+ * \brief Internal routine for decompressing data created by dbm_compress.
+ *        Returns the number of doubles written, which is at most max_n.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_decompress(const int nbytes, const unsigned char *input,
+                   const int max_n, double data[max_n]);
+
+#endif
+
+// EOF
@@ -17,6 +17,11 @@ static const int MAX_BATCH_SIZE = 10000;
 static const int BATCH_NUM_BUCKETS = 1000;
 static const int INITIAL_NBLOCKS_ALLOCATED = 100;
 static const int INITIAL_DATA_ALLOCATED = 1024;
+static const int MEMPOOL_THREAD_CACHE_SIZE = 2;
+static const int MEMPOOL_MAX_LARGER_CLASSES = 2;
+static const int SMM_MAX_M = 32;
+static const int SMM_MAX_MNK = 32 * 32 * 32;
+static const int COMPRESS_CHUNK_SIZE = 16384;
 
 #endif
 
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "dbm_compress.h"
 #include "dbm_library.h"
 #include "dbm_mempool.h"
 #include "dbm_mpi.h"
@@ -20,6 +21,15 @@
 #define DBM_NUM_COUNTERS 64
 
 static int64_t **per_thread_counters = NULL;
+static double comm_time_in_flight = 0.0;
+static double comm_time_exposed = 0.0;
+static double thread_time_max = 0.0;
+static double thread_time_mean = 0.0;
+static int64_t compression_nbytes_raw = 0;
+static int64_t compression_nbytes_compressed = 0;
+static int64_t plan_executions = 0;
+static int64_t plan_reuses = 0;
+static double phase_times[DBM_NUM_PHASES] = {0.0};
 static bool library_initialized = false;
 static int max_threads = 0;
 
@@ -52,9 +62,32 @@ void dbm_library_init(void) {
     memset(per_thread_counters[ithread], 0, counters_size);
   }
 
+  comm_time_in_flight = 0.0;
+  comm_time_exposed = 0.0;
+  thread_time_max = 0.0;
+  thread_time_mean = 0.0;
+  compression_nbytes_raw = 0;
+  compression_nbytes_compressed = 0;
+  plan_executions = 0;
+  plan_reuses = 0;
+  memset(phase_times, 0, DBM_NUM_PHASES * sizeof(double));
+  dbm_mempool_init();
   library_initialized = true;
 }
 
+/*******************************************************************************
+ * \brief Selects the compression of pack transfers.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_set_pack_compression(const int mode) {
+  if (mode != DBM_COMPRESS_NONE && mode != DBM_COMPRESS_LOSSLESS &&
+      mode != DBM_COMPRESS_LOSSY) {
+    fprintf(stderr, "Error: Unknown pack compression mode %i.\n", mode);
+    abort();
+  }
+  dbm_compress_set_mode((dbm_compress_mode_t)mode);
+}
+
 /*******************************************************************************
  * \brief Finalizes the DBM library.
  * \author Ole Schuett
@@ -73,7 +106,7 @@ void dbm_library_finalize(void) {
   free(per_thread_counters);
   per_thread_counters = NULL;
 
-  dbm_mempool_clear();
+  dbm_mempool_finalize();
   library_initialized = false;
 }
 
@@ -105,6 +138,73 @@ void dbm_library_counter_increment(const int m, const int n, const int k) {
   per_thread_counters[ithread][idx]++;
 }
 
+/*******************************************************************************
+ * \brief Add timings of the pack transfers of a multiplication to the stats.
+ *        The time_exposed is the portion of time_in_flight that was not
+ *        overlapped with computation. This routine must be called serially.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_comm_time_add(const double time_in_flight,
+                               const double time_exposed) {
+  assert(omp_get_num_threads() == 1);
+  comm_time_in_flight += time_in_flight;
+  comm_time_exposed += time_exposed;
+}
+
+/*******************************************************************************
+ * \brief Add the max and mean time the threads spent on multiplying the packs
+ *        of one tick to the stats. This routine must be called serially.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_imbalance_add(const double time_max, const double time_mean) {
+  assert(omp_get_num_threads() == 1);
+  thread_time_max += time_max;
+  thread_time_mean += time_mean;
+}
+
+/*******************************************************************************
+ * \brief Add the raw and compressed size of a pack transfer to the stats.
+ *        This routine must be called serially.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_compression_add(const int64_t nbytes_raw,
+                                 const int64_t nbytes_compressed) {
+  assert(omp_get_num_threads() == 1);
+  compression_nbytes_raw += nbytes_raw;
+  compression_nbytes_compressed += nbytes_compressed;
+}
+
+/*******************************************************************************
+ * \brief Add an execution of a multiply plan to the stats.
+ *        This routine must be called serially.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_plan_add(const bool reused) {
+  assert(omp_get_num_threads() == 1);
+  plan_executions++;
+  if (reused) {
+    plan_reuses++;
+  }
+}
+
+/*******************************************************************************
+ * \brief Add the wall time spent in the given phase of a multiplication.
+ *        This routine must be called serially.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_phase_time_add(const dbm_phase_t phase, const double time) {
+  assert(omp_get_num_threads() == 1);
+  phase_times[phase] += time;
+}
+
+/*******************************************************************************
+ * \brief Returns the accumulated wall times of the phases of multiplications.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_get_phase_times(double times[DBM_NUM_PHASES]) {
+  memcpy(times, phase_times, DBM_NUM_PHASES * sizeof(double));
+}
+
 /*******************************************************************************
  * \brief Comperator passed to qsort to compare two counters.
  * \author Ole Schuett
@@ -182,6 +282,112 @@ void dbm_library_print_stats(const int fortran_comm,
     print_func(buffer, output_unit);
   }
 
+  // Print statistics of the memory pool.
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+  print_func("    MEMPOOL              MALLOCS        HIT-RATE    CURRENT [MiB"
+             "]     PEAK [MiB]\n",
+             output_unit);
+  for (int on_device = 0; on_device < 2; on_device++) {
+    dbm_mempool_statistics_t stats;
+    dbm_mempool_statistics(on_device, &stats);
+    int64_t nmallocs[2] = {stats.nmallocs, stats.nhits};
+    dbm_mpi_sum_int64(nmallocs, 2, comm);
+    double sizes[2] = {stats.size, stats.size_max};
+    dbm_mpi_max_double(sizes, 2, comm);
+    if (nmallocs[0] == 0) {
+      continue; // skip unused pools
+    }
+    const double hit_rate = 100.0 * nmallocs[1] / nmallocs[0];
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer),
+             "    %-7s %20" PRId64 " %14.2f%% %16.1f %14.1f\n",
+             (on_device) ? "device" : "host", nmallocs[0], hit_rate,
+             sizes[0] / 1048576.0, sizes[1] / 1048576.0);
+    print_func(buffer, output_unit);
+  }
+
+  // Print on which NUMA nodes the host memory of the pool was placed. Like
+  // the pool sizes above, the placement is the maximum over all ranks.
+  dbm_mempool_statistics_t host_stats;
+  dbm_mempool_statistics(false, &host_stats);
+  double node_sizes[OFFLOAD_MAX_NUMA_NODES];
+  for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+    node_sizes[node] = host_stats.numa_placement[node];
+  }
+  dbm_mpi_max_double(node_sizes, OFFLOAD_MAX_NUMA_NODES, comm);
+  for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+    host_stats.numa_placement[node] = (int64_t)node_sizes[node];
+  }
+  char placement[50];
+  offload_numa_format_placement(host_stats.numa_placement, placement,
+                                sizeof(placement));
+  if (placement[0] != '\0') {
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "    %-25s %49s\n",
+             "host NUMA nodes [MiB]", placement);
+    print_func(buffer, output_unit);
+  }
+
+  // Print fraction of pack transfers that were hidden behind computation.
+  double comm_times[2] = {comm_time_in_flight, comm_time_exposed};
+  dbm_mpi_sum_double(comm_times, 2, comm);
+  if (comm_times[0] > 0.0) {
+    print_func(" --------------------------------------------------------------"
+               "-----------------\n",
+               output_unit);
+    const double overlap = 100.0 * (1.0 - comm_times[1] / comm_times[0]);
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), " %-67s %10.2f%%\n",
+             "COMMUNICATION OVERLAPPED WITH COMPUTATION", overlap);
+    print_func(buffer, output_unit);
+  }
+
+  // Print load imbalance among the threads, ie. the slowest over the average.
+  double thread_times[2] = {thread_time_max, thread_time_mean};
+  dbm_mpi_sum_double(thread_times, 2, comm);
+  if (thread_times[1] > 0.0) {
+    print_func(" --------------------------------------------------------------"
+               "-----------------\n",
+               output_unit);
+    const double imbalance = thread_times[0] / thread_times[1];
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), " %-67s %11.2f\n",
+             "MULTIPLICATION LOAD IMBALANCE AMONG THREADS", imbalance);
+    print_func(buffer, output_unit);
+  }
+
+  // Print compression ratio of the pack transfers, ie. raw over sent bytes.
+  int64_t compression_nbytes[2] = {compression_nbytes_raw,
+                                   compression_nbytes_compressed};
+  dbm_mpi_sum_int64(compression_nbytes, 2, comm);
+  if (compression_nbytes[1] > 0) {
+    print_func(" --------------------------------------------------------------"
+               "-----------------\n",
+               output_unit);
+    const double ratio =
+        (double)compression_nbytes[0] / (double)compression_nbytes[1];
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), " %-67s %11.2f\n",
+             "PACK TRANSFER COMPRESSION RATIO", ratio);
+    print_func(buffer, output_unit);
+  }
+
+  // Print fraction of multiply plan executions that reused their packs.
+  int64_t plan_counts[2] = {plan_executions, plan_reuses};
+  dbm_mpi_sum_int64(plan_counts, 2, comm);
+  if (plan_counts[0] > 0) {
+    print_func(" --------------------------------------------------------------"
+               "-----------------\n",
+               output_unit);
+    const double percent = 100.0 * plan_counts[1] / plan_counts[0];
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), " %-67s %10.2f%%\n",
+             "MULTIPLY PLAN EXECUTIONS REUSING PACKS", percent);
+    print_func(buffer, output_unit);
+  }
+
   print_func(" ----------------------------------------------------------------"
              "---------------\n",
              output_unit);
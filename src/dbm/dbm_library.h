@@ -9,6 +9,18 @@
 
 #include "dbm_multiply.h"
 
+/*******************************************************************************
+ * \brief Internal enum for the phases of a multiplication that get timed.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef enum {
+  DBM_PHASE_PACK,     // Packing and redistributing matrix_a and matrix_b.
+  DBM_PHASE_COMM,     // Waiting for pack transfers.
+  DBM_PHASE_MULTIPLY, // Multiplying the packs.
+  DBM_PHASE_FILTER,   // Final filtering of matrix_c.
+  DBM_NUM_PHASES
+} dbm_phase_t;
+
 /*******************************************************************************
  * \brief Initializes the DBM library.
  * \author Ole Schuett
@@ -21,12 +33,59 @@ void dbm_library_init(void);
  ******************************************************************************/
 void dbm_library_finalize(void);
 
+/*******************************************************************************
+ * \brief Selects the compression of pack transfers. Valid modes are
+ *        DBM_COMPRESS_NONE (default), DBM_COMPRESS_LOSSLESS, and
+ *        DBM_COMPRESS_LOSSY. The mode has to be the same on all ranks.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_set_pack_compression(const int mode);
+
 /*******************************************************************************
  * \brief Add given block multiplication to stats. This routine is thread-safe.
  * \author Ole Schuett
  ******************************************************************************/
 void dbm_library_counter_increment(const int m, const int n, const int k);
 
+/*******************************************************************************
+ * \brief Add timings of the pack transfers of a multiplication to the stats.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_comm_time_add(const double time_in_flight,
+                               const double time_exposed);
+
+/*******************************************************************************
+ * \brief Add the max and mean time threads spent multiplying a tick's packs.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_imbalance_add(const double time_max, const double time_mean);
+
+/*******************************************************************************
+ * \brief Add the raw and compressed size of a pack transfer to the stats.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_compression_add(const int64_t nbytes_raw,
+                                 const int64_t nbytes_compressed);
+
+/*******************************************************************************
+ * \brief Add an execution of a multiply plan to the stats.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_plan_add(const bool reused);
+
+/*******************************************************************************
+ * \brief Add the wall time spent in the given phase of a multiplication.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_phase_time_add(const dbm_phase_t phase, const double time);
+
+/*******************************************************************************
+ * \brief Returns the accumulated wall times that this rank spent in each phase
+ *        of the multiplications. Used by the miniapp to break down timings.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_library_get_phase_times(double times[DBM_NUM_PHASES]);
+
 /*******************************************************************************
  * \brief Prints statistics gathered by the DBM library.
  * \author Ole Schuett
@@ -99,6 +99,17 @@ void dbm_copy(dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b) {
   }
 }
 
+/*******************************************************************************
+ * \brief Private routine for computing the cumulative sums of given numbers.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline void icumsum(const int n, const int input[n], int output[n]) {
+  output[0] = 0;
+  for (int i = 1; i < n; i++) {
+    output[i] = output[i - 1] + input[i - 1];
+  }
+}
+
 /*******************************************************************************
  * \brief Copies content of matrix_b into matrix_a.
  *        Matrices may have different distributions.
@@ -119,81 +130,193 @@ void dbm_redistribute(const dbm_matrix_t *matrix, dbm_matrix_t *redist) {
   const dbm_mpi_comm_t comm = redist->dist->comm;
   const int nranks = dbm_mpi_comm_size(comm);
 
-  // 1st pass: Compute send_count.
-  int send_count[nranks];
-  memset(send_count, 0, nranks * sizeof(int));
-  for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
-    dbm_shard_t *shard = &matrix->shards[ishard];
-    for (int iblock = 0; iblock < shard->nblocks; iblock++) {
-      const dbm_block_t *blk = &shard->blocks[iblock];
-      const int row_size = matrix->row_sizes[blk->row];
-      const int col_size = matrix->col_sizes[blk->col];
-      const int block_size = row_size * col_size;
-      const int rank = dbm_get_stored_coordinates(redist, blk->row, blk->col);
-      assert(0 <= rank && rank < nranks);
-      send_count[rank] += 2 + block_size;
+  // The row/col of each block are sent as a separate stream of headers.
+  int blks_send_count[nranks], data_send_count[nranks];
+  int blks_send_displ[nranks], data_send_displ[nranks];
+  memset(blks_send_count, 0, nranks * sizeof(int));
+  memset(data_send_count, 0, nranks * sizeof(int));
+  int *headers_send = NULL;
+  double *data_send = NULL;
+
+#pragma omp parallel
+  {
+    // 1st pass: Compute per rank nblks and ndata.
+    int nblks_mythread[nranks], ndata_mythread[nranks];
+    memset(nblks_mythread, 0, nranks * sizeof(int));
+    memset(ndata_mythread, 0, nranks * sizeof(int));
+#pragma omp for schedule(static)
+    for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
+      const dbm_shard_t *shard = &matrix->shards[ishard];
+      for (int iblock = 0; iblock < shard->nblocks; iblock++) {
+        const dbm_block_t *blk = &shard->blocks[iblock];
+        const int row_size = matrix->row_sizes[blk->row];
+        const int col_size = matrix->col_sizes[blk->col];
+        const int rank = dbm_get_stored_coordinates(redist, blk->row, blk->col);
+        assert(0 <= rank && rank < nranks);
+        nblks_mythread[rank] += 1;
+        ndata_mythread[rank] += row_size * col_size;
+      }
     }
-  }
 
-  // 1st communication: Exchange counts.
-  int recv_count[nranks];
-  dbm_mpi_alltoall_int(send_count, 1, recv_count, 1, comm);
-
-  // Compute displacements and allocate data buffers.
-  int send_displ[nranks + 1], recv_displ[nranks + 1];
-  send_displ[0] = recv_displ[0] = 0;
-  for (int irank = 1; irank <= nranks; irank++) {
-    send_displ[irank] = send_displ[irank - 1] + send_count[irank - 1];
-    recv_displ[irank] = recv_displ[irank - 1] + recv_count[irank - 1];
-  }
-  const int total_send_count = send_displ[nranks];
-  const int total_recv_count = recv_displ[nranks];
-  double *data_send = dbm_mpi_alloc_mem(total_send_count * sizeof(double));
-  double *data_recv = dbm_mpi_alloc_mem(total_recv_count * sizeof(double));
-
-  // 2nd pass: Fill send_data.
-  int send_data_positions[nranks];
-  memcpy(send_data_positions, send_displ, nranks * sizeof(int));
-  for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
-    dbm_shard_t *shard = &matrix->shards[ishard];
-    for (int iblock = 0; iblock < shard->nblocks; iblock++) {
-      const dbm_block_t *blk = &shard->blocks[iblock];
-      const double *blk_data = &shard->data[blk->offset];
-      const int row_size = matrix->row_sizes[blk->row];
-      const int col_size = matrix->col_sizes[blk->col];
-      const int block_size = row_size * col_size;
-      const int rank = dbm_get_stored_coordinates(redist, blk->row, blk->col);
-      const int pos = send_data_positions[rank];
-      data_send[pos + 0] = blk->row; // send integers as doubles
-      data_send[pos + 1] = blk->col;
-      memcpy(&data_send[pos + 2], blk_data, block_size * sizeof(double));
-      send_data_positions[rank] += 2 + block_size;
+    // Sum nblks and ndata across threads.
+#pragma omp critical
+    for (int irank = 0; irank < nranks; irank++) {
+      blks_send_count[irank] += nblks_mythread[irank];
+      data_send_count[irank] += ndata_mythread[irank];
+      nblks_mythread[irank] = blks_send_count[irank];
+      ndata_mythread[irank] = data_send_count[irank];
     }
-  }
+#pragma omp barrier
+
+    // Compute send displacements and allocate send buffers.
+#pragma omp master
+    {
+      icumsum(nranks, blks_send_count, blks_send_displ);
+      icumsum(nranks, data_send_count, data_send_displ);
+      const int m = nranks - 1;
+      const int nblks_send = blks_send_displ[m] + blks_send_count[m];
+      const int ndata_send = data_send_displ[m] + data_send_count[m];
+      headers_send = dbm_mpi_alloc_mem(2 * nblks_send * sizeof(int));
+      data_send = dbm_mpi_alloc_mem(ndata_send * sizeof(double));
+    }
+#pragma omp barrier
+
+    // 2nd pass: Fill headers_send and data_send.
+#pragma omp for schedule(static) // Need static to match previous loop.
+    for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
+      const dbm_shard_t *shard = &matrix->shards[ishard];
+      for (int iblock = 0; iblock < shard->nblocks; iblock++) {
+        const dbm_block_t *blk = &shard->blocks[iblock];
+        const int row_size = matrix->row_sizes[blk->row];
+        const int col_size = matrix->col_sizes[blk->col];
+        const int block_size = row_size * col_size;
+        const int rank = dbm_get_stored_coordinates(redist, blk->row, blk->col);
+        // Headers and data of each thread are filled backwards in lockstep.
+        nblks_mythread[rank] -= 1;
+        ndata_mythread[rank] -= block_size;
+        const int iheader = blks_send_displ[rank] + nblks_mythread[rank];
+        const int offset = data_send_displ[rank] + ndata_mythread[rank];
+        headers_send[2 * iheader + 0] = blk->row;
+        headers_send[2 * iheader + 1] = blk->col;
+        memcpy(&data_send[offset], &shard->data[blk->offset],
+               block_size * sizeof(double));
+      }
+    }
+  } // end of omp parallel region
+
+  // 1st communication: Exchange counts.
+  int blks_recv_count[nranks], data_recv_count[nranks];
+  int blks_recv_displ[nranks], data_recv_displ[nranks];
+  dbm_mpi_alltoall_int(blks_send_count, 1, blks_recv_count, 1, comm);
+  dbm_mpi_alltoall_int(data_send_count, 1, data_recv_count, 1, comm);
+  icumsum(nranks, blks_recv_count, blks_recv_displ);
+  icumsum(nranks, data_recv_count, data_recv_displ);
+  const int nblks_recv =
+      blks_recv_displ[nranks - 1] + blks_recv_count[nranks - 1];
+  const int ndata_recv =
+      data_recv_displ[nranks - 1] + data_recv_count[nranks - 1];
+
+  // 2nd communication: Exchange headers, which count two ints per block.
+  int headers_send_count[nranks], headers_send_displ[nranks];
+  int headers_recv_count[nranks], headers_recv_displ[nranks];
   for (int irank = 0; irank < nranks; irank++) {
-    assert(send_data_positions[irank] == send_displ[irank + 1]);
+    headers_send_count[irank] = 2 * blks_send_count[irank];
+    headers_send_displ[irank] = 2 * blks_send_displ[irank];
+    headers_recv_count[irank] = 2 * blks_recv_count[irank];
+    headers_recv_displ[irank] = 2 * blks_recv_displ[irank];
   }
-
-  // 2nd communication: Exchange data.
-  dbm_mpi_alltoallv_double(data_send, send_count, send_displ, data_recv,
-                           recv_count, recv_displ, comm);
+  int *headers_recv = dbm_mpi_alloc_mem(2 * nblks_recv * sizeof(int));
+  dbm_mpi_alltoallv_int(headers_send, headers_send_count, headers_send_displ,
+                        headers_recv, headers_recv_count, headers_recv_displ,
+                        comm);
+  dbm_mpi_free_mem(headers_send);
+
+  // 3rd communication: Exchange data.
+  double *data_recv = dbm_mpi_alloc_mem(ndata_recv * sizeof(double));
+  dbm_mpi_alltoallv_double(data_send, data_send_count, data_send_displ,
+                           data_recv, data_recv_count, data_recv_displ, comm);
   dbm_mpi_free_mem(data_send);
 
-  // 3rd pass: Unpack data.
+  // Unpack received blocks.
   dbm_clear(redist);
-  int recv_data_pos = 0;
-  while (recv_data_pos < total_recv_count) {
-    const int row = (int)data_recv[recv_data_pos + 0];
-    const int col = (int)data_recv[recv_data_pos + 1];
-    assert(data_recv[recv_data_pos + 0] - (double)row == 0.0);
-    assert(data_recv[recv_data_pos + 1] - (double)col == 0.0);
-    dbm_put_block(redist, row, col, false, &data_recv[recv_data_pos + 2]);
-    const int row_size = matrix->row_sizes[row];
-    const int col_size = matrix->col_sizes[col];
-    const int block_size = row_size * col_size;
-    recv_data_pos += 2 + block_size;
-  }
-  assert(recv_data_pos == total_recv_count);
+  const int nshards = dbm_get_num_shards(redist);
+  int nblocks_per_shard[nshards], shard_start[nshards];
+  memset(nblocks_per_shard, 0, nshards * sizeof(int));
+  int *blk_offsets = malloc(nblks_recv * sizeof(int));
+  int *blks_by_shard = malloc(nblks_recv * sizeof(int));
+
+#pragma omp parallel
+  {
+    // Locate the data of each received block.
+#pragma omp for
+    for (int irank = 0; irank < nranks; irank++) {
+      int offset = data_recv_displ[irank];
+      for (int i = 0; i < blks_recv_count[irank]; i++) {
+        const int iblock = blks_recv_displ[irank] + i;
+        const int row = headers_recv[2 * iblock + 0];
+        const int col = headers_recv[2 * iblock + 1];
+        blk_offsets[iblock] = offset;
+        offset += redist->row_sizes[row] * redist->col_sizes[col];
+      }
+      assert(offset == data_recv_displ[irank] + data_recv_count[irank]);
+    }
+
+    // Use counting sort to group the received blocks by their shard.
+    int nblocks_mythread[nshards];
+    memset(nblocks_mythread, 0, nshards * sizeof(int));
+#pragma omp for schedule(static)
+    for (int iblock = 0; iblock < nblks_recv; iblock++) {
+      const int row = headers_recv[2 * iblock + 0];
+      const int col = headers_recv[2 * iblock + 1];
+      nblocks_mythread[dbm_get_shard_index(redist, row, col)]++;
+    }
+#pragma omp critical
+    for (int ishard = 0; ishard < nshards; ishard++) {
+      nblocks_per_shard[ishard] += nblocks_mythread[ishard];
+      nblocks_mythread[ishard] = nblocks_per_shard[ishard];
+    }
+#pragma omp barrier
+#pragma omp master
+    icumsum(nshards, nblocks_per_shard, shard_start);
+#pragma omp barrier
+#pragma omp for schedule(static) // Need static to match previous loop.
+    for (int iblock = 0; iblock < nblks_recv; iblock++) {
+      const int row = headers_recv[2 * iblock + 0];
+      const int col = headers_recv[2 * iblock + 1];
+      const int ishard = dbm_get_shard_index(redist, row, col);
+      blks_by_shard[shard_start[ishard] + --nblocks_mythread[ishard]] = iblock;
+    }
+
+    // Pre-size each shard, create all its blocks at once, and copy the data.
+#pragma omp for schedule(dynamic)
+    for (int ishard = 0; ishard < nshards; ishard++) {
+      dbm_shard_t *shard = &redist->shards[ishard];
+      const int *shard_blks = &blks_by_shard[shard_start[ishard]];
+      assert(shard->nblocks == 0);
+      dbm_shard_reserve_blocks(shard, nblocks_per_shard[ishard]);
+      for (int i = 0; i < nblocks_per_shard[ishard]; i++) {
+        const int row = headers_recv[2 * shard_blks[i] + 0];
+        const int col = headers_recv[2 * shard_blks[i] + 1];
+        assert(dbm_get_stored_coordinates(redist, row, col) ==
+               redist->dist->my_rank);
+        const int block_size = redist->row_sizes[row] * redist->col_sizes[col];
+        dbm_shard_promise_new_block(shard, row, col, block_size);
+      }
+      dbm_shard_allocate_promised_blocks(shard);
+      for (int i = 0; i < nblocks_per_shard[ishard]; i++) {
+        const dbm_block_t *blk = &shard->blocks[i];
+        const int block_size =
+            redist->row_sizes[blk->row] * redist->col_sizes[blk->col];
+        const double *blk_data = &data_recv[blk_offsets[shard_blks[i]]];
+        memcpy(&shard->data[blk->offset], blk_data,
+               block_size * sizeof(double));
+      }
+    }
+  } // end of omp parallel region
+
+  free(blk_offsets);
+  free(blks_by_shard);
+  dbm_mpi_free_mem(headers_recv);
   dbm_mpi_free_mem(data_recv);
 }
 
@@ -264,6 +387,7 @@ void dbm_clear(dbm_matrix_t *matrix) {
     shard->data_promised = 0;
     // Does not deallocate memory, hence data_allocated remains unchanged.
     memset(shard->hashtable, 0, shard->hashtable_size * sizeof(int));
+    dbm_shard_unfreeze(shard);
   }
 }
 
@@ -284,6 +408,14 @@ void dbm_filter(dbm_matrix_t *matrix, const double eps) {
   for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
     dbm_shard_t *shard = &matrix->shards[ishard];
     const int old_nblocks = shard->nblocks;
+
+    // Keep track of the new block numbers to preserve a frozen index.
+    const bool was_frozen = dbm_shard_is_frozen(shard);
+    int *new_index = (was_frozen) ? malloc(old_nblocks * sizeof(int)) : NULL;
+    if (!was_frozen) {
+      dbm_shard_unfreeze(shard);
+    }
+
     shard->nblocks = 0;
     shard->data_promised = 0;
     memset(shard->hashtable, 0, shard->hashtable_size * sizeof(int));
@@ -300,8 +432,14 @@ void dbm_filter(dbm_matrix_t *matrix, const double eps) {
       }
       // For historic reasons zero-sized blocks are never filtered.
       if (block_size > 0 && norm < eps2) {
+        if (was_frozen) {
+          new_index[iblock] = -1;
+        }
         continue; // filter the block
       }
+      if (was_frozen) {
+        new_index[iblock] = shard->nblocks;
+      }
       // Re-create block.
       dbm_block_t *new_blk = dbm_shard_promise_new_block(
           shard, old_blk.row, old_blk.col, block_size);
@@ -314,6 +452,11 @@ void dbm_filter(dbm_matrix_t *matrix, const double eps) {
     }
     shard->data_size = shard->data_promised;
     // TODO: Could call realloc to release excess memory.
+
+    if (was_frozen) {
+      dbm_shard_renumber_frozen(shard, old_nblocks, new_index);
+      free(new_index);
+    }
   }
 }
 
@@ -398,7 +541,15 @@ void dbm_add(dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b) {
   for (int ishard = 0; ishard < dbm_get_num_shards(matrix_b); ishard++) {
     dbm_shard_t *shard_a = &matrix_a->shards[ishard];
     const dbm_shard_t *shard_b = &matrix_b->shards[ishard];
-    for (int iblock = 0; iblock < shard_b->nblocks; iblock++) {
+
+    // When both shards are frozen the blocks are matched by a streaming merge.
+    const bool ordered_b = dbm_shard_is_frozen(shard_b);
+    const bool use_cursor_a = dbm_shard_is_frozen(shard_a);
+    dbm_shard_cursor_t cursor_a;
+    dbm_shard_cursor_init(shard_a, &cursor_a);
+
+    for (int k = 0; k < shard_b->nblocks; k++) {
+      const int iblock = (ordered_b) ? shard_b->frozen_blocks[k] : k;
       const dbm_block_t blk_b = shard_b->blocks[iblock];
 
       const int row_size = matrix_b->row_sizes[blk_b.row];
@@ -406,8 +557,14 @@ void dbm_add(dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b) {
       assert(row_size == matrix_a->row_sizes[blk_b.row]);
       assert(col_size == matrix_a->col_sizes[blk_b.col]);
       const int block_size = row_size * col_size;
-      dbm_block_t *blk_a = dbm_shard_get_or_allocate_block(
-          shard_a, blk_b.row, blk_b.col, block_size);
+      dbm_block_t *blk_a = NULL;
+      if (use_cursor_a) {
+        blk_a = dbm_shard_cursor_lookup(&cursor_a, blk_b.row, blk_b.col);
+      }
+      if (blk_a == NULL) {
+        blk_a = dbm_shard_get_or_allocate_block(shard_a, blk_b.row, blk_b.col,
+                                                block_size);
+      }
       double *data_a = &shard_a->data[blk_a->offset];
       const double *data_b = &shard_b->data[blk_b.offset];
       for (int i = 0; i < block_size; i++) {
@@ -470,7 +627,11 @@ void dbm_iterator_next_block(dbm_iterator_t *iter, int *row, int *col,
   assert(iter->next_shard < dbm_get_num_shards(matrix));
   const dbm_shard_t *shard = &matrix->shards[iter->next_shard];
   assert(iter->next_block < shard->nblocks);
-  dbm_block_t *blk = &shard->blocks[iter->next_block];
+  // Frozen shards are traversed in order of rows and cols.
+  const int iblock = (dbm_shard_is_frozen(shard))
+                         ? shard->frozen_blocks[iter->next_block]
+                         : iter->next_block;
+  dbm_block_t *blk = &shard->blocks[iblock];
 
   *row = blk->row;
   *col = blk->col;
@@ -7,21 +7,39 @@
 
 #include <assert.h>
 #include <omp.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../offload/offload_library.h"
 #include "../offload/offload_runtime.h"
+#include "dbm_hyperparams.h"
 #include "dbm_mempool.h"
 #include "dbm_mpi.h"
 
+// Four size classes per power of two, i.e. consecutive classes differ by at
+// most 25%. The smallest class is 1 KiB, the largest 2^48 bytes.
+#define MEMPOOL_MIN_CLASS_SIZE_LOG2 10
+#define MEMPOOL_NUM_CLASSES 153
+
+// NUMA placement of the host memory currently held by the pool.
+static int64_t mempool_numa_placement[OFFLOAD_MAX_NUMA_NODES] = {0};
+
 /*******************************************************************************
- * \brief Private routine for actually allocating system memory.
+ * \brief Private routine for actually allocating system memory. Only the first
+ *        touch_size bytes of host memory are touched, the remainder is placed
+ *        by the thread that uses it first. The placement is stored for
+ *        actual_free.
  * \author Ole Schuett
  ******************************************************************************/
-static void *actual_malloc(const size_t size, const bool on_device) {
+static void *actual_malloc(const size_t size, const size_t touch_size,
+                           const bool on_device,
+                           int64_t placement[OFFLOAD_MAX_NUMA_NODES]) {
   (void)on_device; // mark used
+  memset(placement, 0, OFFLOAD_MAX_NUMA_NODES * sizeof(int64_t));
 
 #if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_DBM)
   if (on_device) {
@@ -37,6 +55,8 @@ static void *actual_malloc(const size_t size, const bool on_device) {
 
   void *memory = dbm_mpi_alloc_mem(size);
   assert(memory != NULL);
+  offload_numa_first_touch(memory, touch_size, placement);
+  offload_numa_add_placement(placement, mempool_numa_placement, NULL);
   return memory;
 }
 
@@ -44,10 +64,12 @@ static void *actual_malloc(const size_t size, const bool on_device) {
  * \brief Private routine for actually freeing system memory.
  * \author Ole Schuett
  ******************************************************************************/
-static void actual_free(void *memory, const bool on_device) {
+static void actual_free(void *memory, const bool on_device,
+                        const int64_t placement[OFFLOAD_MAX_NUMA_NODES]) {
   if (memory == NULL) {
     return;
   }
+  offload_numa_remove_placement(placement, mempool_numa_placement);
 
 #if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_DBM)
   if (on_device) {
@@ -63,75 +85,284 @@ static void actual_free(void *memory, const bool on_device) {
 }
 
 /*******************************************************************************
- * \brief Private struct for storing a chunk of memory.
+ * \brief Private struct for storing a chunk of memory. For host memory it is
+ *        placed in a header directly in front of mem, which allows for finding
+ *        the owning size class in O(1) when the memory is returned.
  * \author Ole Schuett
  ******************************************************************************/
 struct dbm_memchunk {
   bool on_device;
+  int size_class;
   size_t size;
   void *mem;
+  int64_t numa_placement[OFFLOAD_MAX_NUMA_NODES]; // Bytes per node of mem.
   struct dbm_memchunk *next;
 };
 typedef struct dbm_memchunk dbm_memchunk_t;
 
+// Size of the header in front of host chunks, a multiple of the cache line.
+#define MEMPOOL_HEADER_SIZE 128
+
+/*******************************************************************************
+ * \brief Private struct for storing the available chunks of a single thread.
+ *        Only accessed by its owning thread, hence it requires no locking.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  dbm_memchunk_t *head[2][MEMPOOL_NUM_CLASSES]; // 1st index is on_device.
+  int count[2][MEMPOOL_NUM_CLASSES];
+} dbm_mempool_thread_cache_t;
+
+/*******************************************************************************
+ * \brief Private lock-free stack of available chunks shared by threads.
+ *        Chunks are pushed via compare-and-swap, but only ever popped by
+ *        detaching the entire stack, which avoids the ABA problem.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  _Atomic(dbm_memchunk_t *) head;
+} dbm_mempool_bin_t;
+
+static bool mempool_initialized = false;
+static int mempool_nthread_caches = 0;
+static dbm_mempool_thread_cache_t **mempool_thread_caches = NULL;
+static dbm_mempool_bin_t mempool_shared_bins[2][MEMPOOL_NUM_CLASSES];
+
+/*******************************************************************************
+ * \brief Private list of device chunks that are in use. Device memory can not
+ *        carry a host-side header, hence its chunks are looked up here. Only
+ *        the GPU backend allocates device memory, which it does rarely.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_memchunk_t *mempool_device_allocated = NULL;
+static omp_lock_t mempool_device_lock;
+
+/*******************************************************************************
+ * \brief Private statistics, index is on_device.
+ * \author Ole Schuett
+ ******************************************************************************/
+static _Atomic int64_t mempool_mallocs[2];
+static _Atomic int64_t mempool_hits[2];
+static _Atomic int64_t mempool_size[2];
+static _Atomic int64_t mempool_size_max[2];
+static _Atomic int64_t mempool_used[2];
+static _Atomic int64_t mempool_used_max[2];
+
+/*******************************************************************************
+ * \brief Private routine for adding to a counter and updating its maximum.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void add_and_track_max(_Atomic int64_t *counter,
+                              _Atomic int64_t *counter_max,
+                              const int64_t delta) {
+  const int64_t value =
+      atomic_fetch_add_explicit(counter, delta, memory_order_relaxed) + delta;
+  int64_t old_max = atomic_load_explicit(counter_max, memory_order_relaxed);
+  while (old_max < value &&
+         !atomic_compare_exchange_weak_explicit(counter_max, &old_max, value,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for mapping a size onto its size class.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int size_class(const size_t size, size_t *class_size) {
+  const size_t min_size = (size_t)1 << MEMPOOL_MIN_CLASS_SIZE_LOG2;
+  if (size <= min_size) {
+    *class_size = min_size;
+    return 0;
+  }
+  const size_t n = size - 1;
+  int e = 0; // Position of leading bit.
+  while ((n >> (e + 1)) != 0) {
+    e++;
+  }
+  const int sub = (n >> (e - 2)) & 3; // Next two bits select the sub-class.
+  *class_size = (size_t)(4 + sub + 1) << (e - 2);
+  const int iclass = 1 + 4 * (e - MEMPOOL_MIN_CLASS_SIZE_LOG2) + sub;
+  assert(size <= *class_size && iclass < MEMPOOL_NUM_CLASSES);
+  return iclass;
+}
+
+/*******************************************************************************
+ * \brief Private routine for pushing a linked list of chunks onto a bin.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void bin_push(dbm_mempool_bin_t *bin, dbm_memchunk_t *first,
+                     dbm_memchunk_t *last) {
+  dbm_memchunk_t *head = atomic_load_explicit(&bin->head, memory_order_relaxed);
+  do {
+    last->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &bin->head, &head, first, memory_order_release, memory_order_relaxed));
+}
+
+/*******************************************************************************
+ * \brief Private routine for popping a chunk from a bin. The entire stack is
+ *        detached and all but the first chunk are pushed back. Meanwhile,
+ *        other threads see an empty bin, which merely costs them a miss.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_memchunk_t *bin_pop(dbm_mempool_bin_t *bin) {
+  if (atomic_load_explicit(&bin->head, memory_order_relaxed) == NULL) {
+    return NULL; // cheap check without taking the cache line exclusively
+  }
+  dbm_memchunk_t *chunk =
+      atomic_exchange_explicit(&bin->head, NULL, memory_order_acquire);
+  if (chunk != NULL && chunk->next != NULL) {
+    dbm_memchunk_t *last = chunk->next;
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    bin_push(bin, chunk->next, last);
+  }
+  return chunk;
+}
+
 /*******************************************************************************
- * \brief Private linked list of memory chunks that are available.
+ * \brief Private routine for obtaining the calling thread's cache, if any.
+ *        Nested parallel regions fall back to the shared bins.
  * \author Ole Schuett
  ******************************************************************************/
-static dbm_memchunk_t *mempool_available_head = NULL;
+static dbm_mempool_thread_cache_t *get_thread_cache(void) {
+  const int ithread = omp_get_thread_num();
+  if (omp_get_level() <= 1 && ithread < mempool_nthread_caches) {
+    return mempool_thread_caches[ithread];
+  }
+  return NULL;
+}
+
+/*******************************************************************************
+ * \brief Private routine for taking an available chunk of the given size class
+ *        from the thread's own cache or, if there is none, from the shared bin.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_memchunk_t *pop_chunk(dbm_mempool_thread_cache_t *cache,
+                                 const bool on_device, const int iclass) {
+  if (cache != NULL && cache->head[on_device][iclass] != NULL) {
+    dbm_memchunk_t *chunk = cache->head[on_device][iclass];
+    cache->head[on_device][iclass] = chunk->next;
+    cache->count[on_device][iclass]--;
+    return chunk;
+  }
+  return bin_pop(&mempool_shared_bins[on_device][iclass]);
+}
+
+/*******************************************************************************
+ * \brief Private routine for releasing the system memory of a chunk.
+ *        Host chunks live in their own header, hence they vanish as well.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void release_chunk(dbm_memchunk_t *chunk) {
+  const bool on_device = chunk->on_device;
+  atomic_fetch_sub_explicit(&mempool_size[on_device], (int64_t)chunk->size,
+                            memory_order_relaxed);
+  if (on_device) {
+    actual_free(chunk->mem, true, chunk->numa_placement);
+    free(chunk);
+  } else {
+    int64_t placement[OFFLOAD_MAX_NUMA_NODES];
+    memcpy(placement, chunk->numa_placement, sizeof(placement));
+    actual_free(chunk, false, placement);
+  }
+}
 
 /*******************************************************************************
- * \brief Private linked list of memory chunks that are in use.
+ * \brief Private routine for allocating a new chunk from the system.
  * \author Ole Schuett
  ******************************************************************************/
-static dbm_memchunk_t *mempool_allocated_head = NULL;
+static dbm_memchunk_t *create_chunk(const size_t size, const bool on_device) {
+  size_t class_size;
+  const int iclass = size_class(size, &class_size);
+  dbm_memchunk_t *chunk;
+  int64_t placement[OFFLOAD_MAX_NUMA_NODES];
+  if (on_device) {
+    chunk = malloc(sizeof(dbm_memchunk_t));
+    chunk->mem = actual_malloc(class_size, size, true, placement);
+  } else {
+    char *memory = actual_malloc(MEMPOOL_HEADER_SIZE + class_size,
+                                 MEMPOOL_HEADER_SIZE + size, false, placement);
+    chunk = (dbm_memchunk_t *)memory;
+    chunk->mem = memory + MEMPOOL_HEADER_SIZE;
+  }
+  chunk->on_device = on_device;
+  chunk->size_class = iclass;
+  chunk->size = class_size;
+  chunk->next = NULL;
+  memcpy(chunk->numa_placement, placement, sizeof(placement));
+  add_and_track_max(&mempool_size[on_device], &mempool_size_max[on_device],
+                    (int64_t)class_size);
+  return chunk;
+}
 
 /*******************************************************************************
  * \brief Private routine for allocating host or device memory from the pool.
+ *
+ *        A request is served from its own size class or, failing that, from
+ *        one of the next MEMPOOL_MAX_LARGER_CLASSES classes. Hence, a chunk
+ *        is at most about 1.5 times larger than requested. Otherwise a new
+ *        chunk gets allocated and, like a resize, an idle chunk visible to the
+ *        calling thread is released in exchange, preferably a smaller one.
+ *        Idle chunks in other threads' caches are not visible, hence the pool
+ *        may hold up to MEMPOOL_THREAD_CACHE_SIZE extra chunks per thread and
+ *        size class beyond the chunks that were in use at once.
  * \author Ole Schuett
  ******************************************************************************/
 static void *internal_mempool_malloc(const size_t size, const bool on_device) {
   if (size == 0) {
     return NULL;
   }
+  assert(mempool_initialized);
 
-  dbm_memchunk_t *chunk;
+  size_t class_size;
+  const int iclass = size_class(size, &class_size);
+  dbm_mempool_thread_cache_t *cache = get_thread_cache();
 
-#pragma omp critical(dbm_mempool_modify)
-  {
-    // Find a suitable chuck in mempool_available.
-    dbm_memchunk_t **indirect = &mempool_available_head;
-    while (*indirect != NULL && (*indirect)->on_device != on_device) {
-      indirect = &(*indirect)->next;
+  // Look for an available chunk in the request's own and a few larger classes.
+  dbm_memchunk_t *chunk = NULL;
+  const int max_class = iclass + MEMPOOL_MAX_LARGER_CLASSES;
+  for (int jclass = iclass; jclass <= max_class && chunk == NULL; jclass++) {
+    if (jclass < MEMPOOL_NUM_CLASSES) {
+      chunk = pop_chunk(cache, on_device, jclass);
     }
-    chunk = *indirect;
+  }
 
-    // If a chunck was found, remove it from mempool_available.
-    if (chunk != NULL) {
-      assert(chunk->on_device == on_device);
-      *indirect = chunk->next;
+  if (chunk != NULL) {
+    atomic_fetch_add_explicit(&mempool_hits[on_device], 1,
+                              memory_order_relaxed);
+  } else {
+    // Release the nearest smaller idle chunk, which has become too small, or
+    // else the nearest idle chunk that is too large to be reused.
+    dbm_memchunk_t *recycled = NULL;
+    for (int jclass = iclass - 1; jclass >= 0 && recycled == NULL; jclass--) {
+      recycled = pop_chunk(cache, on_device, jclass);
     }
-
-    // If no chunk was found, allocate a new one.
-    if (chunk == NULL) {
-      chunk = malloc(sizeof(dbm_memchunk_t));
-      chunk->on_device = on_device;
-      chunk->size = 0;
-      chunk->mem = NULL;
+    for (int jclass = max_class + 1;
+         jclass < MEMPOOL_NUM_CLASSES && recycled == NULL; jclass++) {
+      recycled = pop_chunk(cache, on_device, jclass);
     }
-
-    // Resize chunk if needed.
-    if (chunk->size < size) {
-      actual_free(chunk->mem, chunk->on_device);
-      chunk->mem = actual_malloc(size, chunk->on_device);
-      chunk->size = size;
+    if (recycled != NULL) {
+      release_chunk(recycled);
     }
+    chunk = create_chunk(size, on_device);
+  }
+  atomic_fetch_add_explicit(&mempool_mallocs[on_device], 1,
+                            memory_order_relaxed);
+  add_and_track_max(&mempool_used[on_device], &mempool_used_max[on_device],
+                    (int64_t)chunk->size);
 
-    // Insert chunk into mempool_allocated.
-    chunk->next = mempool_allocated_head;
-    mempool_allocated_head = chunk;
+  // Device chunks are registered such that dbm_mempool_device_free finds them.
+  if (on_device) {
+    omp_set_lock(&mempool_device_lock);
+    chunk->next = mempool_device_allocated;
+    mempool_device_allocated = chunk;
+    omp_unset_lock(&mempool_device_lock);
   }
 
+  assert(chunk->on_device == on_device && chunk->size >= size);
   return chunk->mem;
 }
 
@@ -152,31 +383,110 @@ void *dbm_mempool_device_malloc(const size_t size) {
 }
 
 /*******************************************************************************
- * \brief Internal routine for releasing memory back to the pool.
+ * \brief Private routine for returning a chunk to the pool.
  * \author Ole Schuett
  ******************************************************************************/
-void dbm_mempool_free(void *mem) {
+static void return_chunk(dbm_memchunk_t *chunk) {
+  const bool on_device = chunk->on_device;
+  const int iclass = chunk->size_class;
+  atomic_fetch_sub_explicit(&mempool_used[on_device], (int64_t)chunk->size,
+                            memory_order_relaxed);
+
+  // Keep a few chunks per size class in the thread's own cache.
+  dbm_mempool_thread_cache_t *cache = get_thread_cache();
+  if (cache != NULL &&
+      cache->count[on_device][iclass] < MEMPOOL_THREAD_CACHE_SIZE) {
+    chunk->next = cache->head[on_device][iclass];
+    cache->head[on_device][iclass] = chunk;
+    cache->count[on_device][iclass]++;
+    return;
+  }
+
+  // Otherwise return the chunk to the shared bin of its size class.
+  bin_push(&mempool_shared_bins[on_device][iclass], chunk, chunk);
+}
+
+/*******************************************************************************
+ * \brief Internal routine for releasing host memory back to the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_host_free(void *mem) {
   if (mem == NULL) {
     return;
   }
+  dbm_memchunk_t *chunk =
+      (dbm_memchunk_t *)((char *)mem - MEMPOOL_HEADER_SIZE);
+  assert(!chunk->on_device && chunk->mem == mem); // not allocated by mempool
+  return_chunk(chunk);
+}
 
-#pragma omp critical(dbm_mempool_modify)
-  {
-    // Find chuck in mempool_allocated.
-    dbm_memchunk_t **indirect = &mempool_allocated_head;
-    while (*indirect != NULL && (*indirect)->mem != mem) {
-      indirect = &(*indirect)->next;
-    }
-    dbm_memchunk_t *chunk = *indirect;
-    assert(chunk != NULL && chunk->mem == mem);
+/*******************************************************************************
+ * \brief Internal routine for releasing device memory back to the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_device_free(void *mem) {
+  if (mem == NULL) {
+    return;
+  }
+  omp_set_lock(&mempool_device_lock);
+  dbm_memchunk_t **indirect = &mempool_device_allocated;
+  while (*indirect != NULL && (*indirect)->mem != mem) {
+    indirect = &(*indirect)->next;
+  }
+  dbm_memchunk_t *chunk = *indirect;
+  assert(chunk != NULL); // mem was not allocated by mempool
+  *indirect = chunk->next;
+  omp_unset_lock(&mempool_device_lock);
+  return_chunk(chunk);
+}
 
-    // Remove chuck from mempool_allocated.
-    *indirect = chunk->next;
+/*******************************************************************************
+ * \brief Private routine for freeing a linked list of chunks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void free_chunks(dbm_memchunk_t *head) {
+  while (head != NULL) {
+    dbm_memchunk_t *chunk = head;
+    head = chunk->next;
+    release_chunk(chunk);
+  }
+}
+
+/*******************************************************************************
+ * \brief Internal routine for initializing the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_init(void) {
+  assert(omp_get_num_threads() == 1);
+  assert(!mempool_initialized);
+  assert(sizeof(dbm_memchunk_t) <= MEMPOOL_HEADER_SIZE);
+
+  for (int on_device = 0; on_device < 2; on_device++) {
+    for (int iclass = 0; iclass < MEMPOOL_NUM_CLASSES; iclass++) {
+      atomic_init(&mempool_shared_bins[on_device][iclass].head, NULL);
+    }
+    atomic_init(&mempool_mallocs[on_device], 0);
+    atomic_init(&mempool_hits[on_device], 0);
+    atomic_init(&mempool_size[on_device], 0);
+    atomic_init(&mempool_size_max[on_device], 0);
+    atomic_init(&mempool_used[on_device], 0);
+    atomic_init(&mempool_used_max[on_device], 0);
+  }
+  memset(mempool_numa_placement, 0, sizeof(mempool_numa_placement));
+  omp_init_lock(&mempool_device_lock);
 
-    // Add chuck to mempool_available.
-    chunk->next = mempool_available_head;
-    mempool_available_head = chunk;
+  // Using parallel regions to ensure memory is allocated near a thread's core.
+  mempool_nthread_caches = omp_get_max_threads();
+  mempool_thread_caches =
+      malloc(mempool_nthread_caches * sizeof(dbm_mempool_thread_cache_t *));
+#pragma omp parallel num_threads(mempool_nthread_caches)
+  {
+    const int ithread = omp_get_thread_num();
+    mempool_thread_caches[ithread] =
+        calloc(1, sizeof(dbm_mempool_thread_cache_t));
   }
+
+  mempool_initialized = true;
 }
 
 /*******************************************************************************
@@ -185,22 +495,58 @@ void dbm_mempool_free(void *mem) {
  ******************************************************************************/
 void dbm_mempool_clear(void) {
   assert(omp_get_num_threads() == 1);
-  assert(mempool_allocated_head == NULL); // check for memory leak
-
-  // while (mempool_allocated_head != NULL) {
-  //  dbm_memchunk_t *chunk = mempool_allocated_head;
-  //  mempool_allocated_head = chunk->next;
-  //  printf("Found alloacted memory chunk of size: %lu\n", chunk->size);
-  //  actual_free(chunk->mem, chunk->on_device);
-  //  free(chunk);
-  //}
-
-  // Free chunks in mempool_avavailable.
-  while (mempool_available_head != NULL) {
-    dbm_memchunk_t *chunk = mempool_available_head;
-    mempool_available_head = chunk->next;
-    actual_free(chunk->mem, chunk->on_device);
-    free(chunk);
+  assert(mempool_used[0] == 0 && mempool_used[1] == 0); // check for leaks
+  assert(mempool_device_allocated == NULL);
+
+  // Free chunks in the thread caches and in the shared bins.
+  for (int on_device = 0; on_device < 2; on_device++) {
+    for (int iclass = 0; iclass < MEMPOOL_NUM_CLASSES; iclass++) {
+      for (int ithread = 0; ithread < mempool_nthread_caches; ithread++) {
+        dbm_mempool_thread_cache_t *cache = mempool_thread_caches[ithread];
+        free_chunks(cache->head[on_device][iclass]);
+        cache->head[on_device][iclass] = NULL;
+        cache->count[on_device][iclass] = 0;
+      }
+      dbm_mempool_bin_t *bin = &mempool_shared_bins[on_device][iclass];
+      free_chunks(atomic_exchange(&bin->head, NULL));
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Internal routine for freeing all memory and finalizing the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_finalize(void) {
+  assert(mempool_initialized);
+  dbm_mempool_clear();
+
+  for (int ithread = 0; ithread < mempool_nthread_caches; ithread++) {
+    free(mempool_thread_caches[ithread]);
+  }
+  free(mempool_thread_caches);
+  mempool_thread_caches = NULL;
+  mempool_nthread_caches = 0;
+  omp_destroy_lock(&mempool_device_lock);
+  mempool_initialized = false;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for querying the statistics of the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_statistics(const bool on_device,
+                            dbm_mempool_statistics_t *stats) {
+  stats->nmallocs = atomic_load(&mempool_mallocs[on_device]);
+  stats->nhits = atomic_load(&mempool_hits[on_device]);
+  stats->size = atomic_load(&mempool_size[on_device]);
+  stats->size_max = atomic_load(&mempool_size_max[on_device]);
+  stats->used_max = atomic_load(&mempool_used_max[on_device]);
+  memset(stats->numa_placement, 0, sizeof(stats->numa_placement));
+  if (!on_device) {
+#pragma omp critical(offload_numa_placement)
+    memcpy(stats->numa_placement, mempool_numa_placement,
+           sizeof(mempool_numa_placement));
   }
 }
 
@@ -12,6 +12,29 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../offload/offload_library.h"
+
+/*******************************************************************************
+ * \brief Internal struct for storing statistics of the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int64_t nmallocs; // Number of allocation requests.
+  int64_t nhits;    // Number of requests served without a system allocation.
+  int64_t size;     // Bytes of system memory currently held by the pool.
+  int64_t size_max; // High-water-mark of size.
+  int64_t used_max; // High-water-mark of bytes handed out to callers.
+  int64_t numa_placement[OFFLOAD_MAX_NUMA_NODES]; // Bytes per node of size.
+} dbm_mempool_statistics_t;
+
+/*******************************************************************************
+ * \brief Internal routine for initializing the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_init(void);
 
 /*******************************************************************************
  * \brief Internal routine for allocating host memory from the pool.
@@ -26,10 +49,16 @@ void *dbm_mempool_host_malloc(const size_t size);
 void *dbm_mempool_device_malloc(const size_t size);
 
 /*******************************************************************************
- * \brief Internal routine for releasing memory back to the pool.
+ * \brief Internal routine for releasing host memory back to the pool.
  * \author Ole Schuett
  ******************************************************************************/
-void dbm_mempool_free(void *memory);
+void dbm_mempool_host_free(void *memory);
+
+/*******************************************************************************
+ * \brief Internal routine for releasing device memory back to the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_device_free(void *memory);
 
 /*******************************************************************************
  * \brief Internal routine for freeing all memory in the pool.
@@ -37,6 +66,19 @@ void dbm_mempool_free(void *memory);
  ******************************************************************************/
 void dbm_mempool_clear(void);
 
+/*******************************************************************************
+ * \brief Internal routine for freeing all memory and finalizing the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_finalize(void);
+
+/*******************************************************************************
+ * \brief Internal routine for querying the statistics of the pool.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mempool_statistics(const bool on_device,
+                            dbm_mempool_statistics_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
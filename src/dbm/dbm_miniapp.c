@@ -6,20 +6,28 @@
 /*----------------------------------------------------------------------------*/
 
 #include <assert.h>
+#include <inttypes.h>
+#include <math.h>
 #include <omp.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #if defined(__LIBXSMM)
 #include <libxsmm.h>
 #endif
 
 #include "../offload/offload_library.h"
+#include "dbm_compress.h"
 #include "dbm_library.h"
 #include "dbm_matrix.h"
+#include "dbm_mempool.h"
 #include "dbm_mpi.h"
+#include "dbm_multiply.h"
+#include "dbm_multiply_cpu.h"
 
 /*******************************************************************************
  * \brief Wrapper for printf, passed to dbm_library_print_stats.
@@ -38,16 +46,14 @@ static void print_func(char *message, int output_unit) {
 static inline int imin(int x, int y) { return (x < y ? x : y); }
 
 /*******************************************************************************
- * \brief Private routine for creating a distribution and an empty matrix.
+ * \brief Private routine for creating a round-robin distribution.
  * \author Ole Schuett
  ******************************************************************************/
-static dbm_matrix_t *create_some_matrix(const int nrows, const int ncols,
-                                        const int row_size, const int col_size,
-                                        const dbm_mpi_comm_t comm) {
+static dbm_distribution_t *create_distribution(const int nrows, const int ncols,
+                                               const dbm_mpi_comm_t comm) {
   int cart_dims[2], cart_periods[2], cart_coords[2];
   dbm_mpi_cart_get(comm, 2, cart_dims, cart_periods, cart_coords);
 
-  // Create distribution.
   int *row_dist = malloc(nrows * sizeof(int));
   int *col_dist = malloc(ncols * sizeof(int));
   for (int i = 0; i < nrows; i++) {
@@ -61,6 +67,18 @@ static dbm_matrix_t *create_some_matrix(const int nrows, const int ncols,
   dbm_distribution_new(&dist, fortran_comm, nrows, ncols, row_dist, col_dist);
   free(row_dist);
   free(col_dist);
+  return dist;
+}
+
+/*******************************************************************************
+ * \brief Private routine for creating a distribution and an empty matrix.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_matrix_t *create_some_matrix(const int nrows, const int ncols,
+                                        const int row_size, const int col_size,
+                                        const dbm_mpi_comm_t comm) {
+  // Create distribution.
+  dbm_distribution_t *dist = create_distribution(nrows, ncols, comm);
 
   // Create matrix.
   int *row_sizes = malloc(nrows * sizeof(int));
@@ -143,6 +161,391 @@ static void set_all_blocks(dbm_matrix_t *matrix) {
     dbm_iterator_stop(iter);
   }
 }
+
+/*******************************************************************************
+ * \brief Private routine for checking that the memory pool does not hold on to
+ *        much more memory than was in use at once, e.g. idle chunks that never
+ *        get reused. Size classes alone account for up to 25% overhead.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_mempool_peak(const dbm_mpi_comm_t comm) {
+  for (int on_device = 0; on_device < 2; on_device++) {
+    dbm_mempool_statistics_t stats;
+    dbm_mempool_statistics(on_device, &stats);
+    if (stats.size_max > 1.5 * stats.used_max) {
+      fprintf(stderr,
+              "ERROR: rank %i mempool peak of %.1f MiB exceeds 1.5 times the "
+              "peak in use of %.1f MiB.\n",
+              dbm_mpi_comm_rank(comm), stats.size_max / 1048576.0,
+              stats.used_max / 1048576.0);
+      exit(1);
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for checking the reuse of chunks by the memory pool.
+ *        Chunks are reused for slightly smaller requests but not for much
+ *        smaller ones, growing requests do not accumulate idle chunks, and
+ *        chunks can be returned by other threads. Must be called while the
+ *        pool holds no memory.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_mempool_reuse(void) {
+  dbm_mempool_statistics_t before, after;
+  bool ok = true;
+
+  // Chunks are reused for requests of the same or a slightly smaller size.
+  void *mem[3];
+  for (int i = 0; i < 3; i++) {
+    mem[i] = dbm_mempool_host_malloc(100000);
+  }
+  for (int i = 0; i < 3; i++) {
+    dbm_mempool_host_free(mem[i]);
+  }
+  dbm_mempool_statistics(false, &before);
+  for (int i = 0; i < 3; i++) {
+    mem[i] = dbm_mempool_host_malloc(90000);
+  }
+  for (int i = 0; i < 3; i++) {
+    dbm_mempool_host_free(mem[i]);
+  }
+  dbm_mempool_statistics(false, &after);
+  ok = ok && (after.nhits == before.nhits + 3 && after.size == before.size);
+
+  // A small request must not occupy a much larger idle chunk. Instead one of
+  // the larger idle chunks gets released in exchange for the new one.
+  dbm_mempool_host_free(dbm_mempool_host_malloc(1 << 20));
+  dbm_mempool_statistics(false, &before);
+  void *small = dbm_mempool_host_malloc(2048);
+  dbm_mempool_statistics(false, &after);
+  dbm_mempool_host_free(small);
+  ok = ok && (after.nhits == before.nhits && after.size < before.size);
+
+  // Growing requests release the idle chunks they outgrew, hence the pool
+  // grows by no more than the largest chunk.
+  dbm_mempool_statistics(false, &before);
+  size_t size = 4096;
+  for (int i = 0; i < 20; i++) {
+    dbm_mempool_host_free(dbm_mempool_host_malloc(size));
+    size = size * 13 / 10;
+  }
+  dbm_mempool_statistics(false, &after);
+  ok = ok && (after.size <= before.size + (int64_t)(size * 10 / 13 * 5 / 4));
+
+  // Chunks allocated by one thread can be returned by another one.
+  const int nthreads = omp_get_max_threads(), nper_thread = 64;
+  void **shared_mem = malloc(nthreads * nper_thread * sizeof(void *));
+#pragma omp parallel num_threads(nthreads)
+  {
+    const int ithread = omp_get_thread_num();
+    for (int round = 0; round < 10; round++) {
+      for (int i = 0; i < nper_thread; i++) {
+        const size_t nbytes = 1024 * (1 + (7 * i + ithread + round) % 37);
+        shared_mem[ithread * nper_thread + i] = dbm_mempool_host_malloc(nbytes);
+        memset(shared_mem[ithread * nper_thread + i], 0, nbytes);
+      }
+#pragma omp barrier
+      const int jthread = (ithread + 1) % omp_get_num_threads();
+      for (int i = 0; i < nper_thread; i++) {
+        dbm_mempool_host_free(shared_mem[jthread * nper_thread + i]);
+      }
+#pragma omp barrier
+    }
+  }
+  free(shared_mem);
+
+  // All chunks are idle now, hence clearing the pool releases all memory.
+  dbm_mempool_clear();
+  dbm_mempool_statistics(false, &after);
+  ok = ok && (after.size == 0);
+
+  if (!ok) {
+    fprintf(stderr, "ERROR: Memory pool did not reuse chunks as expected.\n");
+    exit(1);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for comparing all cursor lookups of a shard against
+ *        the hashtable. Columns are visited ascending, descending, and mixed.
+ * \author Ole Schuett
+ ******************************************************************************/
+static bool shard_lookups_agree(const dbm_shard_t *shard, const int nrows,
+                                const int ncols) {
+  dbm_shard_cursor_t cursor;
+  dbm_shard_cursor_init(shard, &cursor);
+  for (int order = 0; order < 3; order++) {
+    for (int row = 0; row < nrows; row++) {
+      for (int i = 0; i < ncols; i++) {
+        const int col = (order == 0)   ? i
+                        : (order == 1) ? ncols - 1 - i
+                                       : (37 * i) % ncols;
+        if (dbm_shard_cursor_lookup(&cursor, row, col) !=
+            dbm_shard_lookup(shard, row, col)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/*******************************************************************************
+ * \brief Private routine for checking the frozen index of a shard, including
+ *        empty shards, incremental freezing, and out-of-order lookups.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_shard_lookups(void) {
+  const int nrows = 6, ncols = 50; // ncols must not be a multiple of 37
+  dbm_shard_t shard;
+  dbm_shard_init(&shard);
+
+  // An empty shard is not frozen until it gets frozen.
+  bool ok = !dbm_shard_is_frozen(&shard);
+  dbm_shard_freeze(&shard);
+  ok = ok && dbm_shard_is_frozen(&shard) && shard.frozen_nblocks == 0;
+  ok = ok && shard_lookups_agree(&shard, nrows, ncols);
+
+  // Add blocks in scrambled order to the even rows, then refreeze twice.
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < nrows * ncols; i++) {
+      const int row = (5 * i) % nrows, col = (37 * (i / nrows)) % ncols;
+      if (row % 2 == 0 && col % 2 == pass) {
+        dbm_shard_promise_new_block(&shard, row, col, 1);
+      }
+    }
+    dbm_shard_allocate_promised_blocks(&shard);
+    ok = ok && !dbm_shard_is_frozen(&shard);
+    dbm_shard_freeze(&shard);
+    ok = ok && dbm_shard_is_frozen(&shard);
+    ok = ok && shard_lookups_agree(&shard, nrows, ncols);
+  }
+  dbm_shard_release(&shard);
+
+  if (!ok) {
+    fprintf(stderr, "ERROR: Lookups via frozen shard index failed.\n");
+    exit(1);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for checking the CPU backend's small matrix kernels
+ *        against a naive triple loop. Covers partial vectors, odd numbers of
+ *        columns, and blocks that are taller than SMM_MAX_M.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_small_block_kernels(void) {
+  const int sizes[] = {1, 2, 3, 4, 5, 7, 8, 9, 13, 16, 17, 23, 32, 33, 45};
+  const int nsizes = sizeof(sizes) / sizeof(int);
+  const int max_size = 45, max_k = 7;
+  const double alpha = 0.5;
+  double *a = malloc(max_size * max_k * sizeof(double));
+  double *b = malloc(max_size * max_k * sizeof(double));
+  double *c_ref = malloc(max_size * max_size * sizeof(double));
+  for (int i = 0; i < max_size * max_k; i++) {
+    a[i] = (double)((7 * i) % 11) - 5.0;
+    b[i] = (double)((5 * i) % 13) - 6.0;
+  }
+  const dbm_pack_t pack_a = {.data = a, .data_size = max_size * max_k};
+  const dbm_pack_t pack_b = {.data = b, .data_size = max_size * max_k};
+
+  double max_diff = 0.0;
+  for (int k = 1; k <= max_k; k += 3) {
+    for (int im = 0; im < nsizes; im++) {
+      for (int in = 0; in < nsizes; in++) {
+        const int m = sizes[im], n = sizes[in];
+        dbm_shard_t shard_c;
+        dbm_shard_init(&shard_c);
+        const dbm_block_t *blk =
+            dbm_shard_promise_new_block(&shard_c, 0, 0, m * n);
+        dbm_task_t task = {.m = m, .n = n, .k = k, .offset_c = blk->offset};
+        dbm_shard_allocate_promised_blocks(&shard_c);
+        double *c = &shard_c.data[task.offset_c];
+        for (int i = 0; i < m * n; i++) {
+          c[i] = c_ref[i] = (double)(i % 3);
+        }
+        for (int j = 0; j < n; j++) {
+          for (int i = 0; i < m; i++) {
+            for (int l = 0; l < k; l++) {
+              c_ref[i + j * m] += alpha * a[i + l * m] * b[j + l * n];
+            }
+          }
+        }
+        dbm_multiply_cpu_process_batch(1, &task, alpha, &pack_a, &pack_b,
+                                       &shard_c);
+        for (int i = 0; i < m * n; i++) {
+          max_diff = fmax(max_diff, fabs(c[i] - c_ref[i]));
+        }
+        dbm_shard_release(&shard_c);
+      }
+    }
+  }
+  free(a);
+  free(b);
+  free(c_ref);
+
+  // All inputs are small integers, hence the results are exact.
+  if (max_diff != 0.0) {
+    fprintf(stderr, "ERROR: Small block kernels deviate by %e.\n", max_diff);
+    exit(1);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for compressing and decompressing n doubles.
+ *        Returns the compressed size or -1 if the round trip is not exact.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compression_round_trip(const int n, const double data[n]) {
+  const int bound = dbm_compress_bound(n);
+  unsigned char *bytes = malloc(bound);
+  double *result = malloc((n + 1) * sizeof(double));
+  const int nbytes = dbm_compress(n, data, bytes);
+  const int nresult = dbm_decompress(nbytes, bytes, n + 1, result);
+  const bool ok = (nbytes <= bound && nresult == n &&
+                   memcmp(data, result, n * sizeof(double)) == 0);
+  free(bytes);
+  free(result);
+  return (ok) ? nbytes : -1;
+}
+
+/*******************************************************************************
+ * \brief Private routine for checking the compression of pack transfers.
+ *        Covers empty and incompressible data, data that spans several
+ *        chunks, and the error of the lossy mantissa truncation.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_pack_compression(void) {
+  const int n = 3 * 16384 + 17; // Spans several chunks plus a partial one.
+  double *data = malloc(n * sizeof(double));
+  bool ok = true;
+
+  // Empty data.
+  ok = ok && (compression_round_trip(0, data) >= 0);
+
+  // Random bits are incompressible, hence all chunks get copied.
+  // The data is only copied and compared bitwise, so NaNs do no harm.
+  uint64_t state = 88172645463325252ULL;
+  for (int i = 0; i < n; i++) {
+    state ^= state << 13; // xorshift64
+    state ^= state >> 7;
+    state ^= state << 17;
+    memcpy(&data[i], &state, sizeof(double));
+  }
+  ok = ok && (compression_round_trip(n, data) == dbm_compress_bound(n));
+
+  // Smooth data with truncated mantissas compresses well.
+  double norm = 0.0;
+  for (int i = 0; i < n; i++) {
+    data[i] = sin(0.001 * i) * exp(-1e-4 * i);
+    norm += data[i] * data[i];
+  }
+  const double max_error = 1e-6 * sqrt(norm);
+  double *truncated = malloc(n * sizeof(double));
+  memcpy(truncated, data, n * sizeof(double));
+  dbm_compress_truncate(n, truncated,
+                        dbm_compress_mantissa_bits(norm, max_error));
+  double error = 0.0;
+  for (int i = 0; i < n; i++) {
+    error += (data[i] - truncated[i]) * (data[i] - truncated[i]);
+  }
+  ok = ok && (sqrt(error) <= max_error);
+  const int nbytes_smooth = compression_round_trip(n, truncated);
+  ok = ok && (0 < nbytes_smooth && nbytes_smooth < n * (int)sizeof(double) / 2);
+  free(truncated);
+
+  // Zeros are reduced to almost nothing.
+  memset(data, 0, n * sizeof(double));
+  const int nbytes_zeros = compression_round_trip(n, data);
+  ok = ok && (0 < nbytes_zeros && nbytes_zeros < n / 10);
+  free(data);
+
+  if (!ok) {
+    fprintf(stderr, "ERROR: Pack compression round trip failed.\n");
+    exit(1);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for setting all blocks to values that vary with the
+ *        given iteration. Blocks with row + col divisible by three get tiny
+ *        values when requested, such that filtering changes the sparsity.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void set_varying_blocks(dbm_matrix_t *matrix, const int iteration,
+                               const bool thin_out) {
+#pragma omp parallel
+  {
+    dbm_iterator_t *iter = NULL;
+    dbm_iterator_start(&iter, matrix);
+    while (dbm_iterator_blocks_left(iter)) {
+      int row, col, row_size, col_size;
+      double *block;
+      dbm_iterator_next_block(iter, &row, &col, &block, &row_size, &col_size);
+      const double scale = (thin_out && (row + col) % 3 == 0) ? 1e-20 : 1.0;
+      for (int i = 0; i < row_size * col_size; i++) {
+        block[i] = scale * (1.0 + 0.5 * sin(0.7 * row + 1.3 * col + 0.1 * i +
+                                            iteration));
+      }
+    }
+    dbm_iterator_stop(iter);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for checking that a multiply plan yields the same
+ *        results as dbm_multiply, in mixed precision and with filtering.
+ *        The plan is executed with new data, which reuses its packs, and
+ *        with a new sparsity of matrix A, which rebuilds them.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void check_multiply_plan(const dbm_mpi_comm_t comm) {
+  // The fp32_eps is large enough for all block products to qualify.
+  const double filter_eps = 1e-8, fp32_eps = 1e-3;
+  dbm_matrix_t *matrix_a = create_some_matrix(20, 30, 7, 5, comm);
+  dbm_matrix_t *matrix_b = create_some_matrix(30, 25, 5, 9, comm);
+  dbm_matrix_t *matrix_c = create_some_matrix(20, 25, 7, 9, comm);
+  reserve_all_blocks(matrix_a);
+  reserve_all_blocks(matrix_b);
+
+  dbm_multiply_plan_t *plan = NULL;
+  dbm_multiply_plan_create(&plan, false, false, filter_eps, fp32_eps);
+  bool ok = true;
+  for (int iteration = 0; iteration < 3; iteration++) {
+    const bool new_sparsity = (iteration == 2);
+    set_varying_blocks(matrix_a, iteration, new_sparsity);
+    set_varying_blocks(matrix_b, iteration, false);
+    if (new_sparsity) {
+      dbm_filter(matrix_a, 1e-10);
+    }
+
+    int64_t flop_plan = 0, flop_ref = 0;
+    dbm_multiply_plan_execute(plan, 1.0, matrix_a, matrix_b, 0.0, matrix_c,
+                              false, &flop_plan);
+    dbm_matrix_t *matrix_ref = NULL;
+    dbm_create(&matrix_ref, matrix_c->dist, "reference", matrix_c->nrows,
+               matrix_c->ncols, matrix_c->row_sizes, matrix_c->col_sizes);
+    dbm_multiply(false, false, 1.0, matrix_a, matrix_b, 0.0, matrix_ref, false,
+                 filter_eps, fp32_eps, &flop_ref);
+    dbm_scale(matrix_ref, -1.0);
+    dbm_add(matrix_ref, matrix_c);
+    const double error = dbm_maxabs(matrix_ref);
+    ok = ok && (flop_plan == flop_ref) &&
+         (error <= 1e-12 * dbm_maxabs(matrix_c));
+    dbm_release(matrix_ref);
+  }
+  dbm_multiply_plan_release(plan);
+  dbm_release(matrix_a);
+  dbm_release(matrix_b);
+  dbm_release(matrix_c);
+
+  if (!ok) {
+    fprintf(stderr, "ERROR: Multiply plan deviates from dbm_multiply.\n");
+    exit(1);
+  }
+}
+
 /*******************************************************************************
  * \brief Run a benchmark of dbm_multiply with given block sizes.
  * \author Ole Schuett
@@ -160,7 +563,7 @@ void benchmark_multiply(const int M, const int N, const int K, const int m,
   int64_t flop = 0;
   const double time_start_multiply = omp_get_wtime();
   dbm_multiply(false, false, 1.0, matrix_a, matrix_b, 1.0, matrix_c, false,
-               1e-8, &flop);
+               1e-8, 0.0, &flop);
   const double time_end_multiply = omp_get_wtime();
 
   // Validate checksum.
@@ -188,6 +591,596 @@ void benchmark_multiply(const int M, const int N, const int K, const int m,
     fprintf(stderr, "Expected checksum %f but got %f.\n", expected, checksum);
     exit(1);
   }
+  check_mempool_peak(comm);
+}
+
+/*******************************************************************************
+ * \brief Private enum for the sparsity patterns of the benchmark matrices.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef enum {
+  PATTERN_DENSE,
+  PATTERN_RANDOM,
+  PATTERN_BANDED,
+} bench_pattern_t;
+
+static const char *const pattern_names[] = {"dense", "random", "banded"};
+
+// Indexed by dbm_compress_mode_t.
+static const char *const compression_names[] = {"none", "lossless", "lossy"};
+
+/*******************************************************************************
+ * \brief Private struct for storing the parameters of the benchmark suite.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int size[3];             // Number of block rows/cols of M, N, and K.
+  int blk_min[3];          // Smallest block sizes of m, n, and k.
+  int blk_max[3];          // Largest block sizes of m, n, and k.
+  bench_pattern_t pattern; // Sparsity pattern of matrix_a and matrix_b.
+  double occupancy;        // Targeted fraction of present blocks.
+  double decay;            // Orders of magnitude the block norms decay.
+  double filter_eps;       // Passed to dbm_multiply.
+  double fp32_eps;         // Passed to dbm_multiply, zero disables fp32.
+  int pack_compression;    // Passed to dbm_library_set_pack_compression.
+  bool retain_sparsity;    // Passed to dbm_multiply.
+  bool trans[2];           // Whether matrix_a and matrix_b are transposed.
+  int repeat;              // Number of multiplications.
+  bool plan;               // Whether to use a dbm_multiply_plan_t.
+  uint64_t seed;           // Seed of the random number generator.
+  const char *json;        // Output file for JSON, "-" means stdout.
+} bench_params_t;
+
+/*******************************************************************************
+ * \brief Private routine for parsing the options of the benchmark suite.
+ *        Returns false if the options are invalid.
+ * \author Ole Schuett
+ ******************************************************************************/
+static bool parse_bench_params(const int argc, char *argv[],
+                               bench_params_t *params) {
+  *params = (bench_params_t){.size = {128, 128, 128},
+                             .blk_min = {23, 23, 23},
+                             .blk_max = {23, 23, 23},
+                             .pattern = PATTERN_RANDOM,
+                             .occupancy = 0.1,
+                             .decay = 0.0,
+                             .filter_eps = 1e-8,
+                             .fp32_eps = 0.0,
+                             .pack_compression = DBM_COMPRESS_NONE,
+                             .retain_sparsity = false,
+                             .trans = {false, false},
+                             .repeat = 3,
+                             .plan = false,
+                             .seed = 42,
+                             .json = NULL};
+
+  for (int i = 0; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *arg = (i + 1 < argc) ? argv[i + 1] : "";
+    if (strcmp(opt, "--retain-sparsity") == 0) {
+      params->retain_sparsity = true;
+      continue;
+    }
+    if (strcmp(opt, "--plan") == 0) {
+      params->plan = true;
+      continue;
+    }
+    i++; // All remaining options take an argument.
+    if (strcmp(opt, "--size") == 0) {
+      if (sscanf(arg, "%ix%ix%i", &params->size[0], &params->size[1],
+                 &params->size[2]) != 3) {
+        return false;
+      }
+    } else if (strcmp(opt, "--blocks") == 0) {
+      // Each block size is either a single value or a range, e.g. 4-13x23x5.
+      const char *str = arg;
+      for (int j = 0; j < 3; j++) {
+        int nchars;
+        if (sscanf(str, "%i%n", &params->blk_min[j], &nchars) != 1) {
+          return false;
+        }
+        str += nchars;
+        params->blk_max[j] = params->blk_min[j];
+        if (*str == '-') {
+          if (sscanf(str + 1, "%i%n", &params->blk_max[j], &nchars) != 1) {
+            return false;
+          }
+          str += 1 + nchars;
+        }
+        if (j < 2 && *str++ != 'x') {
+          return false;
+        }
+      }
+      if (*str != '\0') {
+        return false;
+      }
+    } else if (strcmp(opt, "--pattern") == 0) {
+      bool found = false;
+      for (int j = 0; j < 3; j++) {
+        if (strcmp(arg, pattern_names[j]) == 0) {
+          params->pattern = (bench_pattern_t)j;
+          found = true;
+        }
+      }
+      if (!found) {
+        return false;
+      }
+    } else if (strcmp(opt, "--occupancy") == 0) {
+      if (sscanf(arg, "%lf", &params->occupancy) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--decay") == 0) {
+      if (sscanf(arg, "%lf", &params->decay) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--filter-eps") == 0) {
+      if (sscanf(arg, "%lf", &params->filter_eps) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--fp32-eps") == 0) {
+      if (sscanf(arg, "%lf", &params->fp32_eps) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--pack-compression") == 0) {
+      bool found = false;
+      for (int j = 0; j < 3; j++) {
+        if (strcmp(arg, compression_names[j]) == 0) {
+          params->pack_compression = j;
+          found = true;
+        }
+      }
+      if (!found) {
+        return false;
+      }
+    } else if (strcmp(opt, "--trans") == 0) {
+      if (strlen(arg) != 2) {
+        return false;
+      }
+      for (int j = 0; j < 2; j++) {
+        if (arg[j] != 'N' && arg[j] != 'T') {
+          return false;
+        }
+        params->trans[j] = (arg[j] == 'T');
+      }
+    } else if (strcmp(opt, "--repeat") == 0) {
+      if (sscanf(arg, "%i", &params->repeat) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--seed") == 0) {
+      if (sscanf(arg, "%" SCNu64, &params->seed) != 1) {
+        return false;
+      }
+    } else if (strcmp(opt, "--json") == 0) {
+      if (*arg == '\0') {
+        return false;
+      }
+      params->json = arg;
+    } else {
+      return false;
+    }
+  }
+
+  // Validate parameters.
+  for (int j = 0; j < 3; j++) {
+    if (params->size[j] < 1 || params->blk_min[j] < 1 ||
+        params->blk_max[j] < params->blk_min[j]) {
+      return false;
+    }
+  }
+  return (0.0 < params->occupancy && params->occupancy <= 1.0 &&
+          0.0 <= params->decay && 0.0 <= params->filter_eps &&
+          0.0 <= params->fp32_eps && 0 < params->repeat);
+}
+
+/*******************************************************************************
+ * \brief Private routine for hashing the given coordinates into a random
+ *        number in [0,1). This keeps the matrices independent of MPI ranks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double hash_uniform(const uint64_t seed, const int id, const int row,
+                           const int col) {
+  // See https://prng.di.unimi.it/splitmix64.c
+  uint64_t x = seed ^ ((uint64_t)id << 56) ^ ((uint64_t)row << 28) ^
+               (uint64_t)col;
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  x = x ^ (x >> 31);
+  return (double)(x >> 11) / (double)(UINT64_C(1) << 53);
+}
+
+/*******************************************************************************
+ * \brief Private routine for drawing block sizes of the given dimension.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int *create_block_sizes(const bench_params_t *params, const int dim) {
+  const int n = params->size[dim];
+  const int range = params->blk_max[dim] - params->blk_min[dim] + 1;
+  int *sizes = malloc(n * sizeof(int));
+  for (int i = 0; i < n; i++) {
+    const double r = hash_uniform(params->seed, 3 + dim, i, 0);
+    sizes[i] = params->blk_min[dim] + imin((int)(r * range), range - 1);
+  }
+  return sizes;
+}
+
+/*******************************************************************************
+ * \brief Private routine for creating an empty matrix with given block sizes.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_matrix_t *create_bench_matrix(const int nrows, const int ncols,
+                                         const int row_sizes[nrows],
+                                         const int col_sizes[ncols],
+                                         const dbm_mpi_comm_t comm) {
+  dbm_distribution_t *dist = create_distribution(nrows, ncols, comm);
+  dbm_matrix_t *matrix = NULL;
+  dbm_create(&matrix, dist, "bench", nrows, ncols, row_sizes, col_sizes);
+  dbm_distribution_release(dist);
+  return matrix;
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the relative distance of a block from
+ *        the diagonal. It governs the banded pattern and the norm decay.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double diagonal_distance(const dbm_matrix_t *matrix, const int row,
+                                const int col) {
+  int nrows, ncols;
+  const int *row_sizes, *col_sizes;
+  dbm_get_row_sizes(matrix, &nrows, &row_sizes);
+  dbm_get_col_sizes(matrix, &ncols, &col_sizes);
+  return fabs((row + 0.5) / nrows - (col + 0.5) / ncols);
+}
+
+/*******************************************************************************
+ * \brief Private routine for deciding if a block belongs to the pattern.
+ * \author Ole Schuett
+ ******************************************************************************/
+static bool block_is_present(const bench_params_t *params, const int id,
+                             const dbm_matrix_t *matrix, const int row,
+                             const int col) {
+  switch (params->pattern) {
+  case PATTERN_DENSE:
+    return true;
+  case PATTERN_RANDOM:
+    return hash_uniform(params->seed, id, row, col) < params->occupancy;
+  case PATTERN_BANDED:
+    // A band of half-width w covers a fraction of 1 - (1 - w)^2.
+    return diagonal_distance(matrix, row, col) <=
+           1.0 - sqrt(1.0 - params->occupancy);
+  }
+  return false;
+}
+
+/*******************************************************************************
+ * \brief Private routine for reserving the blocks of the benchmark pattern.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void reserve_pattern_blocks(const bench_params_t *params, const int id,
+                                   dbm_matrix_t *matrix) {
+  int nrows, ncols;
+  const int *row_sizes, *col_sizes;
+  dbm_get_row_sizes(matrix, &nrows, &row_sizes);
+  dbm_get_col_sizes(matrix, &ncols, &col_sizes);
+
+#pragma omp parallel
+  {
+    int nblocks = 0;
+#pragma omp for collapse(2)
+    for (int row = 0; row < nrows; row++) {
+      for (int col = 0; col < ncols; col++) {
+        if (dbm_get_stored_coordinates(matrix, row, col) ==
+                matrix->dist->my_rank &&
+            block_is_present(params, id, matrix, row, col)) {
+          ++nblocks;
+        }
+      }
+    }
+    int *reserve_row = malloc(nblocks * sizeof(int));
+    int *reserve_col = malloc(nblocks * sizeof(int));
+    int iblock = 0;
+#pragma omp for collapse(2)
+    for (int row = 0; row < nrows; row++) {
+      for (int col = 0; col < ncols; col++) {
+        if (dbm_get_stored_coordinates(matrix, row, col) ==
+                matrix->dist->my_rank &&
+            block_is_present(params, id, matrix, row, col)) {
+          reserve_row[iblock] = row;
+          reserve_col[iblock] = col;
+          iblock++;
+        }
+      }
+    }
+    assert(iblock == nblocks);
+    dbm_reserve_blocks(matrix, nblocks, reserve_row, reserve_col);
+    free(reserve_row);
+    free(reserve_col);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for filling all blocks with random numbers. The block
+ *        norms decay exponentially with the distance from the diagonal.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void set_pattern_blocks(const bench_params_t *params, const int id,
+                               dbm_matrix_t *matrix) {
+#pragma omp parallel
+  {
+    dbm_iterator_t *iter = NULL;
+    dbm_iterator_start(&iter, matrix);
+    while (dbm_iterator_blocks_left(iter)) {
+      int row, col, row_size, col_size;
+      double *block;
+      dbm_iterator_next_block(iter, &row, &col, &block, &row_size, &col_size);
+      const double dist = diagonal_distance(matrix, row, col);
+      const double scale = pow(10.0, -params->decay * dist);
+      const uint64_t seed = params->seed + (uint64_t)row * 0x10001 + col;
+      const int block_size = row_size * col_size;
+      for (int i = 0; i < block_size; i++) {
+        block[i] = scale * (2.0 * hash_uniform(seed, id, i, 0) - 1.0);
+      }
+    }
+    dbm_iterator_stop(iter);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the global fraction of present blocks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double get_occupancy(const dbm_matrix_t *matrix) {
+  int64_t nblocks = dbm_get_num_blocks(matrix);
+  dbm_mpi_sum_int64(&nblocks, 1, matrix->dist->comm);
+  return (double)nblocks / ((double)matrix->nrows * (double)matrix->ncols);
+}
+
+/*******************************************************************************
+ * \brief Private routine for recomputing C in double precision and returning
+ *        the largest deviation of matrix_c from it. Each block product may be
+ *        off by fp32_eps, hence an element of C by fp32_eps times the number
+ *        of block products that contribute to it.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double get_fp32_error(const bench_params_t *params,
+                             const dbm_matrix_t *matrix_a,
+                             const dbm_matrix_t *matrix_b,
+                             const dbm_matrix_t *matrix_c) {
+  dbm_matrix_t *matrix_ref = NULL;
+  dbm_create(&matrix_ref, matrix_c->dist, "reference", matrix_c->nrows,
+             matrix_c->ncols, matrix_c->row_sizes, matrix_c->col_sizes);
+  if (params->retain_sparsity) {
+    reserve_pattern_blocks(params, 2, matrix_ref);
+  }
+  int64_t flop = 0;
+  dbm_multiply(params->trans[0], params->trans[1], 1.0, matrix_a, matrix_b,
+               0.0, matrix_ref, params->retain_sparsity, params->filter_eps,
+               0.0, &flop);
+  dbm_scale(matrix_ref, -1.0);
+  dbm_add(matrix_ref, matrix_c);
+  const double error = dbm_maxabs(matrix_ref);
+  dbm_release(matrix_ref);
+  return error;
+}
+
+/*******************************************************************************
+ * \brief Private struct for storing the measurements of a single multiply.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  double time;                        // Wall time, max over ranks.
+  double phase_times[DBM_NUM_PHASES]; // Max over ranks.
+  int64_t flop;                       // Sum over ranks.
+} bench_run_t;
+
+/*******************************************************************************
+ * \brief Private routine for writing the benchmark results as JSON.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void write_json(FILE *file, const bench_params_t *params,
+                       const int nranks, const double occupancy[3],
+                       const bench_run_t runs[], const double memory[3],
+                       const double checksum, const double fp32_error) {
+  static const char *const phase_names[DBM_NUM_PHASES] = {"pack", "comm",
+                                                          "multiply", "filter"};
+  fprintf(file, "{\n  \"config\": {\n");
+  fprintf(file, "    \"size\": [%i, %i, %i],\n", params->size[0],
+          params->size[1], params->size[2]);
+  fprintf(file, "    \"blocks\": [[%i, %i], [%i, %i], [%i, %i]],\n",
+          params->blk_min[0], params->blk_max[0], params->blk_min[1],
+          params->blk_max[1], params->blk_min[2], params->blk_max[2]);
+  fprintf(file, "    \"pattern\": \"%s\",\n", pattern_names[params->pattern]);
+  fprintf(file, "    \"occupancy\": %g,\n", params->occupancy);
+  fprintf(file, "    \"decay\": %g,\n", params->decay);
+  fprintf(file, "    \"filter_eps\": %g,\n", params->filter_eps);
+  fprintf(file, "    \"fp32_eps\": %g,\n", params->fp32_eps);
+  fprintf(file, "    \"pack_compression\": \"%s\",\n",
+          compression_names[params->pack_compression]);
+  fprintf(file, "    \"retain_sparsity\": %s,\n",
+          (params->retain_sparsity) ? "true" : "false");
+  fprintf(file, "    \"trans\": \"%c%c\",\n", (params->trans[0]) ? 'T' : 'N',
+          (params->trans[1]) ? 'T' : 'N');
+  fprintf(file, "    \"repeat\": %i,\n", params->repeat);
+  fprintf(file, "    \"plan\": %s,\n", (params->plan) ? "true" : "false");
+  fprintf(file, "    \"seed\": %" PRIu64 ",\n", params->seed);
+  fprintf(file, "    \"mpi_ranks\": %i,\n", nranks);
+  fprintf(file, "    \"omp_threads\": %i\n  },\n", omp_get_max_threads());
+  fprintf(file, "  \"occupancy\": {\"a\": %.6f, \"b\": %.6f, \"c\": %.6f},\n",
+          occupancy[0], occupancy[1], occupancy[2]);
+
+  bench_run_t total = {0};
+  fprintf(file, "  \"runs\": [\n");
+  for (int i = 0; i < params->repeat; i++) {
+    const bench_run_t *run = &runs[i];
+    fprintf(file, "    {\"time\": %.6f", run->time);
+    for (int p = 0; p < DBM_NUM_PHASES; p++) {
+      fprintf(file, ", \"%s\": %.6f", phase_names[p], run->phase_times[p]);
+      total.phase_times[p] += run->phase_times[p];
+    }
+    fprintf(file, ", \"flop\": %" PRId64 ", \"gflops\": %.3f}%s\n", run->flop,
+            1e-9 * run->flop / run->time, (i + 1 < params->repeat) ? "," : "");
+    total.time += run->time;
+    total.flop += run->flop;
+  }
+  fprintf(file, "  ],\n");
+  fprintf(file, "  \"total\": {\"time\": %.6f", total.time);
+  for (int p = 0; p < DBM_NUM_PHASES; p++) {
+    fprintf(file, ", \"%s\": %.6f", phase_names[p], total.phase_times[p]);
+  }
+  fprintf(file, ", \"flop\": %" PRId64 ", \"gflops\": %.3f},\n", total.flop,
+          1e-9 * total.flop / total.time);
+
+  fprintf(file, "  \"memory\": {\"max_rss\": %.0f, \"mempool_host_peak\": %.0f",
+          memory[0], memory[1]);
+  fprintf(file, ", \"mempool_device_peak\": %.0f},\n", memory[2]);
+  fprintf(file, "  \"checksum\": %.15e,\n", checksum);
+  fprintf(file, "  \"fp32_error\": %.6e\n}\n", fp32_error);
+}
+
+/*******************************************************************************
+ * \brief Run the configurable benchmark suite of dbm_multiply.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void benchmark_suite(const bench_params_t *params,
+                            const dbm_mpi_comm_t comm) {
+  const int my_rank = dbm_mpi_comm_rank(comm);
+  const bool transa = params->trans[0], transb = params->trans[1];
+
+  // Create matrices, op(A) is M x K and op(B) is K x N.
+  int *sizes[3];
+  for (int dim = 0; dim < 3; dim++) {
+    sizes[dim] = create_block_sizes(params, dim);
+  }
+  const int M = params->size[0], N = params->size[1], K = params->size[2];
+  dbm_matrix_t *matrix_a =
+      (transa) ? create_bench_matrix(K, M, sizes[2], sizes[0], comm)
+               : create_bench_matrix(M, K, sizes[0], sizes[2], comm);
+  dbm_matrix_t *matrix_b =
+      (transb) ? create_bench_matrix(N, K, sizes[1], sizes[2], comm)
+               : create_bench_matrix(K, N, sizes[2], sizes[1], comm);
+  dbm_matrix_t *matrix_c =
+      create_bench_matrix(M, N, sizes[0], sizes[1], comm);
+  for (int dim = 0; dim < 3; dim++) {
+    free(sizes[dim]);
+  }
+  reserve_pattern_blocks(params, 0, matrix_a);
+  reserve_pattern_blocks(params, 1, matrix_b);
+  set_pattern_blocks(params, 0, matrix_a);
+  set_pattern_blocks(params, 1, matrix_b);
+  if (params->retain_sparsity) {
+    reserve_pattern_blocks(params, 2, matrix_c);
+  }
+
+  // Run the multiplications.
+  bench_run_t *runs = calloc(params->repeat, sizeof(bench_run_t));
+  dbm_multiply_plan_t *plan = NULL;
+  if (params->plan) {
+    dbm_multiply_plan_create(&plan, transa, transb, params->filter_eps,
+                             params->fp32_eps);
+  }
+  for (int i = 0; i < params->repeat; i++) {
+    double phase_times_start[DBM_NUM_PHASES];
+    dbm_library_get_phase_times(phase_times_start);
+    int64_t flop = 0;
+    const double time_start = omp_get_wtime();
+    if (params->plan) {
+      dbm_multiply_plan_execute(plan, 1.0, matrix_a, matrix_b, 0.0, matrix_c,
+                                params->retain_sparsity, &flop);
+    } else {
+      dbm_multiply(transa, transb, 1.0, matrix_a, matrix_b, 0.0, matrix_c,
+                   params->retain_sparsity, params->filter_eps,
+                   params->fp32_eps, &flop);
+    }
+    runs[i].time = omp_get_wtime() - time_start;
+    dbm_library_get_phase_times(runs[i].phase_times);
+    for (int p = 0; p < DBM_NUM_PHASES; p++) {
+      runs[i].phase_times[p] -= phase_times_start[p];
+    }
+    dbm_mpi_max_double(&runs[i].time, 1, comm);
+    dbm_mpi_max_double(runs[i].phase_times, DBM_NUM_PHASES, comm);
+    dbm_mpi_sum_int64(&flop, 1, comm);
+    runs[i].flop = flop;
+  }
+  if (params->plan) {
+    dbm_multiply_plan_release(plan);
+  }
+
+  // Collect occupancies, checksum, and memory high-water-marks.
+  const double occupancy[3] = {get_occupancy(matrix_a),
+                               get_occupancy(matrix_b),
+                               get_occupancy(matrix_c)};
+  const double checksum = dbm_checksum(matrix_c);
+  const double fp32_error =
+      (params->fp32_eps > 0.0)
+          ? get_fp32_error(params, matrix_a, matrix_b, matrix_c)
+          : 0.0;
+  const double fp32_bound = K * params->fp32_eps + params->filter_eps;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  const double max_rss = usage.ru_maxrss; // Reported in bytes.
+#else
+  const double max_rss = 1024.0 * usage.ru_maxrss; // Reported in KiB.
+#endif
+  double memory[3] = {max_rss, 0.0, 0.0};
+  for (int on_device = 0; on_device < 2; on_device++) {
+    dbm_mempool_statistics_t stats;
+    dbm_mempool_statistics(on_device, &stats);
+    memory[1 + on_device] = stats.size_max;
+  }
+  dbm_mpi_max_double(memory, 3, comm);
+
+  dbm_release(matrix_a);
+  dbm_release(matrix_b);
+  dbm_release(matrix_c);
+
+  // Report results.
+  if (my_rank == 0) {
+    const bool json_only = (params->json && strcmp(params->json, "-") == 0);
+    if (!json_only) {
+      printf("%5i x %5i x %5i  %s  occupancy: %.3f x %.3f => %.3f\n", M, N, K,
+             pattern_names[params->pattern], occupancy[0], occupancy[1],
+             occupancy[2]);
+      for (int i = 0; i < params->repeat; i++) {
+        const bench_run_t *run = &runs[i];
+        printf("  run %3i: %6.3f s => %8.1f GFLOP/s  (pack %6.3f s, comm %6.3f "
+               "s, multiply %6.3f s, filter %6.3f s)\n",
+               i + 1, run->time, 1e-9 * run->flop / run->time,
+               run->phase_times[DBM_PHASE_PACK],
+               run->phase_times[DBM_PHASE_COMM],
+               run->phase_times[DBM_PHASE_MULTIPLY],
+               run->phase_times[DBM_PHASE_FILTER]);
+      }
+      printf("  max RSS: %.1f MiB  checksum: %.15e\n", memory[0] / 1048576.0,
+             checksum);
+      if (params->fp32_eps > 0.0) {
+        printf("  fp32 error: %.3e  bound: %.3e\n", fp32_error, fp32_bound);
+      }
+      fflush(stdout);
+    }
+    if (params->json) {
+      FILE *file = (json_only) ? stdout : fopen(params->json, "w");
+      if (file == NULL) {
+        fprintf(stderr, "ERROR: could not open %s\n", params->json);
+        exit(1);
+      }
+      write_json(file, params, dbm_mpi_comm_size(comm), occupancy, runs,
+                 memory, checksum, fp32_error);
+      if (!json_only) {
+        fclose(file);
+      }
+    }
+  }
+  free(runs);
+
+  if (fp32_error > fp32_bound) {
+    if (my_rank == 0) {
+      fprintf(stderr, "ERROR: fp32 error %e exceeds bound %e.\n", fp32_error,
+              fp32_bound);
+    }
+    exit(1);
+  }
 }
 
 /*******************************************************************************
@@ -207,6 +1200,25 @@ int main(int argc, char *argv[]) {
     offload_set_chosen_device(my_rank % offload_get_device_count());
   }
 
+  // Parse options of the benchmark suite.
+  const bool bench = (argc > 1 && strcmp(argv[1], "--bench") == 0);
+  bench_params_t params;
+  if (bench && !parse_bench_params(argc - 2, &argv[2], &params)) {
+    if (my_rank == 0) {
+      fprintf(stderr, "Usage: dbm_miniapp.x --bench [--size MxNxK] "
+                      "[--blocks mxnxk] [--pattern dense|random|banded]\n"
+                      "         [--occupancy f] [--decay d] [--filter-eps e] "
+                      "[--retain-sparsity] [--fp32-eps e]\n"
+                      "         [--trans NN|NT|TN|TT] [--repeat n] [--plan] "
+                      "[--seed s] [--json file|-]\n"
+                      "         [--pack-compression none|lossless|lossy]\n");
+    }
+    dbm_library_finalize();
+    dbm_mpi_finalize();
+    return EXIT_FAILURE;
+  }
+  const bool quiet = (bench && params.json && strcmp(params.json, "-") == 0);
+
   // Create 2D cart.
   int dims[2] = {0, 0};
   dbm_mpi_dims_create(nranks, 2, dims);
@@ -214,7 +1226,7 @@ int main(int argc, char *argv[]) {
   dbm_mpi_comm_t comm =
       dbm_mpi_cart_create(world_comm, 2, dims, periods, false);
 
-  if (my_rank == 0) {
+  if (my_rank == 0 && !quiet) {
     printf("OpenMP-threads: %i  GPUs: %i", omp_get_max_threads(),
            imin(offload_get_device_count(), nranks));
 #if defined(__LIBXSMM)
@@ -231,7 +1243,16 @@ int main(int argc, char *argv[]) {
     fflush(stdout);
   }
 
-  if (1 >= argc) {
+  check_mempool_reuse();
+  check_shard_lookups();
+  check_small_block_kernels();
+  check_pack_compression();
+  check_multiply_plan(comm);
+
+  if (bench) {
+    dbm_library_set_pack_compression(params.pack_compression);
+    benchmark_suite(&params, comm);
+  } else if (1 >= argc) {
     benchmark_multiply(16384, 128, 128, 4, 4, 4, comm);
     benchmark_multiply(128, 16384, 128, 4, 4, 4, comm);
     benchmark_multiply(128, 128, 16384, 4, 4, 4, comm);
@@ -293,7 +1314,7 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (EXIT_SUCCESS == result) {
+  if (EXIT_SUCCESS == result && !quiet) {
     dbm_library_print_stats(dbm_mpi_comm_c2f(comm), &print_func, my_rank);
   }
   dbm_library_finalize();
@@ -379,6 +379,128 @@ int dbm_mpi_sendrecv_double(const double *sendbuf, const int sendcount,
 #endif
 }
 
+/*******************************************************************************
+ * \brief Wrapper around MPI_Isend and MPI_Irecv for datatype MPI_BYTE.
+ *        The send request has to be completed via dbm_mpi_wait and the
+ *        receive request via dbm_mpi_wait_byte.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_isendrecv_byte(const void *sendbuf, const int sendcount,
+                            const int dest, const int sendtag, void *recvbuf,
+                            const int recvcount, const int source,
+                            const int recvtag, const dbm_mpi_comm_t comm,
+                            dbm_mpi_request_t *send_request,
+                            dbm_mpi_request_t *recv_request) {
+#if defined(__parallel)
+  CHECK(MPI_Irecv(recvbuf, recvcount, MPI_BYTE, source, recvtag, comm,
+                  recv_request));
+  CHECK(MPI_Isend(sendbuf, sendcount, MPI_BYTE, dest, sendtag, comm,
+                  send_request));
+#else
+  (void)sendbuf; // mark used
+  (void)sendcount;
+  (void)dest;
+  (void)sendtag;
+  (void)recvbuf;
+  (void)recvcount;
+  (void)source;
+  (void)recvtag;
+  (void)comm;
+  (void)send_request;
+  (void)recv_request;
+  fprintf(stderr, "Error: dbm_mpi_isendrecv_byte not available without MPI\n");
+  abort();
+#endif
+}
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Isend and MPI_Irecv for datatype MPI_DOUBLE.
+ *        The send request has to be completed via dbm_mpi_wait and the
+ *        receive request via dbm_mpi_wait_double.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_isendrecv_double(const double *sendbuf, const int sendcount,
+                              const int dest, const int sendtag,
+                              double *recvbuf, const int recvcount,
+                              const int source, const int recvtag,
+                              const dbm_mpi_comm_t comm,
+                              dbm_mpi_request_t *send_request,
+                              dbm_mpi_request_t *recv_request) {
+#if defined(__parallel)
+  CHECK(MPI_Irecv(recvbuf, recvcount, MPI_DOUBLE, source, recvtag, comm,
+                  recv_request));
+  CHECK(MPI_Isend(sendbuf, sendcount, MPI_DOUBLE, dest, sendtag, comm,
+                  send_request));
+#else
+  (void)sendbuf; // mark used
+  (void)sendcount;
+  (void)dest;
+  (void)sendtag;
+  (void)recvbuf;
+  (void)recvcount;
+  (void)source;
+  (void)recvtag;
+  (void)comm;
+  (void)send_request;
+  (void)recv_request;
+  fprintf(stderr,
+          "Error: dbm_mpi_isendrecv_double not available without MPI\n");
+  abort();
+#endif
+}
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_wait(dbm_mpi_request_t *request) {
+#if defined(__parallel)
+  CHECK(MPI_Wait(request, MPI_STATUS_IGNORE));
+#else
+  (void)request; // mark used
+  fprintf(stderr, "Error: dbm_mpi_wait not available without MPI\n");
+  abort();
+#endif
+}
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait for a receive request of datatype MPI_BYTE.
+ *        Returns the number of received bytes.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_mpi_wait_byte(dbm_mpi_request_t *request) {
+#if defined(__parallel)
+  MPI_Status status;
+  CHECK(MPI_Wait(request, &status));
+  int count_received;
+  CHECK(MPI_Get_count(&status, MPI_BYTE, &count_received));
+  return count_received;
+#else
+  (void)request; // mark used
+  fprintf(stderr, "Error: dbm_mpi_wait_byte not available without MPI\n");
+  abort();
+#endif
+}
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait for a receive request of datatype MPI_DOUBLE.
+ *        Returns the number of received doubles.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_mpi_wait_double(dbm_mpi_request_t *request) {
+#if defined(__parallel)
+  MPI_Status status;
+  CHECK(MPI_Wait(request, &status));
+  int count_received;
+  CHECK(MPI_Get_count(&status, MPI_DOUBLE, &count_received));
+  return count_received;
+#else
+  (void)request; // mark used
+  fprintf(stderr, "Error: dbm_mpi_wait_double not available without MPI\n");
+  abort();
+#endif
+}
+
 /*******************************************************************************
  * \brief Wrapper around MPI_Alltoall for datatype MPI_INT.
  * \author Ole Schuett
@@ -395,6 +517,25 @@ void dbm_mpi_alltoall_int(const int *sendbuf, const int sendcount, int *recvbuf,
 #endif
 }
 
+/*******************************************************************************
+ * \brief Wrapper around MPI_Alltoallv for datatype MPI_INT.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_alltoallv_int(const int *sendbuf, const int *sendcounts,
+                           const int *sdispls, int *recvbuf,
+                           const int *recvcounts, const int *rdispls,
+                           const dbm_mpi_comm_t comm) {
+#if defined(__parallel)
+  CHECK(MPI_Alltoallv(sendbuf, sendcounts, sdispls, MPI_INT, recvbuf,
+                      recvcounts, rdispls, MPI_INT, comm));
+#else
+  (void)comm; // mark used
+  assert(sendcounts[0] == recvcounts[0]);
+  assert(sdispls[0] == 0 && rdispls[0] == 0);
+  memcpy(recvbuf, sendbuf, sendcounts[0] * sizeof(int));
+#endif
+}
+
 /*******************************************************************************
  * \brief Wrapper around MPI_Alltoallv for datatype MPI_BYTE.
  * \author Ole Schuett
@@ -15,8 +15,10 @@
 #if defined(__parallel)
 #include <mpi.h>
 typedef MPI_Comm dbm_mpi_comm_t;
+typedef MPI_Request dbm_mpi_request_t;
 #else
 typedef int dbm_mpi_comm_t;
+typedef int dbm_mpi_request_t;
 #endif
 
 /*******************************************************************************
@@ -159,6 +161,53 @@ int dbm_mpi_sendrecv_double(const double *sendbuf, const int sendcount,
                             const int recvcount, const int source,
                             const int recvtag, const dbm_mpi_comm_t comm);
 
+/*******************************************************************************
+ * \brief Wrapper around MPI_Isend and MPI_Irecv for datatype MPI_BYTE.
+ *        The send request has to be completed via dbm_mpi_wait and the
+ *        receive request via dbm_mpi_wait_byte.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_isendrecv_byte(const void *sendbuf, const int sendcount,
+                            const int dest, const int sendtag, void *recvbuf,
+                            const int recvcount, const int source,
+                            const int recvtag, const dbm_mpi_comm_t comm,
+                            dbm_mpi_request_t *send_request,
+                            dbm_mpi_request_t *recv_request);
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Isend and MPI_Irecv for datatype MPI_DOUBLE.
+ *        The send request has to be completed via dbm_mpi_wait and the
+ *        receive request via dbm_mpi_wait_double.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_isendrecv_double(const double *sendbuf, const int sendcount,
+                              const int dest, const int sendtag,
+                              double *recvbuf, const int recvcount,
+                              const int source, const int recvtag,
+                              const dbm_mpi_comm_t comm,
+                              dbm_mpi_request_t *send_request,
+                              dbm_mpi_request_t *recv_request);
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_wait(dbm_mpi_request_t *request);
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait for a receive request of datatype MPI_BYTE.
+ *        Returns the number of received bytes.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_mpi_wait_byte(dbm_mpi_request_t *request);
+
+/*******************************************************************************
+ * \brief Wrapper around MPI_Wait for a receive request of datatype MPI_DOUBLE.
+ *        Returns the number of received doubles.
+ * \author Ole Schuett
+ ******************************************************************************/
+int dbm_mpi_wait_double(dbm_mpi_request_t *request);
+
 /*******************************************************************************
  * \brief Wrapper around MPI_Alltoall for datatype MPI_INT.
  * \author Ole Schuett
@@ -166,6 +215,15 @@ int dbm_mpi_sendrecv_double(const double *sendbuf, const int sendcount,
 void dbm_mpi_alltoall_int(const int *sendbuf, const int sendcount, int *recvbuf,
                           const int recvcount, const dbm_mpi_comm_t comm);
 
+/*******************************************************************************
+ * \brief Wrapper around MPI_Alltoallv for datatype MPI_INT.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_mpi_alltoallv_int(const int *sendbuf, const int *sendcounts,
+                           const int *sdispls, int *recvbuf,
+                           const int *recvcounts, const int *rdispls,
+                           const dbm_mpi_comm_t comm);
+
 /*******************************************************************************
  * \brief Wrapper around MPI_Alltoallv for datatype MPI_BYTE.
  * \author Ole Schuett
@@ -6,11 +6,15 @@
 /*----------------------------------------------------------------------------*/
 
 #include <assert.h>
+#include <float.h>
 #include <limits.h>
+#include <math.h>
+#include <omp.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../offload/offload_runtime.h"
+#include "dbm_compress.h"
 #include "dbm_hyperparams.h"
 #include "dbm_library.h"
 #include "dbm_multiply.h"
@@ -75,6 +79,93 @@ static float *compute_rows_max_eps(const bool trans, const dbm_matrix_t *matrix,
   return row_max_eps; // Ownership of row_max_eps transfers to caller.
 }
 
+/*******************************************************************************
+ * \brief Private routine for hashing the sparsity pattern of a matrix.
+ *        The hash depends on the order of the blocks within each shard,
+ *        because persistent packs refer to blocks by their position.
+ * \author Ole Schuett
+ ******************************************************************************/
+static uint64_t sparsity_fingerprint(const dbm_matrix_t *matrix) {
+  uint64_t fingerprint = 0;
+#pragma omp parallel for reduction(+ : fingerprint) schedule(dynamic)
+  for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
+    const dbm_shard_t *shard = &matrix->shards[ishard];
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a offset basis
+    for (int iblock = 0; iblock < shard->nblocks; iblock++) {
+      const dbm_block_t *blk = &shard->blocks[iblock];
+      const int values[4] = {blk->row, blk->col, matrix->row_sizes[blk->row],
+                             matrix->col_sizes[blk->col]};
+      for (int i = 0; i < 4; i++) {
+        hash = (hash ^ (uint32_t)values[i]) * 1099511628211ULL; // FNV prime
+      }
+    }
+    fingerprint += hash * (2 * (uint64_t)ishard + 1); // Mix in shard index.
+  }
+  return fingerprint;
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the largest squared block norm.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double compute_max_norm(const dbm_matrix_t *matrix) {
+  double max_norm = 0.0;
+#pragma omp parallel for reduction(max : max_norm) schedule(dynamic)
+  for (int ishard = 0; ishard < dbm_get_num_shards(matrix); ishard++) {
+    const dbm_shard_t *shard = &matrix->shards[ishard];
+    for (int iblock = 0; iblock < shard->nblocks; iblock++) {
+      const dbm_block_t *blk = &shard->blocks[iblock];
+      const int row_size = matrix->row_sizes[blk->row];
+      const int col_size = matrix->col_sizes[blk->col];
+      const double *blk_data = &shard->data[blk->offset];
+      double norm = 0.0;
+      for (int i = 0; i < row_size * col_size; i++) {
+        norm += blk_data[i] * blk_data[i];
+      }
+      max_norm = (norm > max_norm) ? norm : max_norm;
+    }
+  }
+  dbm_mpi_max_double(&max_norm, 1, matrix->dist->comm);
+  return max_norm;
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the threshold of the mixed-precision
+ *        mode. A block product alpha * a * b of inner dimension k is computed
+ *        in single precision if (k+2) * FLT_EPSILON * |alpha| * |a| * |b|
+ *        stays below fp32_eps. This bounds the rounding of a and b plus the
+ *        accumulation of k terms in single precision for every element of
+ *        the product. Returns the bound for the product's squared norm times
+ *        (k+2)^2, or zero when the mode is disabled.
+ * \author Ole Schuett
+ ******************************************************************************/
+static float compute_fp32_max_norm(const double fp32_eps) {
+#if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_DBM)
+  (void)fp32_eps; // The GPU backend supports only double precision.
+  return 0.0f;
+#else
+  const double max_norm = (fp32_eps / FLT_EPSILON) * (fp32_eps / FLT_EPSILON);
+  return (max_norm < FLT_MAX) ? (float)max_norm : FLT_MAX;
+#endif
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the error that the lossy compression
+ *        may introduce into each block of one factor. A block product is
+ *        perturbed by at most |alpha| * (|da| * |b| + |a| * |db|), which is
+ *        kept below the smallest on-the-fly filter threshold of all rows.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double compute_lossy_max_error(const double alpha, const int nrows,
+                                      const float rows_max_eps[nrows],
+                                      const double max_norm_other) {
+  float min_eps = FLT_MAX;
+  for (int i = 0; i < nrows; i++) {
+    min_eps = (rows_max_eps[i] < min_eps) ? rows_max_eps[i] : min_eps;
+  }
+  return 0.5 * sqrt(min_eps) / (fabs(alpha) * sqrt(max_norm_other));
+}
+
 /*******************************************************************************
  * \brief Private struct for storing the context of the multiplication backend.
  * \author Ole Schuett
@@ -143,6 +234,30 @@ static void backend_process_batch(const int ntasks, dbm_task_t batch[ntasks],
 #endif
 }
 
+/*******************************************************************************
+ * \brief Private routine for sending a batch of tasks to the multiplication
+ *        backend that are computed in single precision.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void backend_process_batch_fp32(const int ntasks,
+                                       dbm_task_t batch[ntasks],
+                                       const double alpha,
+                                       const dbm_pack_t *pack_a,
+                                       const dbm_pack_t *pack_b,
+                                       dbm_shard_t *shard_c) {
+#if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_DBM)
+  (void)batch; // mark as used
+  (void)alpha;
+  (void)pack_a;
+  (void)pack_b;
+  (void)shard_c;
+  assert(ntasks == 0); // The GPU backend supports only double precision.
+#else
+  dbm_multiply_cpu_process_batch_fp32(ntasks, batch, alpha, pack_a, pack_b,
+                                      shard_c);
+#endif
+}
+
 /*******************************************************************************
  * \brief Private routine for downloading results of the multiplication backend.
  * \author Ole Schuett
@@ -166,8 +281,209 @@ static void backend_stop(backend_context_t *ctx) {
   free(ctx);
 }
 
+/*******************************************************************************
+ * \brief Private struct for storing a share of the work on a C shard.
+ *        Shards are split by interleaving their rows, ie. the share isplit
+ *        owns the rows for which (row / nshard_rows) % nsplit == isplit.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int ishard;
+  int isplit;
+  int nsplit;
+  int64_t cost;
+} shard_work_t;
+
+/*******************************************************************************
+ * \brief Private comperator passed to qsort to sort work by decreasing cost.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compare_shard_work(const void *a, const void *b) {
+  const shard_work_t *work_a = (const shard_work_t *)a;
+  const shard_work_t *work_b = (const shard_work_t *)b;
+  if (work_a->cost != work_b->cost) {
+    return (work_a->cost > work_b->cost) ? -1 : 1;
+  }
+  return work_a->ishard - work_b->ishard; // keep sort deterministic
+}
+
+/*******************************************************************************
+ * \brief Private routine for multiplying the blocks of two packs that belong
+ *        to a given share of a C shard. Returns the number of flops.
+ *
+ *        When promising only, no multiplications are performed. Instead, the
+ *        missing C blocks get promised and allocated. This is required for
+ *        shards that get split, because their shares run concurrently and may
+ *        hence only read the shard's metadata. Whole shards promise their new
+ *        blocks while they are multiplied.
+ *
+ *        Tasks that qualify for single precision, see compute_fp32_max_norm,
+ *        fill the batch from its end, while all other tasks fill it from its
+ *        start.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+static int64_t
+multiply_shard(const bool transa, const bool transb, const double alpha,
+               const dbm_pack_t *pack_a, const dbm_pack_t *pack_b,
+               const dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b,
+               dbm_matrix_t *matrix_c, const bool retain_sparsity,
+               const float *rows_max_eps, const float fp32_max_norm,
+               const int iblock_start, const int jblock_start_init,
+               const bool promise_only, const shard_work_t *work,
+               backend_context_t *ctx) {
+  const float alpha2 = alpha * alpha;
+  const int nshard_rows = matrix_c->dist->rows.nshards;
+  const int nshard_cols = matrix_c->dist->cols.nshards;
+  const int ishard = work->ishard;
+  const int shard_row = ishard / nshard_cols;
+  const int shard_col = ishard % nshard_cols;
+  dbm_shard_t *shard_c = &matrix_c->shards[ishard];
+  int64_t flop = 0;
+
+  const int *sum_index_sizes_a =
+      (transa) ? matrix_a->row_sizes : matrix_a->col_sizes;
+  const int *sum_index_sizes_b =
+      (transb) ? matrix_b->col_sizes : matrix_b->row_sizes;
+  const int *free_index_sizes_a =
+      (transa) ? matrix_a->col_sizes : matrix_a->row_sizes;
+  const int *free_index_sizes_b =
+      (transb) ? matrix_b->row_sizes : matrix_b->col_sizes;
+
+  dbm_task_t batch[MAX_BATCH_SIZE];
+  int mnk_range[][2] = {{INT_MAX, 0}, {INT_MAX, 0}, {INT_MAX, 0}};
+  int ntasks = 0, ntasks_fp32 = 0;
+
+  // Blocks of pack_b with equal sum_index are ordered by free_index.
+  // Hence, the existing C blocks are found by streaming a cursor through
+  // the frozen shard. Only new blocks require a hashtable lookup.
+  if (work->nsplit == 1) {
+    dbm_shard_freeze(shard_c);
+  }
+  assert(dbm_shard_is_frozen(shard_c));
+  dbm_shard_cursor_t cursor_c;
+  dbm_shard_cursor_init(shard_c, &cursor_c);
+
+  // Use a merge-join to find pairs of blocks with matching sum indices.
+  // This utilizes that blocks within a shard are ordered by sum_index.
+  int jblock_start = jblock_start_init;
+  for (int iblock = iblock_start; iblock < pack_a->nblocks; iblock++) {
+    const dbm_pack_block_t *blk_a = &pack_a->blocks[iblock];
+    if (blk_a->free_index % nshard_rows != shard_row) {
+      break;
+    }
+    // Skip rows that are owned by another share of the shard. Since
+    // jblock_start is merely a lower bound, it catches up in the next row.
+    if ((blk_a->free_index / nshard_rows) % work->nsplit != work->isplit) {
+      continue;
+    }
+    for (int jblock = jblock_start; jblock < pack_b->nblocks; jblock++) {
+      const dbm_pack_block_t *blk_b = &pack_b->blocks[jblock];
+      if (blk_b->free_index % nshard_cols != shard_col) {
+        break;
+      }
+      if (blk_a->sum_index < blk_b->sum_index) {
+        break;
+      }
+      if (blk_a->sum_index > blk_b->sum_index) {
+        jblock_start++;
+        continue;
+      }
+      // Found block pair with blk_a->sum_index == blk_b->sum_index.
+
+      // Check norms.
+      const float result_norm = alpha2 * blk_a->norm * blk_b->norm;
+      if (result_norm < rows_max_eps[blk_a->free_index]) {
+        continue;
+      }
+
+      // Check block sizes.
+      const int m = free_index_sizes_a[blk_a->free_index];
+      const int n = free_index_sizes_b[blk_b->free_index];
+      const int k = sum_index_sizes_a[blk_a->sum_index];
+      assert(m == matrix_c->row_sizes[blk_a->free_index]);
+      assert(n == matrix_c->col_sizes[blk_b->free_index]);
+      assert(k == sum_index_sizes_b[blk_b->sum_index]);
+
+      // Get C block.
+      const int row = blk_a->free_index, col = blk_b->free_index;
+      dbm_block_t *blk_c = dbm_shard_cursor_lookup(&cursor_c, row, col);
+      if (blk_c == NULL && !dbm_shard_is_frozen(shard_c)) {
+        blk_c = dbm_shard_lookup(shard_c, row, col);
+      }
+      if (blk_c == NULL && retain_sparsity) {
+        continue;
+      } else if (blk_c == NULL) {
+        assert(work->nsplit == 1); // shares find their blocks promised
+        assert(dbm_get_shard_index(matrix_c, row, col) == ishard);
+        assert(dbm_get_stored_coordinates(matrix_c, row, col) ==
+               matrix_c->dist->my_rank);
+        blk_c = dbm_shard_promise_new_block(shard_c, row, col, m * n);
+      }
+      if (promise_only) {
+        continue;
+      }
+
+      // Count flops.
+      dbm_library_counter_increment(m, n, k);
+      const int task_flops = 2 * m * n * k;
+      flop += task_flops;
+      if (task_flops == 0) {
+        continue;
+      }
+
+      // Add block multiplication to batch.
+      const bool fp32 = (result_norm * (k + 2) * (k + 2) < fp32_max_norm);
+      dbm_task_t *task = (fp32) ? &batch[MAX_BATCH_SIZE - ++ntasks_fp32]
+                                : &batch[ntasks++];
+      task->m = m;
+      task->n = n;
+      task->k = k;
+      task->offset_a = blk_a->offset;
+      task->offset_b = blk_b->offset;
+      task->offset_c = blk_c->offset;
+
+      // track MxN-shape covering an entire batch
+      if (!fp32) {
+        min_max(mnk_range[0], m);
+        min_max(mnk_range[1], n);
+        min_max(mnk_range[2], k);
+      }
+
+      if (ntasks + ntasks_fp32 == MAX_BATCH_SIZE) {
+        backend_process_batch(ntasks, batch, mnk_range, alpha, pack_a, pack_b,
+                              ishard, shard_c, ctx);
+        backend_process_batch_fp32(ntasks_fp32, &batch[ntasks], alpha, pack_a,
+                                   pack_b, shard_c);
+        mnk_range[0][0] = mnk_range[1][0] = mnk_range[2][0] = INT_MAX;
+        mnk_range[0][1] = mnk_range[1][1] = mnk_range[2][1] = 0;
+        ntasks = ntasks_fp32 = 0;
+      }
+    }
+  }
+
+  if (promise_only) {
+    dbm_shard_freeze(shard_c); // cover the newly promised blocks
+    dbm_shard_allocate_promised_blocks(shard_c);
+  } else {
+    backend_process_batch(ntasks, batch, mnk_range, alpha, pack_a, pack_b,
+                          ishard, shard_c, ctx);
+    backend_process_batch_fp32(ntasks_fp32,
+                               &batch[MAX_BATCH_SIZE - ntasks_fp32], alpha,
+                               pack_a, pack_b, shard_c);
+  }
+  return flop;
+}
+
 /*******************************************************************************
  * \brief Private routine for multipling two packs.
+ *
+ *        The cost of each C shard is estimated by its number of candidate
+ *        block pairs, which is known from the pack boundaries without walking
+ *        the merge-join. Shards which are more expensive than the average
+ *        thread's share get split. The work is then assigned to the threads
+ *        in order of decreasing cost.
+ *
  * \author Ole Schuett
  ******************************************************************************/
 static void multiply_packs(const bool transa, const bool transb,
@@ -176,25 +492,42 @@ static void multiply_packs(const bool transa, const bool transb,
                            const dbm_matrix_t *matrix_a,
                            const dbm_matrix_t *matrix_b, dbm_matrix_t *matrix_c,
                            const bool retain_sparsity,
-                           const float *rows_max_eps, int64_t *flop,
+                           const float *rows_max_eps,
+                           const float fp32_max_norm, int64_t *flop,
                            backend_context_t *ctx) {
-  const float alpha2 = alpha * alpha;
   int64_t flop_sum = 0;
 
   const int nshard_rows = matrix_c->dist->rows.nshards;
   const int nshard_cols = matrix_c->dist->cols.nshards;
+  const int nshards = dbm_get_num_shards(matrix_c);
   int shard_row_start[nshard_rows], shard_col_start[nshard_cols];
+  int shard_row_end[nshard_rows], shard_col_end[nshard_cols];
   memset(shard_row_start, 0, nshard_rows * sizeof(int));
   memset(shard_col_start, 0, nshard_cols * sizeof(int));
+  memset(shard_row_end, 0, nshard_rows * sizeof(int));
+  memset(shard_col_end, 0, nshard_cols * sizeof(int));
+  if (pack_a->nblocks > 0) {
+    const int last = pack_a->blocks[pack_a->nblocks - 1].free_index;
+    shard_row_end[last % nshard_rows] = pack_a->nblocks;
+  }
+  if (pack_b->nblocks > 0) {
+    const int last = pack_b->blocks[pack_b->nblocks - 1].free_index;
+    shard_col_end[last % nshard_cols] = pack_b->nblocks;
+  }
 
-  const int *sum_index_sizes_a =
-      (transa) ? matrix_a->row_sizes : matrix_a->col_sizes;
-  const int *sum_index_sizes_b =
-      (transb) ? matrix_b->col_sizes : matrix_b->row_sizes;
-  const int *free_index_sizes_a =
-      (transa) ? matrix_a->col_sizes : matrix_a->row_sizes;
-  const int *free_index_sizes_b =
-      (transb) ? matrix_b->row_sizes : matrix_b->col_sizes;
+  // Splitting of shards is only supported by the cpu backend, because the
+  // gpu backend uses one stream and batch buffer per shard.
+#if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_DBM)
+  const int max_split = 1;
+#else
+  const int max_split = omp_get_max_threads();
+#endif
+
+  // The shards are split into at most max_split shares.
+  shard_work_t *works = malloc(nshards * max_split * sizeof(shard_work_t));
+  int64_t *shard_costs = malloc(nshards * sizeof(int64_t));
+  double *thread_times = calloc(omp_get_max_threads(), sizeof(double));
+  int nworks = 0, nthreads = 1;
 
 #pragma omp parallel reduction(+ : flop_sum)
   {
@@ -207,6 +540,7 @@ static void multiply_packs(const bool transa, const bool transb,
           pack_a->blocks[iblock - 1].free_index % nshard_rows;
       if (prev_shard_row != shard_row) {
         shard_row_start[shard_row] = iblock;
+        shard_row_end[prev_shard_row] = iblock;
       }
     }
 #pragma omp for
@@ -216,119 +550,95 @@ static void multiply_packs(const bool transa, const bool transb,
           pack_b->blocks[jblock - 1].free_index % nshard_cols;
       if (prev_shard_col != shard_col) {
         shard_col_start[shard_col] = jblock;
+        shard_col_end[prev_shard_col] = jblock;
       }
     }
 
-#pragma omp for collapse(2) schedule(dynamic)
-    for (int shard_row = 0; shard_row < nshard_rows; shard_row++) {
-      for (int shard_col = 0; shard_col < nshard_cols; shard_col++) {
-        const int ishard = shard_row * nshard_cols + shard_col;
-        dbm_shard_t *shard_c = &matrix_c->shards[ishard];
-        dbm_task_t batch[MAX_BATCH_SIZE];
-        int mnk_range[][2] = {{INT_MAX, 0}, {INT_MAX, 0}, {INT_MAX, 0}};
-        int ntasks = 0;
-
-        // Use a merge-join to find pairs of blocks with matching sum indices.
-        // This utilizes that blocks within a shard are ordered by sum_index.
-        const int iblock_start = shard_row_start[shard_row];
-        int jblock_start = shard_col_start[shard_col];
-        for (int iblock = iblock_start; iblock < pack_a->nblocks; iblock++) {
-          const dbm_pack_block_t *blk_a = &pack_a->blocks[iblock];
-          if (blk_a->free_index % nshard_rows != shard_row) {
-            break;
-          }
-          for (int jblock = jblock_start; jblock < pack_b->nblocks; jblock++) {
-            const dbm_pack_block_t *blk_b = &pack_b->blocks[jblock];
-            if (blk_b->free_index % nshard_cols != shard_col) {
-              break;
-            }
-            if (blk_a->sum_index < blk_b->sum_index) {
-              break;
-            }
-            if (blk_a->sum_index > blk_b->sum_index) {
-              jblock_start++;
-              continue;
-            }
-            // Found block pair with blk_a->sum_index == blk_b->sum_index.
-
-            // Check norms.
-            const float result_norm = alpha2 * blk_a->norm * blk_b->norm;
-            if (result_norm < rows_max_eps[blk_a->free_index]) {
-              continue;
-            }
-
-            // Check block sizes.
-            const int m = free_index_sizes_a[blk_a->free_index];
-            const int n = free_index_sizes_b[blk_b->free_index];
-            const int k = sum_index_sizes_a[blk_a->sum_index];
-            assert(m == matrix_c->row_sizes[blk_a->free_index]);
-            assert(n == matrix_c->col_sizes[blk_b->free_index]);
-            assert(k == sum_index_sizes_b[blk_b->sum_index]);
-
-            // Get C block.
-            const int row = blk_a->free_index, col = blk_b->free_index;
-            dbm_block_t *blk_c = dbm_shard_lookup(shard_c, row, col);
-            if (blk_c == NULL && retain_sparsity) {
-              continue;
-            } else if (blk_c == NULL) {
-              assert(dbm_get_shard_index(matrix_c, row, col) == ishard);
-              assert(dbm_get_stored_coordinates(matrix_c, row, col) ==
-                     matrix_c->dist->my_rank);
-              blk_c = dbm_shard_promise_new_block(shard_c, row, col, m * n);
-            }
-
-            // Count flops.
-            dbm_library_counter_increment(m, n, k);
-            const int task_flops = 2 * m * n * k;
-            flop_sum += task_flops;
-            if (task_flops == 0) {
-              continue;
-            }
-
-            // Add block multiplication to batch.
-            batch[ntasks].m = m;
-            batch[ntasks].n = n;
-            batch[ntasks].k = k;
-            batch[ntasks].offset_a = blk_a->offset;
-            batch[ntasks].offset_b = blk_b->offset;
-            batch[ntasks].offset_c = blk_c->offset;
-            ntasks++;
-
-            // track MxN-shape covering an entire batch
-            min_max(mnk_range[0], m);
-            min_max(mnk_range[1], n);
-            min_max(mnk_range[2], k);
-
-            if (ntasks == MAX_BATCH_SIZE) {
-              backend_process_batch(ntasks, batch, mnk_range, alpha, pack_a,
-                                    pack_b, ishard, shard_c, ctx);
-              mnk_range[0][0] = mnk_range[1][0] = mnk_range[2][0] = INT_MAX;
-              mnk_range[0][1] = mnk_range[1][1] = mnk_range[2][1] = 0;
-              ntasks = 0;
-            }
-          }
+    // Split expensive shards and sort the work by decreasing cost.
+#pragma omp single
+    {
+      nthreads = omp_get_num_threads();
+      int64_t total_cost = 0;
+      for (int ishard = 0; ishard < nshards; ishard++) {
+        const int shard_row = ishard / nshard_cols;
+        const int shard_col = ishard % nshard_cols;
+        const int64_t nblocks_a =
+            shard_row_end[shard_row] - shard_row_start[shard_row];
+        const int64_t nblocks_b =
+            shard_col_end[shard_col] - shard_col_start[shard_col];
+        shard_costs[ishard] = nblocks_a * nblocks_b;
+        total_cost += shard_costs[ishard];
+      }
+      const int64_t fair_share = (total_cost + nthreads - 1) / nthreads;
+      for (int ishard = 0; ishard < nshards; ishard++) {
+        const int64_t cost = shard_costs[ishard];
+        if (cost == 0) {
+          continue; // nothing to multiply
         }
-        backend_process_batch(ntasks, batch, mnk_range, alpha, pack_a, pack_b,
-                              ishard, shard_c, ctx);
+        int nsplit = (cost + fair_share - 1) / fair_share;
+        nsplit = (nsplit < max_split) ? nsplit : max_split;
+        nsplit = (nsplit < nthreads) ? nsplit : nthreads;
+        for (int isplit = 0; isplit < nsplit; isplit++) {
+          const shard_work_t work = {ishard, isplit, nsplit, cost / nsplit};
+          works[nworks++] = work;
+        }
+      }
+      qsort(works, nworks, sizeof(shard_work_t), &compare_shard_work);
+    }
+
+    // Shares of a shard run concurrently, hence promise their blocks upfront.
+#pragma omp for schedule(dynamic)
+    for (int iwork = 0; iwork < nworks; iwork++) {
+      if (works[iwork].isplit == 0 && works[iwork].nsplit > 1) {
+        const int ishard = works[iwork].ishard;
+        const shard_work_t whole = {ishard, 0, 1, works[iwork].cost};
+        const int iblock_start = shard_row_start[ishard / nshard_cols];
+        const int jblock_start = shard_col_start[ishard % nshard_cols];
+        multiply_shard(transa, transb, alpha, pack_a, pack_b, matrix_a,
+                       matrix_b, matrix_c, retain_sparsity, rows_max_eps,
+                       fp32_max_norm, iblock_start, jblock_start, true, &whole,
+                       ctx);
       }
     }
+
+    // Largest first assignment of the work to the threads.
+    const double time_start = omp_get_wtime();
+#pragma omp for schedule(dynamic, 1) nowait
+    for (int iwork = 0; iwork < nworks; iwork++) {
+      const int ishard = works[iwork].ishard;
+      const int iblock_start = shard_row_start[ishard / nshard_cols];
+      const int jblock_start = shard_col_start[ishard % nshard_cols];
+      flop_sum += multiply_shard(
+          transa, transb, alpha, pack_a, pack_b, matrix_a, matrix_b, matrix_c,
+          retain_sparsity, rows_max_eps, fp32_max_norm, iblock_start,
+          jblock_start, false, &works[iwork], ctx);
+    }
+    thread_times[omp_get_thread_num()] = omp_get_wtime() - time_start;
+  }
+
+  // Record how evenly the work was distributed among the threads.
+  double time_max = 0.0, time_sum = 0.0;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    time_max = (thread_times[ithread] > time_max) ? thread_times[ithread]
+                                                  : time_max;
+    time_sum += thread_times[ithread];
   }
+  dbm_library_imbalance_add(time_max, time_sum / nthreads);
+
+  free(works);
+  free(shard_costs);
+  free(thread_times);
   *flop += flop_sum;
 }
 
 /*******************************************************************************
- * \brief Performs a multiplication of two dbm_matrix_t matrices.
- *        See dbm_matrix.h for details.
+ * \brief Private routine for checking the dimensions of the given matrices.
  * \author Ole Schuett
  ******************************************************************************/
-void dbm_multiply(const bool transa, const bool transb, const double alpha,
-                  const dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b,
-                  const double beta, dbm_matrix_t *matrix_c,
-                  const bool retain_sparsity, const double filter_eps,
-                  int64_t *flop) {
-
-  assert(omp_get_num_threads() == 1);
-
+static void check_dimensions(const bool transa, const bool transb,
+                             const dbm_matrix_t *matrix_a,
+                             const dbm_matrix_t *matrix_b,
+                             const dbm_matrix_t *matrix_c) {
   // Throughout the matrix multiplication code the "sum_index" and "free_index"
   // denote the summation (aka dummy) and free index from the Einstein notation.
   const int num_sum_index_a = (transa) ? matrix_a->nrows : matrix_a->ncols;
@@ -336,47 +646,260 @@ void dbm_multiply(const bool transa, const bool transb, const double alpha,
   const int num_free_index_a = (transa) ? matrix_a->ncols : matrix_a->nrows;
   const int num_free_index_b = (transb) ? matrix_b->nrows : matrix_b->ncols;
 
-  // Sanity check matrix dimensions.
   assert(num_sum_index_a == num_sum_index_b);
   assert(num_free_index_a == matrix_c->nrows);
   assert(num_free_index_b == matrix_c->ncols);
+}
+
+/*******************************************************************************
+ * \brief Private routine for multiplying all packs of the given iterator.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void multiply_iterate(const bool transa, const bool transb,
+                             const double alpha, const dbm_matrix_t *matrix_a,
+                             const dbm_matrix_t *matrix_b,
+                             dbm_matrix_t *matrix_c, const bool retain_sparsity,
+                             const float *rows_max_eps,
+                             const float fp32_max_norm,
+                             dbm_comm_iterator_t *iter, backend_context_t *ctx,
+                             int64_t *flop) {
+  // Main loop.
+  const double time_start = omp_get_wtime();
+  *flop = 0;
+  dbm_pack_t *pack_a, *pack_b;
+  while (dbm_comm_iterator_next(iter, &pack_a, &pack_b)) {
+    backend_upload_packs(pack_a, pack_b, ctx);
+    multiply_packs(transa, transb, alpha, pack_a, pack_b, matrix_a, matrix_b,
+                   matrix_c, retain_sparsity, rows_max_eps, fp32_max_norm, flop,
+                   ctx);
+  }
+
+  // Start downloading matrix_c from the GPU.
+  backend_download_results(ctx);
+  dbm_library_comm_time_add(iter->time_in_flight, iter->time_exposed);
+  const double time_loop = omp_get_wtime() - time_start;
+  dbm_library_phase_time_add(DBM_PHASE_COMM, iter->time_exposed);
+  dbm_library_phase_time_add(DBM_PHASE_MULTIPLY,
+                             time_loop - iter->time_exposed);
+
+  // Compute average flops per rank.
+  dbm_mpi_sum_int64(flop, 1, matrix_c->dist->comm);
+  *flop = (*flop + matrix_c->dist->nranks - 1) / matrix_c->dist->nranks;
+}
+
+/*******************************************************************************
+ * \brief Performs a multiplication of two dbm_matrix_t matrices.
+ *        See dbm_matrix.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply(const bool transa, const bool transb, const double alpha,
+                  const dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b,
+                  const double beta, dbm_matrix_t *matrix_c,
+                  const bool retain_sparsity, const double filter_eps,
+                  const double fp32_eps, int64_t *flop) {
+
+  assert(omp_get_num_threads() == 1);
+
+  // Sanity check matrix dimensions.
+  check_dimensions(transa, transb, matrix_a, matrix_b, matrix_c);
 
   // Prepare matrix_c.
   dbm_scale(matrix_c, beta);
 
   // Start uploading matrix_c to the GPU.
   backend_context_t *ctx = backend_start(matrix_c);
+  const double time_start_pack = omp_get_wtime();
 
   // Compute filter thresholds for each row.
   float *rows_max_eps = compute_rows_max_eps(transa, matrix_a, filter_eps);
 
+  // Compute tolerated errors for the lossy compression of pack transfers.
+  double max_error_a = 0.0, max_error_b = 0.0;
+  if (dbm_compress_get_mode() == DBM_COMPRESS_LOSSY && filter_eps > 0.0) {
+    const double max_norm_a = compute_max_norm(matrix_a);
+    const double max_norm_b = compute_max_norm(matrix_b);
+    const int nrows = (transa) ? matrix_a->ncols : matrix_a->nrows;
+    max_error_a =
+        compute_lossy_max_error(alpha, nrows, rows_max_eps, max_norm_b);
+    max_error_b =
+        compute_lossy_max_error(alpha, nrows, rows_max_eps, max_norm_a);
+  }
+
   // Redistribute matrix_a and matrix_b across MPI ranks.
   dbm_comm_iterator_t *iter =
-      dbm_comm_iterator_start(transa, transb, matrix_a, matrix_b, matrix_c);
-
-  // Main loop.
-  *flop = 0;
-  dbm_pack_t *pack_a, *pack_b;
-  while (dbm_comm_iterator_next(iter, &pack_a, &pack_b)) {
-    backend_upload_packs(pack_a, pack_b, ctx);
-    multiply_packs(transa, transb, alpha, pack_a, pack_b, matrix_a, matrix_b,
-                   matrix_c, retain_sparsity, rows_max_eps, flop, ctx);
-  }
+      dbm_comm_iterator_start(transa, transb, matrix_a, matrix_b, matrix_c,
+                              max_error_a, max_error_b, false);
+  dbm_library_phase_time_add(DBM_PHASE_PACK,
+                             omp_get_wtime() - time_start_pack);
 
-  // Start downloading matrix_c from the GPU.
-  backend_download_results(ctx);
+  // Multiply all packs.
+  const float fp32_max_norm = compute_fp32_max_norm(fp32_eps);
+  multiply_iterate(transa, transb, alpha, matrix_a, matrix_b, matrix_c,
+                   retain_sparsity, rows_max_eps, fp32_max_norm, iter, ctx,
+                   flop);
 
   // Wait for all other MPI ranks to complete, then release ressources.
   dbm_comm_iterator_stop(iter);
   free(rows_max_eps);
   backend_stop(ctx);
 
-  // Compute average flops per rank.
-  dbm_mpi_sum_int64(flop, 1, matrix_c->dist->comm);
-  *flop = (*flop + matrix_c->dist->nranks - 1) / matrix_c->dist->nranks;
-
   // Final filter pass.
+  const double time_start_filter = omp_get_wtime();
   dbm_filter(matrix_c, filter_eps);
+  dbm_library_phase_time_add(DBM_PHASE_FILTER,
+                             omp_get_wtime() - time_start_filter);
+}
+
+/*******************************************************************************
+ * \brief Private struct for storing a plan for repeated multiplications.
+ * \author Ole Schuett
+ ******************************************************************************/
+struct dbm_multiply_plan {
+  bool transa;
+  bool transb;
+  double filter_eps;
+  double fp32_eps;
+  dbm_distribution_t *dist_a;
+  dbm_distribution_t *dist_b;
+  dbm_distribution_t *dist_c;
+  uint64_t fingerprint_a; // Hash of the sparsity pattern of matrix_a.
+  uint64_t fingerprint_b; // Hash of the sparsity pattern of matrix_b.
+  float *rows_max_eps;
+  dbm_comm_iterator_t *iter;
+};
+
+/*******************************************************************************
+ * \brief Creates a plan for repeated multiplications of dbm_matrix_t matrices.
+ *        See dbm_multiply.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_create(dbm_multiply_plan_t **plan_out, const bool transa,
+                              const bool transb, const double filter_eps,
+                              const double fp32_eps) {
+  dbm_multiply_plan_t *plan = calloc(1, sizeof(dbm_multiply_plan_t));
+  plan->transa = transa;
+  plan->transb = transb;
+  plan->filter_eps = filter_eps;
+  plan->fp32_eps = fp32_eps;
+
+  assert(*plan_out == NULL);
+  *plan_out = plan;
+}
+
+/*******************************************************************************
+ * \brief Private routine for releasing the parts of a plan that depend on the
+ *        sparsity of the factors.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void plan_reset(dbm_multiply_plan_t *plan) {
+  if (plan->iter != NULL) {
+    dbm_comm_iterator_stop(plan->iter);
+    dbm_distribution_release(plan->dist_a);
+    dbm_distribution_release(plan->dist_b);
+    dbm_distribution_release(plan->dist_c);
+    free(plan->rows_max_eps);
+  }
+  plan->iter = NULL;
+  plan->dist_a = plan->dist_b = plan->dist_c = NULL;
+  plan->rows_max_eps = NULL;
+}
+
+/*******************************************************************************
+ * \brief Executes a plan for multiplying two dbm_matrix_t matrices.
+ *        See dbm_multiply.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_execute(dbm_multiply_plan_t *plan, const double alpha,
+                               const dbm_matrix_t *matrix_a,
+                               const dbm_matrix_t *matrix_b, const double beta,
+                               dbm_matrix_t *matrix_c,
+                               const bool retain_sparsity, int64_t *flop) {
+
+  assert(omp_get_num_threads() == 1);
+  const bool transa = plan->transa, transb = plan->transb;
+
+  // Sanity check matrix dimensions.
+  check_dimensions(transa, transb, matrix_a, matrix_b, matrix_c);
+
+  // Prepare matrix_c.
+  dbm_scale(matrix_c, beta);
+
+  // Start uploading matrix_c to the GPU.
+  backend_context_t *ctx = backend_start(matrix_c);
+  const double time_start_pack = omp_get_wtime();
+
+  // The packs can be reused if the sparsity of matrix_a and matrix_b did not
+  // change on any rank.
+  const uint64_t fingerprint_a = sparsity_fingerprint(matrix_a);
+  const uint64_t fingerprint_b = sparsity_fingerprint(matrix_b);
+  int outdated = (plan->iter == NULL || plan->dist_a != matrix_a->dist ||
+                  plan->dist_b != matrix_b->dist ||
+                  plan->dist_c != matrix_c->dist ||
+                  plan->fingerprint_a != fingerprint_a ||
+                  plan->fingerprint_b != fingerprint_b);
+  dbm_mpi_max_int(&outdated, 1, matrix_c->dist->comm);
+
+  // Compute filter thresholds for each row, which depend only on sparsity.
+  if (outdated) {
+    plan_reset(plan);
+    plan->rows_max_eps =
+        compute_rows_max_eps(transa, matrix_a, plan->filter_eps);
+  }
+
+  // Compute tolerated errors for the lossy compression of pack transfers.
+  double max_error_a = 0.0, max_error_b = 0.0;
+  if (dbm_compress_get_mode() == DBM_COMPRESS_LOSSY && plan->filter_eps > 0.0) {
+    const double max_norm_a = compute_max_norm(matrix_a);
+    const double max_norm_b = compute_max_norm(matrix_b);
+    const int nrows = (transa) ? matrix_a->ncols : matrix_a->nrows;
+    max_error_a =
+        compute_lossy_max_error(alpha, nrows, plan->rows_max_eps, max_norm_b);
+    max_error_b =
+        compute_lossy_max_error(alpha, nrows, plan->rows_max_eps, max_norm_a);
+  }
+
+  // Redistribute matrix_a and matrix_b across MPI ranks, or only their data.
+  if (outdated) {
+    plan->iter = dbm_comm_iterator_start(transa, transb, matrix_a, matrix_b,
+                                         matrix_c, max_error_a, max_error_b,
+                                         true);
+    plan->dist_a = matrix_a->dist;
+    plan->dist_b = matrix_b->dist;
+    plan->dist_c = matrix_c->dist;
+    dbm_distribution_hold(plan->dist_a);
+    dbm_distribution_hold(plan->dist_b);
+    dbm_distribution_hold(plan->dist_c);
+    plan->fingerprint_a = fingerprint_a;
+    plan->fingerprint_b = fingerprint_b;
+  } else {
+    dbm_comm_iterator_restart(plan->iter, matrix_a, matrix_b, max_error_a,
+                              max_error_b);
+  }
+  dbm_library_plan_add(!outdated);
+  dbm_library_phase_time_add(DBM_PHASE_PACK,
+                             omp_get_wtime() - time_start_pack);
+
+  // Multiply all packs.
+  const float fp32_max_norm = compute_fp32_max_norm(plan->fp32_eps);
+  multiply_iterate(transa, transb, alpha, matrix_a, matrix_b, matrix_c,
+                   retain_sparsity, plan->rows_max_eps, fp32_max_norm,
+                   plan->iter, ctx, flop);
+  backend_stop(ctx);
+
+  // Final filter pass.
+  const double time_start_filter = omp_get_wtime();
+  dbm_filter(matrix_c, plan->filter_eps);
+  dbm_library_phase_time_add(DBM_PHASE_FILTER,
+                             omp_get_wtime() - time_start_filter);
+}
+
+/*******************************************************************************
+ * \brief Releases a plan for multiplying dbm_matrix_t matrices.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_release(dbm_multiply_plan_t *plan) {
+  plan_reset(plan);
+  free(plan);
 }
 
 // EOF
@@ -25,13 +25,65 @@
           epsilon divided by the maximum number of possible multiplies in each
           row. In addition a final filtering is done as well with the same
           epsilon value.
+
+          The fp32_eps parameter enables a mixed-precision mode when positive.
+          Each block product is then computed in single precision if the
+          bound (k+2) * FLT_EPSILON * |alpha| * |a| * |b| on its rounding
+          error stays below fp32_eps, where k is the inner block dimension.
+          The bound covers the rounding of both blocks and the summation over
+          k in single precision. The result is always accumulated into C in
+          double precision. Hence, an element of C deviates by at most
+          fp32_eps times the number of block products that contribute to it.
+          The mode is ignored by the GPU backend, which computes all products
+          in double precision.
  * \author Ole Schuett
  ******************************************************************************/
 void dbm_multiply(const bool transa, const bool transb, const double alpha,
                   const dbm_matrix_t *matrix_a, const dbm_matrix_t *matrix_b,
                   const double beta, dbm_matrix_t *matrix_c,
                   const bool retain_sparsity, const double filter_eps,
-                  int64_t *flop);
+                  const double fp32_eps, int64_t *flop);
+
+/*******************************************************************************
+ * \brief Opaque handle of a plan for repeated multiplications.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct dbm_multiply_plan dbm_multiply_plan_t;
+
+/*******************************************************************************
+ * \brief Creates a plan for repeatedly multiplying dbm_matrix_t matrices.
+
+          Iterative methods often multiply matrices whose sparsity remains
+          unchanged while only their data evolves. A plan remembers the
+          redistribution of A and B from its previous execution. As long as
+          the sparsity and distributions of A and B stay the same, subsequent
+          executions skip the exchange of block metadata and only move data.
+          Otherwise, the plan gets rebuilt transparently.
+          The filter_eps and fp32_eps parameters have the same meaning as for
+          dbm_multiply. Since the mixed-precision mode decides per block
+          product from the current block norms, it works with reused plans.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_create(dbm_multiply_plan_t **plan_out, const bool transa,
+                              const bool transb, const double filter_eps,
+                              const double fp32_eps);
+
+/*******************************************************************************
+ * \brief Executes a plan, as  C := alpha * op( A ) * op( B ) + beta * C.
+ *        The parameters have the same meaning as for dbm_multiply.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_execute(dbm_multiply_plan_t *plan, const double alpha,
+                               const dbm_matrix_t *matrix_a,
+                               const dbm_matrix_t *matrix_b, const double beta,
+                               dbm_matrix_t *matrix_c,
+                               const bool retain_sparsity, int64_t *flop);
+
+/*******************************************************************************
+ * \brief Releases a plan and all its ressources.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_plan_release(dbm_multiply_plan_t *plan);
 
 #endif
 
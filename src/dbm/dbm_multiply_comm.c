@@ -8,10 +8,13 @@
 #include "dbm_multiply_comm.h"
 
 #include <assert.h>
+#include <omp.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "dbm_compress.h"
 #include "dbm_hyperparams.h"
+#include "dbm_library.h"
 #include "dbm_mempool.h"
 #include "dbm_mpi.h"
 
@@ -80,7 +83,8 @@ static void create_pack_plans(const bool trans_matrix, const bool trans_dist,
                               const dbm_mpi_comm_t comm,
                               const dbm_dist_1d_t *dist_indices,
                               const dbm_dist_1d_t *dist_ticks, const int nticks,
-                              const int npacks, plan_t *plans_per_pack[npacks],
+                              const int npacks,
+                              plan_t *plans_per_pack[npacks],
                               int nblks_per_pack[npacks],
                               int ndata_per_pack[npacks]) {
 
@@ -152,16 +156,46 @@ static void create_pack_plans(const bool trans_matrix, const bool trans_dist,
   } // end of omp parallel region
 }
 
+/*******************************************************************************
+ * \brief Private routine for copying a block into a double precision buffer.
+ *        When trans_matrix is set, the block gets transposed to allow for
+ *        outer-product style multiplication. Returns the block's squared norm.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double copy_block(const bool trans_matrix, const int row_size,
+                         const int col_size, const double *src, double *dst) {
+  double norm = 0.0;
+  if (trans_matrix) {
+    for (int i = 0; i < row_size; i++) {
+      for (int j = 0; j < col_size; j++) {
+        const double element = src[j * row_size + i];
+        norm += element * element;
+        dst[i * col_size + j] = element;
+      }
+    }
+  } else {
+    for (int i = 0; i < row_size * col_size; i++) {
+      const double element = src[i];
+      norm += element * element;
+      dst[i] = element;
+    }
+  }
+  return norm;
+}
+
 /*******************************************************************************
  * \brief Private routine for filling send buffers.
+ *        If a layout is given, the origin of each block gets recorded in it.
  * \author Ole Schuett
  ******************************************************************************/
 static void fill_send_buffers(
-    const dbm_matrix_t *matrix, const bool trans_matrix, const int nblks_send,
-    const int ndata_send, plan_t plans[nblks_send], const int nranks,
+    const dbm_matrix_t *matrix, const bool trans_matrix, const double max_error,
+    const int nblks_send, const int ndata_send, plan_t plans[nblks_send],
+    const int nranks,
     int blks_send_count[nranks], int data_send_count[nranks],
     int blks_send_displ[nranks], int data_send_displ[nranks],
-    dbm_pack_block_t blks_send[nblks_send], double data_send[ndata_send]) {
+    dbm_pack_block_t blks_send[nblks_send], double data_send[ndata_send],
+    dbm_pack_layout_t *layout) {
 
   memset(blks_send_count, 0, nranks * sizeof(int));
   memset(data_send_count, 0, nranks * sizeof(int));
@@ -219,43 +253,41 @@ static void fill_send_buffers(
       const int offset = data_send_displ[irank] + ndata_mythread[irank];
       const int jblock = blks_send_displ[irank] + nblks_mythread[irank];
 
-      double norm = 0.0; // Compute norm as double...
-      if (trans_matrix) {
-        // Transpose block to allow for outer-product style multiplication.
-        for (int i = 0; i < row_size; i++) {
-          for (int j = 0; j < col_size; j++) {
-            const double element = blk_data[j * row_size + i];
-            norm += element * element;
-            data_send[offset + i * col_size + j] = element;
-          }
-        }
-        blks_send[jblock].free_index = plan->blk->col;
-        blks_send[jblock].sum_index = plan->blk->row;
-      } else {
-        for (int i = 0; i < row_size * col_size; i++) {
-          const double element = blk_data[i];
-          norm += element * element;
-          data_send[offset + i] = element;
-        }
-        blks_send[jblock].free_index = plan->blk->row;
-        blks_send[jblock].sum_index = plan->blk->col;
-      }
+      // Compute norm as double...
+      const double norm = copy_block(trans_matrix, row_size, col_size, blk_data,
+                                     &data_send[offset]);
+      // Drop the mantissa bits that are not needed for the lossy transfer.
+      const int nbits = dbm_compress_mantissa_bits(norm, max_error);
+      dbm_compress_truncate(row_size * col_size, &data_send[offset], nbits);
+      blks_send[jblock].free_index = (trans_matrix) ? blk->col : blk->row;
+      blks_send[jblock].sum_index = (trans_matrix) ? blk->row : blk->col;
       blks_send[jblock].norm = (float)norm; // ...store norm as float.
 
       // After the block exchange data_recv_displ will be added to the offsets.
       blks_send[jblock].offset = offset - data_send_displ[irank];
+
+      if (layout != NULL) {
+        layout->blk_shard[jblock] = ishard;
+        layout->blk_index[jblock] = blk - shard->blocks;
+        layout->blk_offset[jblock] = offset;
+      }
     }
   } // end of omp parallel region
 }
 
 /*******************************************************************************
  * \brief Private comperator passed to qsort to compare two blocks by sum_index.
+ *        Ties are broken by free_index, which allows multiply_packs to find
+ *        the result blocks with a streaming cursor.
  * \author Ole Schuett
  ******************************************************************************/
 static int compare_pack_blocks_by_sum_index(const void *a, const void *b) {
   const dbm_pack_block_t *blk_a = (const dbm_pack_block_t *)a;
   const dbm_pack_block_t *blk_b = (const dbm_pack_block_t *)b;
-  return blk_a->sum_index - blk_b->sum_index;
+  if (blk_a->sum_index != blk_b->sum_index) {
+    return blk_a->sum_index - blk_b->sum_index;
+  }
+  return blk_a->free_index - blk_b->free_index;
 }
 
 /*******************************************************************************
@@ -321,6 +353,136 @@ static void postprocess_received_blocks(
   free(blocks_tmp);
 }
 
+/*******************************************************************************
+ * \brief Private routine for exchanging compressed data among all ranks.
+ *        Same as dbm_mpi_alltoallv_double, but the data for each rank is
+ *        compressed before and decompressed after the transfer.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void alltoallv_compressed(const double *data_send,
+                                 const int *data_send_count,
+                                 const int *data_send_displ, double *data_recv,
+                                 const int *data_recv_count,
+                                 const int *data_recv_displ,
+                                 const dbm_mpi_comm_t comm) {
+  const int nranks = dbm_mpi_comm_size(comm);
+  int send_count_byte[nranks], send_displ_byte[nranks];
+  int recv_count_byte[nranks], recv_displ_byte[nranks];
+
+  // Compress data for each rank.
+  int max_nbytes_send = 0;
+  for (int irank = 0; irank < nranks; irank++) {
+    max_nbytes_send += dbm_compress_bound(data_send_count[irank]);
+  }
+  unsigned char *bytes_send = dbm_mpi_alloc_mem(max_nbytes_send);
+  int nbytes_send = 0;
+  for (int irank = 0; irank < nranks; irank++) {
+    send_displ_byte[irank] = nbytes_send;
+    send_count_byte[irank] =
+        dbm_compress(data_send_count[irank], &data_send[data_send_displ[irank]],
+                     &bytes_send[nbytes_send]);
+    nbytes_send += send_count_byte[irank];
+  }
+  dbm_library_compression_add(isum(nranks, data_send_count) * sizeof(double),
+                              nbytes_send);
+
+  // Exchange compressed data.
+  dbm_mpi_alltoall_int(send_count_byte, 1, recv_count_byte, 1, comm);
+  icumsum(nranks, recv_count_byte, recv_displ_byte);
+  const int nbytes_recv = isum(nranks, recv_count_byte);
+  unsigned char *bytes_recv = dbm_mpi_alloc_mem(nbytes_recv);
+  dbm_mpi_alltoallv_byte(bytes_send, send_count_byte, send_displ_byte,
+                         bytes_recv, recv_count_byte, recv_displ_byte, comm);
+
+  // Decompress data from each rank.
+  for (int irank = 0; irank < nranks; irank++) {
+    const int n = dbm_decompress(
+        recv_count_byte[irank], &bytes_recv[recv_displ_byte[irank]],
+        data_recv_count[irank], &data_recv[data_recv_displ[irank]]);
+    assert(n == data_recv_count[irank]);
+  }
+
+  dbm_mpi_free_mem(bytes_send);
+  dbm_mpi_free_mem(bytes_recv);
+}
+
+/*******************************************************************************
+ * \brief Private routine for allocating a pack layout.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void alloc_pack_layout(const int nblks_send, const int ndata_send,
+                              const int nranks, dbm_pack_layout_t *layout) {
+  layout->nblks_send = nblks_send;
+  layout->ndata_send = ndata_send;
+  layout->blk_shard = malloc(nblks_send * sizeof(int));
+  layout->blk_index = malloc(nblks_send * sizeof(int));
+  layout->blk_offset = malloc(nblks_send * sizeof(int));
+  layout->data_send_count = malloc(nranks * sizeof(int));
+  layout->data_send_displ = malloc(nranks * sizeof(int));
+  layout->data_recv_count = malloc(nranks * sizeof(int));
+  layout->data_recv_displ = malloc(nranks * sizeof(int));
+}
+
+/*******************************************************************************
+ * \brief Private routine for releasing a pack layout.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void free_pack_layout(dbm_pack_layout_t *layout) {
+  free(layout->blk_shard);
+  free(layout->blk_index);
+  free(layout->blk_offset);
+  free(layout->data_send_count);
+  free(layout->data_send_displ);
+  free(layout->data_recv_count);
+  free(layout->data_recv_displ);
+}
+
+/*******************************************************************************
+ * \brief Private routine for recomputing the norms of all blocks in a pack.
+ *        Used when only the data of a pack was transferred.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void compute_pack_norms(const dbm_packed_matrix_t *packed,
+                               dbm_pack_t *pack) {
+#pragma omp parallel for schedule(static)
+  for (int iblock = 0; iblock < pack->nblocks; iblock++) {
+    dbm_pack_block_t *blk = &pack->blocks[iblock];
+    const int size = packed->free_index_sizes[blk->free_index] *
+                     packed->sum_index_sizes[blk->sum_index];
+    const double *blk_data = &pack->data[blk->offset];
+    double norm = 0.0;
+    for (int i = 0; i < size; i++) {
+      norm += blk_data[i] * blk_data[i];
+    }
+    blk->norm = (float)norm;
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for compressing the send packs.
+ *        This is done once, since each send pack gets sent to multiple ranks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void compress_send_packs(dbm_packed_matrix_t *packed) {
+  packed->max_nbytes = 0;
+  for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
+    const dbm_pack_t *pack = &packed->send_packs[ipack];
+    unsigned char *bytes = malloc(dbm_compress_bound(pack->data_size));
+    const int nbytes = dbm_compress(pack->data_size, pack->data, bytes);
+    free(packed->send_bytes[ipack]);
+    packed->send_nbytes[ipack] = nbytes;
+    packed->send_bytes[ipack] = realloc(bytes, nbytes);
+    packed->max_nbytes = imax(packed->max_nbytes, nbytes);
+  }
+  dbm_mpi_max_int(&packed->max_nbytes, 1, packed->dist_ticks->comm);
+  for (int ibuf = 0; ibuf < 2; ibuf++) {
+    if (packed->recv_bytes[ibuf] != NULL) {
+      dbm_mpi_free_mem(packed->recv_bytes[ibuf]);
+    }
+    packed->recv_bytes[ibuf] = dbm_mpi_alloc_mem(packed->max_nbytes);
+  }
+}
+
 /*******************************************************************************
  * \brief Private routine for redistributing a matrix along selected dimensions.
  * \author Ole Schuett
@@ -329,7 +491,10 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
                                        const bool trans_dist,
                                        const dbm_matrix_t *matrix,
                                        const dbm_distribution_t *dist,
-                                       const int nticks) {
+                                       const int nticks,
+                                       const double max_error,
+                                       const bool compress,
+                                       const bool persistent) {
 
   assert(dbm_mpi_comms_are_similar(matrix->dist->comm, dist->comm));
 
@@ -346,6 +511,19 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
   packed.dist_ticks = dist_ticks;
   packed.nsend_packs = nsend_packs;
   packed.send_packs = malloc(nsend_packs * sizeof(dbm_pack_t));
+  packed.trans_matrix = trans_matrix;
+  packed.free_index_sizes =
+      (trans_matrix) ? matrix->col_sizes : matrix->row_sizes;
+  packed.sum_index_sizes =
+      (trans_matrix) ? matrix->row_sizes : matrix->col_sizes;
+  packed.layouts = NULL;
+  packed.tick_blocks = NULL;
+  packed.tick_nblocks = NULL;
+  if (persistent) {
+    packed.layouts = malloc(nsend_packs * sizeof(dbm_pack_layout_t));
+    packed.tick_blocks = calloc(nticks, sizeof(dbm_pack_block_t *));
+    packed.tick_nblocks = calloc(nticks, sizeof(int));
+  }
 
   // Plan all packs.
   plan_t *plans_per_pack[nsend_packs];
@@ -370,10 +548,17 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
     const int nranks = dist->nranks;
     int blks_send_count[nranks], data_send_count[nranks];
     int blks_send_displ[nranks], data_send_displ[nranks];
-    fill_send_buffers(matrix, trans_matrix, nblks_send_per_pack[ipack],
-                      ndata_send_per_pack[ipack], plans_per_pack[ipack], nranks,
-                      blks_send_count, data_send_count, blks_send_displ,
-                      data_send_displ, blks_send, data_send);
+    dbm_pack_layout_t *layout = NULL;
+    if (persistent) {
+      layout = &packed.layouts[ipack];
+      alloc_pack_layout(nblks_send_per_pack[ipack], ndata_send_per_pack[ipack],
+                        nranks, layout);
+    }
+    fill_send_buffers(matrix, trans_matrix, max_error,
+                      nblks_send_per_pack[ipack], ndata_send_per_pack[ipack],
+                      plans_per_pack[ipack], nranks, blks_send_count,
+                      data_send_count, blks_send_displ, data_send_displ,
+                      blks_send, data_send, layout);
     free(plans_per_pack[ipack]);
 
     // 1st communication: Exchange block counts.
@@ -406,9 +591,23 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
 
     // 4th communication: Exchange data.
     double *data_recv = dbm_mempool_host_malloc(ndata_recv * sizeof(double));
-    dbm_mpi_alltoallv_double(data_send, data_send_count, data_send_displ,
-                             data_recv, data_recv_count, data_recv_displ,
-                             dist->comm);
+    if (compress) {
+      alltoallv_compressed(data_send, data_send_count, data_send_displ,
+                           data_recv, data_recv_count, data_recv_displ,
+                           dist->comm);
+    } else {
+      dbm_mpi_alltoallv_double(data_send, data_send_count, data_send_displ,
+                               data_recv, data_recv_count, data_recv_displ,
+                               dist->comm);
+    }
+
+    // Remember the data counts, which stay the same as long as the sparsity.
+    if (persistent) {
+      memcpy(layout->data_send_count, data_send_count, nranks * sizeof(int));
+      memcpy(layout->data_send_displ, data_send_displ, nranks * sizeof(int));
+      memcpy(layout->data_recv_count, data_recv_count, nranks * sizeof(int));
+      memcpy(layout->data_recv_displ, data_recv_displ, nranks * sizeof(int));
+    }
 
     // Post-process received blocks and assemble them into a pack.
     postprocess_received_blocks(nranks, dist_indices->nshards, nblocks_recv,
@@ -422,7 +621,7 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
 
   // Deallocate send buffers.
   dbm_mpi_free_mem(blks_send);
-  dbm_mempool_free(data_send);
+  dbm_mempool_host_free(data_send);
 
   // Allocate pack_recv.
   int max_nblocks = 0, max_data_size = 0;
@@ -434,22 +633,103 @@ static dbm_packed_matrix_t pack_matrix(const bool trans_matrix,
   dbm_mpi_max_int(&max_data_size, 1, packed.dist_ticks->comm);
   packed.max_nblocks = max_nblocks;
   packed.max_data_size = max_data_size;
-  packed.recv_pack.blocks =
-      dbm_mpi_alloc_mem(packed.max_nblocks * sizeof(dbm_pack_block_t));
-  packed.recv_pack.data =
-      dbm_mempool_host_malloc(packed.max_data_size * sizeof(double));
+  for (int ibuf = 0; ibuf < 2; ibuf++) {
+    packed.recv_packs[ibuf].blocks =
+        dbm_mpi_alloc_mem(packed.max_nblocks * sizeof(dbm_pack_block_t));
+    packed.recv_packs[ibuf].data = NULL; // Allocated by post_pack if needed.
+  }
+  packed.next_recv_pack = 0;
+  packed.next_pack = NULL;
+  packed.nrequests = 0;
+  packed.next_itick = -1;
+
+  // Compress send packs.
+  packed.compress = compress;
+  packed.send_nbytes = NULL;
+  packed.send_bytes = NULL;
+  packed.recv_bytes[0] = packed.recv_bytes[1] = NULL;
+  packed.max_nbytes = 0;
+  packed.next_bytes = NULL;
+  if (compress) {
+    packed.send_nbytes = malloc(nsend_packs * sizeof(int));
+    packed.send_bytes = calloc(nsend_packs, sizeof(unsigned char *));
+    compress_send_packs(&packed);
+  }
 
   return packed; // Ownership of packed transfers to caller.
 }
 
 /*******************************************************************************
- * \brief Private routine for sending and receiving the pack for the given tick.
+ * \brief Private routine for redoing pack_matrix for a matrix with unchanged
+ *        sparsity. Only the data gets exchanged, the norms are recomputed.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void repack_matrix(const dbm_matrix_t *matrix, const double max_error,
+                          const dbm_mpi_comm_t comm,
+                          dbm_packed_matrix_t *packed) {
+  assert(packed->layouts != NULL && packed->nrequests == 0);
+  const bool trans_matrix = packed->trans_matrix;
+  packed->free_index_sizes =
+      (trans_matrix) ? matrix->col_sizes : matrix->row_sizes;
+  packed->sum_index_sizes =
+      (trans_matrix) ? matrix->row_sizes : matrix->col_sizes;
+
+  // Allocate send buffer for maximum number of data over all packs.
+  int ndata_send_max = 0;
+  for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
+    ndata_send_max = imax(ndata_send_max, packed->layouts[ipack].ndata_send);
+  }
+  double *data_send = dbm_mempool_host_malloc(ndata_send_max * sizeof(double));
+
+  for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
+    // Fill send buffer at the remembered offsets.
+    const dbm_pack_layout_t *layout = &packed->layouts[ipack];
+#pragma omp parallel for schedule(static)
+    for (int iblock = 0; iblock < layout->nblks_send; iblock++) {
+      const dbm_shard_t *shard = &matrix->shards[layout->blk_shard[iblock]];
+      const dbm_block_t *blk = &shard->blocks[layout->blk_index[iblock]];
+      const int row_size = matrix->row_sizes[blk->row];
+      const int col_size = matrix->col_sizes[blk->col];
+      double *blk_send = &data_send[layout->blk_offset[iblock]];
+      const double norm = copy_block(trans_matrix, row_size, col_size,
+                                     &shard->data[blk->offset], blk_send);
+      const int nbits = dbm_compress_mantissa_bits(norm, max_error);
+      dbm_compress_truncate(row_size * col_size, blk_send, nbits);
+    }
+
+    // Exchange data.
+    dbm_pack_t *pack = &packed->send_packs[ipack];
+    if (packed->compress) {
+      alltoallv_compressed(data_send, layout->data_send_count,
+                           layout->data_send_displ, pack->data,
+                           layout->data_recv_count, layout->data_recv_displ,
+                           comm);
+    } else {
+      dbm_mpi_alltoallv_double(data_send, layout->data_send_count,
+                               layout->data_send_displ, pack->data,
+                               layout->data_recv_count,
+                               layout->data_recv_displ, comm);
+    }
+    compute_pack_norms(packed, pack);
+  }
+
+  dbm_mempool_host_free(data_send);
+
+  if (packed->compress) {
+    compress_send_packs(packed);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for posting the transfer of the pack for given tick.
+ *        The transfer is completed by a subsequent call to wait_pack.
  * \author Ole Schuett
  ******************************************************************************/
-static dbm_pack_t *sendrecv_pack(const int itick, const int nticks,
-                                 dbm_packed_matrix_t *packed) {
+static void post_pack(const int itick, const int nticks,
+                      dbm_packed_matrix_t *packed) {
   const int nranks = packed->dist_ticks->nranks;
   const int my_rank = packed->dist_ticks->my_rank;
+  assert(packed->next_pack == NULL && packed->nrequests == 0);
 
   // Compute send rank and pack.
   const int itick_of_rank0 = (itick + nticks - my_rank) % nticks;
@@ -464,64 +744,181 @@ static dbm_pack_t *sendrecv_pack(const int itick, const int nticks,
 
   if (send_rank == my_rank) {
     assert(send_rank == recv_rank && send_ipack == recv_ipack);
-    return &packed->send_packs[send_ipack]; // Local pack, no mpi needed.
+    packed->next_pack = &packed->send_packs[send_ipack]; // Local pack, no mpi.
   } else {
     const dbm_pack_t *send_pack = &packed->send_packs[send_ipack];
+    dbm_pack_t *recv_pack = &packed->recv_packs[packed->next_recv_pack];
+    unsigned char *recv_bytes = packed->recv_bytes[packed->next_recv_pack];
+    packed->next_recv_pack = 1 - packed->next_recv_pack; // Flip buffers.
+
+    // Receive buffers are allocated lazily since all packs might be local.
+    if (recv_pack->data == NULL) {
+      recv_pack->data =
+          dbm_mempool_host_malloc(packed->max_data_size * sizeof(double));
+    }
 
-    // Exchange blocks.
-    const int nblocks_in_bytes = dbm_mpi_sendrecv_byte(
-        /*sendbuf=*/send_pack->blocks,
-        /*sendcound=*/send_pack->nblocks * sizeof(dbm_pack_block_t),
-        /*dest=*/send_rank,
-        /*sendtag=*/send_ipack,
-        /*recvbuf=*/packed->recv_pack.blocks,
-        /*recvcount=*/packed->max_nblocks * sizeof(dbm_pack_block_t),
-        /*source=*/recv_rank,
-        /*recvtag=*/recv_ipack,
-        /*comm=*/packed->dist_ticks->comm);
-
-    assert(nblocks_in_bytes % sizeof(dbm_pack_block_t) == 0);
-    packed->recv_pack.nblocks = nblocks_in_bytes / sizeof(dbm_pack_block_t);
+    // Post exchange of blocks, unless they were received by a previous run.
+    // Since all ranks were run equally often, they agree on this decision.
+    if (packed->tick_blocks == NULL || packed->tick_blocks[itick] == NULL) {
+      dbm_mpi_isendrecv_byte(
+          /*sendbuf=*/send_pack->blocks,
+          /*sendcound=*/send_pack->nblocks * sizeof(dbm_pack_block_t),
+          /*dest=*/send_rank,
+          /*sendtag=*/send_ipack,
+          /*recvbuf=*/recv_pack->blocks,
+          /*recvcount=*/packed->max_nblocks * sizeof(dbm_pack_block_t),
+          /*source=*/recv_rank,
+          /*recvtag=*/recv_ipack,
+          /*comm=*/packed->dist_ticks->comm,
+          /*send_request=*/&packed->requests[0],
+          /*recv_request=*/&packed->requests[1]);
+    }
 
-    // Exchange data.
-    packed->recv_pack.data_size = dbm_mpi_sendrecv_double(
-        /*sendbuf=*/send_pack->data,
-        /*sendcound=*/send_pack->data_size,
-        /*dest=*/send_rank,
-        /*sendtag=*/send_ipack,
-        /*recvbuf=*/packed->recv_pack.data,
-        /*recvcount=*/packed->max_data_size,
-        /*source=*/recv_rank,
-        /*recvtag=*/recv_ipack,
-        /*comm=*/packed->dist_ticks->comm);
-
-    return &packed->recv_pack;
+    // Post exchange of data.
+    if (packed->compress) {
+      dbm_mpi_isendrecv_byte(
+          /*sendbuf=*/packed->send_bytes[send_ipack],
+          /*sendcound=*/packed->send_nbytes[send_ipack],
+          /*dest=*/send_rank,
+          /*sendtag=*/send_ipack,
+          /*recvbuf=*/recv_bytes,
+          /*recvcount=*/packed->max_nbytes,
+          /*source=*/recv_rank,
+          /*recvtag=*/recv_ipack,
+          /*comm=*/packed->dist_ticks->comm,
+          /*send_request=*/&packed->requests[2],
+          /*recv_request=*/&packed->requests[3]);
+      dbm_library_compression_add(send_pack->data_size * sizeof(double),
+                                  packed->send_nbytes[send_ipack]);
+    } else {
+      dbm_mpi_isendrecv_double(
+          /*sendbuf=*/send_pack->data,
+          /*sendcound=*/send_pack->data_size,
+          /*dest=*/send_rank,
+          /*sendtag=*/send_ipack,
+          /*recvbuf=*/recv_pack->data,
+          /*recvcount=*/packed->max_data_size,
+          /*source=*/recv_rank,
+          /*recvtag=*/recv_ipack,
+          /*comm=*/packed->dist_ticks->comm,
+          /*send_request=*/&packed->requests[2],
+          /*recv_request=*/&packed->requests[3]);
+    }
+
+    packed->nrequests = 4;
+    packed->next_pack = recv_pack;
+    packed->next_bytes = recv_bytes;
+    packed->next_itick = itick;
   }
 }
 
+/*******************************************************************************
+ * \brief Private routine for completing the transfer started by post_pack.
+ * \author Ole Schuett
+ ******************************************************************************/
+static dbm_pack_t *wait_pack(dbm_packed_matrix_t *packed) {
+  dbm_pack_t *pack = packed->next_pack;
+  assert(pack != NULL);
+
+  if (packed->nrequests > 0) {
+    const int itick = packed->next_itick;
+    const bool cached =
+        (packed->tick_blocks != NULL && packed->tick_blocks[itick] != NULL);
+    if (cached) {
+      pack->nblocks = packed->tick_nblocks[itick];
+      memcpy(pack->blocks, packed->tick_blocks[itick],
+             pack->nblocks * sizeof(dbm_pack_block_t));
+    } else {
+      const int nblocks_in_bytes = dbm_mpi_wait_byte(&packed->requests[1]);
+      assert(nblocks_in_bytes % sizeof(dbm_pack_block_t) == 0);
+      pack->nblocks = nblocks_in_bytes / sizeof(dbm_pack_block_t);
+      dbm_mpi_wait(&packed->requests[0]);
+    }
+    if (packed->compress) {
+      const int nbytes = dbm_mpi_wait_byte(&packed->requests[3]);
+      pack->data_size = dbm_decompress(nbytes, packed->next_bytes,
+                                       packed->max_data_size, pack->data);
+    } else {
+      pack->data_size = dbm_mpi_wait_double(&packed->requests[3]);
+    }
+    dbm_mpi_wait(&packed->requests[2]);
+    packed->nrequests = 0;
+
+    if (cached) {
+      compute_pack_norms(packed, pack); // The cached norms are outdated.
+    } else if (packed->tick_blocks != NULL) {
+      // Remember the blocks, which stay the same as long as the sparsity.
+      const size_t size = pack->nblocks * sizeof(dbm_pack_block_t);
+      packed->tick_blocks[itick] = malloc(size);
+      memcpy(packed->tick_blocks[itick], pack->blocks, size);
+      packed->tick_nblocks[itick] = pack->nblocks;
+    }
+  }
+
+  packed->next_pack = NULL;
+  return pack;
+}
+
 /*******************************************************************************
  * \brief Private routine for releasing a packed matrix.
  * \author Ole Schuett
  ******************************************************************************/
 static void free_packed_matrix(dbm_packed_matrix_t *packed) {
-  dbm_mpi_free_mem(packed->recv_pack.blocks);
-  dbm_mempool_free(packed->recv_pack.data);
+  assert(packed->nrequests == 0); // check for pending transfers
+  for (int ibuf = 0; ibuf < 2; ibuf++) {
+    dbm_mpi_free_mem(packed->recv_packs[ibuf].blocks);
+    dbm_mempool_host_free(packed->recv_packs[ibuf].data);
+  }
   for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
     dbm_mpi_free_mem(packed->send_packs[ipack].blocks);
-    dbm_mempool_free(packed->send_packs[ipack].data);
+    dbm_mempool_host_free(packed->send_packs[ipack].data);
   }
   free(packed->send_packs);
+  if (packed->compress) {
+    for (int ibuf = 0; ibuf < 2; ibuf++) {
+      dbm_mpi_free_mem(packed->recv_bytes[ibuf]);
+    }
+    for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
+      free(packed->send_bytes[ipack]);
+    }
+    free(packed->send_bytes);
+    free(packed->send_nbytes);
+  }
+  if (packed->layouts != NULL) {
+    const int nticks = packed->nsend_packs * packed->dist_ticks->nranks;
+    for (int ipack = 0; ipack < packed->nsend_packs; ipack++) {
+      free_pack_layout(&packed->layouts[ipack]);
+    }
+    for (int itick = 0; itick < nticks; itick++) {
+      free(packed->tick_blocks[itick]);
+    }
+    free(packed->layouts);
+    free(packed->tick_blocks);
+    free(packed->tick_nblocks);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for posting transfers of both packs for given tick.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void post_packs(const int itick, dbm_comm_iterator_t *iter) {
+  // Start each rank at a different tick to spread the load on the sources.
+  const int shift = iter->dist->rows.my_rank + iter->dist->cols.my_rank;
+  const int shifted_itick = (itick + shift) % iter->nticks;
+  post_pack(shifted_itick, iter->nticks, &iter->packed_a);
+  post_pack(shifted_itick, iter->nticks, &iter->packed_b);
+  iter->time_posted = omp_get_wtime();
 }
 
 /*******************************************************************************
  * \brief Internal routine for creating a communication iterator.
  * \author Ole Schuett
  ******************************************************************************/
-dbm_comm_iterator_t *dbm_comm_iterator_start(const bool transa,
-                                             const bool transb,
-                                             const dbm_matrix_t *matrix_a,
-                                             const dbm_matrix_t *matrix_b,
-                                             const dbm_matrix_t *matrix_c) {
+dbm_comm_iterator_t *dbm_comm_iterator_start(
+    const bool transa, const bool transb, const dbm_matrix_t *matrix_a,
+    const dbm_matrix_t *matrix_b, const dbm_matrix_t *matrix_c,
+    const double max_error_a, const double max_error_b, const bool persistent) {
 
   dbm_comm_iterator_t *iter = malloc(sizeof(dbm_comm_iterator_t));
   iter->dist = matrix_c->dist;
@@ -532,15 +929,51 @@ dbm_comm_iterator_t *dbm_comm_iterator_start(const bool transa,
   iter->nticks = lcm(iter->dist->rows.nranks, iter->dist->cols.nranks);
   iter->itick = 0;
 
+  // Compression only pays off when the packs are sent to other ranks.
+  const dbm_compress_mode_t mode = dbm_compress_get_mode();
+  const bool compress = (mode != DBM_COMPRESS_NONE && iter->dist->nranks > 1);
+  iter->lossy = (compress && mode == DBM_COMPRESS_LOSSY);
+  iter->persistent = persistent;
+
   // 1.arg=source dimension, 2.arg=target dimension, false=rows, true=columns.
-  iter->packed_a =
-      pack_matrix(transa, false, matrix_a, iter->dist, iter->nticks);
-  iter->packed_b =
-      pack_matrix(!transb, true, matrix_b, iter->dist, iter->nticks);
+  iter->packed_a = pack_matrix(transa, false, matrix_a, iter->dist,
+                               iter->nticks, (iter->lossy) ? max_error_a : 0.0,
+                               compress, persistent);
+  iter->packed_b = pack_matrix(!transb, true, matrix_b, iter->dist,
+                               iter->nticks, (iter->lossy) ? max_error_b : 0.0,
+                               compress, persistent);
+
+  // Already post the transfers for the first tick.
+  iter->time_in_flight = 0.0;
+  iter->time_exposed = 0.0;
+  post_packs(0, iter);
 
   return iter;
 }
 
+/*******************************************************************************
+ * \brief Internal routine for restarting an exhausted persistent iterator.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_comm_iterator_restart(dbm_comm_iterator_t *iter,
+                               const dbm_matrix_t *matrix_a,
+                               const dbm_matrix_t *matrix_b,
+                               const double max_error_a,
+                               const double max_error_b) {
+  assert(iter->persistent && iter->itick == iter->nticks);
+
+  repack_matrix(matrix_a, (iter->lossy) ? max_error_a : 0.0, iter->dist->comm,
+                &iter->packed_a);
+  repack_matrix(matrix_b, (iter->lossy) ? max_error_b : 0.0, iter->dist->comm,
+                &iter->packed_b);
+
+  // Already post the transfers for the first tick.
+  iter->itick = 0;
+  iter->time_in_flight = 0.0;
+  iter->time_exposed = 0.0;
+  post_packs(0, iter);
+}
+
 /*******************************************************************************
  * \brief Internal routine for retriving next pair of packs from given iterator.
  * \author Ole Schuett
@@ -551,13 +984,22 @@ bool dbm_comm_iterator_next(dbm_comm_iterator_t *iter, dbm_pack_t **pack_a,
     return false; // end of iterator reached
   }
 
-  // Start each rank at a different tick to spread the load on the sources.
-  const int shift = iter->dist->rows.my_rank + iter->dist->cols.my_rank;
-  const int shifted_itick = (iter->itick + shift) % iter->nticks;
-  *pack_a = sendrecv_pack(shifted_itick, iter->nticks, &iter->packed_a);
-  *pack_b = sendrecv_pack(shifted_itick, iter->nticks, &iter->packed_b);
+  // Wait for the packs of the current tick, which were posted earlier.
+  const bool remote = (iter->packed_a.nrequests + iter->packed_b.nrequests > 0);
+  const double time_wait_start = omp_get_wtime();
+  *pack_a = wait_pack(&iter->packed_a);
+  *pack_b = wait_pack(&iter->packed_b);
+  const double time_wait_end = omp_get_wtime();
+  if (remote) {
+    iter->time_exposed += time_wait_end - time_wait_start;
+    iter->time_in_flight += time_wait_end - iter->time_posted;
+  }
 
+  // Post the packs of the next tick, which arrive while the current is used.
   iter->itick++;
+  if (iter->itick < iter->nticks) {
+    post_packs(iter->itick, iter);
+  }
   return true;
 }
 
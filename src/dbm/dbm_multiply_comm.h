@@ -10,10 +10,28 @@
 
 #include "dbm_distribution.h"
 #include "dbm_matrix.h"
+#include "dbm_mpi.h"
 #include "dbm_multiply_internal.h"
 
 #include <stdbool.h>
 
+/*******************************************************************************
+ * \brief Internal struct for storing how a send pack was assembled.
+ *        It allows to redo the exchange for a matrix with unchanged sparsity.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int nblks_send;
+  int ndata_send;
+  int *blk_shard;  // Shard from which each block in the send buffer was taken.
+  int *blk_index;  // Index of each block within its shard.
+  int *blk_offset; // Offset of each block's data within the send buffer.
+  int *data_send_count;
+  int *data_send_displ;
+  int *data_recv_count;
+  int *data_recv_displ;
+} dbm_pack_layout_t;
+
 /*******************************************************************************
  * \brief Internal struct for storing a packed matrix.
  * \author Ole Schuett
@@ -23,9 +41,26 @@ typedef struct {
   const dbm_dist_1d_t *dist_ticks;
   int nsend_packs;
   dbm_pack_t *send_packs;
-  dbm_pack_t recv_pack;
-  int max_nblocks; // Max across all ranks in dist_ticks.
+  dbm_pack_t recv_packs[2]; // Double buffer to overlap comm and compute.
+  int max_nblocks;          // Max across all ranks in dist_ticks.
   int max_data_size;
+  int next_recv_pack;    // Recv buffer to be used by the next transfer.
+  dbm_pack_t *next_pack; // Becomes available once the requests completed.
+  int nrequests;         // Either zero or four for blocks/data send/recv.
+  dbm_mpi_request_t requests[4];
+  bool compress;                // Transfer pack data compressed.
+  int *send_nbytes;             // Compressed size of each send pack.
+  unsigned char **send_bytes;   // Compressed data of each send pack.
+  unsigned char *recv_bytes[2]; // Recv buffers for compressed data.
+  int max_nbytes;               // Max across all ranks in dist_ticks.
+  unsigned char *next_bytes;    // Compressed data of next_pack.
+  bool trans_matrix;
+  const int *free_index_sizes;
+  const int *sum_index_sizes;
+  dbm_pack_layout_t *layouts;     // Only kept by persistent packed matrices.
+  dbm_pack_block_t **tick_blocks; // Blocks received during each tick.
+  int *tick_nblocks;
+  int next_itick; // Tick of next_pack.
 } dbm_packed_matrix_t;
 
 /*******************************************************************************
@@ -38,17 +73,37 @@ typedef struct {
   dbm_distribution_t *dist;
   dbm_packed_matrix_t packed_a;
   dbm_packed_matrix_t packed_b;
+  double time_posted;    // Wall time when the next packs were requested.
+  double time_in_flight; // Accumulated wall time of all pack transfers.
+  double time_exposed;   // Portion of time_in_flight spent waiting.
+  bool persistent;
+  bool lossy;
 } dbm_comm_iterator_t;
 
 /*******************************************************************************
  * \brief Internal routine for creating a communication iterator.
+ *        When the lossy pack compression is enabled, the mantissas of each
+ *        block are truncated such that its error stays below max_error_a/b.
+ *        A persistent iterator remembers the layout of its packs, so that it
+ *        can be restarted for matrices with unchanged sparsity.
+ * \author Ole Schuett
+ ******************************************************************************/
+dbm_comm_iterator_t *dbm_comm_iterator_start(
+    const bool transa, const bool transb, const dbm_matrix_t *matrix_a,
+    const dbm_matrix_t *matrix_b, const dbm_matrix_t *matrix_c,
+    const double max_error_a, const double max_error_b, const bool persistent);
+
+/*******************************************************************************
+ * \brief Internal routine for restarting an exhausted persistent iterator.
+ *        The given matrices must have the same sparsity and distribution as
+ *        those passed to dbm_comm_iterator_start. Only their data is resent.
  * \author Ole Schuett
  ******************************************************************************/
-dbm_comm_iterator_t *dbm_comm_iterator_start(const bool transa,
-                                             const bool transb,
-                                             const dbm_matrix_t *matrix_a,
-                                             const dbm_matrix_t *matrix_b,
-                                             const dbm_matrix_t *matrix_c);
+void dbm_comm_iterator_restart(dbm_comm_iterator_t *iter,
+                               const dbm_matrix_t *matrix_a,
+                               const dbm_matrix_t *matrix_b,
+                               const double max_error_a,
+                               const double max_error_b);
 
 /*******************************************************************************
  * \brief Internal routine for retriving next pair of packs from given iterator.
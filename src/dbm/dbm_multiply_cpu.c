@@ -7,8 +7,13 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 #if defined(__LIBXSMM)
 #include <libxsmm.h>
 #if !defined(DBM_LIBXSMM_PREFETCH)
@@ -61,6 +66,263 @@ static inline unsigned int hash(const dbm_task_t task) {
   return mnk;
 }
 
+#if !defined(__LIBXSMM)
+/*******************************************************************************
+ * \brief Signature of the built-in small matrix multiplication kernels.
+ *        They compute C += alpha * A * B^T for the first mc rows of A and C,
+ *        where A is ld x k, B is n x k, and C is ld x n (all column-major).
+ ******************************************************************************/
+typedef void (*smm_kernel_t)(const int ld, const int mc, const int n,
+                             const int k, const double alpha,
+                             const double *restrict a,
+                             const double *restrict b, double *restrict c);
+
+#if defined(__AVX512F__)
+/*******************************************************************************
+ * \brief Private AVX-512 micro kernel, which keeps nj columns of C in nvec
+ *        registers each. Multiple columns provide independent FMA chains.
+ ******************************************************************************/
+static inline __attribute__((always_inline)) void
+smm_avx512_cols(const int nvec, const int nj, const int mtail, const int ld,
+                const int n, const int k, const double alpha,
+                const double *restrict a, const double *restrict b,
+                double *restrict c) {
+  const __mmask8 tail = (__mmask8)((1U << mtail) - 1);
+  __m512d acc[4][4];
+  for (int jj = 0; jj < nj; jj++) {
+    for (int v = 0; v < nvec; v++) {
+      acc[jj][v] = _mm512_setzero_pd();
+    }
+  }
+  for (int l = 0; l < k; l++) {
+    const double *a_l = &a[l * ld];
+    __m512d a_v[4];
+    for (int v = 0; v < nvec - 1; v++) {
+      a_v[v] = _mm512_loadu_pd(&a_l[8 * v]);
+    }
+    a_v[nvec - 1] = _mm512_maskz_loadu_pd(tail, &a_l[8 * (nvec - 1)]);
+    for (int jj = 0; jj < nj; jj++) {
+      const __m512d b_jl = _mm512_set1_pd(b[jj + l * n]);
+      for (int v = 0; v < nvec; v++) {
+        acc[jj][v] = _mm512_fmadd_pd(a_v[v], b_jl, acc[jj][v]);
+      }
+    }
+  }
+  const __m512d alpha_v = _mm512_set1_pd(alpha);
+  for (int jj = 0; jj < nj; jj++) {
+    for (int v = 0; v < nvec - 1; v++) {
+      double *c_v = &c[jj * ld + 8 * v];
+      const __m512d acc_v = acc[jj][v];
+      const __m512d sum = _mm512_fmadd_pd(alpha_v, acc_v, _mm512_loadu_pd(c_v));
+      _mm512_storeu_pd(c_v, sum);
+    }
+  }
+  if (mtail == 8) {
+    for (int jj = 0; jj < nj; jj++) {
+      double *c_v = &c[jj * ld + 8 * (nvec - 1)];
+      const __m512d acc_v = acc[jj][nvec - 1];
+      const __m512d sum = _mm512_fmadd_pd(alpha_v, acc_v, _mm512_loadu_pd(c_v));
+      _mm512_storeu_pd(c_v, sum);
+    }
+  } else {
+    // Masked loads of C would stall on the preceding stores of other columns.
+    double buffer[4][8];
+    for (int jj = 0; jj < nj; jj++) {
+      _mm512_storeu_pd(buffer[jj], acc[jj][nvec - 1]);
+    }
+    for (int jj = 0; jj < nj; jj++) {
+      double *c_tail = &c[jj * ld + 8 * (nvec - 1)];
+      for (int i = 0; i < mtail; i++) {
+        c_tail[i] += alpha * buffer[jj][i];
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Private AVX-512 kernel for up to 8 * nvec rows.
+ *        It is specialized for each nvec below by DBM_SMM_AVX512.
+ ******************************************************************************/
+static inline __attribute__((always_inline)) void
+smm_avx512(const int nvec, const int ld, const int mc, const int n,
+           const int k, const double alpha, const double *restrict a,
+           const double *restrict b, double *restrict c) {
+  const int mtail = mc - 8 * (nvec - 1);
+  int j = 0;
+  for (; j + 4 <= n; j += 4) {
+    smm_avx512_cols(nvec, 4, mtail, ld, n, k, alpha, a, &b[j], &c[j * ld]);
+  }
+  for (; j < n; j++) {
+    smm_avx512_cols(nvec, 1, mtail, ld, n, k, alpha, a, &b[j], &c[j * ld]);
+  }
+}
+
+#define DBM_SMM_AVX512(NVEC)                                                   \
+  static void smm_avx512_##NVEC(const int ld, const int mc, const int n,       \
+                                const int k, const double alpha,               \
+                                const double *restrict a,                      \
+                                const double *restrict b,                      \
+                                double *restrict c) {                          \
+    smm_avx512(NVEC, ld, mc, n, k, alpha, a, b, c);                            \
+  }
+DBM_SMM_AVX512(1)
+DBM_SMM_AVX512(2)
+DBM_SMM_AVX512(3)
+DBM_SMM_AVX512(4)
+#undef DBM_SMM_AVX512
+
+static const smm_kernel_t smm_avx512_kernels[] = {
+    smm_avx512_1, smm_avx512_2, smm_avx512_3, smm_avx512_4};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+/*******************************************************************************
+ * \brief Private AVX2 micro kernel, which keeps nj columns of C in nvec
+ *        registers each. Multiple columns provide independent FMA chains.
+ ******************************************************************************/
+static inline __attribute__((always_inline)) void
+smm_avx2_cols(const int nvec, const int nj, const int mtail, const int ld,
+              const int n, const int k, const double alpha,
+              const double *restrict a, const double *restrict b,
+              double *restrict c) {
+  const __m256i tail = _mm256_cmpgt_epi64(_mm256_set1_epi64x(mtail),
+                                          _mm256_set_epi64x(3, 2, 1, 0));
+  __m256d acc[4][8];
+  for (int jj = 0; jj < nj; jj++) {
+    for (int v = 0; v < nvec; v++) {
+      acc[jj][v] = _mm256_setzero_pd();
+    }
+  }
+  for (int l = 0; l < k; l++) {
+    const double *a_l = &a[l * ld];
+    __m256d a_v[8];
+    for (int v = 0; v < nvec - 1; v++) {
+      a_v[v] = _mm256_loadu_pd(&a_l[4 * v]);
+    }
+    a_v[nvec - 1] = _mm256_maskload_pd(&a_l[4 * (nvec - 1)], tail);
+    for (int jj = 0; jj < nj; jj++) {
+      const __m256d b_jl = _mm256_broadcast_sd(&b[jj + l * n]);
+      for (int v = 0; v < nvec; v++) {
+        acc[jj][v] = _mm256_fmadd_pd(a_v[v], b_jl, acc[jj][v]);
+      }
+    }
+  }
+  const __m256d alpha_v = _mm256_set1_pd(alpha);
+  for (int jj = 0; jj < nj; jj++) {
+    for (int v = 0; v < nvec - 1; v++) {
+      double *c_v = &c[jj * ld + 4 * v];
+      const __m256d acc_v = acc[jj][v];
+      const __m256d sum = _mm256_fmadd_pd(alpha_v, acc_v, _mm256_loadu_pd(c_v));
+      _mm256_storeu_pd(c_v, sum);
+    }
+  }
+  if (mtail == 4) {
+    for (int jj = 0; jj < nj; jj++) {
+      double *c_v = &c[jj * ld + 4 * (nvec - 1)];
+      const __m256d acc_v = acc[jj][nvec - 1];
+      const __m256d sum = _mm256_fmadd_pd(alpha_v, acc_v, _mm256_loadu_pd(c_v));
+      _mm256_storeu_pd(c_v, sum);
+    }
+  } else {
+    // Masked loads of C would stall on the preceding stores of other columns.
+    double buffer[4][4];
+    for (int jj = 0; jj < nj; jj++) {
+      _mm256_storeu_pd(buffer[jj], acc[jj][nvec - 1]);
+    }
+    for (int jj = 0; jj < nj; jj++) {
+      double *c_tail = &c[jj * ld + 4 * (nvec - 1)];
+      for (int i = 0; i < mtail; i++) {
+        c_tail[i] += alpha * buffer[jj][i];
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Private AVX2 kernel for up to 4 * nvec rows. The number of columns
+ *        processed at once is chosen such that the accumulators fit into the
+ *        16 registers. It is specialized for each nvec below by DBM_SMM_AVX2.
+ ******************************************************************************/
+static inline __attribute__((always_inline)) void
+smm_avx2(const int nvec, const int ld, const int mc, const int n, const int k,
+         const double alpha, const double *restrict a,
+         const double *restrict b, double *restrict c) {
+  const int mtail = mc - 4 * (nvec - 1);
+  const int nj = (nvec <= 2) ? 4 : ((nvec <= 5) ? 2 : 1);
+  int j = 0;
+  for (; j + nj <= n; j += nj) {
+    smm_avx2_cols(nvec, nj, mtail, ld, n, k, alpha, a, &b[j], &c[j * ld]);
+  }
+  for (; j < n; j++) {
+    smm_avx2_cols(nvec, 1, mtail, ld, n, k, alpha, a, &b[j], &c[j * ld]);
+  }
+}
+
+#define DBM_SMM_AVX2(NVEC)                                                     \
+  static void smm_avx2_##NVEC(const int ld, const int mc, const int n,         \
+                              const int k, const double alpha,                 \
+                              const double *restrict a,                        \
+                              const double *restrict b, double *restrict c) {  \
+    smm_avx2(NVEC, ld, mc, n, k, alpha, a, b, c);                              \
+  }
+DBM_SMM_AVX2(1)
+DBM_SMM_AVX2(2)
+DBM_SMM_AVX2(3)
+DBM_SMM_AVX2(4)
+DBM_SMM_AVX2(5)
+DBM_SMM_AVX2(6)
+DBM_SMM_AVX2(7)
+DBM_SMM_AVX2(8)
+#undef DBM_SMM_AVX2
+
+static const smm_kernel_t smm_avx2_kernels[] = {
+    smm_avx2_1, smm_avx2_2, smm_avx2_3, smm_avx2_4,
+    smm_avx2_5, smm_avx2_6, smm_avx2_7, smm_avx2_8};
+
+#else
+/*******************************************************************************
+ * \brief Private generic small matrix multiplication kernel, which relies on
+ *        the compiler's auto-vectorization.
+ ******************************************************************************/
+static void smm_generic(const int ld, const int mc, const int n, const int k,
+                        const double alpha, const double *restrict a,
+                        const double *restrict b, double *restrict c) {
+  double acc[SMM_MAX_M];
+  for (int j = 0; j < n; j++) {
+    memset(acc, 0, mc * sizeof(double));
+    for (int l = 0; l < k; l++) {
+      const double b_jl = b[j + l * n];
+      const double *a_l = &a[l * ld];
+#pragma omp simd
+      for (int i = 0; i < mc; i++) {
+        acc[i] += a_l[i] * b_jl;
+      }
+    }
+    double *c_j = &c[j * ld];
+#pragma omp simd
+    for (int i = 0; i < mc; i++) {
+      c_j[i] += alpha * acc[i];
+    }
+  }
+}
+#endif
+
+/*******************************************************************************
+ * \brief Private routine for selecting a built-in kernel for mc rows.
+ *        The instruction set is determined at compile time. Only the number
+ *        of rows is specialized, while n and k remain runtime loop counts.
+ ******************************************************************************/
+static inline smm_kernel_t smm_select(const int mc) {
+  assert(0 < mc && mc <= SMM_MAX_M);
+#if defined(__AVX512F__)
+  return smm_avx512_kernels[(mc + 7) / 8 - 1];
+#elif defined(__AVX2__) && defined(__FMA__)
+  return smm_avx2_kernels[(mc + 3) / 4 - 1];
+#else
+  return smm_generic;
+#endif
+}
+#endif
+
 /*******************************************************************************
  * \brief Internal routine for executing the tasks in given batch on the CPU.
  * \author Ole Schuett
@@ -76,8 +338,6 @@ void dbm_multiply_cpu_process_batch(const int ntasks, dbm_task_t batch[ntasks],
   }
   dbm_shard_allocate_promised_blocks(shard_c);
 
-#if defined(__LIBXSMM)
-
   // Sort tasks approximately by m,n,k via bucket sort.
   int buckets[BATCH_NUM_BUCKETS];
   memset(buckets, 0, BATCH_NUM_BUCKETS * sizeof(int));
@@ -96,6 +356,8 @@ void dbm_multiply_cpu_process_batch(const int ntasks, dbm_task_t batch[ntasks],
     batch_order[buckets[i]] = itask;
   }
 
+#if defined(__LIBXSMM)
+
   // Prepare arguments for libxsmm's kernel-dispatch.
   const int flags = LIBXSMM_GEMM_FLAG_TRANS_B; // transa = "N", transb = "T"
   const int prefetch = DBM_LIBXSMM_PREFETCH;
@@ -168,16 +430,114 @@ void dbm_multiply_cpu_process_batch(const int ntasks, dbm_task_t batch[ntasks],
     }
   }
 #else
-  // Fallback to BLAS when libxsmm is not available.
+  // Use built-in kernels when libxsmm is not available.
+  const smm_kernel_t kernel_full = smm_select(SMM_MAX_M);
+  smm_kernel_t kernel_tail = NULL;
+  int kernel_m = 0;
   for (int itask = 0; itask < ntasks; ++itask) {
-    const dbm_task_t task = batch[itask];
+    const dbm_task_t task = batch[batch_order[itask]];
     const double *data_a = &pack_a->data[task.offset_a];
     const double *data_b = &pack_b->data[task.offset_b];
     double *data_c = &shard_c->data[task.offset_c];
-    dbm_dgemm('N', 'T', task.m, task.n, task.k, alpha, data_a, task.m, data_b,
-              task.n, 1.0, data_c, task.m);
+
+    // Fallback to BLAS for larger blocks.
+    if (task.m * task.n * task.k > SMM_MAX_MNK) {
+      dbm_dgemm('N', 'T', task.m, task.n, task.k, alpha, data_a, task.m,
+                data_b, task.n, 1.0, data_c, task.m);
+      continue;
+    }
+
+    // Kernels only depend on m, which is processed in chunks of SMM_MAX_M
+    // rows. Thanks to the sorting, the kernel for the tail rarely changes.
+    const int mtail = (task.m - 1) % SMM_MAX_M + 1;
+    if (task.m != kernel_m) {
+      kernel_tail = smm_select(mtail);
+      kernel_m = task.m;
+    }
+    int i = 0;
+    for (; i < task.m - mtail; i += SMM_MAX_M) {
+      kernel_full(task.m, SMM_MAX_M, task.n, task.k, alpha, &data_a[i],
+                  data_b, &data_c[i]);
+    }
+    kernel_tail(task.m, mtail, task.n, task.k, alpha, &data_a[i], data_b,
+                &data_c[i]);
   }
 #endif
 }
 
+/*******************************************************************************
+ * \brief Private kernel for the tasks of dbm_multiply's mixed-precision mode.
+ *        It computes C += alpha * A * B^T, where A is m x k and B is n x k,
+ *        from single precision copies of A and B. The products are summed in
+ *        single precision, which doubles the width of the SIMD lanes.
+ ******************************************************************************/
+static void smm_fp32(const int m, const int n, const int k, const double alpha,
+                     const float *restrict a, const float *restrict b,
+                     double *restrict c) {
+  float acc[SMM_MAX_M];
+  for (int i0 = 0; i0 < m; i0 += SMM_MAX_M) {
+    const int mc = (m - i0 < SMM_MAX_M) ? m - i0 : SMM_MAX_M;
+    for (int j = 0; j < n; j++) {
+      memset(acc, 0, mc * sizeof(float));
+      for (int l = 0; l < k; l++) {
+        const float b_jl = b[j + l * n];
+        const float *a_l = &a[i0 + l * m];
+#pragma omp simd
+        for (int i = 0; i < mc; i++) {
+          acc[i] += a_l[i] * b_jl;
+        }
+      }
+      double *c_j = &c[i0 + j * m];
+#pragma omp simd
+      for (int i = 0; i < mc; i++) {
+        c_j[i] += alpha * (double)acc[i];
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Internal routine for executing the tasks in given batch on the CPU
+ *        in single precision. The blocks of A and B are rounded on the fly.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_cpu_process_batch_fp32(const int ntasks,
+                                         const dbm_task_t batch[ntasks],
+                                         const double alpha,
+                                         const dbm_pack_t *pack_a,
+                                         const dbm_pack_t *pack_b,
+                                         dbm_shard_t *shard_c) {
+
+  if (0 >= ntasks) { // nothing to do
+    return;
+  }
+  dbm_shard_allocate_promised_blocks(shard_c);
+
+  int max_size_a = 0, max_size_b = 0;
+  for (int itask = 0; itask < ntasks; ++itask) {
+    const dbm_task_t task = batch[itask];
+    max_size_a = (task.m * task.k > max_size_a) ? task.m * task.k : max_size_a;
+    max_size_b = (task.n * task.k > max_size_b) ? task.n * task.k : max_size_b;
+  }
+  float *a = malloc(max_size_a * sizeof(float));
+  float *b = malloc(max_size_b * sizeof(float));
+
+  for (int itask = 0; itask < ntasks; ++itask) {
+    const dbm_task_t task = batch[itask];
+    const double *data_a = &pack_a->data[task.offset_a];
+    const double *data_b = &pack_b->data[task.offset_b];
+    for (int i = 0; i < task.m * task.k; i++) {
+      a[i] = (float)data_a[i];
+    }
+    for (int i = 0; i < task.n * task.k; i++) {
+      b[i] = (float)data_b[i];
+    }
+    smm_fp32(task.m, task.n, task.k, alpha, a, b,
+             &shard_c->data[task.offset_c]);
+  }
+
+  free(a);
+  free(b);
+}
+
 // EOF
@@ -22,6 +22,18 @@ void dbm_multiply_cpu_process_batch(const int ntasks, dbm_task_t batch[ntasks],
                                     const dbm_pack_t *pack_b,
                                     dbm_shard_t *shard_c);
 
+/*******************************************************************************
+ * \brief Internal routine for executing the tasks in given batch on the CPU
+ *        in single precision, see dbm_multiply's mixed-precision mode.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_multiply_cpu_process_batch_fp32(const int ntasks,
+                                         const dbm_task_t batch[ntasks],
+                                         const double alpha,
+                                         const dbm_pack_t *pack_a,
+                                         const dbm_pack_t *pack_b,
+                                         dbm_shard_t *shard_c);
+
 #endif
 
 // EOF
@@ -61,7 +61,7 @@ static void upload_pack(const dbm_pack_t *pack_host, dbm_pack_t *pack_dev,
 
   const size_t size = pack_host->data_size * sizeof(double);
   if (pack_dev->data_size < pack_host->data_size) {
-    dbm_mempool_free(pack_dev->data);
+    dbm_mempool_device_free(pack_dev->data);
     pack_dev->data = dbm_mempool_device_malloc(size);
   }
   offloadMemcpyAsyncHtoD(pack_dev->data, pack_host->data, size, stream);
@@ -135,7 +135,7 @@ void dbm_multiply_gpu_process_batch(const int ntasks, const dbm_task_t *batch,
                            shard_c_dev->stream);
     // Wait for copy to complete before freeing old buffer.
     offloadStreamSynchronize(shard_c_dev->stream);
-    dbm_mempool_free(old_data_dev);
+    dbm_mempool_device_free(old_data_dev);
   }
 
   // Zero new blocks if necessary.
@@ -194,13 +194,13 @@ void dbm_multiply_gpu_stop(dbm_multiply_gpu_context_t *ctx) {
     dbm_shard_gpu_t *shard_c_dev = &ctx->shards_c_dev[i];
     offloadStreamSynchronize(shard_c_dev->stream);
     offloadStreamDestroy(shard_c_dev->stream);
-    dbm_mempool_free(shard_c_dev->data);
+    dbm_mempool_device_free(shard_c_dev->data);
   }
   free(ctx->shards_c_dev);
 
-  dbm_mempool_free(ctx->pack_a_dev.data);
-  dbm_mempool_free(ctx->pack_b_dev.data);
-  dbm_mempool_free(ctx->batches_dev);
+  dbm_mempool_device_free(ctx->pack_a_dev.data);
+  dbm_mempool_device_free(ctx->pack_b_dev.data);
+  dbm_mempool_device_free(ctx->batches_dev);
   offloadStreamDestroy(ctx->main_stream);
 }
 
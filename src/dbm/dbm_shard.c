@@ -70,6 +70,12 @@ void dbm_shard_init(dbm_shard_t *shard) {
   shard->data_allocated = INITIAL_DATA_ALLOCATED;
   shard->data = malloc(shard->data_allocated * sizeof(double));
 
+  shard->frozen_nblocks = 0;
+  shard->frozen_nrows = 0;
+  shard->frozen_blocks = NULL;
+  shard->frozen_rows = NULL;
+  shard->frozen_row_start = NULL;
+
   omp_init_lock(&shard->lock);
 }
 
@@ -98,6 +104,8 @@ void dbm_shard_copy(dbm_shard_t *shard_a, const dbm_shard_t *shard_b) {
   shard_a->data = malloc(shard_b->data_allocated * sizeof(double));
   shard_a->data_size = shard_b->data_size;
   memcpy(shard_a->data, shard_b->data, shard_b->data_size * sizeof(double));
+
+  dbm_shard_unfreeze(shard_a);
 }
 
 /*******************************************************************************
@@ -108,6 +116,7 @@ void dbm_shard_release(dbm_shard_t *shard) {
   free(shard->blocks);
   free(shard->hashtable);
   free(shard->data);
+  dbm_shard_unfreeze(shard);
   omp_destroy_lock(&shard->lock);
 }
 
@@ -164,6 +173,215 @@ dbm_block_t *dbm_shard_lookup(const dbm_shard_t *shard, const int row,
   }
 }
 
+/*******************************************************************************
+ * \brief Private comperator passed to qsort to compare two blocks by row/col.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compare_blocks_by_row_col(const void *a, const void *b) {
+  const dbm_block_t *blk_a = (const dbm_block_t *)a;
+  const dbm_block_t *blk_b = (const dbm_block_t *)b;
+  if (blk_a->row != blk_b->row) {
+    return (blk_a->row < blk_b->row) ? -1 : 1;
+  }
+  return (blk_a->col > blk_b->col) - (blk_a->col < blk_b->col);
+}
+
+/*******************************************************************************
+ * \brief Private routine for computing the row offsets of the frozen index in
+ *        compressed sparse row fashion.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void frozen_rows_init(dbm_shard_t *shard) {
+  const int n = shard->frozen_nblocks;
+  free(shard->frozen_rows);
+  free(shard->frozen_row_start);
+  shard->frozen_rows = malloc(n * sizeof(int));
+  shard->frozen_row_start = malloc((n + 1) * sizeof(int));
+  shard->frozen_nrows = 0;
+  for (int k = 0; k < n; k++) {
+    const int row = shard->blocks[shard->frozen_blocks[k]].row;
+    if (k == 0 || row != shard->frozen_rows[shard->frozen_nrows - 1]) {
+      shard->frozen_rows[shard->frozen_nrows] = row;
+      shard->frozen_row_start[shard->frozen_nrows] = k;
+      shard->frozen_nrows++;
+    }
+  }
+  shard->frozen_row_start[shard->frozen_nrows] = n;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for updating the frozen index to cover all blocks.
+ *        Blocks added afterwards are not covered until the next freeze.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_freeze(dbm_shard_t *shard) {
+  if (dbm_shard_is_frozen(shard)) {
+    return; // nothing to do
+  }
+  const int nold = shard->frozen_nblocks;
+  const int nnew = shard->nblocks - nold;
+  assert(0 <= nold && 0 <= nnew); // blocks must not be removed while frozen
+
+  // Sort the new blocks. Their block number is temporarily stored as offset.
+  dbm_block_t *tail = malloc(nnew * sizeof(dbm_block_t));
+  bool is_sorted = true;
+  for (int i = 0; i < nnew; i++) {
+    tail[i] = shard->blocks[nold + i];
+    tail[i].offset = nold + i;
+    if (i > 0 && compare_blocks_by_row_col(&tail[i - 1], &tail[i]) > 0) {
+      is_sorted = false;
+    }
+  }
+  if (!is_sorted) {
+    qsort(tail, nnew, sizeof(dbm_block_t), &compare_blocks_by_row_col);
+  }
+
+  // Merge the new blocks into the existing order. The index of an empty shard
+  // still gets allocated because a NULL index means not frozen.
+  int *merged = malloc((shard->nblocks + 1) * sizeof(int));
+  int i = 0, j = 0, n = 0;
+  while (i < nold || j < nnew) {
+    if (j == nnew || (i < nold && compare_blocks_by_row_col(
+                                      &shard->blocks[shard->frozen_blocks[i]],
+                                      &tail[j]) < 0)) {
+      merged[n++] = shard->frozen_blocks[i++];
+    } else {
+      merged[n++] = tail[j++].offset;
+    }
+  }
+  assert(n == shard->nblocks);
+  free(tail);
+  free(shard->frozen_blocks);
+  shard->frozen_blocks = merged;
+  shard->frozen_nblocks = shard->nblocks;
+  frozen_rows_init(shard);
+}
+
+/*******************************************************************************
+ * \brief Internal routine for renumbering the frozen index after blocks were
+ *        removed. The new_index maps old block numbers to new ones or to -1.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_renumber_frozen(dbm_shard_t *shard, const int old_nblocks,
+                               const int new_index[old_nblocks]) {
+  assert(shard->frozen_nblocks == old_nblocks);
+  int n = 0;
+  for (int k = 0; k < old_nblocks; k++) {
+    const int iblock = new_index[shard->frozen_blocks[k]];
+    if (iblock >= 0) {
+      shard->frozen_blocks[n++] = iblock;
+    }
+  }
+  assert(n == shard->nblocks);
+  shard->frozen_nblocks = n;
+  frozen_rows_init(shard);
+}
+
+/*******************************************************************************
+ * \brief Internal routine for discarding the frozen index.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_unfreeze(dbm_shard_t *shard) {
+  free(shard->frozen_blocks);
+  free(shard->frozen_rows);
+  free(shard->frozen_row_start);
+  shard->frozen_blocks = NULL;
+  shard->frozen_rows = NULL;
+  shard->frozen_row_start = NULL;
+  shard->frozen_nblocks = 0;
+  shard->frozen_nrows = 0;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for creating a cursor into a frozen shard.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_cursor_init(const dbm_shard_t *shard,
+                           dbm_shard_cursor_t *cursor) {
+  cursor->shard = shard;
+  cursor->row = -1;
+  cursor->begin = cursor->end = cursor->pos = 0;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for looking up a block via a cursor.
+ *        Only blocks covered by the frozen index are found. Lookups are cheap
+ *        when consecutive calls ask for the same row and ascending columns.
+ * \author Ole Schuett
+ ******************************************************************************/
+dbm_block_t *dbm_shard_cursor_lookup(dbm_shard_cursor_t *cursor, const int row,
+                                     const int col) {
+  const dbm_shard_t *shard = cursor->shard;
+  const int *frozen = shard->frozen_blocks;
+
+  if (row != cursor->row) {
+    // Binary search for the row's segment.
+    int lower = 0, upper = shard->frozen_nrows;
+    while (lower < upper) {
+      const int middle = (lower + upper) / 2;
+      if (shard->frozen_rows[middle] < row) {
+        lower = middle + 1;
+      } else {
+        upper = middle;
+      }
+    }
+    cursor->row = row;
+    if (lower < shard->frozen_nrows && shard->frozen_rows[lower] == row) {
+      cursor->begin = shard->frozen_row_start[lower];
+      cursor->end = shard->frozen_row_start[lower + 1];
+    } else {
+      cursor->begin = cursor->end = 0; // row has no blocks
+    }
+    cursor->pos = cursor->begin;
+  } else if (cursor->pos > cursor->begin &&
+             col <= shard->blocks[frozen[cursor->pos - 1]].col) {
+    // Binary search among the already passed blocks for descending columns.
+    int lower = cursor->begin, upper = cursor->pos - 1;
+    while (lower < upper) {
+      const int middle = (lower + upper) / 2;
+      if (shard->blocks[frozen[middle]].col < col) {
+        lower = middle + 1;
+      } else {
+        upper = middle;
+      }
+    }
+    cursor->pos = lower;
+  }
+
+  // Stream through the segment.
+  while (cursor->pos < cursor->end &&
+         shard->blocks[frozen[cursor->pos]].col < col) {
+    cursor->pos++;
+  }
+  if (cursor->pos < cursor->end) {
+    dbm_block_t *blk = &shard->blocks[frozen[cursor->pos]];
+    if (blk->col == col) {
+      return blk;
+    }
+  }
+  return NULL; // block not found
+}
+
+/*******************************************************************************
+ * \brief Internal routine for growing the blocks array to hold nblocks.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_reserve_blocks(dbm_shard_t *shard, const int nblocks) {
+  if (shard->nblocks_allocated >= nblocks) {
+    return;
+  }
+  shard->nblocks_allocated = nblocks;
+  shard->blocks = (dbm_block_t *)realloc(
+      shard->blocks, shard->nblocks_allocated * sizeof(dbm_block_t));
+
+  // rebuild hashtable
+  free(shard->hashtable);
+  hashtable_init(shard);
+  for (int i = 0; i < shard->nblocks; i++) {
+    hashtable_insert(shard, i);
+  }
+}
+
 /*******************************************************************************
  * \brief Internal routine for allocating the metadata of a new block.
  * \author Ole Schuett
@@ -172,16 +390,7 @@ dbm_block_t *dbm_shard_promise_new_block(dbm_shard_t *shard, const int row,
                                          const int col, const int block_size) {
   // Grow blocks array if necessary.
   if (shard->nblocks_allocated < shard->nblocks + 1) {
-    shard->nblocks_allocated = ALLOCATION_FACTOR * (shard->nblocks + 1);
-    shard->blocks = (dbm_block_t *)realloc(
-        shard->blocks, shard->nblocks_allocated * sizeof(dbm_block_t));
-
-    // rebuild hashtable
-    free(shard->hashtable);
-    hashtable_init(shard);
-    for (int i = 0; i < shard->nblocks; i++) {
-      hashtable_insert(shard, i);
-    }
+    dbm_shard_reserve_blocks(shard, ALLOCATION_FACTOR * (shard->nblocks + 1));
   }
 
   const int new_block_idx = shard->nblocks;
@@ -8,6 +8,7 @@
 #define DBM_SHARD_H
 
 #include <omp.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,9 +44,29 @@ typedef struct {
   int data_size;      // actually allocated and initialized
   double *data;
 
+  // Optional frozen index that orders the blocks by row and then by col.
+  // It covers the first frozen_nblocks blocks and is rebuilt by freezing.
+  int frozen_nblocks;
+  int frozen_nrows;      // number of distinct rows among the covered blocks
+  int *frozen_blocks;    // block numbers ordered by row and then by col
+  int *frozen_rows;      // distinct rows in ascending order
+  int *frozen_row_start; // offsets into frozen_blocks, has frozen_nrows + 1
+
   omp_lock_t lock; // used by dbm_put_block
 } dbm_shard_t;
 
+/*******************************************************************************
+ * \brief Internal struct for streaming lookups in a frozen shard.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  const dbm_shard_t *shard;
+  int row;   // row of the current segment
+  int begin; // current segment within frozen_blocks
+  int end;
+  int pos; // current position within segment
+} dbm_shard_cursor_t;
+
 /*******************************************************************************
  * \brief Internal routine for initializing a shard.
  * \author Ole Schuett
@@ -71,6 +92,60 @@ void dbm_shard_release(dbm_shard_t *shard);
 dbm_block_t *dbm_shard_lookup(const dbm_shard_t *shard, const int row,
                               const int col);
 
+/*******************************************************************************
+ * \brief Internal routine for updating the frozen index to cover all blocks.
+ *        Blocks added afterwards are not covered until the next freeze.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_freeze(dbm_shard_t *shard);
+
+/*******************************************************************************
+ * \brief Internal routine for renumbering the frozen index after blocks were
+ *        removed. The new_index maps old block numbers to new ones or to -1.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_renumber_frozen(dbm_shard_t *shard, const int old_nblocks,
+                               const int new_index[old_nblocks]);
+
+/*******************************************************************************
+ * \brief Internal routine for discarding the frozen index.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_unfreeze(dbm_shard_t *shard);
+
+/*******************************************************************************
+ * \brief Internal routine for testing if the frozen index covers all blocks.
+ *        A shard without index is never frozen, even when it has no blocks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline bool dbm_shard_is_frozen(const dbm_shard_t *shard) {
+  return shard->frozen_blocks != NULL &&
+         shard->frozen_nblocks == shard->nblocks;
+}
+
+/*******************************************************************************
+ * \brief Internal routine for creating a cursor into a frozen shard.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_cursor_init(const dbm_shard_t *shard,
+                           dbm_shard_cursor_t *cursor);
+
+/*******************************************************************************
+ * \brief Internal routine for looking up a block via a cursor.
+ *        Only blocks covered by the frozen index are found. Lookups are cheap
+ *        when consecutive calls ask for the same row and ascending columns,
+ *        other orders cost a binary search.
+ * \author Ole Schuett
+ ******************************************************************************/
+dbm_block_t *dbm_shard_cursor_lookup(dbm_shard_cursor_t *cursor, const int row,
+                                     const int col);
+
+/*******************************************************************************
+ * \brief Internal routine for growing the blocks array to hold nblocks.
+ * \author Ole Schuett
+ ******************************************************************************/
+void dbm_shard_reserve_blocks(dbm_shard_t *shard, const int nblocks);
+
 /*******************************************************************************
  * \brief Internal routine for allocating the metadata of a new block.
  * \author Ole Schuett
@@ -52,6 +52,7 @@ enum grid_backend {
   GRID_BACKEND_DGEMM = 13,
   GRID_BACKEND_GPU = 14,
   GRID_BACKEND_HIP = 15,
+  GRID_BACKEND_TUNED = 16,
 };
 
 #endif
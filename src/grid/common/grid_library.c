@@ -5,13 +5,22 @@
 /*  SPDX-License-Identifier: BSD-3-Clause                                     */
 /*----------------------------------------------------------------------------*/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <math.h>
 #include <omp.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
+#include "../../offload/offload_buffer.h"
 #include "../../offload/offload_runtime.h"
 #include "grid_common.h"
 #include "grid_constants.h"
@@ -21,17 +30,60 @@
 #define GRID_NBACKENDS 5
 #define GRID_NKERNELS 4
 #define GRID_MAX_LP 20
+#define GRID_NPHASES 5
+
+// autotuning table dimension, higher levels are clamped
+#define GRID_TUNING_MAX_LEVELS 8
+
+// Grid spacings are binned in steps of 2^(1/4), i.e. about 19%, ranging from
+// 2^-7 to 2^4 bohr. Spacings outside this range are clamped.
+#define GRID_TUNING_MIN_SPACING_BIN (-28)
+#define GRID_TUNING_NSPACING_BINS 45
+
+typedef struct {
+  long calls;
+  long ticks;
+  long npoints;
+  long nbytes;
+} grid_library_timing;
 
 typedef struct {
   grid_sphere_cache sphere_cache;
   long counters[GRID_NBACKENDS * GRID_NKERNELS * GRID_MAX_LP];
+  grid_library_timing kernel_timings[GRID_NBACKENDS * GRID_NKERNELS *
+                                     GRID_MAX_LP];
+  grid_library_timing phase_timings[GRID_NBACKENDS * GRID_NPHASES];
+  long screened_tasks;
+  long skipped_tasks;
 } grid_library_globals;
 
 static grid_library_globals **per_thread_globals = NULL;
 static bool library_initialized = false;
 static int max_threads = 0;
-static grid_library_config config = {
-    .backend = GRID_BACKEND_AUTO, .validate = false, .apply_cutoff = false};
+static grid_library_config config = {.backend = GRID_BACKEND_AUTO,
+                                      .validate = false,
+                                      .apply_cutoff = false,
+                                      .tiled_collocate = false,
+                                      .collocate_tiles = 0,
+                                      .spatial_ordering = false,
+                                      .fused_integrate = false,
+                                      .eps_screening = 0.0};
+static const char *backend_names[GRID_NBACKENDS] = {"REF", "CPU", "DGEMM",
+                                                    "GPU", "HIP"};
+static const char *kernel_names[GRID_NKERNELS] = {
+    "collocate ortho", "integrate ortho", "collocate general",
+    "integrate general"};
+static const char *phase_names[GRID_NPHASES] = {
+    "load_pab", "cab_to_grid", "grid_to_cab", "reduction", "store_hab"};
+
+// Timing instrumentation, the ticks are calibrated against the wall clock.
+static bool timings_enabled = false;
+static long init_ticks = 0;
+static double init_time = 0.0;
+
+// Backends picked by the autotuner, zero means no decision was made yet.
+static int tuned_backends[2][GRID_TUNING_MAX_LEVELS][GRID_TUNING_NSPACING_BINS]
+                         [GRID_TUNING_MAX_LP];
 
 #if !defined(_OPENMP)
 #error "OpenMP is required. Please add -fopenmp to your C compiler flags."
@@ -42,6 +94,47 @@ static grid_library_config config = {
     "Please do not build CP2K with NDEBUG. There is no performance advantage and asserts will save your neck."
 #endif
 
+/*******************************************************************************
+ * \brief Private routine for loading the decisions of the autotuner from the
+ *        file given by the environment variable GRID_AUTOTUNE_FILE.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void load_tuning(void) {
+  memset(tuned_backends, 0, sizeof(tuned_backends));
+  const char *filename = getenv("GRID_AUTOTUNE_FILE");
+  if (filename == NULL) {
+    return;
+  }
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return; // nothing was tuned yet
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    int ortho, level, lp;
+    double spacing;
+    char name[16];
+    if (line[0] == '#' || sscanf(line, "%i %i %lf %i %15s", &ortho, &level,
+                                 &spacing, &lp, name) != 5) {
+      continue; // skip comments, empty lines, and lines of older versions
+    }
+    int backend = 0;
+    for (int i = 0; i < GRID_NBACKENDS; i++) {
+      if (strcmp(name, backend_names[i]) == 0) {
+        backend = GRID_BACKEND_REF + i;
+      }
+    }
+    if (backend == 0 || ortho < 0 || ortho > 1 || level < 1 || lp < 0 ||
+        !(spacing > 0.0)) {
+      fprintf(stderr, "Warning: Ignoring invalid line in %s: %s", filename,
+              line);
+      continue;
+    }
+    grid_library_set_tuned_backend(ortho, level - 1, spacing, lp, backend);
+  }
+  fclose(fp);
+}
+
 /*******************************************************************************
  * \brief Initializes the grid library.
  * \author Ole Schuett
@@ -73,6 +166,13 @@ void grid_library_init(void) {
     memset(per_thread_globals[ithread], 0, sizeof(grid_library_globals));
   }
 
+  load_tuning();
+
+  timings_enabled = (getenv("GRID_TIMINGS") != NULL ||
+                     getenv("GRID_TIMINGS_JSON") != NULL);
+  init_ticks = grid_library_ticks();
+  init_time = omp_get_wtime();
+
   library_initialized = true;
 }
 
@@ -110,10 +210,20 @@ grid_sphere_cache *grid_library_get_sphere_cache(void) {
  * \author Ole Schuett
  ******************************************************************************/
 void grid_library_set_config(const enum grid_backend backend,
-                             const bool validate, const bool apply_cutoff) {
+                             const bool validate, const bool apply_cutoff,
+                             const bool tiled_collocate,
+                             const int collocate_tiles,
+                             const bool spatial_ordering,
+                             const bool fused_integrate,
+                             const double eps_screening) {
   config.backend = backend;
   config.validate = validate;
   config.apply_cutoff = apply_cutoff;
+  config.tiled_collocate = tiled_collocate;
+  config.collocate_tiles = collocate_tiles;
+  config.spatial_ordering = spatial_ordering;
+  config.fused_integrate = fused_integrate;
+  config.eps_screening = eps_screening;
 }
 
 /*******************************************************************************
@@ -140,6 +250,462 @@ void grid_library_counter_add(const int lp, const enum grid_backend backend,
   per_thread_globals[ithread]->counters[idx] += increment;
 }
 
+/*******************************************************************************
+ * \brief Counts a task that was considered by the screening.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_screening_add(const bool skipped) {
+  const int ithread = omp_get_thread_num();
+  assert(ithread < max_threads);
+  per_thread_globals[ithread]->screened_tasks++;
+  if (skipped) {
+    per_thread_globals[ithread]->skipped_tasks++;
+  }
+}
+
+/*******************************************************************************
+ * \brief Returns the number of screened and skipped tasks of this process.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_get_screening(long *screened_tasks, long *skipped_tasks) {
+  *screened_tasks = 0;
+  *skipped_tasks = 0;
+  for (int i = 0; i < max_threads; i++) {
+    *screened_tasks += per_thread_globals[i]->screened_tasks;
+    *skipped_tasks += per_thread_globals[i]->skipped_tasks;
+  }
+}
+
+/*******************************************************************************
+ * \brief Returns true when the timing instrumentation is enabled.
+ * \author Ole Schuett
+ ******************************************************************************/
+bool grid_library_timings_enabled(void) { return timings_enabled; }
+
+/*******************************************************************************
+ * \brief Returns a timestamp in ticks of the processor's time stamp counter.
+ * \author Ole Schuett
+ ******************************************************************************/
+long grid_library_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return (long)__rdtsc();
+#else
+  return (long)(omp_get_wtime() * 1e9);
+#endif
+}
+
+/*******************************************************************************
+ * \brief Adds given measurements to the timings of the specified kernel.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_kernel_timing_add(const int lp,
+                                    const enum grid_backend backend,
+                                    const enum grid_library_kernel kernel,
+                                    const long ticks, const long npoints,
+                                    const long nbytes) {
+  assert(lp >= 0);
+  assert(kernel < GRID_NKERNELS);
+  const int back = backend - GRID_BACKEND_REF;
+  assert(back < GRID_NBACKENDS);
+  const int idx = back * GRID_NKERNELS * GRID_MAX_LP + kernel * GRID_MAX_LP +
+                  imin(lp, GRID_MAX_LP - 1);
+  const int ithread = omp_get_thread_num();
+  assert(ithread < max_threads);
+  grid_library_timing *timing =
+      &per_thread_globals[ithread]->kernel_timings[idx];
+  timing->calls++;
+  timing->ticks += ticks;
+  timing->npoints += npoints;
+  timing->nbytes += nbytes;
+}
+
+/*******************************************************************************
+ * \brief Adds given measurements to the timings of the specified phase.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_phase_timing_add(const enum grid_backend backend,
+                                   const enum grid_library_phase phase,
+                                   const long ticks, const long nbytes) {
+  assert(phase < GRID_NPHASES);
+  const int back = backend - GRID_BACKEND_REF;
+  assert(back < GRID_NBACKENDS);
+  const int idx = back * GRID_NPHASES + phase;
+  const int ithread = omp_get_thread_num();
+  assert(ithread < max_threads);
+  grid_library_timing *timing =
+      &per_thread_globals[ithread]->phase_timings[idx];
+  timing->calls++;
+  timing->ticks += ticks;
+  timing->nbytes += nbytes;
+}
+
+/*******************************************************************************
+ * \brief Private routine for looking up the bin of given grid spacing.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int spacing_bin(const double spacing) {
+  assert(spacing > 0.0);
+  const int ibin =
+      (int)lround(4.0 * log2(spacing)) - GRID_TUNING_MIN_SPACING_BIN;
+  return imax(0, imin(ibin, GRID_TUNING_NSPACING_BINS - 1));
+}
+
+/*******************************************************************************
+ * \brief Private routine for returning the grid spacing at the bin's center.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double bin_spacing(const int ibin) {
+  return exp2(0.25 * (ibin + GRID_TUNING_MIN_SPACING_BIN));
+}
+
+/*******************************************************************************
+ * \brief Private routine for looking up an entry of the autotuning table.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int *tuning_entry(const bool orthorhombic, const int level,
+                         const double spacing, const int lp) {
+  assert(level >= 0 && lp >= 0);
+  const int ilevel = imin(level, GRID_TUNING_MAX_LEVELS - 1);
+  const int ilp = imin(lp, GRID_TUNING_MAX_LP - 1);
+  return &tuned_backends[orthorhombic][ilevel][spacing_bin(spacing)][ilp];
+}
+
+/*******************************************************************************
+ * \brief Returns the backend that the autotuner picked for given tasks.
+ * \author Ole Schuett
+ ******************************************************************************/
+enum grid_backend grid_library_get_tuned_backend(const bool orthorhombic,
+                                                 const int level,
+                                                 const double spacing,
+                                                 const int lp) {
+  const int backend = *tuning_entry(orthorhombic, level, spacing, lp);
+  return (backend == 0) ? GRID_BACKEND_AUTO : (enum grid_backend)backend;
+}
+
+/*******************************************************************************
+ * \brief Records the backend that the autotuner picked for given tasks.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_set_tuned_backend(const bool orthorhombic, const int level,
+                                    const double spacing, const int lp,
+                                    const enum grid_backend backend) {
+  assert(GRID_BACKEND_REF <= backend &&
+         backend < GRID_BACKEND_REF + GRID_NBACKENDS);
+  *tuning_entry(orthorhombic, level, spacing, lp) = backend;
+}
+
+/*******************************************************************************
+ * \brief Writes the decisions of the autotuner to a file.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_save_tuning(void) {
+  const char *filename = getenv("GRID_AUTOTUNE_FILE");
+  if (filename == NULL) {
+    return;
+  }
+
+  // Several processes might save at the same time. Hence, each one writes a
+  // private file first, which then atomically replaces the old one.
+  char tmp_filename[1024];
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.%i", filename,
+           (int)getpid());
+  FILE *fp = fopen(tmp_filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Warning: Could not write file: %s\n", tmp_filename);
+    return;
+  }
+  fprintf(fp, "# Grid autotuning decisions: "
+              "orthorhombic level spacing lp backend\n");
+  for (int ortho = 0; ortho < 2; ortho++) {
+    for (int level = 0; level < GRID_TUNING_MAX_LEVELS; level++) {
+      for (int ibin = 0; ibin < GRID_TUNING_NSPACING_BINS; ibin++) {
+        for (int lp = 0; lp < GRID_TUNING_MAX_LP; lp++) {
+          const int backend = tuned_backends[ortho][level][ibin][lp];
+          if (backend != 0) {
+            fprintf(fp, "%i %i %.4f %i %s\n", ortho, level + 1,
+                    bin_spacing(ibin), lp,
+                    backend_names[backend - GRID_BACKEND_REF]);
+          }
+        }
+      }
+    }
+  }
+  fclose(fp);
+  if (rename(tmp_filename, filename) != 0) {
+    fprintf(stderr, "Warning: Could not write file: %s\n", filename);
+    remove(tmp_filename);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for printing the banner of a statistics table.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void print_banner(const char *title, void (*print_func)(char *, int),
+                         const int output_unit) {
+  char buffer[100];
+  const int indent = (79 - strlen(title)) / 2;
+  snprintf(buffer, sizeof(buffer), " -%*s%-*s-\n", indent, "", 77 - indent,
+           title);
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+  print_func(buffer, output_unit);
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+}
+
+/*******************************************************************************
+ * \brief Private routine for summing timings across threads and mpi ranks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void sum_timings(const bool kernels, const int ntimings,
+                        void (*mpi_sum_func)(long *, int), const int mpi_comm,
+                        grid_library_timing totals[ntimings]) {
+  memset(totals, 0, ntimings * sizeof(grid_library_timing));
+  for (int i = 0; i < ntimings; i++) {
+    for (int j = 0; j < max_threads; j++) {
+      const grid_library_timing *timing =
+          (kernels) ? &per_thread_globals[j]->kernel_timings[i]
+                    : &per_thread_globals[j]->phase_timings[i];
+      totals[i].calls += timing->calls;
+      totals[i].ticks += timing->ticks;
+      totals[i].npoints += timing->npoints;
+      totals[i].nbytes += timing->nbytes;
+    }
+    mpi_sum_func(&totals[i].calls, mpi_comm);
+    mpi_sum_func(&totals[i].ticks, mpi_comm);
+    mpi_sum_func(&totals[i].npoints, mpi_comm);
+    mpi_sum_func(&totals[i].nbytes, mpi_comm);
+  }
+}
+
+/*******************************************************************************
+ * \brief Comperator passed to qsort to sort timings by descending ticks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compare_ticks(const void *a, const void *b) {
+  const long ticks_a = *(const long *)a, ticks_b = *(const long *)b;
+  return (ticks_a < ticks_b) - (ticks_a > ticks_b);
+}
+
+/*******************************************************************************
+ * \brief Private routine for writing the timings to a JSON file.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void write_timings_json(const char *filename,
+                               const double ticks_per_second,
+                               const int nkernel_timings,
+                               const grid_library_timing kernels[],
+                               const int nphase_timings,
+                               const grid_library_timing phases[]) {
+
+  // Several processes might write at the same time, see also save_tuning.
+  char tmp_filename[1024];
+  snprintf(tmp_filename, sizeof(tmp_filename), "%s.%i", filename,
+           (int)getpid());
+  FILE *fp = fopen(tmp_filename, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Warning: Could not write file: %s\n", tmp_filename);
+    return;
+  }
+
+  fprintf(fp, "{\n  \"ticks_per_second\": %.6e,\n  \"kernels\": [",
+          ticks_per_second);
+  bool first = true;
+  for (int i = 0; i < nkernel_timings; i++) {
+    if (kernels[i].calls == 0) {
+      continue;
+    }
+    const int backend_stride = GRID_NKERNELS * GRID_MAX_LP;
+    const int back = i / backend_stride;
+    const int kern = (i % backend_stride) / GRID_MAX_LP;
+    const int lp = (i % backend_stride) % GRID_MAX_LP;
+    fprintf(fp,
+            "%s\n    {\"backend\": \"%s\", \"kernel\": \"%s\", \"lp\": %i, "
+            "\"calls\": %li, \"seconds\": %.6e, \"grid_points\": %li, "
+            "\"bytes\": %li}",
+            (first) ? "" : ",", backend_names[back], kernel_names[kern], lp,
+            kernels[i].calls, kernels[i].ticks / ticks_per_second,
+            kernels[i].npoints, kernels[i].nbytes);
+    first = false;
+  }
+  fprintf(fp, "\n  ],\n  \"phases\": [");
+  first = true;
+  for (int i = 0; i < nphase_timings; i++) {
+    if (phases[i].calls == 0) {
+      continue;
+    }
+    fprintf(fp,
+            "%s\n    {\"backend\": \"%s\", \"phase\": \"%s\", "
+            "\"calls\": %li, \"seconds\": %.6e, \"bytes\": %li}",
+            (first) ? "" : ",", backend_names[i / GRID_NPHASES],
+            phase_names[i % GRID_NPHASES], phases[i].calls,
+            phases[i].ticks / ticks_per_second, phases[i].nbytes);
+    first = false;
+  }
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+
+  if (rename(tmp_filename, filename) != 0) {
+    fprintf(stderr, "Warning: Could not write file: %s\n", filename);
+    remove(tmp_filename);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for printing the timings of kernels and phases.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void print_timings(void (*mpi_sum_func)(long *, int),
+                          const int mpi_comm, void (*print_func)(char *, int),
+                          const int output_unit) {
+
+  // Sum all timings across threads and mpi ranks.
+  const int nkernel_timings = GRID_NBACKENDS * GRID_NKERNELS * GRID_MAX_LP;
+  const int nphase_timings = GRID_NBACKENDS * GRID_NPHASES;
+  grid_library_timing kernels[nkernel_timings], phases[nphase_timings];
+  sum_timings(true, nkernel_timings, mpi_sum_func, mpi_comm, kernels);
+  sum_timings(false, nphase_timings, mpi_sum_func, mpi_comm, phases);
+
+  // Calibrate the ticks against the wall clock.
+  const double elapsed_time = omp_get_wtime() - init_time;
+  const double ticks_per_second =
+      (elapsed_time > 0.0) ? (grid_library_ticks() - init_ticks) / elapsed_time
+                           : 1e9;
+
+  // Print kernels sorted by time. Times are summed over threads and ranks,
+  // hence throughputs are per thread.
+  char buffer[100];
+  long order[nkernel_timings][2];
+  for (int i = 0; i < nkernel_timings; i++) {
+    order[i][0] = kernels[i].ticks;
+    order[i][1] = i; // needed as inverse index after qsort
+  }
+  qsort(order, nkernel_timings, 2 * sizeof(long), &compare_ticks);
+
+  print_banner("GRID TIMINGS", print_func, output_unit);
+  snprintf(buffer, sizeof(buffer), " %-5s %-17s  %-6s %14s %12s %9s %9s\n",
+           "LP", "KERNEL", "BACKEND", "CALLS", "SECONDS", "GPTS/S", "GB/S");
+  print_func(buffer, output_unit);
+  for (int i = 0; i < nkernel_timings; i++) {
+    const int idx = order[i][1];
+    if (kernels[idx].calls == 0) {
+      continue; // skip empty timings
+    }
+    const int backend_stride = GRID_NKERNELS * GRID_MAX_LP;
+    const int back = idx / backend_stride;
+    const int kern = (idx % backend_stride) / GRID_MAX_LP;
+    const int lp = (idx % backend_stride) % GRID_MAX_LP;
+    const double seconds = kernels[idx].ticks / ticks_per_second;
+    const double points_rate = kernels[idx].npoints / seconds * 1e-9;
+    const double bytes_rate = kernels[idx].nbytes / seconds * 1e-9;
+    snprintf(buffer, sizeof(buffer),
+             " %-5i %-17s  %-6s %14li %12.3f %9.3f %9.3f\n", lp,
+             kernel_names[kern], backend_names[back], kernels[idx].calls,
+             seconds, points_rate, bytes_rate);
+    print_func(buffer, output_unit);
+  }
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+
+  // Print phases in their natural order.
+  double total_ticks = 0.0;
+  for (int i = 0; i < nphase_timings; i++) {
+    total_ticks += phases[i].ticks;
+  }
+  snprintf(buffer, sizeof(buffer), " %-17s  %-6s %14s %12s %9s %15s\n",
+           "PHASE", "BACKEND", "CALLS", "SECONDS", "GB/S", "PERCENT");
+  print_func(buffer, output_unit);
+  for (int i = 0; i < nphase_timings; i++) {
+    if (phases[i].calls == 0) {
+      continue; // skip empty timings
+    }
+    const double seconds = phases[i].ticks / ticks_per_second;
+    char bytes_rate[16] = "-"; // not all phases move a known amount of bytes
+    if (phases[i].nbytes > 0) {
+      snprintf(bytes_rate, sizeof(bytes_rate), "%.3f",
+               phases[i].nbytes / seconds * 1e-9);
+    }
+    snprintf(buffer, sizeof(buffer), " %-17s  %-6s %14li %12.3f %9s %14.2f%%\n",
+             phase_names[i % GRID_NPHASES], backend_names[i / GRID_NPHASES],
+             phases[i].calls, seconds, bytes_rate,
+             100.0 * phases[i].ticks / total_ticks);
+    print_func(buffer, output_unit);
+  }
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+
+  // Export timings when requested. Only printing processes write the file.
+  const char *filename = getenv("GRID_TIMINGS_JSON");
+  if (filename != NULL && output_unit >= 0) {
+    write_timings_json(filename, ticks_per_second, nkernel_timings, kernels,
+                       nphase_timings, phases);
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for printing the decisions of the autotuner.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void print_tuning(void (*print_func)(char *, int),
+                         const int output_unit) {
+  print_banner("GRID AUTOTUNING DECISIONS", print_func, output_unit);
+  print_func(" CELL          LEVEL     SPACING   LP                           "
+             "         BACKEND\n",
+             output_unit);
+
+  const char *cell_names[] = {"general", "ortho"};
+  for (int ortho = 1; ortho >= 0; ortho--) {
+    for (int level = 0; level < GRID_TUNING_MAX_LEVELS; level++) {
+      for (int ibin = 0; ibin < GRID_TUNING_NSPACING_BINS; ibin++) {
+        for (int lp = 0; lp < GRID_TUNING_MAX_LP; lp++) {
+          const int backend = tuned_backends[ortho][level][ibin][lp];
+          if (backend == 0) {
+            continue; // skip combinations that were never tuned
+          }
+          char lp_range[16];
+          snprintf(lp_range, sizeof(lp_range),
+                   (lp == GRID_TUNING_MAX_LP - 1) ? "%i+" : "%i", lp);
+          char buffer[100];
+          snprintf(buffer, sizeof(buffer), " %-12s  %-8i  %-8.4f  %-8s  %35s\n",
+                   cell_names[ortho], level + 1, bin_spacing(ibin), lp_range,
+                   backend_names[backend - GRID_BACKEND_REF]);
+          print_func(buffer, output_unit);
+        }
+      }
+    }
+  }
+
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+}
+
+/*******************************************************************************
+ * \brief Private routine for printing the number of tasks skipped by screening.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void print_screening(const long screened_tasks, const long skipped_tasks,
+                            void (*print_func)(char *, int),
+                            const int output_unit) {
+  print_banner("GRID SCREENING", print_func, output_unit);
+  char buffer[100];
+  snprintf(buffer, sizeof(buffer), " %-30s %48li\n", "TASKS SCREENED",
+           screened_tasks);
+  print_func(buffer, output_unit);
+  const double percent = 100.0 * skipped_tasks / screened_tasks;
+  snprintf(buffer, sizeof(buffer), " %-30s %36li %10.2f%%\n", "TASKS SKIPPED",
+           skipped_tasks, percent);
+  print_func(buffer, output_unit);
+  print_func(" ----------------------------------------------------------------"
+             "---------------\n",
+             output_unit);
+}
+
 /*******************************************************************************
  * \brief Comperator passed to qsort to compare two counters.
  * \author Ole Schuett
@@ -199,10 +765,6 @@ void grid_library_print_stats(void (*mpi_sum_func)(long *, int),
              "COUNT     PERCENT\n",
              output_unit);
 
-  const char *kernel_names[] = {"collocate ortho", "integrate ortho",
-                                "collocate general", "integrate general"};
-  const char *backend_names[] = {"REF", "CPU", "DGEMM", "GPU", "HIP"};
-
   for (int i = 0; i < ncounters; i++) {
     if (counters[i][0] == 0)
       continue; // skip empty counters
@@ -218,9 +780,52 @@ void grid_library_print_stats(void (*mpi_sum_func)(long *, int),
     print_func(buffer, output_unit);
   }
 
+  // Print on which NUMA nodes the grid buffers were placed at their peak.
+  int64_t numa_placement[OFFLOAD_MAX_NUMA_NODES];
+  offload_buffer_numa_placement(numa_placement);
+  for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+    long nbytes = numa_placement[node];
+    mpi_sum_func(&nbytes, mpi_comm);
+    numa_placement[node] = nbytes;
+  }
+  char placement[50];
+  offload_numa_format_placement(numa_placement, placement, sizeof(placement));
+  if (placement[0] != '\0') {
+    print_func(" --------------------------------------------------------------"
+               "-----------------\n",
+               output_unit);
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), " %-28s %50s\n",
+             "BUFFER NUMA NODES [MiB]", placement);
+    print_func(buffer, output_unit);
+  }
+
   print_func(" ----------------------------------------------------------------"
              "---------------\n",
              output_unit);
+
+  // Print timings, if they were collected.
+  if (timings_enabled) {
+    print_timings(mpi_sum_func, mpi_comm, print_func, output_unit);
+  }
+
+  // Print number of skipped tasks, if the screening was active.
+  long screened_tasks, skipped_tasks;
+  grid_library_get_screening(&screened_tasks, &skipped_tasks);
+  mpi_sum_func(&screened_tasks, mpi_comm);
+  mpi_sum_func(&skipped_tasks, mpi_comm);
+  if (screened_tasks > 0) {
+    print_screening(screened_tasks, skipped_tasks, print_func, output_unit);
+  }
+
+  // Print decisions of the autotuner, if there are any.
+  const int nentries = sizeof(tuned_backends) / sizeof(int);
+  for (int i = 0; i < nentries; i++) {
+    if ((&tuned_backends[0][0][0][0])[i] != 0) {
+      print_tuning(print_func, output_unit);
+      break;
+    }
+  }
 }
 
 // EOF
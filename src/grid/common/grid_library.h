@@ -33,9 +33,14 @@ void grid_library_finalize(void);
  ******************************************************************************/
 typedef struct {
   enum grid_backend
-      backend;       // Selectes the backend to be used by the grid library.
-  bool validate;     // When true the reference backend runs in shadow mode.
-  bool apply_cutoff; // only important for the dgemm and gpu backends
+      backend;           // Selectes the backend to be used by the grid library.
+  bool validate;         // When true the reference backend runs in shadow mode.
+  bool apply_cutoff;     // only important for the dgemm and gpu backends
+  bool tiled_collocate;  // only important for the cpu backend
+  int collocate_tiles;   // only important for the cpu backend
+  bool spatial_ordering; // only important for the cpu backend
+  bool fused_integrate;  // only important for the cpu backend
+  double eps_screening;  // only important for the cpu backend
 } grid_library_config;
 
 /*******************************************************************************
@@ -43,7 +48,12 @@ typedef struct {
  * \author Ole Schuett
  ******************************************************************************/
 void grid_library_set_config(const enum grid_backend backend,
-                             const bool validate, const bool apply_cutoff);
+                             const bool validate, const bool apply_cutoff,
+                             const bool tiled_collocate,
+                             const int collocate_tiles,
+                             const bool spatial_ordering,
+                             const bool fused_integrate,
+                             const double eps_screening);
 
 /*******************************************************************************
  * \brief Returns the library config.
@@ -83,6 +93,99 @@ void grid_library_counter_add(const int lp, const enum grid_backend backend,
                               const enum grid_library_kernel kern,
                               const int increment);
 
+/*******************************************************************************
+ * \brief Phases of a task list run, which are timed separately.
+ * \author Ole Schuett
+ ******************************************************************************/
+enum grid_library_phase {
+  GRID_PHASE_LOAD_PAB = 0,
+  GRID_PHASE_CAB_TO_GRID = 1,
+  GRID_PHASE_GRID_TO_CAB = 2,
+  GRID_PHASE_REDUCTION = 3,
+  GRID_PHASE_STORE_HAB = 4,
+};
+
+/*******************************************************************************
+ * \brief Counts a task that was considered by the screening and whether it
+ *        got skipped because its contribution is below eps_screening.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_screening_add(const bool skipped);
+
+/*******************************************************************************
+ * \brief Returns the number of tasks that were considered by the screening and
+ *        the number of tasks that got skipped, summed over all threads.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_get_screening(long *screened_tasks, long *skipped_tasks);
+
+/*******************************************************************************
+ * \brief Returns true when the timing instrumentation is enabled, which is the
+ *        case when the environment variable GRID_TIMINGS or GRID_TIMINGS_JSON
+ *        is set.
+ * \author Ole Schuett
+ ******************************************************************************/
+bool grid_library_timings_enabled(void);
+
+/*******************************************************************************
+ * \brief Returns a timestamp in ticks of the processor's time stamp counter.
+ *        On other architectures nanoseconds are returned instead.
+ * \author Ole Schuett
+ ******************************************************************************/
+long grid_library_ticks(void);
+
+/*******************************************************************************
+ * \brief Adds the elapsed ticks, the number of touched grid points, and the
+ *        number of moved bytes to the timings of the kernel specified by lp,
+ *        backend, and kernel.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_kernel_timing_add(const int lp,
+                                    const enum grid_backend backend,
+                                    const enum grid_library_kernel kernel,
+                                    const long ticks, const long npoints,
+                                    const long nbytes);
+
+/*******************************************************************************
+ * \brief Adds the elapsed ticks and the number of moved bytes to the timings
+ *        of given task list phase.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_phase_timing_add(const enum grid_backend backend,
+                                   const enum grid_library_phase phase,
+                                   const long ticks, const long nbytes);
+
+// The autotuner decides per lp, larger lp share the decision of the last one.
+#define GRID_TUNING_MAX_LP 20
+
+/*******************************************************************************
+ * \brief Returns the backend that the autotuner picked for tasks with given
+ *        cell type, grid level (zero based), grid spacing, and lp. The spacing
+ *        is the cube root of the volume per grid point and gets binned.
+ *        Returns GRID_BACKEND_AUTO when no decision has been made yet.
+ * \author Ole Schuett
+ ******************************************************************************/
+enum grid_backend grid_library_get_tuned_backend(const bool orthorhombic,
+                                                 const int level,
+                                                 const double spacing,
+                                                 const int lp);
+
+/*******************************************************************************
+ * \brief Records the backend that the autotuner picked for tasks with given
+ *        cell type, grid level (zero based), grid spacing, and lp.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_set_tuned_backend(const bool orthorhombic, const int level,
+                                    const double spacing, const int lp,
+                                    const enum grid_backend backend);
+
+/*******************************************************************************
+ * \brief Writes the decisions of the autotuner to the file given by the
+ *        environment variable GRID_AUTOTUNE_FILE, if it is set.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_library_save_tuning(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,10 +12,14 @@
 #include <stdlib.h>
 #include <string.h>
 
-#if defined(__AVX2__) && defined(__FMA__)
+#if (defined(__AVX2__) && defined(__FMA__)) || defined(__AVX512F__)
 #include <immintrin.h>
 #endif
 
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "../common/grid_common.h"
 #include "../common/grid_library.h"
 #include "../common/grid_sphere_cache.h"
@@ -155,6 +159,168 @@ ortho_cx_to_grid_avx2(const int lp, const int cmax, const int i,
 }
 #endif // __AVX2__ && __FMA__
 
+/*******************************************************************************
+ * \brief Optimized loop body for ortho_cx_to_grid using AVX-512 Intrinsics.
+ *        This routine always processes eight consecutive grid elements at once.
+ * \author Ole Schuett
+ ******************************************************************************/
+#if defined(__AVX512F__)
+static inline void __attribute__((always_inline))
+ortho_cx_to_grid_avx512(const int lp, const int cmax, const int i,
+                        const double pol[3][lp + 1][2 * cmax + 1],
+                        GRID_CONST_WHEN_COLLOCATE double *cx,
+                        GRID_CONST_WHEN_INTEGRATE double *grid_0,
+                        GRID_CONST_WHEN_INTEGRATE double *grid_1,
+                        GRID_CONST_WHEN_INTEGRATE double *grid_2,
+                        GRID_CONST_WHEN_INTEGRATE double *grid_3) {
+
+  const int icmax = i + cmax;
+
+#if (GRID_DO_COLLOCATE)
+  // collocate
+  // First iteration for lxp == 0 does not need add instructions.
+  __m512d p_vec = _mm512_loadu_pd(&pol[0][0][icmax]);
+  __m512d r_vec_0 = _mm512_mul_pd(p_vec, _mm512_set1_pd(cx[0]));
+  __m512d r_vec_1 = _mm512_mul_pd(p_vec, _mm512_set1_pd(cx[1]));
+  __m512d r_vec_2 = _mm512_mul_pd(p_vec, _mm512_set1_pd(cx[2]));
+  __m512d r_vec_3 = _mm512_mul_pd(p_vec, _mm512_set1_pd(cx[3]));
+
+  // Remaining iterations for lxp > 0 use fused multiply adds.
+  GRID_PRAGMA_UNROLL_UP_TO(GRID_MAX_LP_OPTIMIZED)
+  for (int lxp = 1; lxp <= lp; lxp++) {
+    const double *cx_base = &cx[lxp * 4];
+    p_vec = _mm512_loadu_pd(&pol[0][lxp][icmax]);
+    r_vec_0 = _mm512_fmadd_pd(p_vec, _mm512_set1_pd(cx_base[0]), r_vec_0);
+    r_vec_1 = _mm512_fmadd_pd(p_vec, _mm512_set1_pd(cx_base[1]), r_vec_1);
+    r_vec_2 = _mm512_fmadd_pd(p_vec, _mm512_set1_pd(cx_base[2]), r_vec_2);
+    r_vec_3 = _mm512_fmadd_pd(p_vec, _mm512_set1_pd(cx_base[3]), r_vec_3);
+  }
+
+  // Add vectors to grid one at a time, because they can aliase when cube wraps.
+  _mm512_storeu_pd(grid_0, _mm512_add_pd(_mm512_loadu_pd(grid_0), r_vec_0));
+  _mm512_storeu_pd(grid_1, _mm512_add_pd(_mm512_loadu_pd(grid_1), r_vec_1));
+  _mm512_storeu_pd(grid_2, _mm512_add_pd(_mm512_loadu_pd(grid_2), r_vec_2));
+  _mm512_storeu_pd(grid_3, _mm512_add_pd(_mm512_loadu_pd(grid_3), r_vec_3));
+
+#else
+  // integrate
+  const __m512d grid_vec_0 = _mm512_loadu_pd(grid_0);
+  const __m512d grid_vec_1 = _mm512_loadu_pd(grid_1);
+  const __m512d grid_vec_2 = _mm512_loadu_pd(grid_2);
+  const __m512d grid_vec_3 = _mm512_loadu_pd(grid_3);
+
+  GRID_PRAGMA_UNROLL_UP_TO(GRID_MAX_LP_OPTIMIZED + 1)
+  for (int lxp = 0; lxp <= lp; lxp++) {
+    const __m512d p_vec = _mm512_loadu_pd(&pol[0][lxp][icmax]);
+
+    // Do 4 dot products at once by first folding the upper half onto the
+    // lower half and then proceeding as in ortho_cx_to_grid_avx2.
+    const __m512d xy0_full = _mm512_mul_pd(p_vec, grid_vec_0);
+    const __m512d xy1_full = _mm512_mul_pd(p_vec, grid_vec_1);
+    const __m512d xy2_full = _mm512_mul_pd(p_vec, grid_vec_2);
+    const __m512d xy3_full = _mm512_mul_pd(p_vec, grid_vec_3);
+    const __m256d xy0 = _mm256_add_pd(_mm512_castpd512_pd256(xy0_full),
+                                      _mm512_extractf64x4_pd(xy0_full, 1));
+    const __m256d xy1 = _mm256_add_pd(_mm512_castpd512_pd256(xy1_full),
+                                      _mm512_extractf64x4_pd(xy1_full, 1));
+    const __m256d xy2 = _mm256_add_pd(_mm512_castpd512_pd256(xy2_full),
+                                      _mm512_extractf64x4_pd(xy2_full, 1));
+    const __m256d xy3 = _mm256_add_pd(_mm512_castpd512_pd256(xy3_full),
+                                      _mm512_extractf64x4_pd(xy3_full, 1));
+
+    // low to high: xy00+xy01 xy10+xy11 xy02+xy03 xy12+xy13
+    const __m256d temp01 = _mm256_hadd_pd(xy0, xy1);
+
+    // low to high: xy20+xy21 xy30+xy31 xy22+xy23 xy32+xy33
+    const __m256d temp23 = _mm256_hadd_pd(xy2, xy3);
+
+    // low to high: xy02+xy03 xy12+xy13 xy20+xy21 xy30+xy31
+    const __m256d swapped = _mm256_permute2f128_pd(temp01, temp23, 0x21);
+
+    // low to high: xy00+xy01 xy10+xy11 xy22+xy23 xy32+xy33
+    const __m256d blended = _mm256_blend_pd(temp01, temp23, 0b1100);
+
+    const __m256d r_vec = _mm256_add_pd(swapped, blended);
+
+    // cx += r_vec
+    double *cx_base = &cx[lxp * 4];
+    _mm256_storeu_pd(cx_base, _mm256_add_pd(r_vec, _mm256_loadu_pd(cx_base)));
+  }
+#endif
+}
+#endif // __AVX512F__
+
+/*******************************************************************************
+ * \brief Optimized loop body for ortho_cx_to_grid using ARM NEON Intrinsics.
+ *        This routine always processes two consecutive grid elements at once.
+ * \author Ole Schuett
+ ******************************************************************************/
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static inline void __attribute__((always_inline))
+ortho_cx_to_grid_neon(const int lp, const int cmax, const int i,
+                      const double pol[3][lp + 1][2 * cmax + 1],
+                      GRID_CONST_WHEN_COLLOCATE double *cx,
+                      GRID_CONST_WHEN_INTEGRATE double *grid_0,
+                      GRID_CONST_WHEN_INTEGRATE double *grid_1,
+                      GRID_CONST_WHEN_INTEGRATE double *grid_2,
+                      GRID_CONST_WHEN_INTEGRATE double *grid_3) {
+
+  const int icmax = i + cmax;
+
+#if (GRID_DO_COLLOCATE)
+  // collocate
+  // First iteration for lxp == 0 does not need add instructions.
+  float64x2_t p_vec = vld1q_f64(&pol[0][0][icmax]);
+  float64x2_t r_vec_0 = vmulq_n_f64(p_vec, cx[0]);
+  float64x2_t r_vec_1 = vmulq_n_f64(p_vec, cx[1]);
+  float64x2_t r_vec_2 = vmulq_n_f64(p_vec, cx[2]);
+  float64x2_t r_vec_3 = vmulq_n_f64(p_vec, cx[3]);
+
+  // Remaining iterations for lxp > 0 use fused multiply adds.
+  GRID_PRAGMA_UNROLL_UP_TO(GRID_MAX_LP_OPTIMIZED)
+  for (int lxp = 1; lxp <= lp; lxp++) {
+    const double *cx_base = &cx[lxp * 4];
+    p_vec = vld1q_f64(&pol[0][lxp][icmax]);
+    r_vec_0 = vfmaq_n_f64(r_vec_0, p_vec, cx_base[0]);
+    r_vec_1 = vfmaq_n_f64(r_vec_1, p_vec, cx_base[1]);
+    r_vec_2 = vfmaq_n_f64(r_vec_2, p_vec, cx_base[2]);
+    r_vec_3 = vfmaq_n_f64(r_vec_3, p_vec, cx_base[3]);
+  }
+
+  // Add vectors to grid one at a time, because they can aliase when cube wraps.
+  vst1q_f64(grid_0, vaddq_f64(vld1q_f64(grid_0), r_vec_0));
+  vst1q_f64(grid_1, vaddq_f64(vld1q_f64(grid_1), r_vec_1));
+  vst1q_f64(grid_2, vaddq_f64(vld1q_f64(grid_2), r_vec_2));
+  vst1q_f64(grid_3, vaddq_f64(vld1q_f64(grid_3), r_vec_3));
+
+#else
+  // integrate
+  const float64x2_t grid_vec_0 = vld1q_f64(grid_0);
+  const float64x2_t grid_vec_1 = vld1q_f64(grid_1);
+  const float64x2_t grid_vec_2 = vld1q_f64(grid_2);
+  const float64x2_t grid_vec_3 = vld1q_f64(grid_3);
+
+  GRID_PRAGMA_UNROLL_UP_TO(GRID_MAX_LP_OPTIMIZED + 1)
+  for (int lxp = 0; lxp <= lp; lxp++) {
+    const float64x2_t p_vec = vld1q_f64(&pol[0][lxp][icmax]);
+
+    // Do 4 dot products at once via pairwise additions.
+    // low to high: xy00+xy01 xy10+xy11
+    const float64x2_t r_vec_01 = vpaddq_f64(vmulq_f64(p_vec, grid_vec_0),
+                                            vmulq_f64(p_vec, grid_vec_1));
+    // low to high: xy20+xy21 xy30+xy31
+    const float64x2_t r_vec_23 = vpaddq_f64(vmulq_f64(p_vec, grid_vec_2),
+                                            vmulq_f64(p_vec, grid_vec_3));
+
+    // cx += r_vec
+    double *cx_base = &cx[lxp * 4];
+    vst1q_f64(&cx_base[0], vaddq_f64(r_vec_01, vld1q_f64(&cx_base[0])));
+    vst1q_f64(&cx_base[2], vaddq_f64(r_vec_23, vld1q_f64(&cx_base[2])));
+  }
+#endif
+}
+#endif // __ARM_NEON && __aarch64__
+
 /*******************************************************************************
  * \brief Collocates coefficients C_x onto the grid for orthorhombic case.
  * \author Ole Schuett
@@ -189,6 +355,18 @@ ortho_cx_to_grid(const int lp, const int kg1, const int kg2, const int jg1,
     GRID_CONST_WHEN_INTEGRATE double *grid_base_2 = &grid[grid_index_2];
     GRID_CONST_WHEN_INTEGRATE double *grid_base_3 = &grid[grid_index_3];
 
+    // Use AVX-512 to process grid points in chunks of eight.
+#if defined(__AVX512F__)
+    const int istop_vec8 = istart + 8 * ((istop - istart + 1) / 8) - 1;
+    for (int i = istart; i <= istop_vec8; i += 8) {
+      const int ig = i + cube2grid;
+      ortho_cx_to_grid_avx512(lp, cmax, i, pol, cx, &grid_base_0[ig],
+                              &grid_base_1[ig], &grid_base_2[ig],
+                              &grid_base_3[ig]);
+    }
+    istart = istop_vec8 + 1;
+#endif
+
     // Use AVX2 to process grid points in chunks of four, ie. 256 bit vectors.
 #if defined(__AVX2__) && defined(__FMA__)
     const int istop_vec = istart + 4 * ((istop - istart + 1) / 4) - 1;
@@ -199,9 +377,19 @@ ortho_cx_to_grid(const int lp, const int kg1, const int kg2, const int jg1,
                             &grid_base_3[ig]);
     }
     istart = istop_vec + 1;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // Use NEON to process grid points in pairs, ie. 128 bit vectors.
+    const int istop_vec = istart + 2 * ((istop - istart + 1) / 2) - 1;
+    for (int i = istart; i <= istop_vec; i += 2) {
+      const int ig = i + cube2grid;
+      ortho_cx_to_grid_neon(lp, cmax, i, pol, cx, &grid_base_0[ig],
+                            &grid_base_1[ig], &grid_base_2[ig],
+                            &grid_base_3[ig]);
+    }
+    istart = istop_vec + 1;
 #endif
 
-    // Process up to 3 remaining points - or everything if AVX2 isn't available.
+    // Process the few remaining points - or everything without SIMD support.
     for (int i = istart; i <= istop; i++) {
       const int ig = i + cube2grid;
       ortho_cx_to_grid_scalar(lp, cmax, i, pol, cx, &grid_base_0[ig],
@@ -348,7 +536,8 @@ static inline void ortho_cxyz_to_cxy(const int lp, const int k1, const int k2,
 }
 
 /*******************************************************************************
- * \brief Collocates coefficients C_xyz onto the grid for orthorhombic case.
+ * \brief Collocates coefficients C_xyz onto the grids for orthorhombic case.
+ *        The exponentials and mappings are shared by all ngrids grids.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void
@@ -356,8 +545,8 @@ ortho_cxyz_to_grid(const int lp, const double zetp, const double dh[3][3],
                    const double dh_inv[3][3], const double rp[3],
                    const int npts_global[3], const int npts_local[3],
                    const int shift_local[3], const double radius,
-                   GRID_CONST_WHEN_COLLOCATE double *cxyz,
-                   GRID_CONST_WHEN_INTEGRATE double *grid) {
+                   const int ngrids, GRID_CONST_WHEN_COLLOCATE double *cxyz,
+                   GRID_CONST_WHEN_INTEGRATE double *const *grids) {
 
   // *** position of the gaussian product
   //
@@ -470,6 +659,7 @@ ortho_cxyz_to_grid(const int lp, const double zetp, const double dh[3][3],
 
   // Loop over k dimension of the cube.
   const int kstart = *((*sphere_bounds_iter)++);
+  const size_t cxyz_size = (lp + 1) * (lp + 1) * (lp + 1);
   const size_t cxy_size = (lp + 1) * (lp + 1) * 2;
   double cxy[cxy_size];
   for (int k1 = kstart; k1 <= 0; k1++) {
@@ -477,19 +667,24 @@ ortho_cxyz_to_grid(const int lp, const double zetp, const double dh[3][3],
     const int kg1 = map[2][k1 + cmax];
     const int kg2 = map[2][k2 + cmax];
 
-    memset(cxy, 0, cxy_size * sizeof(double));
+    // All grids walk through the same sphere bounds.
+    int *const sphere_bounds_k = *sphere_bounds_iter;
+    for (int igrid = 0; igrid < ngrids; igrid++) {
+      *sphere_bounds_iter = sphere_bounds_k;
+      memset(cxy, 0, cxy_size * sizeof(double));
 
 #if (GRID_DO_COLLOCATE)
-    // collocate
-    ortho_cxyz_to_cxy(lp, k1, k2, cmax, pol, cxyz, cxy);
-    ortho_cxy_to_grid(lp, kg1, kg2, cmax, pol, map, sections, npts_local,
-                      sphere_bounds_iter, cxy, grid);
+      // collocate
+      ortho_cxyz_to_cxy(lp, k1, k2, cmax, pol, &cxyz[igrid * cxyz_size], cxy);
+      ortho_cxy_to_grid(lp, kg1, kg2, cmax, pol, map, sections, npts_local,
+                        sphere_bounds_iter, cxy, grids[igrid]);
 #else
-    // integrate
-    ortho_cxy_to_grid(lp, kg1, kg2, cmax, pol, map, sections, npts_local,
-                      sphere_bounds_iter, cxy, grid);
-    ortho_cxyz_to_cxy(lp, k1, k2, cmax, pol, cxyz, cxy);
+      // integrate
+      ortho_cxy_to_grid(lp, kg1, kg2, cmax, pol, map, sections, npts_local,
+                        sphere_bounds_iter, cxy, grids[igrid]);
+      ortho_cxyz_to_cxy(lp, k1, k2, cmax, pol, &cxyz[igrid * cxyz_size], cxy);
 #endif
+    }
   }
 }
 
@@ -796,7 +991,8 @@ general_fill_exp_table(const int idir, const int jdir, const int index_min[3],
 }
 
 /*******************************************************************************
- * \brief Collocates coefficients C_ijk onto the grid for general case.
+ * \brief Collocates coefficients C_ijk onto the grids for general case.
+ *        The exponential tables and mappings are shared by all ngrids grids.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void
@@ -805,8 +1001,8 @@ general_cijk_to_grid(const int border_mask, const int lp, const double zetp,
                      const double rp[3], const int npts_global[3],
                      const int npts_local[3], const int shift_local[3],
                      const int border_width[3], const double radius,
-                     GRID_CONST_WHEN_COLLOCATE double *cijk,
-                     GRID_CONST_WHEN_INTEGRATE double *grid) {
+                     const int ngrids, GRID_CONST_WHEN_COLLOCATE double *cijk,
+                     GRID_CONST_WHEN_INTEGRATE double *const *grids) {
 
   // Default for border_mask == 0.
   int bounds_i[2] = {0, npts_local[0] - 1};
@@ -882,6 +1078,7 @@ general_cijk_to_grid(const int border_mask, const int lp, const double zetp,
   general_fill_exp_table(2, 0, index_min, index_max, zetp, dh, gp, exp_ki);
 
   // go over the grid, but cycle if the point is not within the radius
+  const int cijk_size = (lp + 1) * (lp + 1) * (lp + 1);
   const int cij_size = (lp + 1) * (lp + 1);
   double cij[cij_size];
   for (int k = index_min[2]; k <= index_max[2]; k++) {
@@ -891,22 +1088,24 @@ general_cijk_to_grid(const int border_mask, const int lp, const double zetp,
       continue;
     }
 
-    // zero coef_xyt
-    memset(cij, 0, cij_size * sizeof(double));
+    for (int igrid = 0; igrid < ngrids; igrid++) {
+      // zero coef_xyt
+      memset(cij, 0, cij_size * sizeof(double));
 
 #if (GRID_DO_COLLOCATE)
-    // collocate
-    general_cijk_to_cij(lp, (double)k - gp[2], cijk, cij);
-    general_cij_to_grid(lp, k, kg, npts_local, index_min, index_max, map_i,
-                        map_j, sections_i, sections_j, dh, gp, radius, exp_ij,
-                        exp_jk, exp_ki, cij, grid);
+      // collocate
+      general_cijk_to_cij(lp, (double)k - gp[2], &cijk[igrid * cijk_size], cij);
+      general_cij_to_grid(lp, k, kg, npts_local, index_min, index_max, map_i,
+                          map_j, sections_i, sections_j, dh, gp, radius, exp_ij,
+                          exp_jk, exp_ki, cij, grids[igrid]);
 #else
-    // integrate
-    general_cij_to_grid(lp, k, kg, npts_local, index_min, index_max, map_i,
-                        map_j, sections_i, sections_j, dh, gp, radius, exp_ij,
-                        exp_jk, exp_ki, cij, grid);
-    general_cijk_to_cij(lp, (double)k - gp[2], cijk, cij);
+      // integrate
+      general_cij_to_grid(lp, k, kg, npts_local, index_min, index_max, map_i,
+                          map_j, sections_i, sections_j, dh, gp, radius, exp_ij,
+                          exp_jk, exp_ki, cij, grids[igrid]);
+      general_cijk_to_cij(lp, (double)k - gp[2], &cijk[igrid * cijk_size], cij);
 #endif
+    }
   }
 }
 
@@ -982,7 +1181,7 @@ general_cxyz_to_cijk(const int lp, const double dh[3][3],
 }
 
 /*******************************************************************************
- * \brief Collocates coefficients C_xyz onto the grid for general case.
+ * \brief Collocates coefficients C_xyz onto the grids for general case.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void
@@ -991,30 +1190,36 @@ general_cxyz_to_grid(const int border_mask, const int lp, const double zetp,
                      const double rp[3], const int npts_global[3],
                      const int npts_local[3], const int shift_local[3],
                      const int border_width[3], const double radius,
-                     GRID_CONST_WHEN_COLLOCATE double *cxyz,
-                     GRID_CONST_WHEN_INTEGRATE double *grid) {
+                     const int ngrids, GRID_CONST_WHEN_COLLOCATE double *cxyz,
+                     GRID_CONST_WHEN_INTEGRATE double *const *grids) {
 
   const size_t cijk_size = (lp + 1) * (lp + 1) * (lp + 1);
-  double cijk[cijk_size];
-  memset(cijk, 0, cijk_size * sizeof(double));
+  double cijk[ngrids * cijk_size];
+  memset(cijk, 0, ngrids * cijk_size * sizeof(double));
 
 #if (GRID_DO_COLLOCATE)
   // collocate
-  general_cxyz_to_cijk(lp, dh, cxyz, cijk);
+  for (int igrid = 0; igrid < ngrids; igrid++) {
+    general_cxyz_to_cijk(lp, dh, &cxyz[igrid * cijk_size],
+                         &cijk[igrid * cijk_size]);
+  }
   general_cijk_to_grid(border_mask, lp, zetp, dh, dh_inv, rp, npts_global,
-                       npts_local, shift_local, border_width, radius, cijk,
-                       grid);
+                       npts_local, shift_local, border_width, radius, ngrids,
+                       cijk, grids);
 #else
   // integrate
   general_cijk_to_grid(border_mask, lp, zetp, dh, dh_inv, rp, npts_global,
-                       npts_local, shift_local, border_width, radius, cijk,
-                       grid);
-  general_cxyz_to_cijk(lp, dh, cxyz, cijk);
+                       npts_local, shift_local, border_width, radius, ngrids,
+                       cijk, grids);
+  for (int igrid = 0; igrid < ngrids; igrid++) {
+    general_cxyz_to_cijk(lp, dh, &cxyz[igrid * cijk_size],
+                         &cijk[igrid * cijk_size]);
+  }
 #endif
 }
 
 /*******************************************************************************
- * \brief Collocates coefficients C_xyz onto the grid.
+ * \brief Collocates coefficients C_xyz onto the grids.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void
@@ -1023,31 +1228,51 @@ cxyz_to_grid(const bool orthorhombic, const int border_mask, const int lp,
              const double dh_inv[3][3], const double rp[3],
              const int npts_global[3], const int npts_local[3],
              const int shift_local[3], const int border_width[3],
-             const double radius, GRID_CONST_WHEN_COLLOCATE double *cxyz,
-             GRID_CONST_WHEN_INTEGRATE double *grid) {
+             const double radius, const int ngrids,
+             GRID_CONST_WHEN_COLLOCATE double *cxyz,
+             GRID_CONST_WHEN_INTEGRATE double *const *grids) {
+
+  const bool timings = grid_library_timings_enabled();
+  const long start_ticks = (timings) ? grid_library_ticks() : 0;
 
   enum grid_library_kernel k;
   if (orthorhombic && border_mask == 0) {
     k = (GRID_DO_COLLOCATE) ? GRID_COLLOCATE_ORTHO : GRID_INTEGRATE_ORTHO;
     ortho_cxyz_to_grid(lp, zetp, dh, dh_inv, rp, npts_global, npts_local,
-                       shift_local, radius, cxyz, grid);
+                       shift_local, radius, ngrids, cxyz, grids);
   } else {
     k = (GRID_DO_COLLOCATE) ? GRID_COLLOCATE_GENERAL : GRID_INTEGRATE_GENERAL;
     general_cxyz_to_grid(border_mask, lp, zetp, dh, dh_inv, rp, npts_global,
-                         npts_local, shift_local, border_width, radius, cxyz,
-                         grid);
+                         npts_local, shift_local, border_width, radius, ngrids,
+                         cxyz, grids);
+  }
+  grid_library_counter_add(lp, GRID_BACKEND_CPU, k, ngrids);
+
+  if (timings) {
+    const long ticks = grid_library_ticks() - start_ticks;
+    // Estimate the touched grid points from the volume of the sphere.
+    const double dh_det =
+        dh[0][0] * (dh[1][1] * dh[2][2] - dh[1][2] * dh[2][1]) -
+        dh[0][1] * (dh[1][0] * dh[2][2] - dh[1][2] * dh[2][0]) +
+        dh[0][2] * (dh[1][0] * dh[2][1] - dh[1][1] * dh[2][0]);
+    const double sphere_volume = 4.0 / 3.0 * acos(-1.0) * pow(radius, 3);
+    const long npoints = ngrids * (long)(sphere_volume / fabs(dh_det));
+    // Collocate reads and writes each grid point, integrate only reads it.
+    const long nbytes = npoints * sizeof(double) * (GRID_DO_COLLOCATE ? 2 : 1);
+    grid_library_kernel_timing_add(lp, GRID_BACKEND_CPU, k, ticks, npoints,
+                                   nbytes);
   }
-  grid_library_counter_add(lp, GRID_BACKEND_CPU, k, 1);
 }
 
 /*******************************************************************************
- * \brief Transforms coefficients C_ab into C_xyz.
+ * \brief Transforms coefficients C_ab into C_xyz for ngrids stacked blocks.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void cab_to_cxyz(const int la_max, const int la_min,
                                const int lb_max, const int lb_min,
                                const double prefactor, const double ra[3],
                                const double rb[3], const double rp[3],
+                               const int ngrids,
                                GRID_CONST_WHEN_COLLOCATE double *cab,
                                GRID_CONST_WHEN_INTEGRATE double *cxyz) {
 
@@ -1094,31 +1319,37 @@ static inline void cab_to_cxyz(const int la_max, const int la_min,
   // (current implementation is l**7)
   //
 
-  for (int lzb = 0; lzb <= lb_max; lzb++) {
-    for (int lza = 0; lza <= la_max; lza++) {
-      for (int lyb = 0; lyb <= lb_max - lzb; lyb++) {
-        for (int lya = 0; lya <= la_max - lza; lya++) {
-          const int lxb_min = imax(lb_min - lzb - lyb, 0);
-          const int lxa_min = imax(la_min - lza - lya, 0);
-          for (int lxb = lxb_min; lxb <= lb_max - lzb - lyb; lxb++) {
-            for (int lxa = lxa_min; lxa <= la_max - lza - lya; lxa++) {
-              const int ico = coset(lxa, lya, lza);
-              const int jco = coset(lxb, lyb, lzb);
-              const int cab_index = jco * ncoset(la_max) + ico; // [jco, ico]
-              for (int lzp = 0; lzp <= lza + lzb; lzp++) {
-                for (int lyp = 0; lyp <= lp - lza - lzb; lyp++) {
-                  for (int lxp = 0; lxp <= lp - lza - lzb - lyp; lxp++) {
-                    const double p = alpha[0][lxb][lxa][lxp] *
-                                     alpha[1][lyb][lya][lyp] *
-                                     alpha[2][lzb][lza][lzp] * prefactor;
-                    const int lp1 = lp + 1;
-                    const int cxyz_index =
-                        lzp * lp1 * lp1 + lyp * lp1 + lxp; // [lzp, lyp, lxp]
+  const int cab_size = ncoset(la_max) * ncoset(lb_max);
+  const int cxyz_size = (lp + 1) * (lp + 1) * (lp + 1);
+  for (int igrid = 0; igrid < ngrids; igrid++) {
+    GRID_CONST_WHEN_COLLOCATE double *cab_i = &cab[igrid * cab_size];
+    GRID_CONST_WHEN_INTEGRATE double *cxyz_i = &cxyz[igrid * cxyz_size];
+    for (int lzb = 0; lzb <= lb_max; lzb++) {
+      for (int lza = 0; lza <= la_max; lza++) {
+        for (int lyb = 0; lyb <= lb_max - lzb; lyb++) {
+          for (int lya = 0; lya <= la_max - lza; lya++) {
+            const int lxb_min = imax(lb_min - lzb - lyb, 0);
+            const int lxa_min = imax(la_min - lza - lya, 0);
+            for (int lxb = lxb_min; lxb <= lb_max - lzb - lyb; lxb++) {
+              for (int lxa = lxa_min; lxa <= la_max - lza - lya; lxa++) {
+                const int ico = coset(lxa, lya, lza);
+                const int jco = coset(lxb, lyb, lzb);
+                const int cab_index = jco * ncoset(la_max) + ico; // [jco, ico]
+                for (int lzp = 0; lzp <= lza + lzb; lzp++) {
+                  for (int lyp = 0; lyp <= lp - lza - lzb; lyp++) {
+                    for (int lxp = 0; lxp <= lp - lza - lzb - lyp; lxp++) {
+                      const double p = alpha[0][lxb][lxa][lxp] *
+                                       alpha[1][lyb][lya][lyp] *
+                                       alpha[2][lzb][lza][lzp] * prefactor;
+                      const int lp1 = lp + 1;
+                      const int cxyz_index =
+                          lzp * lp1 * lp1 + lyp * lp1 + lxp; // [lzp, lyp, lxp]
 #if (GRID_DO_COLLOCATE)
-                    cxyz[cxyz_index] += cab[cab_index] * p; // collocate
+                      cxyz_i[cxyz_index] += cab_i[cab_index] * p; // collocate
 #else
-                    cab[cab_index] += cxyz[cxyz_index] * p; // integrate
+                      cab_i[cab_index] += cxyz_i[cxyz_index] * p; // integrate
 #endif
+                    }
                   }
                 }
               }
@@ -1131,7 +1362,9 @@ static inline void cab_to_cxyz(const int la_max, const int la_min,
 }
 
 /*******************************************************************************
- * \brief Collocates coefficients C_ab onto the grid.
+ * \brief Collocates coefficients C_ab onto the grids. The cab array holds one
+ *        block of ncoset(la_max) * ncoset(lb_max) elements for each grid.
+ *        All geometric work is done only once and then shared by the grids.
  * \author Ole Schuett
  ******************************************************************************/
 static inline void
@@ -1141,9 +1374,9 @@ cab_to_grid(const bool orthorhombic, const int border_mask, const int la_max,
             const double dh[3][3], const double dh_inv[3][3],
             const double ra[3], const double rab[3], const int npts_global[3],
             const int npts_local[3], const int shift_local[3],
-            const int border_width[3], const double radius,
+            const int border_width[3], const double radius, const int ngrids,
             GRID_CONST_WHEN_COLLOCATE double *cab,
-            GRID_CONST_WHEN_INTEGRATE double *grid) {
+            GRID_CONST_WHEN_INTEGRATE double *const *grids) {
 
   // Check if radius is too small to be mapped onto grid of given resolution.
   double dh_max = 0.0;
@@ -1168,19 +1401,23 @@ cab_to_grid(const bool orthorhombic, const int border_mask, const int la_max,
 
   const int lp = la_max + lb_max;
   const size_t cxyz_size = (lp + 1) * (lp + 1) * (lp + 1);
-  double cxyz[cxyz_size];
-  memset(cxyz, 0, cxyz_size * sizeof(double));
+  double cxyz[ngrids * cxyz_size];
+  memset(cxyz, 0, ngrids * cxyz_size * sizeof(double));
 
 #if (GRID_DO_COLLOCATE)
   // collocate
-  cab_to_cxyz(la_max, la_min, lb_max, lb_min, prefactor, ra, rb, rp, cab, cxyz);
+  cab_to_cxyz(la_max, la_min, lb_max, lb_min, prefactor, ra, rb, rp, ngrids,
+              cab, cxyz);
   cxyz_to_grid(orthorhombic, border_mask, lp, zetp, dh, dh_inv, rp, npts_global,
-               npts_local, shift_local, border_width, radius, cxyz, grid);
+               npts_local, shift_local, border_width, radius, ngrids, cxyz,
+               grids);
 #else
   // integrate
   cxyz_to_grid(orthorhombic, border_mask, lp, zetp, dh, dh_inv, rp, npts_global,
-               npts_local, shift_local, border_width, radius, cxyz, grid);
-  cab_to_cxyz(la_max, la_min, lb_max, lb_min, prefactor, ra, rb, rp, cab, cxyz);
+               npts_local, shift_local, border_width, radius, ngrids, cxyz,
+               grids);
+  cab_to_cxyz(la_max, la_min, lb_max, lb_min, prefactor, ra, rb, rp, ngrids,
+              cab, cxyz);
 #endif
 }
 
@@ -141,7 +141,7 @@ static void write_task_file(
 }
 
 /*******************************************************************************
- * \brief Collocates a single product of primitiv Gaussians.
+ * \brief Collocates a single product of primitiv Gaussians onto ngrids grids.
  *        See grid_cpu_collocate.h for details.
  * \author Ole Schuett
  ******************************************************************************/
@@ -152,8 +152,8 @@ static void collocate_internal(
     const double dh[3][3], const double dh_inv[3][3], const double ra[3],
     const double rab[3], const int npts_global[3], const int npts_local[3],
     const int shift_local[3], const int border_width[3], const double radius,
-    const int o1, const int o2, const int n1, const int n2,
-    const double pab[n2][n1], double *grid) {
+    const int o1, const int o2, const int n1, const int n2, const int ngrids,
+    const double *const pabs[ngrids], double *const grids[ngrids]) {
 
   int la_min_diff, la_max_diff, lb_min_diff, lb_max_diff;
   grid_cpu_prepare_get_ldiffs(func, &la_min_diff, &la_max_diff, &lb_min_diff,
@@ -167,14 +167,19 @@ static void collocate_internal(
   const int n2_cab = ncoset(lb_max_cab);
 
   const size_t cab_size = n2_cab * n1_cab;
-  double cab[cab_size];
-  memset(cab, 0, cab_size * sizeof(double));
+  double cab[ngrids * cab_size];
+  memset(cab, 0, ngrids * cab_size * sizeof(double));
 
-  grid_cpu_prepare_pab(func, o1, o2, la_max, la_min, lb_max, lb_min, zeta, zetb,
-                       n1, n2, pab, n1_cab, n2_cab, (double(*)[n1_cab])cab);
+  for (int igrid = 0; igrid < ngrids; igrid++) {
+    double *const cab_igrid = &cab[igrid * cab_size];
+    grid_cpu_prepare_pab(func, o1, o2, la_max, la_min, lb_max, lb_min, zeta,
+                         zetb, n1, n2, (const double(*)[n1])pabs[igrid],
+                         n1_cab, n2_cab, (double(*)[n1_cab])cab_igrid);
+  }
   cab_to_grid(orthorhombic, border_mask, la_max_cab, la_min_cab, lb_max_cab,
               lb_min_cab, zeta, zetb, rscale, dh, dh_inv, ra, rab, npts_global,
-              npts_local, shift_local, border_width, radius, cab, grid);
+              npts_local, shift_local, border_width, radius, ngrids, cab,
+              grids);
 }
 
 /*******************************************************************************
@@ -182,45 +187,73 @@ static void collocate_internal(
  *        write_task_file when DUMP_TASKS = true.
  * \author Ole Schuett
  ******************************************************************************/
-void grid_cpu_collocate_pgf_product(
+void grid_cpu_collocate_pgf_product_multi(
     const bool orthorhombic, const int border_mask, const enum grid_func func,
     const int la_max, const int la_min, const int lb_max, const int lb_min,
     const double zeta, const double zetb, const double rscale,
     const double dh[3][3], const double dh_inv[3][3], const double ra[3],
     const double rab[3], const int npts_global[3], const int npts_local[3],
     const int shift_local[3], const int border_width[3], const double radius,
-    const int o1, const int o2, const int n1, const int n2,
-    const double pab[n2][n1], double *grid) {
+    const int o1, const int o2, const int n1, const int n2, const int ngrids,
+    const double *const pabs[ngrids], double *const grids[ngrids]) {
 
   // Set this to true to write each task to a file.
   const bool DUMP_TASKS = false;
 
-  double *grid_before = NULL;
-  const size_t npts_local_total = npts_local[0] * npts_local[1] * npts_local[2];
+  if (!DUMP_TASKS) {
+    collocate_internal(orthorhombic, border_mask, func, la_max, la_min, lb_max,
+                       lb_min, zeta, zetb, rscale, dh, dh_inv, ra, rab,
+                       npts_global, npts_local, shift_local, border_width,
+                       radius, o1, o2, n1, n2, ngrids, pabs, grids);
+    return;
+  }
 
-  if (DUMP_TASKS) {
-    const size_t sizeof_grid = sizeof(double) * npts_local_total;
-    grid_before = malloc(sizeof_grid);
+  // A task file holds a single grid, hence each grid is dumped separately.
+  const size_t npts_local_total = npts_local[0] * npts_local[1] * npts_local[2];
+  const size_t sizeof_grid = sizeof(double) * npts_local_total;
+  double *grid_before = malloc(sizeof_grid);
+  for (int igrid = 0; igrid < ngrids; igrid++) {
+    double *grid = grids[igrid];
     memcpy(grid_before, grid, sizeof_grid);
     memset(grid, 0, sizeof_grid);
-  }
 
-  collocate_internal(orthorhombic, border_mask, func, la_max, la_min, lb_max,
-                     lb_min, zeta, zetb, rscale, dh, dh_inv, ra, rab,
-                     npts_global, npts_local, shift_local, border_width, radius,
-                     o1, o2, n1, n2, pab, grid);
+    collocate_internal(orthorhombic, border_mask, func, la_max, la_min, lb_max,
+                       lb_min, zeta, zetb, rscale, dh, dh_inv, ra, rab,
+                       npts_global, npts_local, shift_local, border_width,
+                       radius, o1, o2, n1, n2, 1, &pabs[igrid], &grids[igrid]);
 
-  if (DUMP_TASKS) {
     write_task_file(orthorhombic, border_mask, func, la_max, la_min, lb_max,
                     lb_min, zeta, zetb, rscale, dh, dh_inv, ra, rab,
                     npts_global, npts_local, shift_local, border_width, radius,
-                    o1, o2, n1, n2, pab, grid);
+                    o1, o2, n1, n2, (const double(*)[n1])pabs[igrid], grid);
 
     for (size_t i = 0; i < npts_local_total; i++) {
       grid[i] += grid_before[i];
     }
-    free(grid_before);
   }
+  free(grid_before);
+}
+
+/*******************************************************************************
+ * \brief Collocates a single task. See grid_cpu_collocate.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_cpu_collocate_pgf_product(
+    const bool orthorhombic, const int border_mask, const enum grid_func func,
+    const int la_max, const int la_min, const int lb_max, const int lb_min,
+    const double zeta, const double zetb, const double rscale,
+    const double dh[3][3], const double dh_inv[3][3], const double ra[3],
+    const double rab[3], const int npts_global[3], const int npts_local[3],
+    const int shift_local[3], const int border_width[3], const double radius,
+    const int o1, const int o2, const int n1, const int n2,
+    const double pab[n2][n1], double *grid) {
+
+  const double *const pabs[1] = {(const double *)pab};
+  double *const grids[1] = {grid};
+  grid_cpu_collocate_pgf_product_multi(
+      orthorhombic, border_mask, func, la_max, la_min, lb_max, lb_min, zeta,
+      zetb, rscale, dh, dh_inv, ra, rab, npts_global, npts_local, shift_local,
+      border_width, radius, o1, o2, n1, n2, 1, pabs, grids);
 }
 
 // EOF
@@ -54,6 +54,28 @@ void grid_cpu_collocate_pgf_product(
     const int o1, const int o2, const int n1, const int n2,
     const double pab[n2][n1], double *grid);
 
+/*******************************************************************************
+ * \brief Collocates a single task onto several grids at once, e.g. one for
+ *        each spin channel. The exponentials, polynomials, and loop bounds are
+ *        computed only once and shared by all grids.
+ *        Arguments are identical with grid_cpu_collocate_pgf_product except:
+ *
+ * \param ngrids        Number of density matrix blocks and grids.
+ * \param pabs          The atom-pair's density matrix blocks, each [n2][n1].
+ * \param grids         The output grid arrays to collocate into.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_cpu_collocate_pgf_product_multi(
+    const bool orthorhombic, const int border_mask, const enum grid_func func,
+    const int la_max, const int la_min, const int lb_max, const int lb_min,
+    const double zeta, const double zetb, const double rscale,
+    const double dh[3][3], const double dh_inv[3][3], const double ra[3],
+    const double rab[3], const int npts_global[3], const int npts_local[3],
+    const int shift_local[3], const int border_width[3], const double radius,
+    const int o1, const int o2, const int n1, const int n2, const int ngrids,
+    const double *const pabs[ngrids], double *const grids[ngrids]);
+
 #endif
 
 // EOF
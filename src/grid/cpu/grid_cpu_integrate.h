@@ -39,5 +39,32 @@ void grid_cpu_integrate_pgf_product(
     double hdab[n2][n1][3], double hadb[n2][n1][3],
     double a_hdab[n2][n1][3][3]);
 
+/*******************************************************************************
+ * \brief Integrates a single task from several grids at once, e.g. one for
+ *        each spin channel. The exponentials, polynomials, and loop bounds are
+ *        computed only once and shared by all grids.
+ *        Arguments are identical with grid_cpu_integrate_pgf_product except:
+ *
+ * \param ngrids        Number of grids and matrix blocks.
+ * \param grids         Input grid arrays.
+ * \param habs          Output Hamiltonian matrix blocks, each [n2][n1].
+ * \param pabs          Optional input density matrix blocks, each [n2][n1].
+ * \param forces        Optional output forces summed over all grids.
+ * \param virials       Optional output virials summed over all grids.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_cpu_integrate_pgf_product_multi(
+    const bool orthorhombic, const bool compute_tau, const int border_mask,
+    const int la_max, const int la_min, const int lb_max, const int lb_min,
+    const double zeta, const double zetb, const double dh[3][3],
+    const double dh_inv[3][3], const double ra[3], const double rab[3],
+    const int npts_global[3], const int npts_local[3], const int shift_local[3],
+    const int border_width[3], const double radius, const int o1, const int o2,
+    const int n1, const int n2, const int ngrids,
+    const double *const grids[ngrids], double *const habs[ngrids],
+    const double *const pabs[ngrids], double forces[2][3],
+    double virials[2][3][3]);
+
 #endif
 // EOF
@@ -6,6 +6,7 @@
 /*----------------------------------------------------------------------------*/
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <omp.h>
 #include <stdint.h>
@@ -14,10 +15,17 @@
 #include <string.h>
 
 #include "../common/grid_common.h"
+#include "../common/grid_library.h"
+#include "../common/grid_sphere_cache.h"
 #include "grid_cpu_collocate.h"
 #include "grid_cpu_integrate.h"
+#include "grid_cpu_prepare_pab.h"
 #include "grid_cpu_task_list.h"
 
+// Max number of densities that are collocated or integrated in a single pass.
+// It bounds the memory needed for thread-local grids and for stack arrays.
+#define GRID_CPU_MAX_DENSITIES 4
+
 /*******************************************************************************
  * \brief Comperator passed to qsort to compare two tasks.
  * \author Ole Schuett
@@ -34,6 +42,387 @@ static int compare_tasks(const void *a, const void *b) {
     return task_a->jset - task_b->jset;
   }
 }
+
+/*******************************************************************************
+ * \brief Computes the z planes of the local grid which a task touches. The
+ *        range is not wrapped and includes a safety margin of one plane.
+ *        This mirrors the loop bounds of ortho_cxyz_to_grid and
+ *        general_cijk_to_grid.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void task_plane_range(const grid_cpu_task_list *task_list,
+                             const grid_cpu_task *task,
+                             const grid_cpu_layout *layout, int *plane_min,
+                             int *plane_max) {
+  const int iatom = task->iatom - 1;
+  const int jatom = task->jatom - 1;
+  const int iset = task->iset - 1;
+  const int jset = task->jset - 1;
+  const int ipgf = task->ipgf - 1;
+  const int jpgf = task->jpgf - 1;
+  const int ikind = task_list->atom_kinds[iatom] - 1;
+  const int jkind = task_list->atom_kinds[jatom] - 1;
+  const grid_basis_set *ibasis = task_list->basis_sets[ikind];
+  const grid_basis_set *jbasis = task_list->basis_sets[jkind];
+  const double zeta = ibasis->zet[iset * ibasis->maxpgf + ipgf];
+  const double zetb = jbasis->zet[jset * jbasis->maxpgf + jpgf];
+  const double *ra = &task_list->atom_positions[3 * iatom];
+
+  // Center of the Gaussian product, see cab_to_grid.
+  const double f = zetb / (zeta + zetb);
+  double rp[3];
+  for (int i = 0; i < 3; i++) {
+    rp[i] = ra[i] + f * task->rab[i];
+  }
+
+  int index_min, index_max;
+  if (task_list->orthorhombic && task->border_mask == 0) {
+    double dh_inv_rp = 0.0;
+    for (int j = 0; j < 3; j++) {
+      dh_inv_rp += layout->dh_inv[j][2] * rp[j];
+    }
+    const int cubecenter = (int)floor(dh_inv_rp);
+    int *sphere_bounds;
+    double disr_radius;
+    grid_sphere_cache_lookup(task->radius, layout->dh, layout->dh_inv,
+                             &sphere_bounds, &disr_radius);
+    const int lb_cube = (int)ceil(-1e-8 - disr_radius * layout->dh_inv[2][2]);
+    index_min = cubecenter + lb_cube;
+    index_max = cubecenter + 1 - lb_cube;
+  } else {
+    index_min = INT_MAX;
+    index_max = INT_MIN;
+    for (int i = -1; i <= 1; i++) {
+      for (int j = -1; j <= 1; j++) {
+        for (int k = -1; k <= 1; k++) {
+          const double x = rp[0] + i * task->radius;
+          const double y = rp[1] + j * task->radius;
+          const double z = rp[2] + k * task->radius;
+          const double resc = layout->dh_inv[0][2] * x +
+                              layout->dh_inv[1][2] * y +
+                              layout->dh_inv[2][2] * z;
+          index_min = imin(index_min, (int)floor(resc));
+          index_max = imax(index_max, (int)ceil(resc));
+        }
+      }
+    }
+  }
+  *plane_min = index_min - layout->shift_local[2] - 1;
+  *plane_max = index_max - layout->shift_local[2] + 1;
+}
+
+/*******************************************************************************
+ * \brief Deallocates the given tiling.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void free_tiling(grid_cpu_tiling *tiling) {
+  free(tiling->window_lower);
+  free(tiling->window_size);
+  free(tiling->first_tile_task);
+  free(tiling->tile_tasks);
+  memset(tiling, 0, sizeof(grid_cpu_tiling));
+}
+
+/*******************************************************************************
+ * \brief Splits given grid level into slabs along z and assigns its tasks.
+ *        Leaves the level untiled if it has no benefit or is not supported.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void create_tiling(const grid_cpu_task_list *task_list, const int level,
+                          const int max_tiles, grid_cpu_tiling *tiling) {
+  memset(tiling, 0, sizeof(grid_cpu_tiling));
+  const grid_cpu_layout *layout = &task_list->layouts[level];
+  const int nplanes = layout->npts_local[2];
+  const int nplanes_global = layout->npts_global[2];
+
+  // Find the tasks of this level, which are contiguous after sorting.
+  int first_task = 0;
+  while (first_task < task_list->ntasks &&
+         task_list->tasks[first_task].level - 1 < level) {
+    first_task++;
+  }
+  int ntasks = 0;
+  while (first_task + ntasks < task_list->ntasks &&
+         task_list->tasks[first_task + ntasks].level - 1 == level) {
+    ntasks++;
+  }
+  const int ntiles = imin(max_tiles, nplanes);
+  if (ntiles < 2 || ntasks == 0) {
+    return;
+  }
+
+  // Locate each task in z. Its planes are shifted by a multiple of the global
+  // grid size such that its center lies in or close to the local grid.
+  int *home_plane = malloc(ntasks * sizeof(int));
+  int *lower_plane = malloc(ntasks * sizeof(int));
+  int *upper_plane = malloc(ntasks * sizeof(int));
+  double *plane_costs = calloc(nplanes, sizeof(double));
+  bool supported = true;
+  for (int i = 0; i < ntasks; i++) {
+    const grid_cpu_task *task = &task_list->tasks[first_task + i];
+    // Tasks cut off at the z borders of a distributed grid are not supported.
+    if (task->border_mask & (3 << 4)) {
+      supported = false;
+    }
+    int plane_min, plane_max;
+    task_plane_range(task_list, task, layout, &plane_min, &plane_max);
+    const int center = plane_min + (plane_max - plane_min) / 2;
+    int wrapped = modulo(center, nplanes_global);
+    if (wrapped >= nplanes &&
+        nplanes_global - wrapped < wrapped - nplanes + 1) {
+      wrapped -= nplanes_global;
+    }
+    lower_plane[i] = plane_min + wrapped - center;
+    upper_plane[i] = plane_max + wrapped - center;
+    home_plane[i] = imin(imax(wrapped, 0), nplanes - 1);
+    const double extent = upper_plane[i] - lower_plane[i] + 1;
+    plane_costs[home_plane[i]] += extent * extent * extent;
+  }
+
+  // Split the planes into tiles of roughly equal cost.
+  double total_cost = 0.0;
+  for (int iplane = 0; iplane < nplanes; iplane++) {
+    total_cost += plane_costs[iplane];
+  }
+  int *tile_of_plane = malloc(nplanes * sizeof(int));
+  int tile_lower[ntiles + 1];
+  tile_lower[0] = 0;
+  tile_lower[ntiles] = nplanes;
+  double cost = 0.0;
+  int iplane = 0;
+  for (int itile = 1; itile < ntiles; itile++) {
+    const double target = total_cost * itile / ntiles;
+    while (iplane < nplanes && cost + plane_costs[iplane] <= target) {
+      cost += plane_costs[iplane++];
+    }
+    // Every tile gets at least one plane.
+    tile_lower[itile] = imin(imax(iplane, tile_lower[itile - 1] + 1),
+                             nplanes - ntiles + itile);
+  }
+  for (int itile = 0; itile < ntiles; itile++) {
+    for (int i = tile_lower[itile]; i < tile_lower[itile + 1]; i++) {
+      tile_of_plane[i] = itile;
+    }
+  }
+
+  // Windows cover their slab and all planes touched by their tasks.
+  tiling->ntiles = ntiles;
+  tiling->window_lower = malloc(ntiles * sizeof(int));
+  tiling->window_size = malloc(ntiles * sizeof(int));
+  tiling->first_tile_task = calloc(ntiles + 1, sizeof(int));
+  tiling->tile_tasks = malloc(ntasks * sizeof(int));
+  int window_upper[ntiles];
+  for (int itile = 0; itile < ntiles; itile++) {
+    tiling->window_lower[itile] = tile_lower[itile];
+    window_upper[itile] = tile_lower[itile + 1] - 1;
+  }
+  for (int i = 0; i < ntasks; i++) {
+    const int itile = tile_of_plane[home_plane[i]];
+    tiling->window_lower[itile] =
+        imin(tiling->window_lower[itile], lower_plane[i]);
+    window_upper[itile] = imax(window_upper[itile], upper_plane[i]);
+    tiling->first_tile_task[itile + 1]++;
+  }
+  for (int itile = 0; itile < ntiles; itile++) {
+    tiling->window_size[itile] =
+        window_upper[itile] - tiling->window_lower[itile] + 1;
+    // A window must not wrap around the periodic grid onto itself.
+    if (tiling->window_size[itile] > nplanes_global) {
+      supported = false;
+    }
+    tiling->first_tile_task[itile + 1] += tiling->first_tile_task[itile];
+  }
+
+  // Group the tasks by tile while retaining their order for load_pab.
+  int tile_ntasks[ntiles];
+  memset(tile_ntasks, 0, ntiles * sizeof(int));
+  for (int i = 0; i < ntasks; i++) {
+    const int itile = tile_of_plane[home_plane[i]];
+    const int j = tiling->first_tile_task[itile] + tile_ntasks[itile]++;
+    tiling->tile_tasks[j] = first_task + i;
+  }
+
+  free(home_plane);
+  free(lower_plane);
+  free(upper_plane);
+  free(plane_costs);
+  free(tile_of_plane);
+  if (!supported) {
+    free_tiling(tiling);
+  }
+}
+
+/*******************************************************************************
+ * \brief Internal key-value pair for sorting blocks along a Morton curve.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  uint64_t key;
+  int block_num;
+} block_key;
+
+/*******************************************************************************
+ * \brief Comperator passed to qsort to compare two block keys.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compare_block_keys(const void *a, const void *b) {
+  const block_key *key_a = a, *key_b = b;
+  if (key_a->key != key_b->key) {
+    return (key_a->key < key_b->key) ? -1 : 1;
+  } else {
+    return key_a->block_num - key_b->block_num;
+  }
+}
+
+/*******************************************************************************
+ * \brief Computes the Morton key of a point given in fractional coordinates.
+ *        The bits of the z coordinate are most significant, which matches the
+ *        memory layout of the grids.
+ * \author Ole Schuett
+ ******************************************************************************/
+static uint64_t morton_key(const double frac[3]) {
+  const int nbits = 21; // 3 * 21 bits fit into 64 bits
+  uint64_t coords[3];
+  for (int i = 0; i < 3; i++) {
+    const double wrapped = frac[i] - floor(frac[i]);
+    coords[i] = (uint64_t)(wrapped * (1 << nbits)) & ((1 << nbits) - 1);
+  }
+  uint64_t key = 0;
+  for (int bit = nbits - 1; bit >= 0; bit--) {
+    for (int i = 2; i >= 0; i--) {
+      key = (key << 1) | ((coords[i] >> bit) & 1);
+    }
+  }
+  return key;
+}
+
+/*******************************************************************************
+ * \brief Orders the blocks along a Morton curve through the centers of their
+ *        atom pairs and rearranges the tasks of each level accordingly. Hence,
+ *        consecutive blocks touch nearby regions of the grids, while the tasks
+ *        of each block remain contiguous.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void sort_blocks_spatially(grid_cpu_task_list *task_list) {
+  const int nblocks = task_list->nblocks;
+  const int nlevels = task_list->nlevels;
+  const grid_cpu_layout *layout = &task_list->layouts[0];
+
+  // Blocks correspond to atom pairs, which are the same on all levels.
+  block_key *keys = malloc(nblocks * sizeof(block_key));
+  for (int block_num = 0; block_num < nblocks; block_num++) {
+    keys[block_num].key = 0;
+    keys[block_num].block_num = block_num;
+  }
+  for (int itask = 0; itask < task_list->ntasks; itask++) {
+    const grid_cpu_task *task = &task_list->tasks[itask];
+    const int iatom = task->iatom - 1;
+    const double *ra = &task_list->atom_positions[3 * iatom];
+    double frac[3];
+    for (int i = 0; i < 3; i++) {
+      double index = 0.0;
+      for (int j = 0; j < 3; j++) {
+        index += layout->dh_inv[j][i] * (ra[j] + 0.5 * task->rab[j]);
+      }
+      frac[i] = index / layout->npts_global[i];
+    }
+    keys[task->block_num - 1].key = morton_key(frac);
+  }
+  qsort(keys, nblocks, sizeof(block_key), &compare_block_keys);
+  for (int iblock = 0; iblock < nblocks; iblock++) {
+    task_list->block_order[iblock] = keys[iblock].block_num;
+  }
+  free(keys);
+
+  // Rearrange the tasks of each level into the new block order.
+  grid_cpu_task *tasks = malloc(task_list->ntasks * sizeof(grid_cpu_task));
+  int ntasks = 0;
+  for (int level = 0; level < nlevels; level++) {
+    for (int iblock = 0; iblock < nblocks; iblock++) {
+      const int idx = level * nblocks + task_list->block_order[iblock];
+      const int first_task = task_list->first_level_block_task[idx];
+      const int last_task = task_list->last_level_block_task[idx];
+      if (last_task < first_task) {
+        continue;
+      }
+      const int n = last_task - first_task + 1;
+      memcpy(&tasks[ntasks], &task_list->tasks[first_task],
+             n * sizeof(grid_cpu_task));
+      task_list->first_level_block_task[idx] = ntasks;
+      task_list->last_level_block_task[idx] = ntasks + n - 1;
+      ntasks += n;
+    }
+  }
+  assert(ntasks == task_list->ntasks);
+  free(task_list->tasks);
+  task_list->tasks = tasks;
+}
+
+/*******************************************************************************
+ * \brief Internal sort key for grouping the tasks of all levels by block.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int block_num;
+  int iset;
+  int jset;
+  int level;
+  int itask;
+} block_task_key;
+
+/*******************************************************************************
+ * \brief Comperator passed to qsort to compare two block task keys.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int compare_block_task_keys(const void *a, const void *b) {
+  const block_task_key *key_a = a, *key_b = b;
+  if (key_a->block_num != key_b->block_num) {
+    return key_a->block_num - key_b->block_num;
+  } else if (key_a->iset != key_b->iset) {
+    return key_a->iset - key_b->iset;
+  } else if (key_a->jset != key_b->jset) {
+    return key_a->jset - key_b->jset;
+  } else if (key_a->level != key_b->level) {
+    return key_a->level - key_b->level;
+  } else {
+    return key_a->itask - key_b->itask;
+  }
+}
+
+/*******************************************************************************
+ * \brief Groups the tasks of all levels by block. Within a block the tasks are
+ *        ordered by iset and jset, such that each subblock of pab and hab is
+ *        only loaded and stored once for all levels.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void group_tasks_by_block(grid_cpu_task_list *task_list) {
+  const int ntasks = task_list->ntasks;
+  const int nblocks = task_list->nblocks;
+
+  block_task_key *keys = malloc(ntasks * sizeof(block_task_key));
+  task_list->first_block_task = calloc(nblocks + 1, sizeof(int));
+  for (int itask = 0; itask < ntasks; itask++) {
+    const grid_cpu_task *task = &task_list->tasks[itask];
+    keys[itask].block_num = task->block_num - 1;
+    keys[itask].iset = task->iset;
+    keys[itask].jset = task->jset;
+    keys[itask].level = task->level;
+    keys[itask].itask = itask;
+    task_list->first_block_task[task->block_num]++;
+  }
+  qsort(keys, ntasks, sizeof(block_task_key), &compare_block_task_keys);
+
+  task_list->block_tasks = malloc(ntasks * sizeof(int));
+  for (int i = 0; i < ntasks; i++) {
+    task_list->block_tasks[i] = keys[i].itask;
+  }
+  for (int block_num = 0; block_num < nblocks; block_num++) {
+    task_list->first_block_task[block_num + 1] +=
+        task_list->first_block_task[block_num];
+  }
+  free(keys);
+}
+
 /*******************************************************************************
  * \brief Allocates a task list for the cpu backend.
  *        See grid_task_list.h for details.
@@ -139,20 +528,49 @@ void grid_cpu_create_task_list(
     task_list->last_level_block_task[level * nblocks + block_num] = itask;
   }
 
+  // Optionally, process the blocks along a space-filling curve.
+  task_list->block_order = malloc(nblocks * sizeof(int));
+  for (int iblock = 0; iblock < nblocks; iblock++) {
+    task_list->block_order[iblock] = iblock;
+  }
+  if (grid_library_get_config().spatial_ordering) {
+    sort_blocks_spatially(task_list);
+  }
+
+  // Group tasks by block for the fused integration of all levels.
+  group_tasks_by_block(task_list);
+
   // Find largest Cartesian subblock size.
   task_list->maxco = 0;
   for (int i = 0; i < nkinds; i++) {
     task_list->maxco = imax(task_list->maxco, task_list->basis_sets[i]->maxco);
   }
 
-  // Initialize thread-local storage.
-  size = omp_get_max_threads() * sizeof(double *);
+  // By default the levels are split into one slab per thread.
+  const grid_library_config config = grid_library_get_config();
+  const int max_tiles = (config.collocate_tiles > 0) ? config.collocate_tiles
+                                                     : omp_get_max_threads();
+
+  // Initialize thread-local storage, which also holds the windows of tiles.
+  task_list->nthreadlocals = omp_get_max_threads();
+  if (config.tiled_collocate) {
+    task_list->nthreadlocals = imax(task_list->nthreadlocals, max_tiles);
+  }
+  size = task_list->nthreadlocals * sizeof(double *);
   task_list->threadlocals = malloc(size);
   memset(task_list->threadlocals, 0, size);
-  size = omp_get_max_threads() * sizeof(size_t);
+  size = task_list->nthreadlocals * sizeof(size_t);
   task_list->threadlocal_sizes = malloc(size);
   memset(task_list->threadlocal_sizes, 0, size);
 
+  // Split grid levels into slabs for the tiled collocation.
+  task_list->tilings = calloc(nlevels, sizeof(grid_cpu_tiling));
+  if (config.tiled_collocate) {
+    for (int level = 0; level < nlevels; level++) {
+      create_tiling(task_list, level, max_tiles, &task_list->tilings[level]);
+    }
+  }
+
   *task_list_out = task_list;
 }
 
@@ -169,13 +587,20 @@ void grid_cpu_free_task_list(grid_cpu_task_list *task_list) {
   free(task_list->layouts);
   free(task_list->first_level_block_task);
   free(task_list->last_level_block_task);
-  for (int i = 0; i < omp_get_max_threads(); i++) {
+  free(task_list->block_order);
+  free(task_list->first_block_task);
+  free(task_list->block_tasks);
+  for (int i = 0; i < task_list->nthreadlocals; i++) {
     if (task_list->threadlocals[i] != NULL) {
       free(task_list->threadlocals[i]);
     }
   }
   free(task_list->threadlocals);
   free(task_list->threadlocal_sizes);
+  for (int level = 0; level < task_list->nlevels; level++) {
+    free_tiling(&task_list->tilings[level]);
+  }
+  free(task_list->tilings);
   free(task_list);
 }
 
@@ -240,8 +665,242 @@ static void load_pab(const grid_basis_set *ibasis, const grid_basis_set *jbasis,
         maxcob, work, ncoa, 0.0, pab, ncoa);
 }
 
+/*******************************************************************************
+ * \brief Returns the number of bytes moved by load_pab or store_hab, i.e. the
+ *        spherical subblock plus its Cartesian counterpart.
+ * \author Ole Schuett
+ ******************************************************************************/
+static long subblock_nbytes(const grid_basis_set *ibasis,
+                            const grid_basis_set *jbasis, const int iset,
+                            const int jset) {
+  const long ncoa = ibasis->npgf[iset] * ncoset(ibasis->lmax[iset]);
+  const long ncob = jbasis->npgf[jset] * ncoset(jbasis->lmax[jset]);
+  const long nsgf = ibasis->nsgf_set[iset] * jbasis->nsgf_set[jset];
+  return (nsgf + ncoa * ncob) * sizeof(double);
+}
+
+/*******************************************************************************
+ * \brief Returns the current tick count if timings are enabled, zero otherwise.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline long start_timing(const bool timings) {
+  return (timings) ? grid_library_ticks() : 0;
+}
+
+/*******************************************************************************
+ * \brief Records the ticks elapsed since start_ticks for given phase.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline void stop_timing(const bool timings,
+                               const enum grid_library_phase phase,
+                               const long start_ticks, const long nbytes) {
+  if (timings) {
+    grid_library_phase_timing_add(GRID_BACKEND_CPU, phase,
+                                  grid_library_ticks() - start_ticks, nbytes);
+  }
+}
+
+/*******************************************************************************
+ * \brief Returns an upper bound for the sum of the absolute coefficients that
+ *        prepare_pab creates from a single element of pab. Derivatives turn
+ *        a Cartesian Gaussian into two with coefficients l and 2*zeta.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double screening_func_weight(const enum grid_func func,
+                                    const int la_max, const int lb_max,
+                                    const double zeta, const double zetb) {
+  const double s = la_max + lb_max + 2 + 2.0 * (zeta + zetb);
+  switch (func) {
+  case GRID_FUNC_AB:
+    return 1.0;
+  case GRID_FUNC_DADB:
+    return 1.5 * s * s; // 0.5 * sum over three directions
+  case GRID_FUNC_DXDY:
+  case GRID_FUNC_DYDZ:
+  case GRID_FUNC_DZDX:
+  case GRID_FUNC_DXDX:
+  case GRID_FUNC_DYDY:
+  case GRID_FUNC_DZDZ:
+    return s * s;
+  default:
+    return s; // all other functions take a single derivative
+  }
+}
+
+/*******************************************************************************
+ * \brief Returns true if the contribution of a task is below eps_screening.
+ *
+ *        With P the Gaussian product center and d = max(|PA|, |PB|), every
+ *        product of Cartesian Gaussians with la + lb <= l is bounded by
+ *          exp(-zeta*zetb/(zeta+zetb)*rab^2) * max(1, t + d)^l
+ *                                           * exp(-(zeta+zetb)*t^2),
+ *        where t = |r - P|. The maximum over t is attained below
+ *        t0 = sqrt(l/(2*(zeta+zetb))), hence max(1, t0 + d)^l is an upper
+ *        bound for the polynomial part. It is multiplied with the summed
+ *        absolute values of the task's slice of pab and the func's weight.
+ * \author Ole Schuett
+ ******************************************************************************/
+static bool screen_task(const double eps_screening, const enum grid_func func,
+                        const int la_max, const int lb_max, const double zeta,
+                        const double zetb, const double rab[3],
+                        const double rscale, const int o1, const int o2,
+                        const int n1, const int ncoseta, const int ncosetb,
+                        const int ndensities,
+                        const double *const pabs[ndensities]) {
+  int la_min_diff, la_max_diff, lb_min_diff, lb_max_diff;
+  grid_cpu_prepare_get_ldiffs(func, &la_min_diff, &la_max_diff, &lb_min_diff,
+                              &lb_max_diff);
+  const int l = la_max + la_max_diff + lb_max + lb_max_diff;
+  const double zetp = zeta + zetb;
+  const double rab2 = rab[0] * rab[0] + rab[1] * rab[1] + rab[2] * rab[2];
+  const double d = fmax(zeta, zetb) / zetp * sqrt(rab2);
+  const double t0 = sqrt(l / (2.0 * zetp));
+  const double polynomial = pow(fmax(1.0, t0 + d), l);
+  const double prefactor =
+      rscale * exp(-zeta * zetb / zetp * rab2) * polynomial *
+      screening_func_weight(func, la_max, lb_max, zeta, zetb);
+  const double threshold = eps_screening / prefactor;
+  for (int i = 0; i < ndensities; i++) {
+    double pab_sum = 0.0;
+    for (int jco = o2; jco < o2 + ncosetb; jco++) {
+      for (int ico = o1; ico < o1 + ncoseta; ico++) {
+        pab_sum += fabs(pabs[i][jco * n1 + ico]);
+      }
+    }
+    if (pab_sum >= threshold) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*******************************************************************************
+ * \brief Collocate a single task onto given grids, which might be windows.
+ *        There is one grid for each of the ndensities density matrices.
+ *        The previous pabs are reused when only ipgf or jpgf has changed.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void collocate_one_task(
+    const grid_cpu_task_list *task_list, const int itask,
+    const enum grid_func func, const int npts_global[3],
+    const int npts_local[3], const int shift_local[3],
+    const int border_width[3], const double dh[3][3], const double dh_inv[3][3],
+    const int ndensities, const double *const pab_blocks[ndensities],
+    int *old_offset, int *old_iset, int *old_jset, double *pab,
+    double *const grids[ndensities]) {
+
+  // Define some convenient aliases.
+  const grid_cpu_task *task = &task_list->tasks[itask];
+  const int iatom = task->iatom - 1;
+  const int jatom = task->jatom - 1;
+  const int iset = task->iset - 1;
+  const int jset = task->jset - 1;
+  const int ipgf = task->ipgf - 1;
+  const int jpgf = task->jpgf - 1;
+  const int ikind = task_list->atom_kinds[iatom] - 1;
+  const int jkind = task_list->atom_kinds[jatom] - 1;
+  const grid_basis_set *ibasis = task_list->basis_sets[ikind];
+  const grid_basis_set *jbasis = task_list->basis_sets[jkind];
+  const double zeta = ibasis->zet[iset * ibasis->maxpgf + ipgf];
+  const double zetb = jbasis->zet[jset * jbasis->maxpgf + jpgf];
+  const int ncoseta = ncoset(ibasis->lmax[iset]);
+  const int ncosetb = ncoset(jbasis->lmax[jset]);
+  const int ncoa = ibasis->npgf[iset] * ncoseta; // size of carthesian set
+  const int ncob = jbasis->npgf[jset] * ncosetb;
+  const int block_num = task->block_num - 1;
+  const int block_offset = task_list->block_offsets[block_num];
+  const bool transpose = (iatom <= jatom);
+
+  // The pab buffer holds one Cartesian subblock for each density.
+  const int pab_size = task_list->maxco * task_list->maxco;
+  const double *pabs[ndensities];
+  for (int i = 0; i < ndensities; i++) {
+    pabs[i] = &pab[i * pab_size];
+  }
+
+  // Load subblocks from buffers and decontract into Cartesian sublocks pab.
+  const bool timings = grid_library_timings_enabled();
+  if (block_offset != *old_offset || iset != *old_iset || jset != *old_jset) {
+    const long start_ticks = start_timing(timings);
+    *old_offset = block_offset;
+    *old_iset = iset;
+    *old_jset = jset;
+    for (int i = 0; i < ndensities; i++) {
+      const double *block = &pab_blocks[i][block_offset];
+      double *pab_i = &pab[i * pab_size];
+      load_pab(ibasis, jbasis, iset, jset, transpose, block, pab_i);
+    }
+    const long nbytes =
+        ndensities * subblock_nbytes(ibasis, jbasis, iset, jset);
+    stop_timing(timings, GRID_PHASE_LOAD_PAB, start_ticks, nbytes);
+  }
+
+  // Optionally skip tasks with a negligible contribution. The screening is
+  // disabled in validation mode because the reference backend does not skip.
+  const double rscale = (iatom == jatom) ? 1 : 2;
+  const grid_library_config config = grid_library_get_config();
+  const double eps_screening = config.eps_screening;
+  if (eps_screening > 0.0 && !config.validate) {
+    const bool skip = screen_task(
+        eps_screening, func, ibasis->lmax[iset], jbasis->lmax[jset], zeta, zetb,
+        task->rab, rscale, ipgf * ncoseta, jpgf * ncosetb, ncoa, ncoseta,
+        ncosetb, ndensities, pabs);
+    grid_library_screening_add(skip);
+    if (skip) {
+      return;
+    }
+  }
+
+  const long start_ticks = start_timing(timings);
+  grid_cpu_collocate_pgf_product_multi(
+      /*orthorhombic=*/task_list->orthorhombic,
+      /*border_mask=*/task->border_mask,
+      /*func=*/func,
+      /*la_max=*/ibasis->lmax[iset],
+      /*la_min=*/ibasis->lmin[iset],
+      /*lb_max=*/jbasis->lmax[jset],
+      /*lb_min=*/jbasis->lmin[jset],
+      /*zeta=*/zeta,
+      /*zetb=*/zetb,
+      /*rscale=*/rscale,
+      /*dh=*/dh,
+      /*dh_inv=*/dh_inv,
+      /*ra=*/&task_list->atom_positions[3 * iatom],
+      /*rab=*/task->rab,
+      /*npts_global=*/npts_global,
+      /*npts_local=*/npts_local,
+      /*shift_local=*/shift_local,
+      /*border_width=*/border_width,
+      /*radius=*/task->radius,
+      /*o1=*/ipgf * ncoseta,
+      /*o2=*/jpgf * ncosetb,
+      /*n1=*/ncoa,
+      /*n2=*/ncob,
+      /*ngrids=*/ndensities,
+      /*pabs=*/pabs,
+      /*grids=*/grids);
+  stop_timing(timings, GRID_PHASE_CAB_TO_GRID, start_ticks, 0);
+}
+
+/*******************************************************************************
+ * \brief Ensures that the thread-local storage can hold given number of bytes.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double *get_threadlocal(const grid_cpu_task_list *task_list,
+                               const int ithread, const size_t size) {
+  if (task_list->threadlocal_sizes[ithread] < size) {
+    if (task_list->threadlocals[ithread] != NULL) {
+      free(task_list->threadlocals[ithread]);
+    }
+    task_list->threadlocals[ithread] = malloc(size);
+    task_list->threadlocal_sizes[ithread] = size;
+  }
+  return task_list->threadlocals[ithread];
+}
+
 /*******************************************************************************
  * \brief Collocate a range of tasks which are destined for the same grid level.
+ *        Each of the ndensities density matrices goes into its own grid.
  * \author Ole Schuett
  ******************************************************************************/
 static void collocate_one_grid_level(
@@ -249,7 +908,8 @@ static void collocate_one_grid_level(
     const int *last_block_task, const enum grid_func func,
     const int npts_global[3], const int npts_local[3], const int shift_local[3],
     const int border_width[3], const double dh[3][3], const double dh_inv[3][3],
-    const double *pab_blocks, offload_buffer *grid) {
+    const int ndensities, const double *const pab_blocks[ndensities],
+    offload_buffer *const grids[ndensities]) {
 
 // Using default(shared) because with GCC 9 the behavior around const changed:
 // https://www.gnu.org/software/gcc/gcc-9/porting_to.html
@@ -261,100 +921,52 @@ static void collocate_one_grid_level(
     // Initialize variables to detect when a new subblock has to be fetched.
     int old_offset = -1, old_iset = -1, old_jset = -1;
 
-    // Matrix pab is re-used across tasks.
-    double pab[task_list->maxco * task_list->maxco];
+    // Matrices pab are re-used across tasks.
+    const size_t pab_size = task_list->maxco * task_list->maxco;
+    double *pab = malloc(ndensities * pab_size * sizeof(double));
 
-    // Ensure that grid can fit into thread-local storage, reallocate if needed.
+    // Ensure that grids fit into thread-local storage, reallocate if needed.
+    // The thread-local copies of the grids are stored one after another.
     const int npts_local_total = npts_local[0] * npts_local[1] * npts_local[2];
-    const size_t grid_size = npts_local_total * sizeof(double);
-    if (task_list->threadlocal_sizes[ithread] < grid_size) {
-      if (task_list->threadlocals[ithread] != NULL) {
-        free(task_list->threadlocals[ithread]);
-      }
-      task_list->threadlocals[ithread] = malloc(grid_size);
-      task_list->threadlocal_sizes[ithread] = grid_size;
+    const size_t ngrid_points = (size_t)ndensities * npts_local_total;
+    const size_t grids_size = ngrid_points * sizeof(double);
+    double *const my_grids_data =
+        get_threadlocal(task_list, ithread, grids_size);
+    double *my_grids[ndensities];
+    for (int i = 0; i < ndensities; i++) {
+      my_grids[i] = &my_grids_data[(size_t)i * npts_local_total];
     }
 
-    // Zero thread-local copy of the grid.
-    double *const my_grid = task_list->threadlocals[ithread];
-    memset(my_grid, 0, grid_size);
+    // Zero thread-local copies of the grids.
+    const bool timings = grid_library_timings_enabled();
+    long start_ticks = start_timing(timings);
+    memset(my_grids_data, 0, grids_size);
+    stop_timing(timings, GRID_PHASE_REDUCTION, start_ticks, grids_size);
 
     // Parallelize over blocks to avoid unnecessary calls to load_pab.
+    // Each chunk is a contiguous range of blocks in their processing order.
     const int chunk_size = imax(1, task_list->nblocks / (nthreads * 50));
 #pragma omp for schedule(dynamic, chunk_size)
-    for (int block_num = 0; block_num < task_list->nblocks; block_num++) {
+    for (int iblock = 0; iblock < task_list->nblocks; iblock++) {
+      const int block_num = task_list->block_order[iblock];
       const int first_task = first_block_task[block_num];
       const int last_task = last_block_task[block_num];
-
       for (int itask = first_task; itask <= last_task; itask++) {
-        // Define some convenient aliases.
-        const grid_cpu_task *task = &task_list->tasks[itask];
-        const int iatom = task->iatom - 1;
-        const int jatom = task->jatom - 1;
-        const int iset = task->iset - 1;
-        const int jset = task->jset - 1;
-        const int ipgf = task->ipgf - 1;
-        const int jpgf = task->jpgf - 1;
-        const int ikind = task_list->atom_kinds[iatom] - 1;
-        const int jkind = task_list->atom_kinds[jatom] - 1;
-        const grid_basis_set *ibasis = task_list->basis_sets[ikind];
-        const grid_basis_set *jbasis = task_list->basis_sets[jkind];
-        const double zeta = ibasis->zet[iset * ibasis->maxpgf + ipgf];
-        const double zetb = jbasis->zet[jset * jbasis->maxpgf + jpgf];
-        const int ncoseta = ncoset(ibasis->lmax[iset]);
-        const int ncosetb = ncoset(jbasis->lmax[jset]);
-        const int ncoa = ibasis->npgf[iset] * ncoseta; // size of carthesian set
-        const int ncob = jbasis->npgf[jset] * ncosetb;
-        const int block_num = task->block_num - 1;
-        const int block_offset = task_list->block_offsets[block_num];
-        const double *block = &pab_blocks[block_offset];
-        const bool transpose = (iatom <= jatom);
-
-        // Load subblock from buffer and decontract into Cartesian sublock pab.
-        // The previous pab can be reused when only ipgf or jpgf has changed.
-        if (block_offset != old_offset || iset != old_iset ||
-            jset != old_jset) {
-          old_offset = block_offset;
-          old_iset = iset;
-          old_jset = jset;
-          load_pab(ibasis, jbasis, iset, jset, transpose, block, pab);
-        }
-
-        grid_cpu_collocate_pgf_product(
-            /*orthorhombic=*/task_list->orthorhombic,
-            /*border_mask=*/task->border_mask,
-            /*func=*/func,
-            /*la_max=*/ibasis->lmax[iset],
-            /*la_min=*/ibasis->lmin[iset],
-            /*lb_max=*/jbasis->lmax[jset],
-            /*lb_min=*/jbasis->lmin[jset],
-            /*zeta=*/zeta,
-            /*zetb=*/zetb,
-            /*rscale=*/(iatom == jatom) ? 1 : 2,
-            /*dh=*/dh,
-            /*dh_inv=*/dh_inv,
-            /*ra=*/&task_list->atom_positions[3 * iatom],
-            /*rab=*/task->rab,
-            /*npts_global=*/npts_global,
-            /*npts_local=*/npts_local,
-            /*shift_local=*/shift_local,
-            /*border_width=*/border_width,
-            /*radius=*/task->radius,
-            /*o1=*/ipgf * ncoseta,
-            /*o2=*/jpgf * ncosetb,
-            /*n1=*/ncoa,
-            /*n2=*/ncob,
-            /*pab=*/(const double(*)[ncoa])pab,
-            /*grid=*/my_grid);
-
-      } // end of task loop
-    } // end of block loop
+        collocate_one_task(task_list, itask, func, npts_global, npts_local,
+                           shift_local, border_width, dh, dh_inv, ndensities,
+                           pab_blocks, &old_offset, &old_iset, &old_jset, pab,
+                           my_grids);
+      }
+    }
+    free(pab);
 
 // While there should be an implicit barrier at the end of the block loop, this
 // explicit barrier eliminates occasional seg faults with icc compiled binaries.
 #pragma omp barrier
 
     // Merge thread-local grids via an efficient tree reduction.
+    start_ticks = start_timing(timings);
+    long nbytes = 0;
     const int nreduction_cycles = ceil(log(nthreads) / log(2)); // tree depth
     for (int icycle = 1; icycle <= nreduction_cycles; icycle++) {
       // Threads are divided into groups, whose size doubles with each cycle.
@@ -367,23 +979,123 @@ static void collocate_one_grid_level(
       const int actual_group_size = imin(group_size, nthreads - dest_thread);
       // Parallelize summation by dividing grid points across group members.
       const int rank = modulo(ithread, group_size); // position within the group
-      const int lb = (npts_local_total * rank) / actual_group_size;
-      const int ub = (npts_local_total * (rank + 1)) / actual_group_size;
+      const size_t lb = (ngrid_points * rank) / actual_group_size;
+      const size_t ub = (ngrid_points * (rank + 1)) / actual_group_size;
       if (src_thread < nthreads) {
-        for (int i = lb; i < ub; i++) {
+        for (size_t i = lb; i < ub; i++) {
           task_list->threadlocals[dest_thread][i] +=
               task_list->threadlocals[src_thread][i];
         }
+        nbytes += 3 * (ub - lb) * sizeof(double);
       }
 #pragma omp barrier
     }
 
-    // Copy final result from first thread into shared grid.
+    // Copy final results from first thread into shared grids.
     const int lb = (npts_local_total * ithread) / nthreads;
     const int ub = (npts_local_total * (ithread + 1)) / nthreads;
-    for (int i = lb; i < ub; i++) {
-      grid->host_buffer[i] = task_list->threadlocals[0][i];
+    for (int idensity = 0; idensity < ndensities; idensity++) {
+      const size_t offset = (size_t)idensity * npts_local_total;
+      const double *src = &task_list->threadlocals[0][offset];
+      for (int i = lb; i < ub; i++) {
+        grids[idensity]->host_buffer[i] = src[i];
+      }
+    }
+    nbytes += 2L * ndensities * (ub - lb) * sizeof(double);
+    stop_timing(timings, GRID_PHASE_REDUCTION, start_ticks, nbytes);
+
+  } // end of omp parallel region
+}
+
+/*******************************************************************************
+ * \brief Collocate the tasks of a grid level slab by slab. Each slab is owned
+ *        by a thread, which collocates the slab's tasks into a private window.
+ *        Afterwards, every z plane of the grid is summed from the windows that
+ *        overlap it. Hence, neither full copies of the grid nor a reduction
+ *        across all threads are needed.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void collocate_one_grid_level_tiled(
+    const grid_cpu_task_list *task_list, const grid_cpu_tiling *tiling,
+    const enum grid_func func, const int npts_global[3],
+    const int npts_local[3], const int shift_local[3],
+    const int border_width[3], const double dh[3][3], const double dh_inv[3][3],
+    const int ndensities, const double *const pab_blocks[ndensities],
+    offload_buffer *const grids[ndensities]) {
+
+  const int ntiles = tiling->ntiles;
+  const size_t plane_size = npts_local[0] * npts_local[1];
+
+// Using default(shared) because with GCC 9 the behavior around const changed:
+// https://www.gnu.org/software/gcc/gcc-9/porting_to.html
+#pragma omp parallel default(shared)
+  {
+    // Initialize variables to detect when a new subblock has to be fetched.
+    int old_offset = -1, old_iset = -1, old_jset = -1;
+    const bool timings = grid_library_timings_enabled();
+
+    // Matrices pab are re-used across tasks.
+    const size_t pab_size = task_list->maxco * task_list->maxco;
+    double *pab = malloc(ndensities * pab_size * sizeof(double));
+
+    // Collocate the tasks of each tile into its windows, one per density.
+#pragma omp for schedule(static)
+    for (int itile = 0; itile < ntiles; itile++) {
+      const size_t window_points = tiling->window_size[itile] * plane_size;
+      const size_t windows_size = ndensities * window_points * sizeof(double);
+      double *const windows_data =
+          get_threadlocal(task_list, itile, windows_size);
+      const long start_ticks = start_timing(timings);
+      memset(windows_data, 0, windows_size);
+      stop_timing(timings, GRID_PHASE_REDUCTION, start_ticks, windows_size);
+      double *windows[ndensities];
+      for (int i = 0; i < ndensities; i++) {
+        windows[i] = &windows_data[i * window_points];
+      }
+
+      // The window looks to the kernels like a non-periodic local grid.
+      const int window_npts_local[3] = {npts_local[0], npts_local[1],
+                                        tiling->window_size[itile]};
+      const int window_shift_local[3] = {
+          shift_local[0], shift_local[1],
+          shift_local[2] + tiling->window_lower[itile]};
+
+      const int first_task = tiling->first_tile_task[itile];
+      const int last_task = tiling->first_tile_task[itile + 1] - 1;
+      for (int i = first_task; i <= last_task; i++) {
+        collocate_one_task(task_list, tiling->tile_tasks[i], func, npts_global,
+                           window_npts_local, window_shift_local, border_width,
+                           dh, dh_inv, ndensities, pab_blocks, &old_offset,
+                           &old_iset, &old_jset, pab, windows);
+      }
+    } // implicit barrier
+    free(pab);
+
+    // Sum the overlapping windows into the shared grids plane by plane.
+    const long start_ticks = start_timing(timings);
+    long nbytes = 0;
+#pragma omp for schedule(static) nowait
+    for (int iplane = 0; iplane < npts_local[2]; iplane++) {
+      for (int idensity = 0; idensity < ndensities; idensity++) {
+        double *const dest = &grids[idensity]->host_buffer[iplane * plane_size];
+        memset(dest, 0, plane_size * sizeof(double));
+        for (int itile = 0; itile < ntiles; itile++) {
+          const int j = modulo(iplane - tiling->window_lower[itile],
+                               npts_global[2]);
+          if (j < tiling->window_size[itile]) {
+            const size_t window_points =
+                tiling->window_size[itile] * plane_size;
+            const size_t offset = idensity * window_points + j * plane_size;
+            const double *src = &task_list->threadlocals[itile][offset];
+            for (size_t i = 0; i < plane_size; i++) {
+              dest[i] += src[i];
+            }
+            nbytes += 2 * plane_size * sizeof(double);
+          }
+        }
+      }
     }
+    stop_timing(timings, GRID_PHASE_REDUCTION, start_ticks, nbytes);
 
   } // end of omp parallel region
 }
@@ -395,20 +1107,43 @@ static void collocate_one_grid_level(
  ******************************************************************************/
 void grid_cpu_collocate_task_list(const grid_cpu_task_list *task_list,
                                   const enum grid_func func, const int nlevels,
-                                  const offload_buffer *pab_blocks,
-                                  offload_buffer *grids[nlevels]) {
+                                  const int ndensities,
+                                  const offload_buffer *pab_blocks[ndensities],
+                                  offload_buffer *grids[ndensities][nlevels]) {
 
   assert(task_list->nlevels == nlevels);
 
-  for (int level = 0; level < task_list->nlevels; level++) {
-    const int idx = level * task_list->nblocks;
-    const int *first_block_task = &task_list->first_level_block_task[idx];
-    const int *last_block_task = &task_list->last_level_block_task[idx];
-    const grid_cpu_layout *layout = &task_list->layouts[level];
-    collocate_one_grid_level(
-        task_list, first_block_task, last_block_task, func, layout->npts_global,
-        layout->npts_local, layout->shift_local, layout->border_width,
-        layout->dh, layout->dh_inv, pab_blocks->host_buffer, grids[level]);
+  // Densities are processed in batches to bound the memory consumption.
+  for (int first = 0; first < ndensities; first += GRID_CPU_MAX_DENSITIES) {
+    const int nbatch = imin(GRID_CPU_MAX_DENSITIES, ndensities - first);
+    const double *pab_data[nbatch];
+    for (int i = 0; i < nbatch; i++) {
+      pab_data[i] = pab_blocks[first + i]->host_buffer;
+    }
+
+    for (int level = 0; level < task_list->nlevels; level++) {
+      const int idx = level * task_list->nblocks;
+      const int *first_block_task = &task_list->first_level_block_task[idx];
+      const int *last_block_task = &task_list->last_level_block_task[idx];
+      const grid_cpu_layout *layout = &task_list->layouts[level];
+      const grid_cpu_tiling *tiling = &task_list->tilings[level];
+      offload_buffer *level_grids[nbatch];
+      for (int i = 0; i < nbatch; i++) {
+        level_grids[i] = grids[first + i][level];
+      }
+      if (tiling->ntiles > 0) {
+        collocate_one_grid_level_tiled(
+            task_list, tiling, func, layout->npts_global, layout->npts_local,
+            layout->shift_local, layout->border_width, layout->dh,
+            layout->dh_inv, nbatch, pab_data, level_grids);
+      } else {
+        collocate_one_grid_level(
+            task_list, first_block_task, last_block_task, func,
+            layout->npts_global, layout->npts_local, layout->shift_local,
+            layout->border_width, layout->dh, layout->dh_inv, nbatch, pab_data,
+            level_grids);
+      }
+    }
   }
 }
 
@@ -456,7 +1191,56 @@ static inline void store_hab(const grid_basis_set *ibasis,
 }
 
 /*******************************************************************************
- * \brief Integrate a range of tasks that belong to the same grid level.
+ * \brief Adds the forces of a block to the shared forces and its virial to the
+ *        thread-local virial. The forces are updated atomically, which keeps
+ *        the memory footprint independent of the number of threads.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline void add_block_derivs(const int natoms, const int iatom,
+                                    const int jatom,
+                                    const double block_forces[2][3],
+                                    const double block_virials[2][3][3],
+                                    double forces[natoms][3],
+                                    double my_virial[3][3]) {
+  const double scalef = (iatom == jatom) ? 1.0 : 2.0;
+  if (forces != NULL) {
+    for (int i = 0; i < 3; i++) {
+#pragma omp atomic
+      forces[iatom][i] += scalef * block_forces[0][i];
+#pragma omp atomic
+      forces[jatom][i] += scalef * block_forces[1][i];
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      my_virial[i][j] +=
+          scalef * (block_virials[0][i][j] + block_virials[1][i][j]);
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Adds a thread-local virial to the shared one.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline void add_virial(const bool timings, const double my_virial[3][3],
+                              double virial[3][3]) {
+  if (virial == NULL) {
+    return;
+  }
+  const long start_ticks = start_timing(timings);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+#pragma omp atomic
+      virial[i][j] += my_virial[i][j];
+    }
+  }
+  stop_timing(timings, GRID_PHASE_REDUCTION, start_ticks, 9 * sizeof(double));
+}
+
+/*******************************************************************************
+ * \brief Integrate all tasks of a single grid level.
+ *        Each of the ndensities grids is integrated into its own hab blocks.
  * \author Ole Schuett
  ******************************************************************************/
 static void integrate_one_grid_level(
@@ -464,8 +1248,9 @@ static void integrate_one_grid_level(
     const int *last_block_task, const bool compute_tau, const int natoms,
     const int npts_global[3], const int npts_local[3], const int shift_local[3],
     const int border_width[3], const double dh[3][3], const double dh_inv[3][3],
-    const offload_buffer *pab_blocks, const offload_buffer *grid,
-    offload_buffer *hab_blocks, double forces[natoms][3], double virial[3][3]) {
+    const int ndensities, const double *const pab_blocks[ndensities],
+    const double *const grids[ndensities], double *const hab_blocks[ndensities],
+    double forces[natoms][3], double virial[3][3]) {
 
 // Using default(shared) because with GCC 9 the behavior around const changed:
 // https://www.gnu.org/software/gcc/gcc-9/porting_to.html
@@ -475,18 +1260,32 @@ static void integrate_one_grid_level(
     int old_offset = -1, old_iset = -1, old_jset = -1;
     grid_basis_set *old_ibasis = NULL, *old_jbasis = NULL;
     bool old_transpose = false;
-
-    // Matrix pab and hab are re-used across tasks.
-    double pab[task_list->maxco * task_list->maxco];
-    double hab[task_list->maxco * task_list->maxco];
+    const bool timings = grid_library_timings_enabled();
+    const bool pab_required = (forces != NULL || virial != NULL);
+    double my_virial[3][3] = {0};
+
+    // Matrices pab and hab are re-used across tasks.
+    const size_t pab_size = task_list->maxco * task_list->maxco;
+    double *pab = malloc(ndensities * pab_size * sizeof(double));
+    double *hab = malloc(ndensities * pab_size * sizeof(double));
+    const double *pabs[ndensities];
+    double *habs[ndensities];
+    for (int i = 0; i < ndensities; i++) {
+      pabs[i] = &pab[i * pab_size];
+      habs[i] = &hab[i * pab_size];
+    }
 
     // Parallelize over blocks to avoid concurred access to hab_blocks.
     const int nthreads = omp_get_num_threads();
     const int chunk_size = imax(1, task_list->nblocks / (nthreads * 50));
 #pragma omp for schedule(dynamic, chunk_size)
-    for (int block_num = 0; block_num < task_list->nblocks; block_num++) {
+    for (int iblock = 0; iblock < task_list->nblocks; iblock++) {
+      const int block_num = task_list->block_order[iblock];
       const int first_task = first_block_task[block_num];
       const int last_task = last_block_task[block_num];
+      if (last_task < first_task) {
+        continue; // block has no tasks on this level
+      }
 
       // Accumulate forces per block as it corresponds to a pair of atoms.
       const int iatom = task_list->tasks[first_task].iatom - 1;
@@ -515,21 +1314,35 @@ static void integrate_one_grid_level(
         const int ncob = jbasis->npgf[jset] * ncosetb;
         const int block_offset = task_list->block_offsets[block_num];
         const bool transpose = (iatom <= jatom);
-        const bool pab_required = (forces != NULL || virial != NULL);
 
         // Load pab and store hab subblocks when needed.
         // Previous hab and pab can be reused when only ipgf or jpgf changed.
         if (block_offset != old_offset || iset != old_iset ||
             jset != old_jset) {
           if (pab_required) {
-            load_pab(ibasis, jbasis, iset, jset, transpose,
-                     &pab_blocks->host_buffer[block_offset], pab);
+            const long start_ticks = start_timing(timings);
+            for (int i = 0; i < ndensities; i++) {
+              load_pab(ibasis, jbasis, iset, jset, transpose,
+                       &pab_blocks[i][block_offset], &pab[i * pab_size]);
+            }
+            const long nbytes =
+                ndensities * subblock_nbytes(ibasis, jbasis, iset, jset);
+            stop_timing(timings, GRID_PHASE_LOAD_PAB, start_ticks, nbytes);
           }
           if (old_offset >= 0) { // skip first iteration
-            store_hab(old_ibasis, old_jbasis, old_iset, old_jset, old_transpose,
-                      hab, &hab_blocks->host_buffer[old_offset]);
+            const long start_ticks = start_timing(timings);
+            for (int i = 0; i < ndensities; i++) {
+              store_hab(old_ibasis, old_jbasis, old_iset, old_jset,
+                        old_transpose, habs[i], &hab_blocks[i][old_offset]);
+            }
+            const long nbytes =
+                ndensities *
+                subblock_nbytes(old_ibasis, old_jbasis, old_iset, old_jset);
+            stop_timing(timings, GRID_PHASE_STORE_HAB, start_ticks, nbytes);
+          }
+          for (int i = 0; i < ndensities; i++) {
+            memset(habs[i], 0, ncoa * ncob * sizeof(double));
           }
-          memset(hab, 0, ncoa * ncob * sizeof(double));
           old_offset = block_offset;
           old_iset = iset;
           old_jset = jset;
@@ -538,7 +1351,8 @@ static void integrate_one_grid_level(
           old_transpose = transpose;
         }
 
-        grid_cpu_integrate_pgf_product(
+        const long start_ticks = start_timing(timings);
+        grid_cpu_integrate_pgf_product_multi(
             /*orthorhombic=*/task_list->orthorhombic,
             /*compute_tau=*/compute_tau,
             /*border_mask=*/task->border_mask,
@@ -561,44 +1375,220 @@ static void integrate_one_grid_level(
             /*o2=*/jpgf * ncosetb,
             /*n1=*/ncoa,
             /*n2=*/ncob,
-            /*grid=*/grid->host_buffer,
-            /*hab=*/(double(*)[ncoa])hab,
-            /*pab=*/(pab_required) ? (const double(*)[ncoa])pab : NULL,
+            /*ngrids=*/ndensities,
+            /*grids=*/grids,
+            /*habs=*/habs,
+            /*pabs=*/(pab_required) ? pabs : NULL,
             /*forces=*/(forces != NULL) ? my_forces : NULL,
-            /*virials=*/(virial != NULL) ? my_virials : NULL,
-            /*hdab=*/NULL,
-            /*hadb=*/NULL,
-            /*a_hdab=*/NULL);
+            /*virials=*/(virial != NULL) ? my_virials : NULL);
+        stop_timing(timings, GRID_PHASE_GRID_TO_CAB, start_ticks, 0);
 
       } // end of task loop
 
-      // Merge thread-local forces and virial into shared ones.
-      // It does not seem worth the trouble to accumulate them thread-locally.
-      const double scalef = (iatom == jatom) ? 1.0 : 2.0;
-      if (forces != NULL) {
-#pragma omp critical(forces)
-        for (int i = 0; i < 3; i++) {
-          forces[iatom][i] += scalef * my_forces[0][i];
-          forces[jatom][i] += scalef * my_forces[1][i];
-        }
+      if (pab_required) {
+        add_block_derivs(natoms, iatom, jatom, my_forces, my_virials, forces,
+                         my_virial);
+      }
+
+    } // end of block loop
+
+    // store final habs
+    if (old_offset >= 0) {
+      const long start_ticks = start_timing(timings);
+      for (int i = 0; i < ndensities; i++) {
+        store_hab(old_ibasis, old_jbasis, old_iset, old_jset, old_transpose,
+                  habs[i], &hab_blocks[i][old_offset]);
       }
-      if (virial != NULL) {
-#pragma omp critical(virial)
-        for (int i = 0; i < 3; i++) {
-          for (int j = 0; j < 3; j++) {
-            virial[i][j] += scalef * my_virials[0][i][j];
-            virial[i][j] += scalef * my_virials[1][i][j];
+      const long nbytes = ndensities * subblock_nbytes(old_ibasis, old_jbasis,
+                                                       old_iset, old_jset);
+      stop_timing(timings, GRID_PHASE_STORE_HAB, start_ticks, nbytes);
+    }
+    free(pab);
+    free(hab);
+    add_virial(timings, my_virial, virial);
+
+  } // end of omp parallel region
+}
+
+/*******************************************************************************
+ * \brief Integrate the tasks of all grid levels block by block. Each hab
+ *        subblock stays resident until the tasks of all levels are done.
+ *        Each of the ndensities grids is integrated into its own hab blocks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void integrate_all_grid_levels(
+    const grid_cpu_task_list *task_list, const bool compute_tau,
+    const int natoms, const int nlevels, const int ndensities,
+    const double *const pab_blocks[ndensities],
+    const double *const grids[ndensities][nlevels],
+    double *const hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]) {
+
+// Using default(shared) because with GCC 9 the behavior around const changed:
+// https://www.gnu.org/software/gcc/gcc-9/porting_to.html
+#pragma omp parallel default(shared)
+  {
+    // Initialize variables to detect when a new subblock has to be fetched.
+    int old_offset = -1, old_iset = -1, old_jset = -1;
+    grid_basis_set *old_ibasis = NULL, *old_jbasis = NULL;
+    bool old_transpose = false;
+    const bool timings = grid_library_timings_enabled();
+    const bool pab_required = (forces != NULL || virial != NULL);
+    double my_virial[3][3] = {0};
+
+    // Matrices pab and hab are re-used across tasks.
+    const size_t pab_size = task_list->maxco * task_list->maxco;
+    double *pab = malloc(ndensities * pab_size * sizeof(double));
+    double *hab = malloc(ndensities * pab_size * sizeof(double));
+    const double *pabs[ndensities];
+    double *habs[ndensities];
+    for (int i = 0; i < ndensities; i++) {
+      pabs[i] = &pab[i * pab_size];
+      habs[i] = &hab[i * pab_size];
+    }
+
+    // Parallelize over blocks to avoid concurred access to hab_blocks.
+    const int nthreads = omp_get_num_threads();
+    const int chunk_size = imax(1, task_list->nblocks / (nthreads * 50));
+#pragma omp for schedule(dynamic, chunk_size)
+    for (int iblock = 0; iblock < task_list->nblocks; iblock++) {
+      const int block_num = task_list->block_order[iblock];
+      const int first_task = task_list->first_block_task[block_num];
+      const int last_task = task_list->first_block_task[block_num + 1] - 1;
+      if (last_task < first_task) {
+        continue; // block has no tasks
+      }
+
+      // Accumulate forces per block as it corresponds to a pair of atoms.
+      const int itask_first = task_list->block_tasks[first_task];
+      const int iatom = task_list->tasks[itask_first].iatom - 1;
+      const int jatom = task_list->tasks[itask_first].jatom - 1;
+      double my_forces[2][3] = {0};
+      double my_virials[2][3][3] = {0};
+
+      for (int i = first_task; i <= last_task; i++) {
+        // Define some convenient aliases.
+        const int itask = task_list->block_tasks[i];
+        const grid_cpu_task *task = &task_list->tasks[itask];
+        assert(task->block_num - 1 == block_num);
+        assert(task->iatom - 1 == iatom && task->jatom - 1 == jatom);
+        const int level = task->level - 1;
+        const grid_cpu_layout *layout = &task_list->layouts[level];
+        const int ikind = task_list->atom_kinds[iatom] - 1;
+        const int jkind = task_list->atom_kinds[jatom] - 1;
+        grid_basis_set *ibasis = task_list->basis_sets[ikind];
+        grid_basis_set *jbasis = task_list->basis_sets[jkind];
+        const int iset = task->iset - 1;
+        const int jset = task->jset - 1;
+        const int ipgf = task->ipgf - 1;
+        const int jpgf = task->jpgf - 1;
+        const double zeta = ibasis->zet[iset * ibasis->maxpgf + ipgf];
+        const double zetb = jbasis->zet[jset * jbasis->maxpgf + jpgf];
+        const int ncoseta = ncoset(ibasis->lmax[iset]);
+        const int ncosetb = ncoset(jbasis->lmax[jset]);
+        const int ncoa = ibasis->npgf[iset] * ncoseta; // size of carthesian set
+        const int ncob = jbasis->npgf[jset] * ncosetb;
+        const int block_offset = task_list->block_offsets[block_num];
+        const bool transpose = (iatom <= jatom);
+        const double *level_grids[ndensities];
+        for (int idensity = 0; idensity < ndensities; idensity++) {
+          level_grids[idensity] = grids[idensity][level];
+        }
+
+        // Load pab and store hab subblocks when needed.
+        // Previous hab and pab can be reused when only ipgf, jpgf, or the
+        // level changed.
+        if (block_offset != old_offset || iset != old_iset ||
+            jset != old_jset) {
+          if (pab_required) {
+            const long start_ticks = start_timing(timings);
+            for (int idensity = 0; idensity < ndensities; idensity++) {
+              load_pab(ibasis, jbasis, iset, jset, transpose,
+                       &pab_blocks[idensity][block_offset],
+                       &pab[idensity * pab_size]);
+            }
+            const long nbytes =
+                ndensities * subblock_nbytes(ibasis, jbasis, iset, jset);
+            stop_timing(timings, GRID_PHASE_LOAD_PAB, start_ticks, nbytes);
+          }
+          if (old_offset >= 0) { // skip first iteration
+            const long start_ticks = start_timing(timings);
+            for (int idensity = 0; idensity < ndensities; idensity++) {
+              store_hab(old_ibasis, old_jbasis, old_iset, old_jset,
+                        old_transpose, habs[idensity],
+                        &hab_blocks[idensity][old_offset]);
+            }
+            const long nbytes =
+                ndensities *
+                subblock_nbytes(old_ibasis, old_jbasis, old_iset, old_jset);
+            stop_timing(timings, GRID_PHASE_STORE_HAB, start_ticks, nbytes);
+          }
+          for (int idensity = 0; idensity < ndensities; idensity++) {
+            memset(habs[idensity], 0, ncoa * ncob * sizeof(double));
           }
+          old_offset = block_offset;
+          old_iset = iset;
+          old_jset = jset;
+          old_ibasis = ibasis;
+          old_jbasis = jbasis;
+          old_transpose = transpose;
         }
+
+        const long start_ticks = start_timing(timings);
+        grid_cpu_integrate_pgf_product_multi(
+            /*orthorhombic=*/task_list->orthorhombic,
+            /*compute_tau=*/compute_tau,
+            /*border_mask=*/task->border_mask,
+            /*la_max=*/ibasis->lmax[iset],
+            /*la_min=*/ibasis->lmin[iset],
+            /*lb_max=*/jbasis->lmax[jset],
+            /*lb_min=*/jbasis->lmin[jset],
+            /*zeta=*/zeta,
+            /*zetb=*/zetb,
+            /*dh=*/layout->dh,
+            /*dh_inv=*/layout->dh_inv,
+            /*ra=*/&task_list->atom_positions[3 * iatom],
+            /*rab=*/task->rab,
+            /*npts_global=*/layout->npts_global,
+            /*npts_local=*/layout->npts_local,
+            /*shift_local=*/layout->shift_local,
+            /*border_width=*/layout->border_width,
+            /*radius=*/task->radius,
+            /*o1=*/ipgf * ncoseta,
+            /*o2=*/jpgf * ncosetb,
+            /*n1=*/ncoa,
+            /*n2=*/ncob,
+            /*ngrids=*/ndensities,
+            /*grids=*/level_grids,
+            /*habs=*/habs,
+            /*pabs=*/(pab_required) ? pabs : NULL,
+            /*forces=*/(forces != NULL) ? my_forces : NULL,
+            /*virials=*/(virial != NULL) ? my_virials : NULL);
+        stop_timing(timings, GRID_PHASE_GRID_TO_CAB, start_ticks, 0);
+
+      } // end of task loop
+
+      if (pab_required) {
+        add_block_derivs(natoms, iatom, jatom, my_forces, my_virials, forces,
+                         my_virial);
       }
 
     } // end of block loop
 
-    // store final hab
+    // store final habs
     if (old_offset >= 0) {
-      store_hab(old_ibasis, old_jbasis, old_iset, old_jset, old_transpose, hab,
-                &hab_blocks->host_buffer[old_offset]);
+      const long start_ticks = start_timing(timings);
+      for (int i = 0; i < ndensities; i++) {
+        store_hab(old_ibasis, old_jbasis, old_iset, old_jset, old_transpose,
+                  habs[i], &hab_blocks[i][old_offset]);
+      }
+      const long nbytes = ndensities * subblock_nbytes(old_ibasis, old_jbasis,
+                                                       old_iset, old_jset);
+      stop_timing(timings, GRID_PHASE_STORE_HAB, start_ticks, nbytes);
     }
+    free(pab);
+    free(hab);
+    add_virial(timings, my_virial, virial);
 
   } // end of omp parallel region
 }
@@ -610,15 +1600,19 @@ static void integrate_one_grid_level(
  ******************************************************************************/
 void grid_cpu_integrate_task_list(
     const grid_cpu_task_list *task_list, const bool compute_tau,
-    const int natoms, const int nlevels, const offload_buffer *pab_blocks,
-    const offload_buffer *grids[nlevels], offload_buffer *hab_blocks,
-    double forces[natoms][3], double virial[3][3]) {
+    const int natoms, const int nlevels, const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]) {
 
   assert(task_list->nlevels == nlevels);
   assert(task_list->natoms == natoms);
 
   // Zero result arrays.
-  memset(hab_blocks->host_buffer, 0, hab_blocks->size);
+  for (int i = 0; i < ndensities; i++) {
+    memset(hab_blocks[i]->host_buffer, 0, hab_blocks[i]->size);
+  }
   if (forces != NULL) {
     memset(forces, 0, natoms * 3 * sizeof(double));
   }
@@ -626,16 +1620,42 @@ void grid_cpu_integrate_task_list(
     memset(virial, 0, 9 * sizeof(double));
   }
 
-  for (int level = 0; level < task_list->nlevels; level++) {
-    const int idx = level * task_list->nblocks;
-    const int *first_block_task = &task_list->first_level_block_task[idx];
-    const int *last_block_task = &task_list->last_level_block_task[idx];
-    const grid_cpu_layout *layout = &task_list->layouts[level];
-    integrate_one_grid_level(
-        task_list, first_block_task, last_block_task, compute_tau, natoms,
-        layout->npts_global, layout->npts_local, layout->shift_local,
-        layout->border_width, layout->dh, layout->dh_inv, pab_blocks,
-        grids[level], hab_blocks, forces, virial);
+  // Densities are processed in batches to bound the memory consumption.
+  for (int first = 0; first < ndensities; first += GRID_CPU_MAX_DENSITIES) {
+    const int nbatch = imin(GRID_CPU_MAX_DENSITIES, ndensities - first);
+    const double *pab_data[nbatch];
+    const double *grid_data[nbatch][nlevels];
+    double *hab_data[nbatch];
+    for (int i = 0; i < nbatch; i++) {
+      pab_data[i] =
+          (pab_blocks != NULL) ? pab_blocks[first + i]->host_buffer : NULL;
+      hab_data[i] = hab_blocks[first + i]->host_buffer;
+      for (int level = 0; level < nlevels; level++) {
+        grid_data[i][level] = grids[first + i][level]->host_buffer;
+      }
+    }
+
+    if (grid_library_get_config().fused_integrate) {
+      integrate_all_grid_levels(task_list, compute_tau, natoms, nlevels,
+                                nbatch, pab_data, grid_data, hab_data, forces,
+                                virial);
+    } else {
+      for (int level = 0; level < task_list->nlevels; level++) {
+        const int idx = level * task_list->nblocks;
+        const int *first_block_task = &task_list->first_level_block_task[idx];
+        const int *last_block_task = &task_list->last_level_block_task[idx];
+        const grid_cpu_layout *layout = &task_list->layouts[level];
+        const double *level_grids[nbatch];
+        for (int i = 0; i < nbatch; i++) {
+          level_grids[i] = grid_data[i][level];
+        }
+        integrate_one_grid_level(
+            task_list, first_block_task, last_block_task, compute_tau, natoms,
+            layout->npts_global, layout->npts_local, layout->shift_local,
+            layout->border_width, layout->dh, layout->dh_inv, nbatch,
+            pab_data, level_grids, hab_data, forces, virial);
+      }
+    }
   }
 }
 
@@ -44,6 +44,21 @@ typedef struct {
   double dh_inv[3][3];
 } grid_cpu_layout;
 
+/*******************************************************************************
+ * \brief Internal representation of the spatial tiling of a grid level.
+ *        The local grid is split along z into slabs, which are owned by
+ *        threads. Each slab is collocated into a window, which extends beyond
+ *        the slab by the halo of the tasks that straddle its boundaries.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int ntiles;           // Number of slabs, zero when the level is not tiled.
+  int *window_lower;    // First z plane of each window, might be negative.
+  int *window_size;     // Number of z planes of each window.
+  int *first_tile_task; // Start of each tile's tasks, has ntiles + 1 entries.
+  int *tile_tasks;      // Indices of the level's tasks grouped by tile.
+} grid_cpu_tiling;
+
 /*******************************************************************************
  * \brief Internal representation of a task list.
  * \author Ole Schuett
@@ -63,9 +78,14 @@ typedef struct {
   grid_cpu_layout *layouts;
   int *first_level_block_task;
   int *last_level_block_task;
+  int *block_order;      // Blocks in the order in which they are processed.
+  int *first_block_task; // Start of each block's tasks, has nblocks+1 entries.
+  int *block_tasks;      // Indices of all tasks grouped by block.
   int maxco;
+  int nthreadlocals;
   double **threadlocals;
   size_t *threadlocal_sizes;
+  grid_cpu_tiling *tilings;
 } grid_cpu_task_list;
 
 /*******************************************************************************
@@ -101,8 +121,9 @@ void grid_cpu_free_task_list(grid_cpu_task_list *task_list);
  ******************************************************************************/
 void grid_cpu_collocate_task_list(const grid_cpu_task_list *task_list,
                                   const enum grid_func func, const int nlevels,
-                                  const offload_buffer *pab_blocks,
-                                  offload_buffer *grids[nlevels]);
+                                  const int ndensities,
+                                  const offload_buffer *pab_blocks[ndensities],
+                                  offload_buffer *grids[ndensities][nlevels]);
 
 /*******************************************************************************
  * \brief Integrate all tasks of in given list from given grids.
@@ -111,9 +132,11 @@ void grid_cpu_collocate_task_list(const grid_cpu_task_list *task_list,
  ******************************************************************************/
 void grid_cpu_integrate_task_list(
     const grid_cpu_task_list *task_list, const bool compute_tau,
-    const int natoms, const int nlevels, const offload_buffer *pab_blocks,
-    const offload_buffer *grids[nlevels], offload_buffer *hab_blocks,
-    double forces[natoms][3], double virial[3][3]);
+    const int natoms, const int nlevels, const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]);
 
 #endif
 
@@ -0,0 +1,428 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../offload/offload_buffer.h"
+#include "common/grid_common.h"
+#include "common/grid_constants.h"
+#include "common/grid_library.h"
+#include "grid_autotune.h"
+
+// Maximum number of tasks that are timed for a single tuning decision.
+#define GRID_AUTOTUNE_NSAMPLES 128
+
+// Number of timing repetitions of which the fastest one is taken.
+#define GRID_AUTOTUNE_NREPEATS 3
+
+// Backends among which the autotuner chooses. The reference backend is left
+// out, because it only serves as baseline for validation.
+#define GRID_AUTOTUNE_NCANDIDATES 2
+static const enum grid_backend candidates[GRID_AUTOTUNE_NCANDIDATES] = {
+    GRID_BACKEND_CPU, GRID_BACKEND_DGEMM};
+
+/*******************************************************************************
+ * \brief Private struct for storing a subset of the tasks of a task list.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  int ntasks;
+  int *level_list;
+  int *iatom_list;
+  int *jatom_list;
+  int *iset_list;
+  int *jset_list;
+  int *ipgf_list;
+  int *jpgf_list;
+  int *border_mask_list;
+  int *block_num_list;
+  double *radius_list;
+  double (*rab_list)[3];
+} grid_autotune_tasks;
+
+/*******************************************************************************
+ * \brief Private routine for computing the spacing of a grid, i.e. the cube
+ *        root of the volume per grid point. Together with the exponents it
+ *        determines how many grid points a task touches.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double grid_spacing(const double dh[3][3]) {
+  const double volume = dh[0][0] * (dh[1][1] * dh[2][2] - dh[1][2] * dh[2][1]) -
+                        dh[0][1] * (dh[1][0] * dh[2][2] - dh[1][2] * dh[2][0]) +
+                        dh[0][2] * (dh[1][0] * dh[2][1] - dh[1][1] * dh[2][0]);
+  return cbrt(fabs(volume));
+}
+
+/*******************************************************************************
+ * \brief Private routine for copying the tasks with given indices.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void gather_tasks(
+    const int ntasks, const int level_list[ntasks],
+    const int iatom_list[ntasks], const int jatom_list[ntasks],
+    const int iset_list[ntasks], const int jset_list[ntasks],
+    const int ipgf_list[ntasks], const int jpgf_list[ntasks],
+    const int border_mask_list[ntasks], const int block_num_list[ntasks],
+    const double radius_list[ntasks], const double rab_list[ntasks][3],
+    const int nsubset, const int indices[nsubset],
+    grid_autotune_tasks *subset) {
+
+  const size_t size = nsubset * sizeof(int);
+  subset->ntasks = nsubset;
+  subset->level_list = malloc(size);
+  subset->iatom_list = malloc(size);
+  subset->jatom_list = malloc(size);
+  subset->iset_list = malloc(size);
+  subset->jset_list = malloc(size);
+  subset->ipgf_list = malloc(size);
+  subset->jpgf_list = malloc(size);
+  subset->border_mask_list = malloc(size);
+  subset->block_num_list = malloc(size);
+  subset->radius_list = malloc(nsubset * sizeof(double));
+  subset->rab_list = malloc(nsubset * 3 * sizeof(double));
+
+  for (int i = 0; i < nsubset; i++) {
+    const int itask = indices[i];
+    assert(0 <= itask && itask < ntasks);
+    subset->level_list[i] = level_list[itask];
+    subset->iatom_list[i] = iatom_list[itask];
+    subset->jatom_list[i] = jatom_list[itask];
+    subset->iset_list[i] = iset_list[itask];
+    subset->jset_list[i] = jset_list[itask];
+    subset->ipgf_list[i] = ipgf_list[itask];
+    subset->jpgf_list[i] = jpgf_list[itask];
+    subset->border_mask_list[i] = border_mask_list[itask];
+    subset->block_num_list[i] = block_num_list[itask];
+    subset->radius_list[i] = radius_list[itask];
+    memcpy(subset->rab_list[i], rab_list[itask], 3 * sizeof(double));
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for deallocating a subset of tasks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void free_tasks(grid_autotune_tasks *subset) {
+  free(subset->level_list);
+  free(subset->iatom_list);
+  free(subset->jatom_list);
+  free(subset->iset_list);
+  free(subset->jset_list);
+  free(subset->ipgf_list);
+  free(subset->jpgf_list);
+  free(subset->border_mask_list);
+  free(subset->block_num_list);
+  free(subset->radius_list);
+  free(subset->rab_list);
+}
+
+/*******************************************************************************
+ * \brief Private routine for creating a task list of given backend.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void create_backend_task_list(
+    const enum grid_backend backend, const bool orthorhombic,
+    const int nlevels, const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const grid_autotune_tasks *tasks, const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3], grid_cpu_task_list **cpu_task_list,
+    grid_dgemm_task_list **dgemm_task_list) {
+
+  switch (backend) {
+  case GRID_BACKEND_CPU:
+    grid_cpu_create_task_list(
+        orthorhombic, tasks->ntasks, nlevels, natoms, nkinds, nblocks,
+        block_offsets, atom_positions, atom_kinds, basis_sets,
+        tasks->level_list, tasks->iatom_list, tasks->jatom_list,
+        tasks->iset_list, tasks->jset_list, tasks->ipgf_list, tasks->jpgf_list,
+        tasks->border_mask_list, tasks->block_num_list, tasks->radius_list,
+        (const double(*)[3])tasks->rab_list, npts_global, npts_local,
+        shift_local, border_width, dh, dh_inv, cpu_task_list);
+    break;
+  case GRID_BACKEND_DGEMM:
+    grid_dgemm_create_task_list(
+        orthorhombic, tasks->ntasks, nlevels, natoms, nkinds, nblocks,
+        block_offsets, atom_positions, atom_kinds, basis_sets,
+        tasks->level_list, tasks->iatom_list, tasks->jatom_list,
+        tasks->iset_list, tasks->jset_list, tasks->ipgf_list, tasks->jpgf_list,
+        tasks->border_mask_list, tasks->block_num_list, tasks->radius_list,
+        (const double(*)[3])tasks->rab_list, npts_global, npts_local,
+        shift_local, border_width, dh, dh_inv, dgemm_task_list);
+    break;
+  default:
+    printf("Error: Grid backend %i can not be autotuned.\n", backend);
+    abort();
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for timing a collocate and integrate of given tasks,
+ *        which all have to reside on a single grid level.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double time_backend(
+    const enum grid_backend backend, const bool orthorhombic,
+    const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const grid_autotune_tasks *tasks, const int npts_global[1][3],
+    const int npts_local[1][3], const int shift_local[1][3],
+    const int border_width[1][3], const double dh[1][3][3],
+    const double dh_inv[1][3][3], const offload_buffer *pab_blocks,
+    offload_buffer *grid, offload_buffer *hab_blocks) {
+
+  grid_cpu_task_list *cpu_task_list = NULL;
+  grid_dgemm_task_list *dgemm_task_list = NULL;
+  create_backend_task_list(backend, orthorhombic, 1, natoms, nkinds, nblocks,
+                           block_offsets, atom_positions, atom_kinds,
+                           basis_sets, tasks, npts_global, npts_local,
+                           shift_local, border_width, dh, dh_inv,
+                           &cpu_task_list, &dgemm_task_list);
+
+  offload_buffer *grids[1][1] = {{grid}};
+  const offload_buffer *const_grids[1][1] = {{grid}};
+  double best_time = DBL_MAX;
+  for (int irepeat = 0; irepeat < GRID_AUTOTUNE_NREPEATS; irepeat++) {
+    const double start_time = omp_get_wtime();
+    if (backend == GRID_BACKEND_CPU) {
+      grid_cpu_collocate_task_list(cpu_task_list, GRID_FUNC_AB, 1, 1,
+                                   &pab_blocks, grids);
+      grid_cpu_integrate_task_list(cpu_task_list, false, natoms, 1, 1,
+                                   &pab_blocks, const_grids, &hab_blocks, NULL,
+                                   NULL);
+    } else {
+      grid_dgemm_collocate_task_list(dgemm_task_list, GRID_FUNC_AB, 1,
+                                     pab_blocks, grids[0]);
+      grid_dgemm_integrate_task_list(dgemm_task_list, false, natoms, 1,
+                                     pab_blocks, const_grids[0], hab_blocks,
+                                     NULL, NULL);
+    }
+    best_time = fmin(best_time, omp_get_wtime() - start_time);
+  }
+
+  if (cpu_task_list != NULL) {
+    grid_cpu_free_task_list(cpu_task_list);
+  }
+  if (dgemm_task_list != NULL) {
+    grid_dgemm_free_task_list(dgemm_task_list);
+  }
+  return best_time;
+}
+
+/*******************************************************************************
+ * \brief Private routine for finding the fastest backend for those tasks that
+ *        share grid level and lp with given task.
+ * \author Ole Schuett
+ ******************************************************************************/
+static enum grid_backend tune_backend(
+    const int itask, const bool orthorhombic, const int ntasks,
+    const int nlevels, const int natoms, const int nkinds,
+    const double atom_positions[natoms][3], const int atom_kinds[natoms],
+    const grid_basis_set *basis_sets[nkinds], const int level_list[ntasks],
+    const int iatom_list[ntasks], const int jatom_list[ntasks],
+    const int iset_list[ntasks], const int jset_list[ntasks],
+    const int ipgf_list[ntasks], const int jpgf_list[ntasks],
+    const int border_mask_list[ntasks], const int block_num_list[ntasks],
+    const double radius_list[ntasks], const double rab_list[ntasks][3],
+    const int task_lps[ntasks], const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3]) {
+
+  // Pick evenly spaced samples from the tasks with the same level and lp.
+  int nmatching = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (level_list[i] == level_list[itask] && task_lps[i] == task_lps[itask]) {
+      nmatching++;
+    }
+  }
+  const int stride =
+      (nmatching + GRID_AUTOTUNE_NSAMPLES - 1) / GRID_AUTOTUNE_NSAMPLES;
+  int indices[GRID_AUTOTUNE_NSAMPLES];
+  int nsamples = 0, imatching = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (level_list[i] == level_list[itask] && task_lps[i] == task_lps[itask]) {
+      if (imatching % stride == 0) {
+        indices[nsamples++] = i;
+      }
+      imatching++;
+    }
+  }
+  assert(0 < nsamples && nsamples <= GRID_AUTOTUNE_NSAMPLES);
+
+  grid_autotune_tasks sample;
+  gather_tasks(ntasks, level_list, iatom_list, jatom_list, iset_list,
+               jset_list, ipgf_list, jpgf_list, border_mask_list,
+               block_num_list, radius_list, rab_list, nsamples, indices,
+               &sample);
+
+  // Give every sample its own block and move all of them onto a single level.
+  int block_offsets[nsamples];
+  int pab_length = 0;
+  for (int i = 0; i < nsamples; i++) {
+    const int ikind = atom_kinds[sample.iatom_list[i] - 1] - 1;
+    const int jkind = atom_kinds[sample.jatom_list[i] - 1] - 1;
+    block_offsets[i] = pab_length;
+    pab_length += basis_sets[ikind]->nsgf * basis_sets[jkind]->nsgf;
+    sample.block_num_list[i] = i + 1;
+    sample.level_list[i] = 1;
+  }
+
+  const int level = level_list[itask] - 1;
+  const int npts_local_total =
+      npts_local[level][0] * npts_local[level][1] * npts_local[level][2];
+  offload_buffer *pab_blocks = NULL, *hab_blocks = NULL, *grid = NULL;
+  offload_create_buffer(pab_length, &pab_blocks);
+  offload_create_buffer(pab_length, &hab_blocks);
+  offload_create_buffer(npts_local_total, &grid);
+  for (int i = 0; i < pab_length; i++) {
+    pab_blocks->host_buffer[i] = 1.0;
+  }
+
+  // The cost per task is estimated relative to a run with only the first
+  // sample, which removes fixed costs like the zeroing of the grid.
+  grid_autotune_tasks first_sample = sample;
+  first_sample.ntasks = 1;
+  enum grid_backend best_backend = candidates[0];
+  double best_cost = DBL_MAX;
+  for (int i = 0; i < GRID_AUTOTUNE_NCANDIDATES; i++) {
+    double cost = time_backend(
+        candidates[i], orthorhombic, natoms, nkinds, nsamples, block_offsets,
+        atom_positions, atom_kinds, basis_sets, &sample, &npts_global[level],
+        &npts_local[level], &shift_local[level], &border_width[level],
+        &dh[level], &dh_inv[level], pab_blocks, grid, hab_blocks);
+    if (nsamples > 1) {
+      const double fixed_cost = time_backend(
+          candidates[i], orthorhombic, natoms, nkinds, nsamples, block_offsets,
+          atom_positions, atom_kinds, basis_sets, &first_sample,
+          &npts_global[level], &npts_local[level], &shift_local[level],
+          &border_width[level], &dh[level], &dh_inv[level], pab_blocks, grid,
+          hab_blocks);
+      cost = (cost - fixed_cost) / (nsamples - 1);
+    }
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_backend = candidates[i];
+    }
+  }
+
+  offload_free_buffer(pab_blocks);
+  offload_free_buffer(hab_blocks);
+  offload_free_buffer(grid);
+  free_tasks(&sample);
+  return best_backend;
+}
+
+/*******************************************************************************
+ * \brief Splits the tasks between the cpu and dgemm backends.
+ *        See grid_autotune.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_autotune_create_task_lists(
+    const bool orthorhombic, const int ntasks, const int nlevels,
+    const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const int level_list[ntasks], const int iatom_list[ntasks],
+    const int jatom_list[ntasks], const int iset_list[ntasks],
+    const int jset_list[ntasks], const int ipgf_list[ntasks],
+    const int jpgf_list[ntasks], const int border_mask_list[ntasks],
+    const int block_num_list[ntasks], const double radius_list[ntasks],
+    const double rab_list[ntasks][3], const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3], grid_cpu_task_list **cpu_task_list,
+    grid_dgemm_task_list **dgemm_task_list) {
+
+  // Compute lp of every task, which together with the level and its grid
+  // spacing decides about the backend. Tasks are sampled by the same clamped
+  // lp the decision is stored under, such that every decision is timed on its
+  // own tasks.
+  int *task_lps = malloc(ntasks * sizeof(int));
+  for (int i = 0; i < ntasks; i++) {
+    const int ikind = atom_kinds[iatom_list[i] - 1] - 1;
+    const int jkind = atom_kinds[jatom_list[i] - 1] - 1;
+    const int lp = basis_sets[ikind]->lmax[iset_list[i] - 1] +
+                   basis_sets[jkind]->lmax[jset_list[i] - 1];
+    task_lps[i] = imin(lp, GRID_TUNING_MAX_LP - 1);
+  }
+
+  // Look up the backend of every task and tune missing decisions.
+  double spacings[nlevels];
+  for (int level = 0; level < nlevels; level++) {
+    spacings[level] = grid_spacing(dh[level]);
+  }
+  int *task_backends = malloc(ntasks * sizeof(int));
+  bool tuned_any = false;
+  for (int i = 0; i < ntasks; i++) {
+    const int level = level_list[i] - 1;
+    enum grid_backend backend = grid_library_get_tuned_backend(
+        orthorhombic, level, spacings[level], task_lps[i]);
+    if (backend != GRID_BACKEND_CPU && backend != GRID_BACKEND_DGEMM) {
+      backend = tune_backend(
+          i, orthorhombic, ntasks, nlevels, natoms, nkinds, atom_positions,
+          atom_kinds, basis_sets, level_list, iatom_list, jatom_list,
+          iset_list, jset_list, ipgf_list, jpgf_list, border_mask_list,
+          block_num_list, radius_list, rab_list, task_lps, npts_global,
+          npts_local, shift_local, border_width, dh, dh_inv);
+      grid_library_set_tuned_backend(orthorhombic, level, spacings[level],
+                                     task_lps[i], backend);
+      tuned_any = true;
+    }
+    task_backends[i] = backend;
+  }
+  if (tuned_any) {
+    grid_library_save_tuning();
+  }
+
+  // Create a task list for every backend from its share of the tasks.
+  int *indices = malloc(ntasks * sizeof(int));
+  for (int icandidate = 0; icandidate < GRID_AUTOTUNE_NCANDIDATES;
+       icandidate++) {
+    const enum grid_backend backend = candidates[icandidate];
+    int nsubset = 0;
+    for (int i = 0; i < ntasks; i++) {
+      if (task_backends[i] == (int)backend) {
+        indices[nsubset++] = i;
+      }
+    }
+    if (nsubset > 0) {
+      grid_autotune_tasks subset;
+      gather_tasks(ntasks, level_list, iatom_list, jatom_list, iset_list,
+                   jset_list, ipgf_list, jpgf_list, border_mask_list,
+                   block_num_list, radius_list, rab_list, nsubset, indices,
+                   &subset);
+      create_backend_task_list(backend, orthorhombic, nlevels, natoms, nkinds,
+                               nblocks, block_offsets, atom_positions,
+                               atom_kinds, basis_sets, &subset, npts_global,
+                               npts_local, shift_local, border_width, dh,
+                               dh_inv, cpu_task_list, dgemm_task_list);
+      free_tasks(&subset);
+    } else if (backend == GRID_BACKEND_CPU && *cpu_task_list != NULL) {
+      grid_cpu_free_task_list(*cpu_task_list);
+      *cpu_task_list = NULL;
+    } else if (backend == GRID_BACKEND_DGEMM && *dgemm_task_list != NULL) {
+      grid_dgemm_free_task_list(*dgemm_task_list);
+      *dgemm_task_list = NULL;
+    }
+  }
+
+  free(indices);
+  free(task_backends);
+  free(task_lps);
+}
+
+// EOF
@@ -0,0 +1,44 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#ifndef GRID_AUTOTUNE_H
+#define GRID_AUTOTUNE_H
+
+#include <stdbool.h>
+
+#include "common/grid_basis_set.h"
+#include "cpu/grid_cpu_task_list.h"
+#include "dgemm/grid_dgemm_task_list.h"
+
+/*******************************************************************************
+ * \brief Splits the tasks between the cpu and dgemm backends according to the
+ *        decisions of the autotuner, which the grid library keeps per cell
+ *        type, grid level, grid spacing, and lp. Missing decisions are made right away by
+ *        timing both backends on a sample of the affected tasks.
+ *        Given task lists are reused and set to NULL when their backend
+ *        receives no tasks. See grid_task_list.h for the other arguments.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_autotune_create_task_lists(
+    const bool orthorhombic, const int ntasks, const int nlevels,
+    const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const int level_list[ntasks], const int iatom_list[ntasks],
+    const int jatom_list[ntasks], const int iset_list[ntasks],
+    const int jset_list[ntasks], const int ipgf_list[ntasks],
+    const int jpgf_list[ntasks], const int border_mask_list[ntasks],
+    const int block_num_list[ntasks], const double radius_list[ntasks],
+    const double rab_list[ntasks][3], const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3], grid_cpu_task_list **cpu_task_list,
+    grid_dgemm_task_list **dgemm_task_list);
+
+#endif
+
+// EOF
@@ -0,0 +1,284 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__parallel)
+#include <mpi.h>
+#endif
+
+#include "grid_capture.h"
+
+/*******************************************************************************
+ * \brief Private routine for rounding up to the next multiple of the alignment.
+ * \author Ole Schuett
+ ******************************************************************************/
+static inline size_t padded_size(const size_t nbytes) {
+  return (nbytes + GRID_CAPTURE_ALIGNMENT - 1) / GRID_CAPTURE_ALIGNMENT *
+         GRID_CAPTURE_ALIGNMENT;
+}
+
+/*******************************************************************************
+ * \brief Private routine for appending a padded field to given capture.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void append_field(grid_capture *capture, const void *data,
+                         const size_t nbytes) {
+  const size_t new_size = capture->size + padded_size(nbytes);
+  if (new_size > capture->capacity) {
+    capture->capacity = 2 * new_size;
+    capture->data = realloc(capture->data, capture->capacity);
+    assert(capture->data != NULL);
+  }
+  memset(&capture->data[capture->size], 0, new_size - capture->size);
+  if (nbytes > 0) {
+    memcpy(&capture->data[capture->size], data, nbytes);
+  }
+  capture->size = new_size;
+}
+
+/*******************************************************************************
+ * \brief Private routine for writing a padded field to given file.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void write_field(FILE *fp, const void *data, const size_t nbytes) {
+  const char zeros[GRID_CAPTURE_ALIGNMENT] = {0};
+  if (fwrite(data, 1, nbytes, fp) != nbytes ||
+      fwrite(zeros, 1, padded_size(nbytes) - nbytes, fp) !=
+          padded_size(nbytes) - nbytes) {
+    fprintf(stderr, "Error: Could not write .tasklist file.\n");
+    abort();
+  }
+}
+
+/*******************************************************************************
+ * \brief Private routine for writing the size and content of an offload buffer.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void write_buffer(FILE *fp, const offload_buffer *buffer) {
+  const int64_t length = buffer->size / sizeof(double);
+  write_field(fp, &length, sizeof(int64_t));
+  write_field(fp, buffer->host_buffer, length * sizeof(double));
+}
+
+/*******************************************************************************
+ * \brief Private routine for obtaining the rank within MPI_COMM_WORLD.
+ *        Returns zero for serial runs or when MPI has not been initialized.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int get_world_rank(void) {
+  int rank = 0;
+#if defined(__parallel)
+  int initialized = 0, finalized = 0;
+  MPI_Initialized(&initialized);
+  MPI_Finalized(&finalized);
+  if (initialized && !finalized) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  }
+#endif
+  return rank;
+}
+
+/*******************************************************************************
+ * \brief Private routine for opening a new .tasklist file and writing the
+ *        captured task list into it. The file names contain the MPI rank.
+ * \author Ole Schuett
+ ******************************************************************************/
+static FILE *open_tasklist_file(const grid_capture *capture) {
+  static int counter = 0;
+  int icapture;
+#pragma omp atomic capture
+  icapture = counter++;
+
+  char filename[1024];
+  snprintf(filename, sizeof(filename), "%s_%i_%05i.tasklist",
+           getenv("GRID_CAPTURE_TASKLIST"), get_world_rank(), icapture);
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: Could not open file: %s\n", filename);
+    abort();
+  }
+  write_field(fp, capture->data, capture->size);
+  return fp;
+}
+
+/*******************************************************************************
+ * \brief Serializes the arguments of grid_create_task_list for later capture.
+ *        See grid_capture.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+grid_capture *grid_capture_create(
+    const bool orthorhombic, const int ntasks, const int nlevels,
+    const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const int level_list[ntasks], const int iatom_list[ntasks],
+    const int jatom_list[ntasks], const int iset_list[ntasks],
+    const int jset_list[ntasks], const int ipgf_list[ntasks],
+    const int jpgf_list[ntasks], const int border_mask_list[ntasks],
+    const int block_num_list[ntasks], const double radius_list[ntasks],
+    const double rab_list[ntasks][3], const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3]) {
+
+  if (getenv("GRID_CAPTURE_TASKLIST") == NULL) {
+    return NULL;
+  }
+
+  grid_capture *capture = malloc(sizeof(grid_capture));
+  memset(capture, 0, sizeof(grid_capture));
+
+  const char magic[8] = GRID_CAPTURE_MAGIC;
+  append_field(capture, magic, sizeof(magic));
+  const int header[7] = {GRID_CAPTURE_VERSION, orthorhombic, ntasks, nlevels,
+                         natoms, nkinds, nblocks};
+  append_field(capture, header, sizeof(header));
+  append_field(capture, block_offsets, nblocks * sizeof(int));
+  append_field(capture, atom_positions, natoms * 3 * sizeof(double));
+  append_field(capture, atom_kinds, natoms * sizeof(int));
+
+  for (int ikind = 0; ikind < nkinds; ikind++) {
+    const grid_basis_set *basis_set = basis_sets[ikind];
+    const int nset = basis_set->nset;
+    const int sizes[4] = {nset, basis_set->nsgf, basis_set->maxco,
+                          basis_set->maxpgf};
+    append_field(capture, sizes, sizeof(sizes));
+    append_field(capture, basis_set->lmin, nset * sizeof(int));
+    append_field(capture, basis_set->lmax, nset * sizeof(int));
+    append_field(capture, basis_set->npgf, nset * sizeof(int));
+    append_field(capture, basis_set->nsgf_set, nset * sizeof(int));
+    append_field(capture, basis_set->first_sgf, nset * sizeof(int));
+    append_field(capture, basis_set->sphi,
+                 basis_set->nsgf * basis_set->maxco * sizeof(double));
+    append_field(capture, basis_set->zet,
+                 nset * basis_set->maxpgf * sizeof(double));
+  }
+
+  append_field(capture, level_list, ntasks * sizeof(int));
+  append_field(capture, iatom_list, ntasks * sizeof(int));
+  append_field(capture, jatom_list, ntasks * sizeof(int));
+  append_field(capture, iset_list, ntasks * sizeof(int));
+  append_field(capture, jset_list, ntasks * sizeof(int));
+  append_field(capture, ipgf_list, ntasks * sizeof(int));
+  append_field(capture, jpgf_list, ntasks * sizeof(int));
+  append_field(capture, border_mask_list, ntasks * sizeof(int));
+  append_field(capture, block_num_list, ntasks * sizeof(int));
+  append_field(capture, radius_list, ntasks * sizeof(double));
+  append_field(capture, rab_list, ntasks * 3 * sizeof(double));
+
+  append_field(capture, npts_global, nlevels * 3 * sizeof(int));
+  append_field(capture, npts_local, nlevels * 3 * sizeof(int));
+  append_field(capture, shift_local, nlevels * 3 * sizeof(int));
+  append_field(capture, border_width, nlevels * 3 * sizeof(int));
+  append_field(capture, dh, nlevels * 9 * sizeof(double));
+  append_field(capture, dh_inv, nlevels * 9 * sizeof(double));
+
+  return capture;
+}
+
+/*******************************************************************************
+ * \brief Deallocates given capture.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_free(grid_capture *capture) {
+  free(capture->data);
+  free(capture);
+}
+
+/*******************************************************************************
+ * \brief Writes the task list together with a collocate call to a file.
+ *        See grid_capture.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_collocate(grid_capture *capture, const enum grid_func func,
+                            const int nlevels, const int npts_local[nlevels][3],
+                            const int ndensities,
+                            const offload_buffer *pab_blocks[ndensities],
+                            offload_buffer *grids[ndensities][nlevels]) {
+
+  if (capture->collocate_captured) {
+    return;
+  }
+  capture->collocate_captured = true;
+
+  FILE *fp = open_tasklist_file(capture);
+  const int record[4] = {GRID_CAPTURE_COLLOCATE, func, ndensities, 0};
+  write_field(fp, record, sizeof(record));
+  for (int i = 0; i < ndensities; i++) {
+    write_buffer(fp, pab_blocks[i]);
+  }
+  for (int i = 0; i < ndensities; i++) {
+    for (int level = 0; level < nlevels; level++) {
+      const size_t npts_local_total = (size_t)npts_local[level][0] *
+                                      npts_local[level][1] *
+                                      npts_local[level][2];
+      write_field(fp, grids[i][level]->host_buffer,
+                  npts_local_total * sizeof(double));
+    }
+  }
+  fclose(fp);
+}
+
+/*******************************************************************************
+ * \brief Writes the task list together with an integrate call to a file.
+ *        See grid_capture.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_integrate(grid_capture *capture, const bool compute_tau,
+                            const int natoms, const int nlevels,
+                            const int npts_local[nlevels][3],
+                            const int ndensities,
+                            const offload_buffer *pab_blocks[ndensities],
+                            const offload_buffer *grids[ndensities][nlevels],
+                            offload_buffer *hab_blocks[ndensities],
+                            double forces[natoms][3], double virial[3][3]) {
+
+  if (capture->integrate_captured) {
+    return;
+  }
+  capture->integrate_captured = true;
+
+  // The flags record which of the optional arguments were given.
+  const int flags = (pab_blocks != NULL) | (forces != NULL) << 1 |
+                    (virial != NULL) << 2;
+
+  FILE *fp = open_tasklist_file(capture);
+  const int record[4] = {GRID_CAPTURE_INTEGRATE, compute_tau, ndensities,
+                         flags};
+  write_field(fp, record, sizeof(record));
+  for (int i = 0; i < ndensities && pab_blocks != NULL; i++) {
+    write_buffer(fp, pab_blocks[i]);
+  }
+  for (int i = 0; i < ndensities; i++) {
+    for (int level = 0; level < nlevels; level++) {
+      const size_t npts_local_total = (size_t)npts_local[level][0] *
+                                      npts_local[level][1] *
+                                      npts_local[level][2];
+      write_field(fp, grids[i][level]->host_buffer,
+                  npts_local_total * sizeof(double));
+    }
+  }
+  for (int i = 0; i < ndensities; i++) {
+    write_buffer(fp, hab_blocks[i]);
+  }
+  if (forces != NULL) {
+    write_field(fp, forces, natoms * 3 * sizeof(double));
+  }
+  if (virial != NULL) {
+    write_field(fp, virial, 9 * sizeof(double));
+  }
+  fclose(fp);
+}
+
+// EOF
@@ -0,0 +1,104 @@
+/*----------------------------------------------------------------------------*/
+/*  CP2K: A general program to perform molecular dynamics simulations         */
+/*  Copyright 2000-2024 CP2K developers group <https://cp2k.org>              */
+/*                                                                            */
+/*  SPDX-License-Identifier: BSD-3-Clause                                     */
+/*----------------------------------------------------------------------------*/
+
+#ifndef GRID_CAPTURE_H
+#define GRID_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../offload/offload_buffer.h"
+#include "common/grid_basis_set.h"
+#include "common/grid_constants.h"
+
+// Magic string and version at the beginning of every .tasklist file.
+#define GRID_CAPTURE_MAGIC "CP2KGTL"
+#define GRID_CAPTURE_VERSION 1
+
+// All fields of a .tasklist file are padded to multiples of this alignment,
+// which allows for accessing them directly from a memory mapped file.
+#define GRID_CAPTURE_ALIGNMENT 8
+
+// Record types that follow the task list in a .tasklist file.
+#define GRID_CAPTURE_COLLOCATE 1
+#define GRID_CAPTURE_INTEGRATE 2
+
+/*******************************************************************************
+ * \brief Internal representation of a captured task list.
+ *        The arguments of grid_create_task_list are kept in serialized form,
+ *        ready to be written to a .tasklist file together with a record of
+ *        the first collocate and integrate call.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  size_t size;
+  size_t capacity;
+  char *data;
+  bool collocate_captured;
+  bool integrate_captured;
+} grid_capture;
+
+/*******************************************************************************
+ * \brief Serializes the arguments of grid_create_task_list for later capture.
+ *        Returns NULL unless the environment variable GRID_CAPTURE_TASKLIST
+ *        is set. Its value is used as prefix for the .tasklist files.
+ *        See grid_task_list.h for a description of the arguments.
+ * \author Ole Schuett
+ ******************************************************************************/
+grid_capture *grid_capture_create(
+    const bool orthorhombic, const int ntasks, const int nlevels,
+    const int natoms, const int nkinds, const int nblocks,
+    const int block_offsets[nblocks], const double atom_positions[natoms][3],
+    const int atom_kinds[natoms], const grid_basis_set *basis_sets[nkinds],
+    const int level_list[ntasks], const int iatom_list[ntasks],
+    const int jatom_list[ntasks], const int iset_list[ntasks],
+    const int jset_list[ntasks], const int ipgf_list[ntasks],
+    const int jpgf_list[ntasks], const int border_mask_list[ntasks],
+    const int block_num_list[ntasks], const double radius_list[ntasks],
+    const double rab_list[ntasks][3], const int npts_global[nlevels][3],
+    const int npts_local[nlevels][3], const int shift_local[nlevels][3],
+    const int border_width[nlevels][3], const double dh[nlevels][3][3],
+    const double dh_inv[nlevels][3][3]);
+
+/*******************************************************************************
+ * \brief Deallocates given capture.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_free(grid_capture *capture);
+
+/*******************************************************************************
+ * \brief Writes the task list together with the inputs and results of a
+ *        collocate call to a new .tasklist file. Only the first call per task
+ *        list is captured. See grid_task_list.h for a description of the
+ *        arguments.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_collocate(grid_capture *capture, const enum grid_func func,
+                            const int nlevels, const int npts_local[nlevels][3],
+                            const int ndensities,
+                            const offload_buffer *pab_blocks[ndensities],
+                            offload_buffer *grids[ndensities][nlevels]);
+
+/*******************************************************************************
+ * \brief Writes the task list together with the inputs and results of an
+ *        integrate call to a new .tasklist file. Only the first call per task
+ *        list is captured. See grid_task_list.h for a description of the
+ *        arguments.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_capture_integrate(grid_capture *capture, const bool compute_tau,
+                            const int natoms, const int nlevels,
+                            const int npts_local[nlevels][3],
+                            const int ndensities,
+                            const offload_buffer *pab_blocks[ndensities],
+                            const offload_buffer *grids[ndensities][nlevels],
+                            offload_buffer *hab_blocks[ndensities],
+                            double forces[natoms][3], double virial[3][3]);
+
+#endif
+
+// EOF
@@ -24,37 +24,84 @@ void print_func(char *message, int output_unit) {
 }
 
 /*******************************************************************************
- * \brief Stand-alone miniapp for running .task files.
+ * \brief Parses the name of a grid backend, returns -1 for unknown names.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int parse_backend(const char *name) {
+  if (strcmp(name, "auto") == 0) {
+    return GRID_BACKEND_AUTO;
+  } else if (strcmp(name, "ref") == 0) {
+    return GRID_BACKEND_REF;
+  } else if (strcmp(name, "cpu") == 0) {
+    return GRID_BACKEND_CPU;
+  } else if (strcmp(name, "dgemm") == 0) {
+    return GRID_BACKEND_DGEMM;
+  } else if (strcmp(name, "gpu") == 0) {
+    return GRID_BACKEND_GPU;
+  } else if (strcmp(name, "hip") == 0) {
+    return GRID_BACKEND_HIP;
+  } else if (strcmp(name, "tuned") == 0) {
+    return GRID_BACKEND_TUNED;
+  }
+  return -1;
+}
+
+/*******************************************************************************
+ * \brief Stand-alone miniapp for running .task and .tasklist files.
  * \author Ole Schuett
  ******************************************************************************/
 int main(int argc, char *argv[]) {
   // Parsing of optional args.
   int iarg = 1;
-  int nrequired_args = 2;
+  const int nrequired_args = 2;
+
+  bool tasklist = false;
+  int backend = GRID_BACKEND_AUTO;
+  if (iarg < argc && strcmp(argv[iarg], "--tasklist") == 0) {
+    iarg++;
+    tasklist = true;
+    if (iarg < argc && strcmp(argv[iarg], "--backend") == 0) {
+      iarg++;
+      backend = (iarg < argc) ? parse_backend(argv[iarg++]) : -1;
+      if (backend < 0) {
+        fprintf(stderr, "Error: Could not parse backend.\n");
+        return 1;
+      }
+    }
+  }
 
   bool collocate = true;
-  if (iarg < argc && strcmp(argv[iarg], "--integrate") == 0) {
+  if (!tasklist && iarg < argc && strcmp(argv[iarg], "--integrate") == 0) {
     iarg++;
     collocate = false;
   }
 
   bool batch = false;
-  if (iarg < argc && strcmp(argv[iarg], "--batch") == 0) {
+  int cycles_per_block = 1;
+  int ndensities = 1;
+  if (!tasklist && iarg < argc && strcmp(argv[iarg], "--batch") == 0) {
     iarg++;
     batch = true;
-    nrequired_args++;
+    if (iarg >= argc || sscanf(argv[iarg++], "%i", &cycles_per_block) != 1) {
+      fprintf(stderr, "Error: Could not parse cycles per block.\n");
+      return 1;
+    }
+    if (iarg < argc && strcmp(argv[iarg], "--densities") == 0) {
+      iarg++;
+      if (iarg >= argc || sscanf(argv[iarg++], "%i", &ndensities) != 1) {
+        fprintf(stderr, "Error: Could not parse number of densities.\n");
+        return 1;
+      }
+    }
   }
 
   // All optional args have been parsed.
   if (argc - iarg != nrequired_args) {
     fprintf(stderr, "Usage: grid_miniapp.x [--integrate] [--batch "
-                    "<cycles-per-block>] <cycles> <task-file>\n");
-    return 1;
-  }
-
-  int cycles_per_block = 1;
-  if (batch && sscanf(argv[iarg++], "%i", &cycles_per_block) != 1) {
-    fprintf(stderr, "Error: Could not parse cycles per block.\n");
+                    "<cycles-per-block> [--densities <n>]] <cycles> "
+                    "<task-file>\n"
+                    "       grid_miniapp.x --tasklist [--backend <name>] "
+                    "<cycles> <tasklist-file>\n");
     return 1;
   }
 
@@ -67,9 +114,20 @@ int main(int argc, char *argv[]) {
   offload_set_chosen_device(0);
   grid_library_init();
 
-  const double tolerance = 1e-12 * cycles;
-  const bool success = grid_replay(argv[iarg++], cycles, collocate, batch,
-                                   cycles_per_block, tolerance);
+  bool success;
+  if (tasklist) {
+    // Results are overwritten in each cycle, hence the tolerance stays fixed.
+    const grid_library_config config = grid_library_get_config();
+    grid_library_set_config(backend, config.validate, config.apply_cutoff,
+                            config.tiled_collocate, config.collocate_tiles,
+                            config.spatial_ordering, config.fused_integrate,
+                            config.eps_screening);
+    success = grid_replay_task_list(argv[iarg++], cycles, 1e-12);
+  } else {
+    const double tolerance = 1e-12 * cycles;
+    success = grid_replay(argv[iarg++], cycles, collocate, batch,
+                          cycles_per_block, ndensities, tolerance);
+  }
 
   grid_library_print_stats(&mpi_sum_func, 0, &print_func, 0);
   grid_library_finalize();
@@ -5,19 +5,27 @@
 /*  SPDX-License-Identifier: BSD-3-Clause                                     */
 /*----------------------------------------------------------------------------*/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <assert.h>
+#include <fcntl.h>
 #include <fenv.h>
 #include <limits.h>
 #include <math.h>
 #include <omp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../offload/offload_buffer.h"
 #include "common/grid_common.h"
+#include "grid_capture.h"
 #include "grid_replay.h"
 
 #include "cpu/grid_cpu_collocate.h"
@@ -221,13 +229,18 @@ static void create_dummy_task_list(
  ******************************************************************************/
 bool grid_replay(const char *filename, const int cycles, const bool collocate,
                  const bool batch, const int cycles_per_block,
-                 const double tolerance) {
+                 const int ndensities, const double tolerance) {
 
   if (cycles < 1) {
     fprintf(stderr, "Error: Cycles have to be greater than zero.\n");
     exit(1);
   }
 
+  if (ndensities < 1 || (!batch && ndensities > 1)) {
+    fprintf(stderr, "Error: Multiple densities require batch mode.\n");
+    exit(1);
+  }
+
   if (cycles_per_block < 1 || cycles_per_block > cycles) {
     fprintf(stderr,
             "Error: Cycles per block has to be between 1 and cycles.\n");
@@ -333,6 +346,9 @@ bool grid_replay(const char *filename, const int cycles, const bool collocate,
   double virial_test[3][3];
   double start_time, end_time;
 
+  // All densities are identical, hence so should be their results.
+  double max_density_diff = 0.0;
+
   if (batch) {
     grid_basis_set *basisa = NULL, *basisb = NULL;
     create_dummy_basis_set(n1, la_min, la_max, zeta, &basisa);
@@ -344,32 +360,73 @@ bool grid_replay(const char *filename, const int cycles, const bool collocate,
         (const int(*)[3])npts_local, (const int(*)[3])shift_local,
         (const int(*)[3])border_width, (const double(*)[3][3])dh,
         (const double(*)[3][3])dh_inv, &task_list);
-    offload_buffer *pab_blocks = NULL, *hab_blocks = NULL;
-    offload_create_buffer(n1 * n2, &pab_blocks);
-    offload_create_buffer(n1 * n2, &hab_blocks);
+    offload_buffer *pab_buffers[ndensities], *hab_blocks[ndensities];
+    const offload_buffer *pab_blocks[ndensities];
     const double f = (collocate) ? rscale : 1.0;
-    for (int i = 0; i < n1; i++) {
-      for (int j = 0; j < n2; j++) {
-        pab_blocks->host_buffer[j * n1 + i] = 0.5 * f * pab[j][i];
+    for (int idensity = 0; idensity < ndensities; idensity++) {
+      pab_buffers[idensity] = hab_blocks[idensity] = NULL;
+      offload_create_buffer(n1 * n2, &pab_buffers[idensity]);
+      offload_create_buffer(n1 * n2, &hab_blocks[idensity]);
+      for (int i = 0; i < n1; i++) {
+        for (int j = 0; j < n2; j++) {
+          pab_buffers[idensity]->host_buffer[j * n1 + i] = 0.5 * f * pab[j][i];
+        }
       }
+      pab_blocks[idensity] = pab_buffers[idensity];
     }
     start_time = omp_get_wtime();
     const int nlevels = 1;
     const int natoms = 2;
     if (collocate) {
       // collocate
-      offload_buffer *grids[1] = {grid_test};
-      grid_collocate_task_list(task_list, func, nlevels,
-                               (const int(*)[3])npts_local, pab_blocks, grids);
+      offload_buffer *grids[ndensities][1];
+      grids[0][0] = grid_test;
+      for (int idensity = 1; idensity < ndensities; idensity++) {
+        grids[idensity][0] = NULL;
+        offload_create_buffer(npts_local_total, &grids[idensity][0]);
+      }
+      grid_collocate_task_list_multi(task_list, func, nlevels,
+                                     (const int(*)[3])npts_local, ndensities,
+                                     pab_blocks, grids);
+      for (int idensity = 1; idensity < ndensities; idensity++) {
+        for (int i = 0; i < npts_local_total; i++) {
+          const double diff = fabs(grids[idensity][0]->host_buffer[i] -
+                                   grid_test->host_buffer[i]);
+          max_density_diff = fmax(max_density_diff, diff);
+        }
+        offload_free_buffer(grids[idensity][0]);
+      }
     } else {
       // integrate
-      const offload_buffer *grids[1] = {grid_ref};
-      grid_integrate_task_list(task_list, compute_tau, natoms, nlevels,
-                               (const int(*)[3])npts_local, pab_blocks, grids,
-                               hab_blocks, forces_test, virial_test);
+      const offload_buffer *grids[ndensities][1];
+      for (int idensity = 0; idensity < ndensities; idensity++) {
+        grids[idensity][0] = grid_ref;
+      }
+      grid_integrate_task_list_multi(task_list, compute_tau, natoms, nlevels,
+                                     (const int(*)[3])npts_local, ndensities,
+                                     pab_blocks, grids, hab_blocks,
+                                     forces_test, virial_test);
       for (int i = 0; i < n2; i++) {
         for (int j = 0; j < n1; j++) {
-          hab_test[i][j] = hab_blocks->host_buffer[i * n1 + j];
+          hab_test[i][j] = hab_blocks[0]->host_buffer[i * n1 + j];
+        }
+      }
+      for (int idensity = 1; idensity < ndensities; idensity++) {
+        for (int i = 0; i < n1 * n2; i++) {
+          const double diff = fabs(hab_blocks[idensity]->host_buffer[i] -
+                                   hab_blocks[0]->host_buffer[i]);
+          max_density_diff = fmax(max_density_diff, diff);
+        }
+      }
+      // Forces and virial are summed over all densities.
+      for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 3; j++) {
+          forces_test[i][j] /= ndensities;
+        }
+      }
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          virial_test[i][j] /= ndensities;
         }
       }
     }
@@ -377,8 +434,10 @@ bool grid_replay(const char *filename, const int cycles, const bool collocate,
     grid_free_basis_set(basisa);
     grid_free_basis_set(basisb);
     grid_free_task_list(task_list);
-    offload_free_buffer(pab_blocks);
-    offload_free_buffer(hab_blocks);
+    for (int idensity = 0; idensity < ndensities; idensity++) {
+      offload_free_buffer(pab_buffers[idensity]);
+      offload_free_buffer(hab_blocks[idensity]);
+    }
   } else {
     start_time = omp_get_wtime();
     if (collocate) {
@@ -473,6 +532,11 @@ bool grid_replay(const char *filename, const int cycles, const bool collocate,
       }
     }
   }
+  if (max_density_diff > 0.0) {
+    printf("Results differ between identical densities: %le\n",
+           max_density_diff);
+    max_rel_diff = fmax(max_rel_diff, max_density_diff);
+  }
   printf("Task: %-55s   %9s %-7s   Cycles: %e   Max value: %le   "
          "Max rel diff: %le   Time: %le sec\n",
          filename, collocate ? "Collocate" : "Integrate",
@@ -495,4 +559,304 @@ bool grid_replay(const char *filename, const int cycles, const bool collocate,
   return max_rel_diff < tolerance;
 }
 
+/*******************************************************************************
+ * \brief Cursor for reading the fields of a memory mapped .tasklist file.
+ * \author Ole Schuett
+ ******************************************************************************/
+typedef struct {
+  const char *data;
+  size_t size;
+  size_t offset;
+} tasklist_reader;
+
+/*******************************************************************************
+ * \brief Returns pointer to next field of a .tasklist file and handles errors.
+ * \author Ole Schuett
+ ******************************************************************************/
+static const void *read_field(tasklist_reader *reader, const size_t nbytes) {
+  const size_t padded_nbytes = (nbytes + GRID_CAPTURE_ALIGNMENT - 1) /
+                               GRID_CAPTURE_ALIGNMENT * GRID_CAPTURE_ALIGNMENT;
+  if (reader->offset + padded_nbytes > reader->size) {
+    fprintf(stderr, "Error: Unexpected end of .tasklist file.\n");
+    abort();
+  }
+  const void *field = &reader->data[reader->offset];
+  reader->offset += padded_nbytes;
+  return field;
+}
+
+/*******************************************************************************
+ * \brief Shorthand for reading an array of integers from a .tasklist file.
+ * \author Ole Schuett
+ ******************************************************************************/
+static const int *read_ints(tasklist_reader *reader, const size_t n) {
+  return read_field(reader, n * sizeof(int));
+}
+
+/*******************************************************************************
+ * \brief Shorthand for reading an array of doubles from a .tasklist file.
+ * \author Ole Schuett
+ ******************************************************************************/
+static const double *read_doubles(tasklist_reader *reader, const size_t n) {
+  return read_field(reader, n * sizeof(double));
+}
+
+/*******************************************************************************
+ * \brief Reads a length-prefixed array of doubles into a new offload buffer.
+ * \author Ole Schuett
+ ******************************************************************************/
+static offload_buffer *read_buffer(tasklist_reader *reader) {
+  const int64_t length = *(const int64_t *)read_field(reader, sizeof(int64_t));
+  const double *data = read_doubles(reader, length);
+  offload_buffer *buffer = NULL;
+  offload_create_buffer(length, &buffer);
+  memcpy(buffer->host_buffer, data, length * sizeof(double));
+  return buffer;
+}
+
+/*******************************************************************************
+ * \brief Shorthand for comparing a value against its reference.
+ * \author Ole Schuett
+ ******************************************************************************/
+static double rel_diff(const double ref_value, const double test_value) {
+  return fabs(test_value - ref_value) / fmax(1.0, fabs(ref_value));
+}
+
+/*******************************************************************************
+ * \brief Reads a .tasklist file, replays it, and compares results.
+ *        See grid_replay.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+bool grid_replay_task_list(const char *filename, const int cycles,
+                           const double tolerance) {
+
+  if (cycles < 1) {
+    fprintf(stderr, "Error: Cycles have to be greater than zero.\n");
+    exit(1);
+  }
+
+  const int fd = open(filename, O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    fprintf(stderr, "Could not open tasklist file: %s\n", filename);
+    exit(1);
+  }
+  const size_t file_size = file_stat.st_size;
+  void *file_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file_data == MAP_FAILED) {
+    fprintf(stderr, "Could not map tasklist file: %s\n", filename);
+    exit(1);
+  }
+  tasklist_reader reader_obj = {file_data, file_size, 0};
+  tasklist_reader *reader = &reader_obj;
+
+  const char *magic = read_field(reader, 8);
+  if (strncmp(magic, GRID_CAPTURE_MAGIC, 8) != 0) {
+    fprintf(stderr, "Error: Wrong file header.\n");
+    abort();
+  }
+  const int *header = read_ints(reader, 7);
+  if (header[0] != GRID_CAPTURE_VERSION) {
+    fprintf(stderr, "Error: Unsupported tasklist version: %i\n", header[0]);
+    abort();
+  }
+  const bool orthorhombic = header[1];
+  const int ntasks = header[2];
+  const int nlevels = header[3];
+  const int natoms = header[4];
+  const int nkinds = header[5];
+  const int nblocks = header[6];
+
+  const int *block_offsets = read_ints(reader, nblocks);
+  const double(*atom_positions)[3] =
+      (const double(*)[3])read_doubles(reader, natoms * 3);
+  const int *atom_kinds = read_ints(reader, natoms);
+
+  grid_basis_set *basis_sets_mutable[nkinds];
+  for (int ikind = 0; ikind < nkinds; ikind++) {
+    const int *sizes = read_ints(reader, 4);
+    const int nset = sizes[0], nsgf = sizes[1];
+    const int maxco = sizes[2], maxpgf = sizes[3];
+    const int *lmin = read_ints(reader, nset);
+    const int *lmax = read_ints(reader, nset);
+    const int *npgf = read_ints(reader, nset);
+    const int *nsgf_set = read_ints(reader, nset);
+    const int *first_sgf = read_ints(reader, nset);
+    const double *sphi = read_doubles(reader, nsgf * maxco);
+    const double *zet = read_doubles(reader, nset * maxpgf);
+    grid_create_basis_set(nset, nsgf, maxco, maxpgf, lmin, lmax, npgf,
+                          nsgf_set, first_sgf, (const double(*)[maxco])sphi,
+                          (const double(*)[maxpgf])zet,
+                          &basis_sets_mutable[ikind]);
+  }
+  const grid_basis_set **basis_sets =
+      (const grid_basis_set **)basis_sets_mutable;
+
+  const int *level_list = read_ints(reader, ntasks);
+  const int *iatom_list = read_ints(reader, ntasks);
+  const int *jatom_list = read_ints(reader, ntasks);
+  const int *iset_list = read_ints(reader, ntasks);
+  const int *jset_list = read_ints(reader, ntasks);
+  const int *ipgf_list = read_ints(reader, ntasks);
+  const int *jpgf_list = read_ints(reader, ntasks);
+  const int *border_mask_list = read_ints(reader, ntasks);
+  const int *block_num_list = read_ints(reader, ntasks);
+  const double *radius_list = read_doubles(reader, ntasks);
+  const double(*rab_list)[3] =
+      (const double(*)[3])read_doubles(reader, ntasks * 3);
+
+  const int(*npts_global)[3] = (const int(*)[3])read_ints(reader, nlevels * 3);
+  const int(*npts_local)[3] = (const int(*)[3])read_ints(reader, nlevels * 3);
+  const int(*shift_local)[3] = (const int(*)[3])read_ints(reader, nlevels * 3);
+  const int(*border_width)[3] =
+      (const int(*)[3])read_ints(reader, nlevels * 3);
+  const double(*dh)[3][3] =
+      (const double(*)[3][3])read_doubles(reader, nlevels * 9);
+  const double(*dh_inv)[3][3] =
+      (const double(*)[3][3])read_doubles(reader, nlevels * 9);
+
+  grid_task_list *task_list = NULL;
+  grid_create_task_list(
+      orthorhombic, ntasks, nlevels, natoms, nkinds, nblocks, block_offsets,
+      atom_positions, atom_kinds, basis_sets, level_list, iatom_list,
+      jatom_list, iset_list, jset_list, ipgf_list, jpgf_list, border_mask_list,
+      block_num_list, radius_list, rab_list, npts_global, npts_local,
+      shift_local, border_width, dh, dh_inv, &task_list);
+
+  const int *record = read_ints(reader, 4);
+  const bool collocate = (record[0] == GRID_CAPTURE_COLLOCATE);
+  const int ndensities = record[2];
+  const bool has_pab = collocate || (record[3] & 1);
+  const bool has_forces = !collocate && (record[3] & 2);
+  const bool has_virial = !collocate && (record[3] & 4);
+  if (!collocate && record[0] != GRID_CAPTURE_INTEGRATE) {
+    fprintf(stderr, "Error: Unknown tasklist record: %i\n", record[0]);
+    abort();
+  }
+
+  offload_buffer *pab_buffers[ndensities];
+  const offload_buffer *pab_blocks[ndensities];
+  for (int i = 0; i < ndensities; i++) {
+    pab_buffers[i] = (has_pab) ? read_buffer(reader) : NULL;
+    pab_blocks[i] = pab_buffers[i];
+  }
+
+  offload_buffer *grids[ndensities][nlevels];
+  const double *grids_ref[ndensities][nlevels];
+  for (int i = 0; i < ndensities; i++) {
+    for (int level = 0; level < nlevels; level++) {
+      const size_t npts_local_total = (size_t)npts_local[level][0] *
+                                      npts_local[level][1] *
+                                      npts_local[level][2];
+      grids_ref[i][level] = read_doubles(reader, npts_local_total);
+      grids[i][level] = NULL;
+      offload_create_buffer(npts_local_total, &grids[i][level]);
+      if (!collocate) {
+        memcpy(grids[i][level]->host_buffer, grids_ref[i][level],
+               npts_local_total * sizeof(double));
+      }
+    }
+  }
+
+  double max_value = 0.0;
+  double max_rel_diff = 0.0;
+  double start_time, end_time;
+  if (collocate) {
+    // collocate
+    const enum grid_func func = (enum grid_func)record[1];
+    start_time = omp_get_wtime();
+    for (int icycle = 0; icycle < cycles; icycle++) {
+      grid_collocate_task_list_multi(task_list, func, nlevels, npts_local,
+                                     ndensities, pab_blocks, grids);
+    }
+    end_time = omp_get_wtime();
+
+    // compare grids
+    for (int i = 0; i < ndensities; i++) {
+      for (int level = 0; level < nlevels; level++) {
+        const size_t npts_local_total = (size_t)npts_local[level][0] *
+                                        npts_local[level][1] *
+                                        npts_local[level][2];
+        for (size_t j = 0; j < npts_local_total; j++) {
+          const double test_value = grids[i][level]->host_buffer[j];
+          max_rel_diff = fmax(max_rel_diff,
+                              rel_diff(grids_ref[i][level][j], test_value));
+          max_value = fmax(max_value, fabs(test_value));
+        }
+      }
+    }
+  } else {
+    // integrate
+    const bool compute_tau = record[1];
+    offload_buffer *hab_blocks[ndensities];
+    const double *habs_ref[ndensities];
+    for (int i = 0; i < ndensities; i++) {
+      const int64_t length =
+          *(const int64_t *)read_field(reader, sizeof(int64_t));
+      habs_ref[i] = read_doubles(reader, length);
+      hab_blocks[i] = NULL;
+      offload_create_buffer(length, &hab_blocks[i]);
+    }
+    const double *forces_ref =
+        (has_forces) ? read_doubles(reader, natoms * 3) : NULL;
+    const double *virial_ref = (has_virial) ? read_doubles(reader, 9) : NULL;
+
+    double forces_test[natoms][3], virial_test[3][3];
+    const offload_buffer *(*const_grids)[nlevels] =
+        (const offload_buffer *(*)[nlevels])grids;
+    start_time = omp_get_wtime();
+    for (int icycle = 0; icycle < cycles; icycle++) {
+      grid_integrate_task_list_multi(
+          task_list, compute_tau, natoms, nlevels, npts_local, ndensities,
+          (has_pab) ? pab_blocks : NULL, const_grids, hab_blocks,
+          (has_forces) ? forces_test : NULL,
+          (has_virial) ? virial_test : NULL);
+    }
+    end_time = omp_get_wtime();
+
+    // compare hab
+    for (int i = 0; i < ndensities; i++) {
+      const size_t length = hab_blocks[i]->size / sizeof(double);
+      for (size_t j = 0; j < length; j++) {
+        const double test_value = hab_blocks[i]->host_buffer[j];
+        max_rel_diff = fmax(max_rel_diff, rel_diff(habs_ref[i][j], test_value));
+        max_value = fmax(max_value, fabs(test_value));
+      }
+      offload_free_buffer(hab_blocks[i]);
+    }
+    // compare forces and virial
+    const double derivatives_precision = 1e-4; // account for numeric noise
+    for (int j = 0; j < natoms * 3 && has_forces; j++) {
+      const double diff = rel_diff(forces_ref[j], (&forces_test[0][0])[j]);
+      max_rel_diff = fmax(max_rel_diff, diff * derivatives_precision);
+    }
+    for (int j = 0; j < 9 && has_virial; j++) {
+      const double diff = rel_diff(virial_ref[j], (&virial_test[0][0])[j]);
+      max_rel_diff = fmax(max_rel_diff, diff * derivatives_precision);
+    }
+  }
+
+  printf("Task list: %-50s   %9s   Tasks: %i   Densities: %i   "
+         "Cycles: %e   Max value: %le   Max rel diff: %le   Time: %le sec\n",
+         filename, collocate ? "Collocate" : "Integrate", ntasks, ndensities,
+         (float)cycles, max_value, max_rel_diff, end_time - start_time);
+
+  for (int i = 0; i < ndensities; i++) {
+    if (pab_buffers[i] != NULL) {
+      offload_free_buffer(pab_buffers[i]);
+    }
+    for (int level = 0; level < nlevels; level++) {
+      offload_free_buffer(grids[i][level]);
+    }
+  }
+  grid_free_task_list(task_list);
+  for (int ikind = 0; ikind < nkinds; ikind++) {
+    grid_free_basis_set(basis_sets_mutable[ikind]);
+  }
+  munmap(file_data, file_size);
+
+  return max_rel_diff < tolerance;
+}
+
 // EOF
@@ -19,6 +19,8 @@
  * \param batch             When false grid_ref_collocate_pgf_product is called.
  *                          When true grid_collocate_task_list is called.
  * \param cycles_per_block  Number of cycles per matrix block decontraction.
+ * \param ndensities        Number of identical densities processed at once,
+ *                          values larger than one require batch mode.
  * \param tolerance         Tolerance for comparing floating point results.
  * \returns                 Returns true iff the test passed.
  *
@@ -26,7 +28,23 @@
  ******************************************************************************/
 bool grid_replay(const char *filename, const int cycles, const bool collocate,
                  const bool batch, const int cycles_per_block,
-                 const double tolerance);
+                 const int ndensities, const double tolerance);
+
+/*******************************************************************************
+ * \brief Reads a .tasklist file as written when the environment variable
+ *        GRID_CAPTURE_TASKLIST is set, replays the captured collocate or
+ *        integrate call, and compares results. The backend is taken from the
+ *        library config.
+ *
+ * \param filename          Name of the tasklist file.
+ * \param cycles            Number of times the call should be repeated.
+ * \param tolerance         Tolerance for comparing floating point results.
+ * \returns                 Returns true iff the test passed.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+bool grid_replay_task_list(const char *filename, const int cycles,
+                           const double tolerance);
 
 #endif
 
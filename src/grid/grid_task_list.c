@@ -15,6 +15,7 @@
 #include "common/grid_common.h"
 #include "common/grid_constants.h"
 #include "common/grid_library.h"
+#include "grid_autotune.h"
 #include "grid_task_list.h"
 
 /*******************************************************************************
@@ -62,6 +63,9 @@ void grid_create_task_list(
     // Reuse existing task list.
     task_list = *task_list_out;
     free(task_list->npts_local);
+    if (task_list->capture != NULL) {
+      grid_capture_free(task_list->capture);
+    }
   }
 
   // Store npts_local for bounds checking and validation.
@@ -70,6 +74,14 @@ void grid_create_task_list(
   task_list->npts_local = malloc(size);
   memcpy(task_list->npts_local, npts_local, size);
 
+  // Keep a serialized copy of all arguments if capturing is enabled.
+  task_list->capture = grid_capture_create(
+      orthorhombic, ntasks, nlevels, natoms, nkinds, nblocks, block_offsets,
+      atom_positions, atom_kinds, basis_sets, level_list, iatom_list,
+      jatom_list, iset_list, jset_list, ipgf_list, jpgf_list, border_mask_list,
+      block_num_list, radius_list, rab_list, npts_global, npts_local,
+      shift_local, border_width, dh, dh_inv);
+
   // Always create reference backend because it might be needed for validation.
   grid_ref_create_task_list(
       orthorhombic, ntasks, nlevels, natoms, nkinds, nblocks, block_offsets,
@@ -98,6 +110,15 @@ void grid_create_task_list(
         border_mask_list, block_num_list, radius_list, rab_list, npts_global,
         npts_local, shift_local, border_width, dh, dh_inv, &task_list->dgemm);
     break;
+  case GRID_BACKEND_TUNED:
+    grid_autotune_create_task_lists(
+        orthorhombic, ntasks, nlevels, natoms, nkinds, nblocks, block_offsets,
+        atom_positions, atom_kinds, basis_sets, level_list, iatom_list,
+        jatom_list, iset_list, jset_list, ipgf_list, jpgf_list,
+        border_mask_list, block_num_list, radius_list, rab_list, npts_global,
+        npts_local, shift_local, border_width, dh, dh_inv, &task_list->cpu,
+        &task_list->dgemm);
+    break;
 
   case GRID_BACKEND_GPU:
 #if (defined(__OFFLOAD) && !defined(__NO_OFFLOAD_GRID))
@@ -171,6 +192,10 @@ void grid_free_task_list(grid_task_list *task_list) {
   }
 #endif
 
+  if (task_list->capture != NULL) {
+    grid_capture_free(task_list->capture);
+  }
+
   free(task_list->npts_local);
   free(task_list);
 }
@@ -186,6 +211,71 @@ void grid_collocate_task_list(const grid_task_list *task_list,
                               const offload_buffer *pab_blocks,
                               offload_buffer *grids[nlevels]) {
 
+  grid_collocate_task_list_multi(task_list, func, nlevels, npts_local, 1,
+                                 &pab_blocks,
+                                 (offload_buffer * (*)[nlevels]) grids);
+}
+
+/*******************************************************************************
+ * \brief Collocate with the tasks split between the cpu and dgemm backends.
+ *        The cpu backend writes directly into the grids, while the results
+ *        of the dgemm backend get added on top.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void collocate_tuned(const grid_task_list *task_list,
+                            const enum grid_func func, const int nlevels,
+                            const int npts_local[nlevels][3],
+                            const int ndensities,
+                            const offload_buffer *pab_blocks[ndensities],
+                            offload_buffer *grids[ndensities][nlevels]) {
+
+  if (task_list->cpu != NULL) {
+    grid_cpu_collocate_task_list(task_list->cpu, func, nlevels, ndensities,
+                                 pab_blocks, grids);
+  } else {
+    for (int i = 0; i < ndensities; i++) {
+      for (int level = 0; level < nlevels; level++) {
+        memset(grids[i][level]->host_buffer, 0, grids[i][level]->size);
+      }
+    }
+  }
+
+  if (task_list->dgemm != NULL) {
+    offload_buffer *my_grids[nlevels];
+    for (int level = 0; level < nlevels; level++) {
+      my_grids[level] = NULL;
+      offload_create_buffer(npts_local[level][0] * npts_local[level][1] *
+                                npts_local[level][2],
+                            &my_grids[level]);
+    }
+    for (int i = 0; i < ndensities; i++) {
+      grid_dgemm_collocate_task_list(task_list->dgemm, func, nlevels,
+                                     pab_blocks[i], my_grids);
+      for (int level = 0; level < nlevels; level++) {
+        const int npts_local_total =
+            npts_local[level][0] * npts_local[level][1] * npts_local[level][2];
+        for (int j = 0; j < npts_local_total; j++) {
+          grids[i][level]->host_buffer[j] += my_grids[level]->host_buffer[j];
+        }
+      }
+    }
+    for (int level = 0; level < nlevels; level++) {
+      offload_free_buffer(my_grids[level]);
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Collocate all tasks of in given list for multiple density matrices.
+ *        See grid_task_list.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_collocate_task_list_multi(
+    const grid_task_list *task_list, const enum grid_func func,
+    const int nlevels, const int npts_local[nlevels][3], const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    offload_buffer *grids[ndensities][nlevels]) {
+
   // Bounds check.
   assert(task_list->nlevels == nlevels);
   for (int ilevel = 0; ilevel < nlevels; ilevel++) {
@@ -194,29 +284,41 @@ void grid_collocate_task_list(const grid_task_list *task_list,
     assert(task_list->npts_local[ilevel][2] == npts_local[ilevel][2]);
   }
 
+  // The cpu backend processes all densities in a single pass,
+  // while the other backends process them one after another.
   switch (task_list->backend) {
   case GRID_BACKEND_REF:
-    grid_ref_collocate_task_list(task_list->ref, func, nlevels, pab_blocks,
-                                 grids);
+    grid_ref_collocate_task_list(task_list->ref, func, nlevels, ndensities,
+                                 pab_blocks, grids);
     break;
   case GRID_BACKEND_CPU:
-    grid_cpu_collocate_task_list(task_list->cpu, func, nlevels, pab_blocks,
-                                 grids);
+    grid_cpu_collocate_task_list(task_list->cpu, func, nlevels, ndensities,
+                                 pab_blocks, grids);
+    break;
+  case GRID_BACKEND_TUNED:
+    collocate_tuned(task_list, func, nlevels, npts_local, ndensities,
+                    pab_blocks, grids);
     break;
   case GRID_BACKEND_DGEMM:
-    grid_dgemm_collocate_task_list(task_list->dgemm, func, nlevels, pab_blocks,
-                                   grids);
+    for (int i = 0; i < ndensities; i++) {
+      grid_dgemm_collocate_task_list(task_list->dgemm, func, nlevels,
+                                     pab_blocks[i], grids[i]);
+    }
     break;
 #if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_GRID)
   case GRID_BACKEND_GPU:
-    grid_gpu_collocate_task_list(task_list->gpu, func, nlevels, pab_blocks,
-                                 grids);
+    for (int i = 0; i < ndensities; i++) {
+      grid_gpu_collocate_task_list(task_list->gpu, func, nlevels,
+                                   pab_blocks[i], grids[i]);
+    }
     break;
 #endif
 #if defined(__OFFLOAD_HIP) && !defined(__NO_OFFLOAD_GRID)
   case GRID_BACKEND_HIP:
-    grid_hip_collocate_task_list(task_list->hip, func, nlevels, pab_blocks,
-                                 grids);
+    for (int i = 0; i < ndensities; i++) {
+      grid_hip_collocate_task_list(task_list->hip, func, nlevels,
+                                   pab_blocks[i], grids[i]);
+    }
     break;
 #endif
   default:
@@ -225,49 +327,64 @@ void grid_collocate_task_list(const grid_task_list *task_list,
     break;
   }
 
+  // Write task list and results to file if capturing is enabled.
+  if (task_list->capture != NULL) {
+    grid_capture_collocate(task_list->capture, func, nlevels, npts_local,
+                           ndensities, pab_blocks, grids);
+  }
+
   // Perform validation if enabled.
   if (grid_library_get_config().validate) {
     // Allocate space for reference results.
-    offload_buffer *grids_ref[nlevels];
-    for (int level = 0; level < nlevels; level++) {
-      const int npts_local_total =
-          npts_local[level][0] * npts_local[level][1] * npts_local[level][2];
-      grids_ref[level] = NULL;
-      offload_create_buffer(npts_local_total, &grids_ref[level]);
+    offload_buffer *grids_ref[ndensities][nlevels];
+    for (int i = 0; i < ndensities; i++) {
+      for (int level = 0; level < nlevels; level++) {
+        const int npts_local_total =
+            npts_local[level][0] * npts_local[level][1] * npts_local[level][2];
+        grids_ref[i][level] = NULL;
+        offload_create_buffer(npts_local_total, &grids_ref[i][level]);
+      }
     }
 
     // Call reference implementation.
-    grid_ref_collocate_task_list(task_list->ref, func, nlevels, pab_blocks,
-                                 grids_ref);
+    grid_ref_collocate_task_list(task_list->ref, func, nlevels, ndensities,
+                                 pab_blocks, grids_ref);
 
     // Compare results.
     const double tolerance = 1e-12;
     double max_rel_diff = 0.0;
-    for (int level = 0; level < nlevels; level++) {
-      for (int i = 0; i < npts_local[level][0]; i++) {
-        for (int j = 0; j < npts_local[level][1]; j++) {
-          for (int k = 0; k < npts_local[level][2]; k++) {
-            const int idx = k * npts_local[level][1] * npts_local[level][0] +
-                            j * npts_local[level][0] + i;
-            const double ref_value = grids_ref[level]->host_buffer[idx];
-            const double test_value = grids[level]->host_buffer[idx];
-            const double diff = fabs(test_value - ref_value);
-            const double rel_diff = diff / fmax(1.0, fabs(ref_value));
-            max_rel_diff = fmax(max_rel_diff, rel_diff);
-            if (rel_diff > tolerance) {
-              fprintf(stderr, "Error: Validation failure in grid collocate\n");
-              fprintf(stderr, "   diff:     %le\n", diff);
-              fprintf(stderr, "   rel_diff: %le\n", rel_diff);
-              fprintf(stderr, "   value:    %le\n", ref_value);
-              fprintf(stderr, "   level:    %i\n", level);
-              fprintf(stderr, "   ijk:      %i  %i  %i\n", i, j, k);
-              abort();
+    for (int idensity = 0; idensity < ndensities; idensity++) {
+      for (int level = 0; level < nlevels; level++) {
+        const offload_buffer *grid_ref = grids_ref[idensity][level];
+        const offload_buffer *grid = grids[idensity][level];
+        for (int i = 0; i < npts_local[level][0]; i++) {
+          for (int j = 0; j < npts_local[level][1]; j++) {
+            for (int k = 0; k < npts_local[level][2]; k++) {
+              const int idx = k * npts_local[level][1] * npts_local[level][0] +
+                              j * npts_local[level][0] + i;
+              const double ref_value = grid_ref->host_buffer[idx];
+              const double test_value = grid->host_buffer[idx];
+              const double diff = fabs(test_value - ref_value);
+              const double rel_diff = diff / fmax(1.0, fabs(ref_value));
+              max_rel_diff = fmax(max_rel_diff, rel_diff);
+              if (rel_diff > tolerance) {
+                fprintf(stderr,
+                        "Error: Validation failure in grid collocate\n");
+                fprintf(stderr, "   diff:     %le\n", diff);
+                fprintf(stderr, "   rel_diff: %le\n", rel_diff);
+                fprintf(stderr, "   value:    %le\n", ref_value);
+                fprintf(stderr, "   density:  %i\n", idensity);
+                fprintf(stderr, "   level:    %i\n", level);
+                fprintf(stderr, "   ijk:      %i  %i  %i\n", i, j, k);
+                abort();
+              }
             }
           }
         }
+        offload_free_buffer(grids_ref[idensity][level]);
+        printf("Validated grid collocate, max rel. diff: %le\n",
+               max_rel_diff);
       }
-      offload_free_buffer(grids_ref[level]);
-      printf("Validated grid collocate, max rel. diff: %le\n", max_rel_diff);
     }
   }
 }
@@ -283,16 +400,22 @@ void grid_integrate_task_list(
     const offload_buffer *pab_blocks, const offload_buffer *grids[nlevels],
     offload_buffer *hab_blocks, double forces[natoms][3], double virial[3][3]) {
 
-  // Bounds check.
-  assert(task_list->nlevels == nlevels);
-  for (int ilevel = 0; ilevel < nlevels; ilevel++) {
-    assert(task_list->npts_local[ilevel][0] == npts_local[ilevel][0]);
-    assert(task_list->npts_local[ilevel][1] == npts_local[ilevel][1]);
-    assert(task_list->npts_local[ilevel][2] == npts_local[ilevel][2]);
-  }
+  grid_integrate_task_list_multi(
+      task_list, compute_tau, natoms, nlevels, npts_local, 1,
+      (pab_blocks != NULL) ? &pab_blocks : NULL,
+      (const offload_buffer *(*)[nlevels])grids, &hab_blocks, forces, virial);
+}
 
-  assert(forces == NULL || pab_blocks != NULL);
-  assert(virial == NULL || pab_blocks != NULL);
+/*******************************************************************************
+ * \brief Integrate a single density with a backend that lacks native support
+ *        for multiple densities.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void integrate_one_density(
+    const grid_task_list *task_list, const bool compute_tau, const int natoms,
+    const int nlevels, const offload_buffer *pab_blocks,
+    const offload_buffer *grids[nlevels], offload_buffer *hab_blocks,
+    double forces[natoms][3], double virial[3][3]) {
 
   switch (task_list->backend) {
 #if defined(__OFFLOAD) && !defined(__NO_OFFLOAD_GRID)
@@ -313,50 +436,195 @@ void grid_integrate_task_list(
                                    nlevels, pab_blocks, grids, hab_blocks,
                                    forces, virial);
     break;
+  default:
+    printf("Error: Unknown grid backend: %i.\n", task_list->backend);
+    abort();
+    break;
+  }
+}
+
+/*******************************************************************************
+ * \brief Integrate with the tasks split between the cpu and dgemm backends.
+ *        The cpu backend writes directly into the outputs, while the results
+ *        of the dgemm backend get added on top.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void integrate_tuned(
+    const grid_task_list *task_list, const bool compute_tau, const int natoms,
+    const int nlevels, const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]) {
+
+  if (task_list->cpu != NULL) {
+    grid_cpu_integrate_task_list(task_list->cpu, compute_tau, natoms, nlevels,
+                                 ndensities, pab_blocks, grids, hab_blocks,
+                                 forces, virial);
+  } else {
+    for (int i = 0; i < ndensities; i++) {
+      memset(hab_blocks[i]->host_buffer, 0, hab_blocks[i]->size);
+    }
+    if (forces != NULL) {
+      memset(forces, 0, natoms * 3 * sizeof(double));
+    }
+    if (virial != NULL) {
+      memset(virial, 0, 9 * sizeof(double));
+    }
+  }
+
+  if (task_list->dgemm != NULL) {
+    double(*my_forces)[3] = malloc(natoms * 3 * sizeof(double));
+    double my_virial[3][3];
+    for (int i = 0; i < ndensities; i++) {
+      offload_buffer *my_hab_blocks = NULL;
+      const int hab_length = hab_blocks[i]->size / sizeof(double);
+      offload_create_buffer(hab_length, &my_hab_blocks);
+      grid_dgemm_integrate_task_list(
+          task_list->dgemm, compute_tau, natoms, nlevels,
+          (pab_blocks != NULL) ? pab_blocks[i] : NULL, grids[i], my_hab_blocks,
+          (forces != NULL) ? my_forces : NULL,
+          (virial != NULL) ? my_virial : NULL);
+      for (int j = 0; j < hab_length; j++) {
+        hab_blocks[i]->host_buffer[j] += my_hab_blocks->host_buffer[j];
+      }
+      offload_free_buffer(my_hab_blocks);
+      if (forces != NULL) {
+        for (int iatom = 0; iatom < natoms; iatom++) {
+          for (int idir = 0; idir < 3; idir++) {
+            forces[iatom][idir] += my_forces[iatom][idir];
+          }
+        }
+      }
+      if (virial != NULL) {
+        for (int idir = 0; idir < 3; idir++) {
+          for (int jdir = 0; jdir < 3; jdir++) {
+            virial[idir][jdir] += my_virial[idir][jdir];
+          }
+        }
+      }
+    }
+    free(my_forces);
+  }
+}
+
+/*******************************************************************************
+ * \brief Integrate all tasks of in given list for multiple grids.
+ *        See grid_task_list.h for details.
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_integrate_task_list_multi(
+    const grid_task_list *task_list, const bool compute_tau, const int natoms,
+    const int nlevels, const int npts_local[nlevels][3], const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]) {
+
+  // Bounds check.
+  assert(task_list->nlevels == nlevels);
+  for (int ilevel = 0; ilevel < nlevels; ilevel++) {
+    assert(task_list->npts_local[ilevel][0] == npts_local[ilevel][0]);
+    assert(task_list->npts_local[ilevel][1] == npts_local[ilevel][1]);
+    assert(task_list->npts_local[ilevel][2] == npts_local[ilevel][2]);
+  }
+
+  assert(forces == NULL || pab_blocks != NULL);
+  assert(virial == NULL || pab_blocks != NULL);
+
+  // The cpu backend processes all densities in a single pass,
+  // while the other backends process them one after another.
+  switch (task_list->backend) {
   case GRID_BACKEND_CPU:
     grid_cpu_integrate_task_list(task_list->cpu, compute_tau, natoms, nlevels,
-                                 pab_blocks, grids, hab_blocks, forces, virial);
+                                 ndensities, pab_blocks, grids, hab_blocks,
+                                 forces, virial);
+    break;
+  case GRID_BACKEND_TUNED:
+    integrate_tuned(task_list, compute_tau, natoms, nlevels, ndensities,
+                    pab_blocks, grids, hab_blocks, forces, virial);
     break;
   case GRID_BACKEND_REF:
     grid_ref_integrate_task_list(task_list->ref, compute_tau, natoms, nlevels,
-                                 pab_blocks, grids, hab_blocks, forces, virial);
+                                 ndensities, pab_blocks, grids, hab_blocks,
+                                 forces, virial);
     break;
-  default:
-    printf("Error: Unknown grid backend: %i.\n", task_list->backend);
-    abort();
+  default: {
+    // Forces and virial are summed over all densities.
+    double(*my_forces)[3] = malloc(natoms * 3 * sizeof(double));
+    for (int i = 0; i < ndensities; i++) {
+      double my_virial[3][3];
+      memset(my_forces, 0, natoms * 3 * sizeof(double));
+      memset(my_virial, 0, 9 * sizeof(double));
+      integrate_one_density(task_list, compute_tau, natoms, nlevels,
+                            (pab_blocks != NULL) ? pab_blocks[i] : NULL,
+                            grids[i], hab_blocks[i],
+                            (forces != NULL && i > 0) ? my_forces : forces,
+                            (virial != NULL && i > 0) ? my_virial : virial);
+      if (forces != NULL && i > 0) {
+        for (int iatom = 0; iatom < natoms; iatom++) {
+          for (int idir = 0; idir < 3; idir++) {
+            forces[iatom][idir] += my_forces[iatom][idir];
+          }
+        }
+      }
+      if (virial != NULL && i > 0) {
+        for (int idir = 0; idir < 3; idir++) {
+          for (int jdir = 0; jdir < 3; jdir++) {
+            virial[idir][jdir] += my_virial[idir][jdir];
+          }
+        }
+      }
+    }
+    free(my_forces);
     break;
   }
+  }
+
+  // Write task list and results to file if capturing is enabled.
+  if (task_list->capture != NULL) {
+    grid_capture_integrate(task_list->capture, compute_tau, natoms, nlevels,
+                           npts_local, ndensities, pab_blocks, grids,
+                           hab_blocks, forces, virial);
+  }
 
   // Perform validation if enabled.
   if (grid_library_get_config().validate) {
     // Allocate space for reference results.
-    const int hab_length = hab_blocks->size / sizeof(double);
-    offload_buffer *hab_blocks_ref = NULL;
-    offload_create_buffer(hab_length, &hab_blocks_ref);
+    offload_buffer *hab_blocks_ref[ndensities];
+    for (int i = 0; i < ndensities; i++) {
+      hab_blocks_ref[i] = NULL;
+      offload_create_buffer(hab_blocks[i]->size / sizeof(double),
+                            &hab_blocks_ref[i]);
+    }
     double forces_ref[natoms][3], virial_ref[3][3];
 
     // Call reference implementation.
     grid_ref_integrate_task_list(task_list->ref, compute_tau, natoms, nlevels,
-                                 pab_blocks, grids, hab_blocks_ref,
+                                 ndensities, pab_blocks, grids, hab_blocks_ref,
                                  (forces != NULL) ? forces_ref : NULL,
                                  (virial != NULL) ? virial_ref : NULL);
 
     // Compare hab.
     const double hab_tolerance = 1e-12;
     double hab_max_rel_diff = 0.0;
-    for (int i = 0; i < hab_length; i++) {
-      const double ref_value = hab_blocks_ref->host_buffer[i];
-      const double test_value = hab_blocks->host_buffer[i];
-      const double diff = fabs(test_value - ref_value);
-      const double rel_diff = diff / fmax(1.0, fabs(ref_value));
-      hab_max_rel_diff = fmax(hab_max_rel_diff, rel_diff);
-      if (rel_diff > hab_tolerance) {
-        fprintf(stderr, "Error: Validation failure in grid integrate\n");
-        fprintf(stderr, "   hab diff:     %le\n", diff);
-        fprintf(stderr, "   hab rel_diff: %le\n", rel_diff);
-        fprintf(stderr, "   hab value:    %le\n", ref_value);
-        fprintf(stderr, "   hab i:        %i\n", i);
-        abort();
+    for (int idensity = 0; idensity < ndensities; idensity++) {
+      const int hab_length = hab_blocks[idensity]->size / sizeof(double);
+      for (int i = 0; i < hab_length; i++) {
+        const double ref_value = hab_blocks_ref[idensity]->host_buffer[i];
+        const double test_value = hab_blocks[idensity]->host_buffer[i];
+        const double diff = fabs(test_value - ref_value);
+        const double rel_diff = diff / fmax(1.0, fabs(ref_value));
+        hab_max_rel_diff = fmax(hab_max_rel_diff, rel_diff);
+        if (rel_diff > hab_tolerance) {
+          fprintf(stderr, "Error: Validation failure in grid integrate\n");
+          fprintf(stderr, "   hab diff:     %le\n", diff);
+          fprintf(stderr, "   hab rel_diff: %le\n", rel_diff);
+          fprintf(stderr, "   hab value:    %le\n", ref_value);
+          fprintf(stderr, "   hab density:  %i\n", idensity);
+          fprintf(stderr, "   hab i:        %i\n", i);
+          abort();
+        }
       }
     }
 
@@ -409,7 +677,9 @@ void grid_integrate_task_list(
 
     printf("Validated grid_integrate, max rel. diff: %le %le %le\n",
            hab_max_rel_diff, forces_max_rel_diff, virial_max_rel_diff);
-    offload_free_buffer(hab_blocks_ref);
+    for (int i = 0; i < ndensities; i++) {
+      offload_free_buffer(hab_blocks_ref[i]);
+    }
   }
 }
 
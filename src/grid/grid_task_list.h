@@ -16,6 +16,7 @@
 #include "cpu/grid_cpu_task_list.h"
 #include "dgemm/grid_dgemm_task_list.h"
 #include "gpu/grid_gpu_task_list.h"
+#include "grid_capture.h"
 #include "hip/grid_hip_task_list.h"
 #include "ref/grid_ref_task_list.h"
 
@@ -27,6 +28,7 @@ typedef struct {
   int backend;
   int nlevels;
   int (*npts_local)[3];
+  grid_capture *capture; // only set when capturing is enabled
   grid_ref_task_list *ref;
   grid_cpu_task_list *cpu;
   grid_dgemm_task_list *dgemm;
@@ -149,6 +151,59 @@ void grid_integrate_task_list(
     const offload_buffer *pab_blocks, const offload_buffer *grids[nlevels],
     offload_buffer *hab_blocks, double forces[natoms][3], double virial[3][3]);
 
+/*******************************************************************************
+ * \brief Collocate all tasks of in given list for multiple density matrices,
+ *        e.g. for spin channels or response densities. The cpu backend
+ *        traverses the task list only once and shares the per-task work,
+ *        like exponentials and loop bounds, among all densities. The other
+ *        backends process the densities one after another.
+ *
+ * \param task_list       Task list to collocate.
+ * \param func            Function to be collocated, see grid_prepare_pab.h
+ * \param nlevels         Number of grid levels.
+ * \param npts_local      Number of local grid points for each grid level.
+ * \param ndensities      Number of density matrices.
+ * \param pab_blocks      Buffer with the blocks of each density matrix.
+ * \param grids           The output grids for each density and grid level.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_collocate_task_list_multi(
+    const grid_task_list *task_list, const enum grid_func func,
+    const int nlevels, const int npts_local[nlevels][3], const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    offload_buffer *grids[ndensities][nlevels]);
+
+/*******************************************************************************
+ * \brief Integrate all tasks of in given list from multiple sets of grids,
+ *        e.g. for spin channels or response densities. The cpu backend
+ *        traverses the task list only once and shares the per-task work,
+ *        like exponentials and loop bounds, among all grids. The other
+ *        backends process the grids one after another.
+ *
+ * \param task_list       Task list to integrate.
+ * \param compute_tau     When true then <nabla a| V | nabla b> is computed.
+ * \param natoms          Number of atoms.
+ * \param nlevels         Number of grid levels.
+ * \param npts_local      Number of local grid points for each grid level.
+ * \param ndensities      Number of sets of grids.
+ * \param pab_blocks      Optional density blocks for each set of grids,
+ *                        needed for forces and virial.
+ * \param grids           Grids to integrate from for each set and grid level.
+ * \param hab_blocks      Output Hamiltonian matrix blocks for each set.
+ * \param forces          Optional output forces summed over all sets.
+ * \param virial          Optional output virial summed over all sets.
+ *
+ * \author Ole Schuett
+ ******************************************************************************/
+void grid_integrate_task_list_multi(
+    const grid_task_list *task_list, const bool compute_tau, const int natoms,
+    const int nlevels, const int npts_local[nlevels][3], const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]);
+
 #endif
 
 // EOF
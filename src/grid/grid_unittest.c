@@ -5,13 +5,18 @@
 /*  SPDX-License-Identifier: BSD-3-Clause                                     */
 /*----------------------------------------------------------------------------*/
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../offload/offload_library.h"
 #include "common/grid_library.h"
 #include "grid_replay.h"
+#include "grid_task_list.h"
 
 // Only used to call MPI_Init and MPI_Finalize to avoid spurious MPI error.
 #if defined(__parallel)
@@ -37,16 +42,16 @@ static void print_func(char *message, int output_unit) {
 }
 
 /*******************************************************************************
- * \brief Unit test for the grid code.
+ * \brief Builds the path of the given sample task file.
  * \author Ole Schuett
  ******************************************************************************/
-static int run_test(const char cp2k_root_dir[], const char task_file[]) {
+static void get_task_filename(const char cp2k_root_dir[],
+                              const char task_file[], char filename[1024]) {
   if (strlen(cp2k_root_dir) > 512) {
     fprintf(stderr, "Error: cp2k_root_dir too long.\n");
     abort();
   }
 
-  char filename[1024];
   strcpy(filename, cp2k_root_dir);
   if (filename[strlen(filename) - 1] != '/') {
     strcat(filename, "/");
@@ -54,19 +59,396 @@ static int run_test(const char cp2k_root_dir[], const char task_file[]) {
 
   strcat(filename, "src/grid/sample_tasks/");
   strcat(filename, task_file);
+}
+
+/*******************************************************************************
+ * \brief Unit test for the grid code.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int run_test(const char cp2k_root_dir[], const char task_file[]) {
+  char filename[1024];
+  get_task_filename(cp2k_root_dir, task_file, filename);
 
   const double tolerance = 1e-12;
   int errors = 0;
   for (int icol = 0; icol < 2; icol++) {
-    for (int ibatch = 0; ibatch < 2; ibatch++) {
-      const bool success =
-          grid_replay(filename, 1, icol == 1, ibatch == 1, 1, tolerance);
+    for (int ibatch = 0; ibatch < 5; ibatch++) {
+      // The third and fifth variant run the batch mode with three tiles and
+      // fused integration, the last two variants process three densities
+      // in spatial order. The other batch variants integrate level by level.
+      const bool tiled = (ibatch == 2 || ibatch == 4);
+      const bool fused = (ibatch == 2 || ibatch == 4);
+      const bool spatial = (ibatch >= 3);
+      const int ndensities = (ibatch >= 3) ? 3 : 1;
+      grid_library_set_config(GRID_BACKEND_AUTO, false, false, tiled,
+                              (tiled) ? 3 : 0, spatial, fused, 0.0);
+      const bool success = grid_replay(filename, 1, icol == 1, ibatch >= 1, 1,
+                                       ndensities, tolerance);
       if (!success) {
         printf("Max diff too high, test failed.\n\n");
         errors++;
       }
     }
   }
+  grid_library_set_config(GRID_BACKEND_AUTO, false, false, false, 0, false,
+                          false, 0.0);
+  return errors;
+}
+
+/*******************************************************************************
+ * \brief Private routine for creating a synthetic task list with one task per
+ *        pair of atoms. All atoms carry a single set of d-type primitives,
+ *        which has to be freed together with the task list.
+ * \author Ole Schuett
+ ******************************************************************************/
+static void create_pair_task_list(const bool orthorhombic, const int natoms,
+                                  const double atom_positions[natoms][3],
+                                  const double radius, const int npts[3],
+                                  const double dh[3][3],
+                                  const double dh_inv[3][3],
+                                  grid_basis_set **basis_set,
+                                  grid_task_list **task_list) {
+  // A single set of d-type primitives with an identity decontraction.
+  const int lmin = 0, lmax = 2, npgf = 1, nsgf = 10, first_sgf = 1;
+  double sphi[10][10], zet[1][1] = {{2.0}};
+  for (int i = 0; i < nsgf; i++) {
+    for (int j = 0; j < nsgf; j++) {
+      sphi[i][j] = (i == j) ? 1.0 : 0.0;
+    }
+  }
+  grid_create_basis_set(1, nsgf, nsgf, npgf, &lmin, &lmax, &npgf, &nsgf,
+                        &first_sgf, (const double(*)[10])sphi,
+                        (const double(*)[1])zet, basis_set);
+
+  const int ntasks = natoms * (natoms + 1) / 2;
+  int atom_kinds[natoms];
+  for (int iatom = 0; iatom < natoms; iatom++) {
+    atom_kinds[iatom] = 1;
+  }
+  int level_list[ntasks], iatom_list[ntasks], jatom_list[ntasks];
+  int one_list[ntasks], border_mask_list[ntasks], block_num_list[ntasks];
+  int block_offsets[ntasks];
+  double radius_list[ntasks], rab_list[ntasks][3];
+  int itask = 0;
+  for (int iatom = 0; iatom < natoms; iatom++) {
+    for (int jatom = iatom; jatom < natoms; jatom++) {
+      level_list[itask] = one_list[itask] = 1;
+      iatom_list[itask] = iatom + 1;
+      jatom_list[itask] = jatom + 1;
+      border_mask_list[itask] = 0;
+      block_num_list[itask] = itask + 1;
+      block_offsets[itask] = itask * nsgf * nsgf;
+      radius_list[itask] = radius;
+      for (int i = 0; i < 3; i++) {
+        rab_list[itask][i] =
+            atom_positions[jatom][i] - atom_positions[iatom][i];
+      }
+      itask++;
+    }
+  }
+  const int npts_list[1][3] = {{npts[0], npts[1], npts[2]}};
+  const int zeros[1][3] = {{0, 0, 0}};
+  double dh_list[1][3][3], dh_inv_list[1][3][3];
+  memcpy(dh_list[0], dh, 9 * sizeof(double));
+  memcpy(dh_inv_list[0], dh_inv, 9 * sizeof(double));
+  const grid_basis_set *basis_sets[1] = {*basis_set};
+  grid_create_task_list(
+      orthorhombic, ntasks, 1, natoms, 1, ntasks, block_offsets,
+      atom_positions, atom_kinds, basis_sets, level_list, iatom_list,
+      jatom_list, one_list, one_list, one_list, one_list, border_mask_list,
+      block_num_list, radius_list, (const double(*)[3])rab_list, npts_list,
+      npts_list, zeros, zeros, (const double(*)[3][3])dh_list,
+      (const double(*)[3][3])dh_inv_list, task_list);
+}
+
+/*******************************************************************************
+ * \brief Private routine for collocating a synthetic task list with the cpu
+ *        backend. It returns the grid and the number of skipped tasks.
+ * \author Ole Schuett
+ ******************************************************************************/
+static long collocate_screened(const grid_task_list *task_list,
+                               const enum grid_func func, const bool validate,
+                               const double eps_screening, const int npts[3],
+                               const offload_buffer *pab_blocks,
+                               offload_buffer *grid) {
+  long screened_before, skipped_before, screened_after, skipped_after;
+  grid_library_get_screening(&screened_before, &skipped_before);
+  grid_library_set_config(GRID_BACKEND_CPU, validate, false, false, 0, false,
+                          false, eps_screening);
+  memset(grid->host_buffer, 0, grid->size);
+  offload_buffer *grids[1] = {grid};
+  grid_collocate_task_list(task_list, func, 1, (const int(*)[3])npts,
+                           pab_blocks, grids);
+  grid_library_set_config(GRID_BACKEND_AUTO, false, false, false, 0, false,
+                          false, 0.0);
+  grid_library_get_screening(&screened_after, &skipped_after);
+  return skipped_after - skipped_before;
+}
+
+/*******************************************************************************
+ * \brief Unit test for the screening of the cpu backend. A list of tasks for
+ *        atom pairs at increasing distances is collocated with and without
+ *        screening. Only part of the tasks must be skipped, and the grids
+ *        must agree within eps_screening per skipped task.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int run_screening_test(const enum grid_func func,
+                              const double eps_screening) {
+  // Atoms along the x-axis in an orthorhombic cell, one task per pair.
+  enum { natoms = 6, ntasks = natoms * (natoms + 1) / 2, nsgf = 10 };
+  const double xs[natoms] = {0.0, 0.8, 2.0, 3.5, 5.5, 7.5};
+  double atom_positions[natoms][3];
+  for (int iatom = 0; iatom < natoms; iatom++) {
+    atom_positions[iatom][0] = 2.0 + xs[iatom];
+    atom_positions[iatom][1] = atom_positions[iatom][2] = 6.0;
+  }
+  const int npts[3] = {48, 48, 48};
+  const double dh[3][3] = {{0.25, 0, 0}, {0, 0.25, 0}, {0, 0, 0.25}};
+  const double dh_inv[3][3] = {{4.0, 0, 0}, {0, 4.0, 0}, {0, 0, 4.0}};
+  grid_basis_set *basis_set = NULL;
+  grid_task_list *task_list = NULL;
+  create_pair_task_list(true, natoms, (const double(*)[3])atom_positions, 4.0,
+                        npts, dh, dh_inv, &basis_set, &task_list);
+
+  offload_buffer *pab_blocks = NULL, *grid_ref = NULL, *grid_test = NULL;
+  offload_create_buffer(ntasks * nsgf * nsgf, &pab_blocks);
+  for (int i = 0; i < ntasks * nsgf * nsgf; i++) {
+    pab_blocks->host_buffer[i] = 0.5 + 0.5 * cos(i);
+  }
+  const int npts_total = npts[0] * npts[1] * npts[2];
+  offload_create_buffer(npts_total, &grid_ref);
+  offload_create_buffer(npts_total, &grid_test);
+
+  collocate_screened(task_list, func, false, 0.0, npts, pab_blocks, grid_ref);
+  const long skipped = collocate_screened(
+      task_list, func, false, eps_screening, npts, pab_blocks, grid_test);
+  double max_diff = 0.0;
+  for (int i = 0; i < npts_total; i++) {
+    max_diff = fmax(max_diff,
+                    fabs(grid_ref->host_buffer[i] - grid_test->host_buffer[i]));
+  }
+  printf("Screening of %s with eps %le skipped %li of %i tasks, max diff: "
+         "%le\n\n",
+         (func == GRID_FUNC_AB) ? "density" : "tau", eps_screening, skipped,
+         ntasks, max_diff);
+
+  int errors = 0;
+  if (skipped == 0 || skipped == ntasks) {
+    printf("Expected only part of the tasks to be skipped, screening test "
+           "failed.\n\n");
+    errors++;
+  }
+  if (max_diff > skipped * eps_screening) {
+    printf("Max diff too high, screening test failed.\n\n");
+    errors++;
+  }
+
+  // In validation mode the screening is disabled, otherwise the comparison
+  // against the reference backend would abort.
+  if (collocate_screened(task_list, func, true, eps_screening, npts,
+                         pab_blocks, grid_test) != 0) {
+    printf("Screening was active in validation mode, test failed.\n\n");
+    errors++;
+  }
+
+  offload_free_buffer(pab_blocks);
+  offload_free_buffer(grid_ref);
+  offload_free_buffer(grid_test);
+  grid_free_task_list(task_list);
+  grid_free_basis_set(basis_set);
+  return errors;
+}
+
+/*******************************************************************************
+ * \brief Private routine for collocating a synthetic task list with the cpu
+ *        backend, which gets split into given number of tiles. Returns the
+ *        number of tiles that were actually created.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int collocate_tiled(const bool orthorhombic, const int natoms,
+                           const double atom_positions[natoms][3],
+                           const int npts[3], const double dh[3][3],
+                           const double dh_inv[3][3], const int ntiles,
+                           const enum grid_func func,
+                           const offload_buffer *pab_blocks,
+                           offload_buffer *grid) {
+  // The tiling is decided when the task list gets created.
+  grid_library_set_config(GRID_BACKEND_CPU, false, false, ntiles > 0, ntiles,
+                          false, false, 0.0);
+  grid_basis_set *basis_set = NULL;
+  grid_task_list *task_list = NULL;
+  create_pair_task_list(orthorhombic, natoms, atom_positions, 2.5, npts, dh,
+                        dh_inv, &basis_set, &task_list);
+  const int ntiles_created = task_list->cpu->tilings[0].ntiles;
+  memset(grid->host_buffer, 0, grid->size);
+  offload_buffer *grids[1] = {grid};
+  grid_collocate_task_list(task_list, func, 1, (const int(*)[3])npts,
+                           pab_blocks, grids);
+  grid_library_set_config(GRID_BACKEND_AUTO, false, false, false, 0, false,
+                          false, 0.0);
+  grid_free_task_list(task_list);
+  grid_free_basis_set(basis_set);
+  return ntiles_created;
+}
+
+/*******************************************************************************
+ * \brief Unit test for the tiled collocation of the cpu backend. A list of
+ *        tasks for atom pairs scattered through the cell is collocated with
+ *        explicit numbers of tiles, which are independent of the number of
+ *        threads. The grids must agree with the untiled collocation.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int run_tiled_test(const enum grid_func func, const bool orthorhombic) {
+  // Atoms spread along z, such that their tasks fall into different tiles.
+  enum { natoms = 8, ntasks = natoms * (natoms + 1) / 2, nsgf = 10 };
+  double atom_positions[natoms][3];
+  for (int iatom = 0; iatom < natoms; iatom++) {
+    atom_positions[iatom][0] = fmod(2.0 + 3.7 * iatom, 12.0);
+    atom_positions[iatom][1] = fmod(1.0 + 5.3 * iatom, 12.0);
+    atom_positions[iatom][2] = 0.5 + 1.5 * iatom;
+  }
+  // The general cell is sheared along x.
+  const double shear = (orthorhombic) ? 0.0 : 0.05;
+  const int npts[3] = {48, 48, 48};
+  const double dh[3][3] = {{0.25, 0, 0}, {0, 0.25, 0}, {shear, 0, 0.25}};
+  const double dh_inv[3][3] = {
+      {4.0, 0, 0}, {0, 4.0, 0}, {-shear * 16.0, 0, 4.0}};
+
+  offload_buffer *pab_blocks = NULL, *grid_ref = NULL, *grid_test = NULL;
+  offload_create_buffer(ntasks * nsgf * nsgf, &pab_blocks);
+  for (int i = 0; i < ntasks * nsgf * nsgf; i++) {
+    pab_blocks->host_buffer[i] = 0.5 + 0.5 * cos(i);
+  }
+  const int npts_total = npts[0] * npts[1] * npts[2];
+  offload_create_buffer(npts_total, &grid_ref);
+  offload_create_buffer(npts_total, &grid_test);
+
+  const double(*positions)[3] = (const double(*)[3])atom_positions;
+  collocate_tiled(orthorhombic, natoms, positions, npts, dh, dh_inv, 0, func,
+                  pab_blocks, grid_ref);
+  double ref_max = 0.0;
+  for (int i = 0; i < npts_total; i++) {
+    ref_max = fmax(ref_max, fabs(grid_ref->host_buffer[i]));
+  }
+
+  int errors = 0;
+  const int ntiles_list[3] = {2, 3, 5};
+  for (int k = 0; k < 3; k++) {
+    const int ntiles = ntiles_list[k];
+    const int ntiles_created =
+        collocate_tiled(orthorhombic, natoms, positions, npts, dh, dh_inv,
+                        ntiles, func, pab_blocks, grid_test);
+    double max_diff = 0.0;
+    for (int i = 0; i < npts_total; i++) {
+      max_diff = fmax(max_diff, fabs(grid_ref->host_buffer[i] -
+                                     grid_test->host_buffer[i]));
+    }
+    printf("Tiled collocation of %s in %s cell with %i of %i tiles, max "
+           "diff: %le\n\n",
+           (func == GRID_FUNC_AB) ? "density" : "tau",
+           (orthorhombic) ? "ortho" : "general", ntiles_created, ntiles,
+           max_diff);
+    if (ntiles_created != ntiles) {
+      printf("Expected the level to be tiled, tiled test failed.\n\n");
+      errors++;
+    }
+    if (max_diff > 1e-12 * ref_max) {
+      printf("Max diff too high, tiled test failed.\n\n");
+      errors++;
+    }
+  }
+
+  offload_free_buffer(pab_blocks);
+  offload_free_buffer(grid_ref);
+  offload_free_buffer(grid_test);
+  return errors;
+}
+
+/*******************************************************************************
+ * \brief Unit test for the tuned backend, which splits the tasks between the
+ *        cpu and dgemm backends. Which backend gets which tasks depends on
+ *        timings. Hence, only task files are used for which both backends
+ *        agree with the reference within the tolerance.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int run_tuned_test(const char cp2k_root_dir[], const char task_file[]) {
+  char filename[1024];
+  get_task_filename(cp2k_root_dir, task_file, filename);
+
+  int errors = 0;
+  grid_library_set_config(GRID_BACKEND_TUNED, false, false, false, 0, false,
+                          true, 0.0);
+  for (int icol = 0; icol < 2; icol++) {
+    if (!grid_replay(filename, 1, icol == 1, true, 1, 1, 1e-12)) {
+      printf("Max diff too high, tuned test failed.\n\n");
+      errors++;
+    }
+  }
+  grid_library_set_config(GRID_BACKEND_AUTO, false, false, false, 0, false,
+                          false, 0.0);
+  return errors;
+}
+
+/*******************************************************************************
+ * \brief Unit test for capturing task lists. Runs a collocate and an integrate
+ *        call with GRID_CAPTURE_TASKLIST set, replays the written .tasklist
+ *        files, and compares against the captured results.
+ * \author Ole Schuett
+ ******************************************************************************/
+static int run_capture_test(const char cp2k_root_dir[],
+                            const char task_file[]) {
+  char filename[1024];
+  get_task_filename(cp2k_root_dir, task_file, filename);
+
+  char tmpdir[] = "/tmp/grid_unittest_XXXXXX";
+  if (mkdtemp(tmpdir) == NULL) {
+    fprintf(stderr, "Error: Could not create temporary directory.\n");
+    abort();
+  }
+  char prefix[1024];
+  snprintf(prefix, sizeof(prefix), "%s/capture", tmpdir);
+
+  int rank = 0;
+#if defined(__parallel)
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+
+  // Only the very first and second capture of this process happen here.
+  setenv("GRID_CAPTURE_TASKLIST", prefix, 1);
+  grid_library_set_config(GRID_BACKEND_CPU, false, false, false, 0, false,
+                          true, 0.0);
+  const bool success_collocate =
+      grid_replay(filename, 1, true, true, 1, 1, 1e-12);
+  const bool success_integrate =
+      grid_replay(filename, 1, false, true, 1, 1, 1e-12);
+  unsetenv("GRID_CAPTURE_TASKLIST");
+
+  int errors = 0;
+  if (!success_collocate || !success_integrate) {
+    printf("Max diff too high, capture test failed.\n\n");
+    errors++;
+  }
+
+  // The replay recreates the task list and compares the resulting grids,
+  // respectively hab blocks, forces, and virial, against the captured ones.
+  for (int icapture = 0; icapture < 2; icapture++) {
+    char tasklist_filename[1100];
+    snprintf(tasklist_filename, sizeof(tasklist_filename),
+             "%s_%i_%05i.tasklist", prefix, rank, icapture);
+    if (access(tasklist_filename, R_OK) != 0) {
+      printf("Missing file %s, capture test failed.\n\n", tasklist_filename);
+      errors++;
+      continue;
+    }
+    if (!grid_replay_task_list(tasklist_filename, 1, 1e-12)) {
+      printf("Max diff too high, tasklist replay failed.\n\n");
+      errors++;
+    }
+    remove(tasklist_filename);
+  }
+  grid_library_set_config(GRID_BACKEND_AUTO, false, false, false, 0, false,
+                          false, 0.0);
+  rmdir(tmpdir);
   return errors;
 }
 
@@ -97,6 +479,17 @@ int main(int argc, char *argv[]) {
   errors += run_test(argv[1], "general_subpatch0.task");
   errors += run_test(argv[1], "general_subpatch16.task");
   errors += run_test(argv[1], "general_overflow.task");
+  errors += run_tuned_test(argv[1], "ortho_density_l3300.task");
+  errors += run_tuned_test(argv[1], "ortho_density_l3333.task");
+  errors += run_tuned_test(argv[1], "ortho_density_l0505.task");
+  errors += run_tuned_test(argv[1], "general_tau.task");
+  errors += run_tuned_test(argv[1], "general_overflow.task");
+  errors += run_screening_test(GRID_FUNC_AB, 1e-8);
+  errors += run_screening_test(GRID_FUNC_DADB, 1e-8);
+  errors += run_tiled_test(GRID_FUNC_AB, true);
+  errors += run_tiled_test(GRID_FUNC_AB, false);
+  errors += run_tiled_test(GRID_FUNC_DADB, true);
+  errors += run_capture_test(argv[1], "ortho_density_l2200.task");
 
   grid_library_print_stats(&mpi_sum_func, 0, &print_func, 0);
   grid_library_finalize();
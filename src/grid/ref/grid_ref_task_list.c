@@ -390,25 +390,30 @@ static void collocate_one_grid_level(
 
 /*******************************************************************************
  * \brief Collocate all tasks of in given list onto given grids.
- *        See grid_task_list.h for details.
+ *        See grid_task_list.h for details. For the sake of simplicity the
+ *        densities are collocated one after another.
  * \author Ole Schuett
  ******************************************************************************/
 void grid_ref_collocate_task_list(const grid_ref_task_list *task_list,
                                   const enum grid_func func, const int nlevels,
-                                  const offload_buffer *pab_blocks,
-                                  offload_buffer *grids[nlevels]) {
+                                  const int ndensities,
+                                  const offload_buffer *pab_blocks[ndensities],
+                                  offload_buffer *grids[ndensities][nlevels]) {
 
   assert(task_list->nlevels == nlevels);
 
-  for (int level = 0; level < task_list->nlevels; level++) {
-    const int idx = level * task_list->nblocks;
-    const int *first_block_task = &task_list->first_level_block_task[idx];
-    const int *last_block_task = &task_list->last_level_block_task[idx];
-    const grid_ref_layout *layout = &task_list->layouts[level];
-    collocate_one_grid_level(
-        task_list, first_block_task, last_block_task, func, layout->npts_global,
-        layout->npts_local, layout->shift_local, layout->border_width,
-        layout->dh, layout->dh_inv, pab_blocks->host_buffer, grids[level]);
+  for (int idensity = 0; idensity < ndensities; idensity++) {
+    for (int level = 0; level < task_list->nlevels; level++) {
+      const int idx = level * task_list->nblocks;
+      const int *first_block_task = &task_list->first_level_block_task[idx];
+      const int *last_block_task = &task_list->last_level_block_task[idx];
+      const grid_ref_layout *layout = &task_list->layouts[level];
+      collocate_one_grid_level(
+          task_list, first_block_task, last_block_task, func,
+          layout->npts_global, layout->npts_local, layout->shift_local,
+          layout->border_width, layout->dh, layout->dh_inv,
+          pab_blocks[idensity]->host_buffer, grids[idensity][level]);
+    }
   }
 }
 
@@ -605,20 +610,25 @@ static void integrate_one_grid_level(
 
 /*******************************************************************************
  * \brief Integrate all tasks of in given list from given grids.
- *        See grid_task_list.h for details.
+ *        See grid_task_list.h for details. For the sake of simplicity the
+ *        densities are integrated one after another.
  * \author Ole Schuett
  ******************************************************************************/
 void grid_ref_integrate_task_list(
     const grid_ref_task_list *task_list, const bool compute_tau,
-    const int natoms, const int nlevels, const offload_buffer *pab_blocks,
-    const offload_buffer *grids[nlevels], offload_buffer *hab_blocks,
-    double forces[natoms][3], double virial[3][3]) {
+    const int natoms, const int nlevels, const int ndensities,
+    const offload_buffer *pab_blocks[ndensities],
+    const offload_buffer *grids[ndensities][nlevels],
+    offload_buffer *hab_blocks[ndensities], double forces[natoms][3],
+    double virial[3][3]) {
 
   assert(task_list->nlevels == nlevels);
   assert(task_list->natoms == natoms);
 
   // Zero result arrays.
-  memset(hab_blocks->host_buffer, 0, hab_blocks->size);
+  for (int idensity = 0; idensity < ndensities; idensity++) {
+    memset(hab_blocks[idensity]->host_buffer, 0, hab_blocks[idensity]->size);
+  }
   if (forces != NULL) {
     memset(forces, 0, natoms * 3 * sizeof(double));
   }
@@ -626,16 +636,20 @@ void grid_ref_integrate_task_list(
     memset(virial, 0, 9 * sizeof(double));
   }
 
-  for (int level = 0; level < task_list->nlevels; level++) {
-    const int idx = level * task_list->nblocks;
-    const int *first_block_task = &task_list->first_level_block_task[idx];
-    const int *last_block_task = &task_list->last_level_block_task[idx];
-    const grid_ref_layout *layout = &task_list->layouts[level];
-    integrate_one_grid_level(
-        task_list, first_block_task, last_block_task, compute_tau, natoms,
-        layout->npts_global, layout->npts_local, layout->shift_local,
-        layout->border_width, layout->dh, layout->dh_inv, pab_blocks,
-        grids[level], hab_blocks, forces, virial);
+  // Forces and virial are accumulated over all densities.
+  for (int idensity = 0; idensity < ndensities; idensity++) {
+    for (int level = 0; level < task_list->nlevels; level++) {
+      const int idx = level * task_list->nblocks;
+      const int *first_block_task = &task_list->first_level_block_task[idx];
+      const int *last_block_task = &task_list->last_level_block_task[idx];
+      const grid_ref_layout *layout = &task_list->layouts[level];
+      integrate_one_grid_level(
+          task_list, first_block_task, last_block_task, compute_tau, natoms,
+          layout->npts_global, layout->npts_local, layout->shift_local,
+          layout->border_width, layout->dh, layout->dh_inv,
+          (pab_blocks != NULL) ? pab_blocks[idensity] : NULL,
+          grids[idensity][level], hab_blocks[idensity], forces, virial);
+    }
   }
 }
 
@@ -8,11 +8,17 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "offload_buffer.h"
 #include "offload_library.h"
 #include "offload_runtime.h"
 
+// NUMA placement of the host buffers that are currently allocated and of
+// those that were allocated when their total size peaked.
+static int64_t numa_placement[OFFLOAD_MAX_NUMA_NODES] = {0};
+static int64_t numa_placement_peak[OFFLOAD_MAX_NUMA_NODES] = {0};
+
 /*******************************************************************************
  * \brief Allocates a buffer of given length, ie., number of elements.
  * \author Ole Schuett
@@ -32,6 +38,7 @@ void offload_create_buffer(const int length, offload_buffer **buffer) {
   (*buffer)->size = requested_size;
   (*buffer)->host_buffer = NULL;
   (*buffer)->device_buffer = NULL;
+  memset((*buffer)->numa_placement, 0, sizeof((*buffer)->numa_placement));
 #if defined(__OFFLOAD)
   offload_activate_chosen_device();
   offloadMallocHost((void **)&(*buffer)->host_buffer, requested_size);
@@ -39,6 +46,12 @@ void offload_create_buffer(const int length, offload_buffer **buffer) {
 #else
   (*buffer)->host_buffer = malloc(requested_size);
   (*buffer)->device_buffer = NULL;
+  // Reused buffers keep their placement, hence only new or grown buffers get
+  // touched and have their placement queried.
+  offload_numa_first_touch((*buffer)->host_buffer, requested_size,
+                           (*buffer)->numa_placement);
+  offload_numa_add_placement((*buffer)->numa_placement, numa_placement,
+                             numa_placement_peak);
 #endif
   if (NULL == (*buffer)->host_buffer) { /* unified memory */
     (*buffer)->host_buffer = (*buffer)->device_buffer;
@@ -57,6 +70,7 @@ void offload_free_buffer(offload_buffer *buffer) {
   offloadFree(buffer->device_buffer);
 #else
   free(buffer->host_buffer);
+  offload_numa_remove_placement(buffer->numa_placement, numa_placement);
 #endif
   free(buffer);
 }
@@ -70,4 +84,13 @@ double *offload_get_buffer_host_pointer(offload_buffer *buffer) {
   return buffer->host_buffer;
 }
 
+/*******************************************************************************
+ * \brief Returns the NUMA placement of the host buffers at their peak.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_buffer_numa_placement(int64_t placement[OFFLOAD_MAX_NUMA_NODES]) {
+#pragma omp critical(offload_numa_placement)
+  memcpy(placement, numa_placement_peak, sizeof(numa_placement_peak));
+}
+
 // EOF
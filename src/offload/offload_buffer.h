@@ -8,6 +8,9 @@
 #define OFFLOAD_BUFFER_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "offload_library.h"
 
 /*******************************************************************************
  * \brief Internal representation of a buffer.
@@ -17,6 +20,7 @@ typedef struct {
   size_t size;
   double *host_buffer;
   double *device_buffer;
+  int64_t numa_placement[OFFLOAD_MAX_NUMA_NODES]; // Bytes per node of host.
 } offload_buffer;
 
 /*******************************************************************************
@@ -37,6 +41,13 @@ void offload_free_buffer(offload_buffer *buffer);
  ******************************************************************************/
 double *offload_get_buffer_host_pointer(offload_buffer *buffer);
 
+/*******************************************************************************
+ * \brief Returns the NUMA placement in bytes per node of the host buffers at
+ *        the time their total size peaked, see offload_numa_add_placement.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_buffer_numa_placement(int64_t placement[OFFLOAD_MAX_NUMA_NODES]);
+
 #endif
 
 // EOF
@@ -5,15 +5,27 @@
 /*  SPDX-License-Identifier: BSD-3-Clause                                     */
 /*----------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE // needed for syscall and madvise
+
 #include <assert.h>
+#include <omp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "offload_library.h"
 #include "offload_runtime.h"
 
+// Number of pages that are queried to determine the placement of a buffer.
+#define OFFLOAD_NUMA_NSAMPLES 16
+
 #if defined(__OFFLOAD_CUDA)
 #include <cuda.h>
 #elif defined(__OFFLOAD_HIP)
@@ -186,4 +198,125 @@ int offload_host_free(void *ptr__) {
 #endif
 }
 
+/*******************************************************************************
+ * \brief Prepares freshly allocated host memory for NUMA systems.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_first_touch(void *memory, const size_t size,
+                              int64_t placement[OFFLOAD_MAX_NUMA_NODES]) {
+  if (memory == NULL || size == 0) {
+    return;
+  }
+  char *bytes = memory;
+
+#if defined(__linux__)
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  // Transparent huge pages only apply to the aligned part of the allocation.
+  const size_t huge_page_size = 2 * 1024 * 1024;
+  if (size >= huge_page_size && getenv("OFFLOAD_HUGEPAGES") != NULL) {
+    const uintptr_t begin = ((uintptr_t)bytes + page_size - 1) / page_size;
+    const uintptr_t end = ((uintptr_t)bytes + size) / page_size;
+    if (end > begin) {
+      madvise((void *)(begin * page_size), (end - begin) * page_size,
+              MADV_HUGEPAGE);
+    }
+  }
+#else
+  const size_t page_size = 4096;
+#endif
+
+  // Touch pages in the same static partitioning that later loops use. The
+  // partitioning follows the page boundaries, since memory is usually not
+  // page-aligned and a page belongs to the node of the thread touching it.
+  const uintptr_t first_page = (uintptr_t)bytes / page_size;
+  const uintptr_t end_page = ((uintptr_t)bytes + size - 1) / page_size + 1;
+  const size_t npages = end_page - first_page;
+#pragma omp parallel for schedule(static) if (!omp_in_parallel())
+  for (size_t ipage = 0; ipage < npages; ipage++) {
+    const uintptr_t page_begin = (first_page + ipage) * page_size;
+    const uintptr_t begin =
+        (page_begin > (uintptr_t)bytes) ? page_begin : (uintptr_t)bytes;
+    const uintptr_t end = (page_begin + page_size < (uintptr_t)bytes + size)
+                              ? page_begin + page_size
+                              : (uintptr_t)bytes + size;
+    memset((void *)begin, 0, end - begin);
+  }
+
+#if defined(__linux__)
+  // Query the nodes of a few evenly spaced pages via move_pages(2).
+  const int nsamples =
+      (npages < OFFLOAD_NUMA_NSAMPLES) ? npages : OFFLOAD_NUMA_NSAMPLES;
+  void *pages[OFFLOAD_NUMA_NSAMPLES];
+  int status[OFFLOAD_NUMA_NSAMPLES];
+  for (int i = 0; i < nsamples; i++) {
+    pages[i] = (void *)((first_page + npages * i / nsamples) * page_size);
+  }
+  if (syscall(SYS_move_pages, 0, nsamples, pages, NULL, status, 0) == 0) {
+    for (int i = 0; i < nsamples; i++) {
+      if (status[i] >= 0) { // negative values are error codes
+        const int node = (status[i] < OFFLOAD_MAX_NUMA_NODES)
+                             ? status[i]
+                             : OFFLOAD_MAX_NUMA_NODES - 1;
+#pragma omp atomic
+        placement[node] += size / nsamples;
+      }
+    }
+  }
+#else
+  (void)placement; // mark used
+#endif
+}
+
+/*******************************************************************************
+ * \brief Adds the placement of an allocation to the current byte counts.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_add_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES],
+    int64_t current[OFFLOAD_MAX_NUMA_NODES],
+    int64_t peak[OFFLOAD_MAX_NUMA_NODES]) {
+#pragma omp critical(offload_numa_placement)
+  {
+    int64_t current_total = 0, peak_total = 0;
+    for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+      current[node] += placement[node];
+      current_total += current[node];
+      peak_total += (peak != NULL) ? peak[node] : 0;
+    }
+    if (peak != NULL && current_total > peak_total) {
+      memcpy(peak, current, OFFLOAD_MAX_NUMA_NODES * sizeof(int64_t));
+    }
+  }
+}
+
+/*******************************************************************************
+ * \brief Removes the placement of a freed allocation from the current counts.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_remove_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES],
+    int64_t current[OFFLOAD_MAX_NUMA_NODES]) {
+#pragma omp critical(offload_numa_placement)
+  for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+    current[node] -= placement[node];
+  }
+}
+
+/*******************************************************************************
+ * \brief Formats the given per node byte counts in MiB for statistics output.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_format_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES], char *buffer,
+    const size_t buffer_size) {
+  size_t length = 0;
+  buffer[0] = '\0';
+  for (int node = 0; node < OFFLOAD_MAX_NUMA_NODES; node++) {
+    if (placement[node] > 0 && length < buffer_size) {
+      length += snprintf(&buffer[length], buffer_size - length, "  %i: %.1f",
+                         node, placement[node] / 1048576.0);
+    }
+  }
+}
+
 // EOF
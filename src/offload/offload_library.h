@@ -8,6 +8,10 @@
 #define OFFLOAD_LIBRARY_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+// Max number of NUMA nodes distinguished by the placement statistics.
+#define OFFLOAD_MAX_NUMA_NODES 8
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +74,50 @@ int offload_host_malloc(void **ptr__, const size_t size__);
  ******************************************************************************/
 int offload_host_free(void *ptr__);
 
+/*******************************************************************************
+ * \brief Prepares freshly allocated host memory for NUMA systems.
+ *        The pages are first touched in parallel by all OpenMP threads with a
+ *        static schedule. Hence, they are placed close to the threads which
+ *        later process them with the same schedule. When called from within a
+ *        parallel region the calling thread touches all pages. Allocations of
+ *        at least 2 MiB are advised to use transparent huge pages if the
+ *        environment variable OFFLOAD_HUGEPAGES is set. The resulting
+ *        placement is sampled and added to the given per node byte counts,
+ *        which are usually kept per allocation for offload_numa_add_placement.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_first_touch(void *memory, const size_t size,
+                              int64_t placement[OFFLOAD_MAX_NUMA_NODES]);
+
+/*******************************************************************************
+ * \brief Adds the placement of an allocation, as obtained from
+ *        offload_numa_first_touch, to the per node byte counts of the memory
+ *        that is currently allocated. Whenever their total reaches a new
+ *        high-water-mark the counts are copied into peak, unless it is NULL.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_add_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES],
+    int64_t current[OFFLOAD_MAX_NUMA_NODES],
+    int64_t peak[OFFLOAD_MAX_NUMA_NODES]);
+
+/*******************************************************************************
+ * \brief Removes the placement of a freed allocation from the per node byte
+ *        counts of the memory that is currently allocated.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_remove_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES],
+    int64_t current[OFFLOAD_MAX_NUMA_NODES]);
+
+/*******************************************************************************
+ * \brief Formats the given per node byte counts in MiB for statistics output.
+ * \author Ole Schuett
+ ******************************************************************************/
+void offload_numa_format_placement(
+    const int64_t placement[OFFLOAD_MAX_NUMA_NODES], char *buffer,
+    const size_t buffer_size);
+
 #ifdef __cplusplus
 }
 #endif